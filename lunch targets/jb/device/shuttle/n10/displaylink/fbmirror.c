@@ -4,6 +4,7 @@
 #include <malloc.h>
 #include <string.h>
 #include <fcntl.h>
+#include <time.h>
 #include <linux/fb.h>
 #include <sys/mman.h>
 #include <sys/ioctl.h>
@@ -32,6 +33,8 @@ typedef struct ccinfo {
 typedef struct fbhandle {
 	int handle;
 	int xres,yres;
+	int yres_virtual;
+	int yoffset;	// Line being scanned out
 	int stride;		// In bytes
 	int bpp;		// Bits per pizel
 	ccinfo_t red;
@@ -85,6 +88,8 @@ int open_fb(fb_t* ctx,int idx)
 
 	ctx->xres = vinfo.xres;
 	ctx->yres = vinfo.yres;
+	ctx->yres_virtual = max(vinfo.yres_virtual, vinfo.yres);
+	ctx->yoffset = vinfo.yoffset;
 	ctx->stride = finfo.line_length;
 	ctx->bpp = vinfo.bits_per_pixel;
 	ctx->red.off = vinfo.red.offset;
@@ -94,15 +99,22 @@ int open_fb(fb_t* ctx,int idx)
 	ctx->blue.off = vinfo.blue.offset;
 	ctx->blue.bits = vinfo.blue.length;
 	
-  	/* Calculate the size to mmap */
-  	screensize = finfo.line_length * vinfo.yres;
+  	/* Calculate the size to mmap: All the buffers the display is panned through */
+  	screensize = finfo.line_length * ctx->yres_virtual;
 	ctx->screensize = screensize;
 	
 	// Map the device to memory
 	ctx->pixels = (void *)mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->handle, 0);
+	if (ctx->pixels == MAP_FAILED && ctx->yres_virtual != ctx->yres) {
+		// Just the visible buffer, then
+		ctx->yres_virtual = ctx->yres;
+		screensize = finfo.line_length * vinfo.yres;
+		ctx->screensize = screensize;
+		ctx->pixels = (void *)mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_SHARED, ctx->handle, 0);
+	}
 	if (ctx->pixels == MAP_FAILED) {
 		ctx->pixels = (void *)mmap(NULL, screensize, PROT_READ | PROT_WRITE, MAP_PRIVATE, ctx->handle, 0);
-		if (ctx->handle == MAP_FAILED) {	
+		if (ctx->pixels == MAP_FAILED) {	
 			ALOGE("failed to map framebuffer device to memory.\n");
 			close(ctx->handle);
 			return 0;
@@ -133,226 +145,577 @@ struct dloarea {
 	int x2, y2;
 };
 
-int transfer_fb(fb_t* src,fb_t* dst)
+#ifndef FBIO_WAITFORVSYNC
+#define FBIO_WAITFORVSYNC _IOW('F', 0x20, u32)
+#endif
+
+/* The screen is split in tiles of 64x64 pixels. Only the tiles whose 
+   contents changed are converted and sent to the DisplayLink adapter */
+#define TILE_SHIFT 6
+#define TILE_SIZE (1 << TILE_SHIFT)
+
+#define MIRROR_MIN_INTERVAL_MS	33		// Limit rate to 30 fps...
+#define MIRROR_IDLE_INTERVAL_MS	250		// Look for changes not followed by a pan this often
+#define MIRROR_REFRESH_MS		10000	// Send everything again this often, in case a hash collided
+
+#define FNV_OFFSET 2166136261U
+#define FNV_PRIME  16777619U
+
+typedef struct tiles {
+	int xres,yres;	// Area covered by the tiles
+	int tx,ty;		// Tiles across and down
+	int valid;		// If the hashes describe the contents of the destination
+	u32* hash;		// Hash of the contents of each tile
+	u32* rowhash;	// Hashes of the tiles of the row being scanned
+	u8* dirty;		// Tiles that changed
+} tiles_t;
+
+static void free_tiles(tiles_t* t)
+{
+	free(t->hash);
+	free(t->rowhash);
+	free(t->dirty);
+	memset(t,0,sizeof(*t));
+}
+
+static int alloc_tiles(tiles_t* t,int xres,int yres)
+{
+	if (t->hash && t->xres == xres && t->yres == yres)
+		return 1;
+		
+	free_tiles(t);
+	t->xres = xres;
+	t->yres = yres;
+	t->tx = (xres + TILE_SIZE - 1) >> TILE_SHIFT;
+	t->ty = (yres + TILE_SIZE - 1) >> TILE_SHIFT;
+	t->hash = malloc(t->tx * t->ty * sizeof(u32));
+	t->rowhash = malloc(t->tx * sizeof(u32));
+	t->dirty = malloc(t->tx * t->ty);
+	if (!t->hash || !t->rowhash || !t->dirty) {
+		ALOGE("Unable to allocate %dx%d tiles\n",t->tx,t->ty);
+		free_tiles(t);
+		return 0;
+	}
+	return 1;
+}
+
+static u32 hash_span(u32 h,const u8* p,int len)
+{
+	while (len >= 4) {
+		u32 v;
+		memcpy(&v,p,4);
+		h = (h ^ v) * FNV_PRIME;
+		p += 4;
+		len -= 4;
+	};
+	while (len--)
+		h = (h ^ *p++) * FNV_PRIME;
+	return h;
+}
+
+/* Hash all the tiles of the source, and mark the ones that changed since 
+   the last time. Returns the number of them */
+static int find_damage(fb_t* src,void* srcp,tiles_t* t)
+{
+	int bypp = src->bpp >> 3;
+	int tilebytes = TILE_SIZE * bypp;
+	int lastbytes = (t->xres - ((t->tx - 1) << TILE_SHIFT)) * bypp;
+	int ty, count = 0;
+	
+	for (ty = 0; ty < t->ty; ty++) {
+		int tx, y;
+		int h = min(TILE_SIZE, t->yres - (ty << TILE_SHIFT));
+		const u8* line = (const u8*)srcp + (ty << TILE_SHIFT) * src->stride;
+
+		for (tx = 0; tx < t->tx; tx++)
+			t->rowhash[tx] = FNV_OFFSET;
+
+		// Line by line, to walk the memory in order
+		for (y = 0; y < h; y++) {
+			const u8* p = line;
+			for (tx = 0; tx < t->tx - 1; tx++) {
+				t->rowhash[tx] = hash_span(t->rowhash[tx], p, tilebytes);
+				p += tilebytes;
+			}
+			t->rowhash[tx] = hash_span(t->rowhash[tx], p, lastbytes);
+			line += src->stride;
+		};
+		
+		for (tx = 0; tx < t->tx; tx++) {
+			int i = ty * t->tx + tx;
+			t->dirty[i] = !t->valid || t->hash[i] != t->rowhash[tx];
+			t->hash[i] = t->rowhash[tx];
+			count += t->dirty[i];
+		}
+	}
+	return count;
+}
+
+/* -- Pixel format conversion
+   Each conversion has a reference row converter, that works a pixel at a
+   time, and a fast one, that works on whole 32 bit words, handling several
+   pixels per load and store. Tegra2 has no NEON, so this is as wide as the
+   CPU goes. The fast ones are checked against the reference ones at startup,
+   and not used if they don't match */
+typedef void (*row_conv_t)(u8* dst,const u8* src,int w);
+
+static inline u32 load32(const u8* p)
+{
+	u32 v;
+	memcpy(&v,p,4);
+	return v;
+}
+
+static inline void store32(u8* p,u32 v)
+{
+	memcpy(p,&v,4);
+}
+
+static inline u32 load16(const u8* p)
+{
+	u16 v;
+	memcpy(&v,p,2);
+	return v;
+}
+
+static inline void store16(u8* p,u32 v)
+{
+	u16 h = v;
+	memcpy(p,&h,2);
+}
+
+// 32bit: aaaaaaaarrrrrrrrggggggggbbbbbbbb
+// 16bit:                 rrrrrggggggbbbbb
+static inline u32 rgb32_to_16(u32 col)
+{
+	return	((col >> 3U) & 0x001FU) |
+			((col >> 5U) & 0x07E0U) |
+			((col >> 8U) & 0xF800U);
+}
+
+// 16bit:                 rrrrrggggggbbbbb
+// 32bit: aaaaaaaarrrrrrrrggggggggbbbbbbbb
+static inline u32 rgb16_to_32(u32 col)
+{
+	return	((col << 3U) & 0x0000F8U) |
+			((col << 5U) & 0x00FC00U) |
+			((col << 8U) & 0xF80000U);
+}
+
+// 4 pixels of 24 bits are 3 words: bgrb grbg rbgr
+static inline void pack24(u8* dst,u32 a,u32 b,u32 c,u32 d)
+{
+	store32(dst    , (a & 0xFFFFFFU) | (b << 24U));
+	store32(dst + 4, ((b >> 8U) & 0xFFFFU) | (c << 16U));
+	store32(dst + 8, ((c >> 16U) & 0xFFU) | (d << 8U));
+}
+
+static inline void unpack24(const u8* src,u32* a,u32* b,u32* c,u32* d)
+{
+	u32 w0 = load32(src);
+	u32 w1 = load32(src + 4);
+	u32 w2 = load32(src + 8);
+	*a = w0 & 0xFFFFFFU;
+	*b = (w0 >> 24U) | ((w1 & 0xFFFFU) << 8U);
+	*c = (w1 >> 16U) | ((w2 & 0xFFU) << 16U);
+	*d = w2 >> 8U;
+}
+
+static inline u32 get24(const u8* src)
+{
+	return src[0] | (src[1] << 8U) | (src[2] << 16U);
+}
+
+static inline void put24(u8* dst,u32 col)
+{
+	dst[0] =  col         & 0xFFU;
+	dst[1] = (col >> 8U)  & 0xFFU;
+	dst[2] = (col >> 16U) & 0xFFU;
+}
+
+/* Reference converters */
+static void ref_32_24(u8* dst,const u8* src,int w)
+{
+	while (w--) {
+		put24(dst, load32(src));
+		src += 4;
+		dst += 3;
+	};
+}
+
+static void ref_32_16(u8* dst,const u8* src,int w)
+{
+	while (w--) {
+		store16(dst, rgb32_to_16(load32(src)));
+		src += 4;
+		dst += 2;
+	};
+}
+
+static void ref_24_32(u8* dst,const u8* src,int w)
+{
+	while (w--) {
+		store32(dst, get24(src));
+		src += 3;
+		dst += 4;
+	};
+}
+
+static void ref_24_16(u8* dst,const u8* src,int w)
+{
+	while (w--) {
+		store16(dst, rgb32_to_16(get24(src)));
+		src += 3;
+		dst += 2;
+	};
+}
+
+static void ref_16_32(u8* dst,const u8* src,int w)
+{
+	while (w--) {
+		store32(dst, rgb16_to_32(load16(src)));
+		src += 2;
+		dst += 4;
+	};
+}
+
+static void ref_16_24(u8* dst,const u8* src,int w)
+{
+	while (w--) {
+		put24(dst, rgb16_to_32(load16(src)));
+		src += 2;
+		dst += 3;
+	};
+}
+
+/* Word at a time converters. The leftover pixels of each row are handed to 
+   the reference ones */
+static void swar_32_24(u8* dst,const u8* src,int w)
+{
+	int n = w >> 2;
+	while (n--) {
+		pack24(dst, load32(src), load32(src + 4), load32(src + 8), load32(src + 12));
+		src += 16;
+		dst += 12;
+	};
+	ref_32_24(dst, src, w & 3);
+}
+
+static void swar_32_16(u8* dst,const u8* src,int w)
+{
+	int n = w >> 2;
+	while (n--) {
+		store32(dst    , rgb32_to_16(load32(src    )) | (rgb32_to_16(load32(src +  4)) << 16U));
+		store32(dst + 4, rgb32_to_16(load32(src + 8)) | (rgb32_to_16(load32(src + 12)) << 16U));
+		src += 16;
+		dst += 8;
+	};
+	ref_32_16(dst, src, w & 3);
+}
+
+static void swar_24_32(u8* dst,const u8* src,int w)
+{
+	int n = w >> 2;
+	while (n--) {
+		u32 a,b,c,d;
+		unpack24(src,&a,&b,&c,&d);
+		store32(dst     , a);
+		store32(dst +  4, b);
+		store32(dst +  8, c);
+		store32(dst + 12, d);
+		src += 12;
+		dst += 16;
+	};
+	ref_24_32(dst, src, w & 3);
+}
+
+static void swar_24_16(u8* dst,const u8* src,int w)
+{
+	int n = w >> 2;
+	while (n--) {
+		u32 a,b,c,d;
+		unpack24(src,&a,&b,&c,&d);
+		store32(dst    , rgb32_to_16(a) | (rgb32_to_16(b) << 16U));
+		store32(dst + 4, rgb32_to_16(c) | (rgb32_to_16(d) << 16U));
+		src += 12;
+		dst += 8;
+	};
+	ref_24_16(dst, src, w & 3);
+}
+
+static void swar_16_32(u8* dst,const u8* src,int w)
+{
+	int n = w >> 2;
+	while (n--) {
+		u32 ab = load32(src);
+		u32 cd = load32(src + 4);
+		store32(dst     , rgb16_to_32(ab & 0xFFFFU));
+		store32(dst +  4, rgb16_to_32(ab >> 16U));
+		store32(dst +  8, rgb16_to_32(cd & 0xFFFFU));
+		store32(dst + 12, rgb16_to_32(cd >> 16U));
+		src += 8;
+		dst += 16;
+	};
+	ref_16_32(dst, src, w & 3);
+}
+
+static void swar_16_24(u8* dst,const u8* src,int w)
+{
+	int n = w >> 2;
+	while (n--) {
+		u32 ab = load32(src);
+		u32 cd = load32(src + 4);
+		pack24(dst, rgb16_to_32(ab & 0xFFFFU), rgb16_to_32(ab >> 16U),
+					rgb16_to_32(cd & 0xFFFFU), rgb16_to_32(cd >> 16U));
+		src += 8;
+		dst += 12;
+	};
+	ref_16_24(dst, src, w & 3);
+}
+
+typedef struct conv_desc {
+	int srcbpp, dstbpp;
+	row_conv_t ref;		// Reference converter, or NULL for a plain copy
+	row_conv_t fast;
+	row_conv_t use;		// Converter selected at startup
+} conv_desc_t;
+
+static conv_desc_t conv_table[] = {
+	{ 32, 32, NULL,      NULL,       NULL },
+	{ 32, 24, ref_32_24, swar_32_24, NULL },
+	{ 32, 16, ref_32_16, swar_32_16, NULL },
+	{ 24, 32, ref_24_32, swar_24_32, NULL },
+	{ 24, 24, NULL,      NULL,       NULL },
+	{ 24, 16, ref_24_16, swar_24_16, NULL },
+	{ 16, 32, ref_16_32, swar_16_32, NULL },
+	{ 16, 24, ref_16_24, swar_16_24, NULL },
+	{ 16, 16, NULL,      NULL,       NULL },
+};
+
+#define CONV_CHECK_MAXW 67
+#define CONV_CHECK_GUARD 16
+
+/* Compare the fast converters against the reference ones, with random 
+   pixels, all the leftover cases and misaligned rows. The ones that don't 
+   match are not used */
+static void check_converters(void)
+{
+	static u8 src[CONV_CHECK_MAXW * 4];
+	static u8 msrc[CONV_CHECK_MAXW * 4 + 4];
+	static u8 ref[CONV_CHECK_MAXW * 4 + CONV_CHECK_GUARD];
+	static u8 out[CONV_CHECK_MAXW * 4 + 4 + CONV_CHECK_GUARD];
+	u32 seed = 0x2545F491U;
+	unsigned int i;
+	
+	for (i = 0; i < sizeof(src); i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		src[i] = seed & 0xFFU;
+	}
+	
+	for (i = 0; i < sizeof(conv_table) / sizeof(conv_table[0]); i++) {
+		conv_desc_t* c = &conv_table[i];
+		int ok = 1, w, off;
+		
+		c->use = c->ref;
+		if (!c->fast)
+			continue;
+			
+		for (w = 1; ok && w <= CONV_CHECK_MAXW; w++) {
+			int len = (w * c->dstbpp) >> 3;
+			memset(ref, 0xA5, sizeof(ref));
+			c->ref(ref, src, w);
+			
+			for (off = 0; ok && off < 4; off++) {
+				memcpy(msrc + off, src, (w * c->srcbpp) >> 3);
+				memset(out, 0xA5, sizeof(out));
+				c->fast(out + off, msrc + off, w);
+				ok = !memcmp(out + off, ref, len + CONV_CHECK_GUARD);
+			}
+		}
+		
+		if (ok)
+			c->use = c->fast;
+		else
+			ALOGE("Converter %d->%d does not match the reference one, not using it\n",c->srcbpp,c->dstbpp);
+	}
+}
+
+static conv_desc_t* find_converter(int srcbpp,int dstbpp)
+{
+	unsigned int i;
+	for (i = 0; i < sizeof(conv_table) / sizeof(conv_table[0]); i++) {
+		if (conv_table[i].srcbpp == srcbpp && conv_table[i].dstbpp == dstbpp)
+			return &conv_table[i];
+	}
+	return NULL;
+}
+
+/* Convert a rectangle of w x h pixels */
+static int convert_rect(fb_t* src,fb_t* dst,void* srcp,void* dstp,int w,int h)
+{
+	conv_desc_t* c = find_converter(src->bpp, dst->bpp);
+	u8* psrc = srcp;
+	u8* pdst = dstp;
+	row_conv_t conv;
+	
+	if (!c) {
+		ALOGE("Unsupported transfer:  src bpp: %d, dst bpp: %d\n",src->bpp,dst->bpp);
+		return 0;
+	}
+	
+	if (!c->ref) {
+		// Trivial copy
+		int srcab = (w * src->bpp) >> 3; 
+		while (h--) {
+			memcpy(pdst,psrc,srcab);
+			psrc += src->stride;
+			pdst += dst->stride;
+		};
+		return 1;
+	}
+	
+	conv = c->use ? c->use : c->ref;
+	while (h--) {
+		conv(pdst,psrc,w);
+		psrc += src->stride;
+		pdst += dst->stride;
+	};
+	return 1;
+}
+
+static int report_damage(fb_t* dst,int x,int y,int w,int h)
 {
 	struct dloarea area;
+	area.x = x;
+	area.y = y;
+	area.w = w;
+	area.h = h;
+	return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
+}
+
+/* Convert the tiles from tx0 to tx1 of the rows from ty0 to ty1, and tell 
+   the adapter about them */
+static int transfer_tiles(fb_t* src,fb_t* dst,void* srcp,void* dstp,int dstx,int dsty,
+	tiles_t* t,int tx0,int tx1,int ty0,int ty1)
+{
+	int x = tx0 << TILE_SHIFT;
+	int y = ty0 << TILE_SHIFT;
+	int w = min(tx1 << TILE_SHIFT, t->xres) - x;
+	int h = min(ty1 << TILE_SHIFT, t->yres) - y;
+	
+	srcp = (char*)srcp + ((x * src->bpp) >> 3) + y * src->stride;
+	dstp = (char*)dstp + ((x * dst->bpp) >> 3) + y * dst->stride;
+	if (!convert_rect(src,dst,srcp,dstp,w,h))
+		return 0;
+		
+	return report_damage(dst, dstx + x, dsty + y, w, h);
+}
+
+int transfer_fb(fb_t* src,fb_t* dst,tiles_t* t)
+{
+	int ty, pty0 = 0, ptx0 = -1, ptx1 = -1;
 
 	// Minimum transfer rectangle
 	int xres = min( src->xres, dst->xres );
 	int yres = min( src->yres, dst->yres );
 	
 	// Source and destination pixel pointers centered to copy rectangles
-	void* srcp = (char*)src->pixels + (( ((src->xres - xres) >> 1 ) * src->bpp ) >> 3) + (((src->yres - yres) >> 1 ) * src->stride);
+	void* srcp = (char*)src->pixels + (( ((src->xres - xres) >> 1 ) * src->bpp ) >> 3) + ((((src->yres - yres) >> 1 ) + src->yoffset) * src->stride);
 	void* dstp = (char*)dst->pixels + (( ((dst->xres - xres) >> 1 ) * dst->bpp ) >> 3) + (((dst->yres - yres) >> 1 ) * dst->stride);
-
-	// Calculate active bytes
-	int srcab = (xres * src->bpp) >> 3; 
-	int dstab = (xres * dst->bpp) >> 3; 
-	
-	// Calculate delta strides
-	int srcds = src->stride - ((src->xres * src->bpp) >> 3); 
-	int dstds = dst->stride - ((dst->xres * dst->bpp) >> 3); 
-
-	// Calculate the damage area
-	area.w = xres;
-	area.h = yres;
-	area.x = (dst->xres - xres) >> 1;
-	area.y = (dst->yres - yres) >> 1;
+	int dstx = (dst->xres - xres) >> 1;
+	int dsty = (dst->yres - yres) >> 1;
 	
-	switch (src->bpp) {
-	case 32:
-		switch (dst->bpp) {
-		case 32:
-			{ //32->32
-				// Trivial copy
-				int y = yres;
-				while (y--) {
-					memcpy(dstp,srcp,srcab);
-					srcp = (char*) srcp + src->stride;
-					dstp = (char*) dstp + dst->stride;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		case 24:
-			{ //32->24
-				// Most usual case...
-				int y = yres;
-				u32* psrc = srcp;
-				u8* pdst = dstp;
-				srcds >>= 2;
-				while (y--) {
-					int x = xres;
-					while (x--) {
-						u32 col = *psrc++;
-						pdst[0] =  col         & 0xFFU;
-						pdst[1] = (col >> 8U)  & 0xFFU;
-						pdst[2] = (col >> 16U) & 0xFFU;
-						pdst += 3;
-					};
-					psrc += srcds;
-					pdst += dstds;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		case 16:
-			{ //32->16
-				// Most usual case...
-				int y = yres;
-				u32* psrc = srcp;
-				u16* pdst = dstp;
-				srcds >>= 2;
-				dstds >>= 1;
-				while (y--) {
-					int x = xres;
-					while (x--) {
-						u32 col = *psrc++;
-						
-						// 32bit: aaaaaaaarrrrrrrrggggggggbbbbbbbb
-						// 16bit:                 rrrrrggggggbbbbb
-						*pdst++ =
-							((col >> 3U) & 0x001FU) |
-							((col >> 5U) & 0x07E0U) |
-							((col >> 8U) & 0xF100U);
-					};
-					psrc += srcds;
-					pdst += dstds;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		}
-	case 24:
-		switch (dst->bpp) {
-		case 32:
-			{ //24->32
-				// Most usual case...
-				int y = yres;
-				u8* psrc = srcp;
-				u32* pdst = dstp;
-				dstds >>= 2;
-				while (y--) {
-					int x = xres;
-					while (x--) {
-						u32 col = psrc[0] | (psrc[1] << 8U) | (psrc[2] << 16U);
-						psrc += 3;
-						*pdst++ = col;
-					};
-					psrc += srcds;
-					pdst += dstds;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		case 24:
-			{ //24->24
-				// Trivial copy
-				int y = yres;
-				while (y--) {
-					memcpy(dstp,srcp,srcab);
-					srcp = (char*) srcp + src->stride;
-					dstp = (char*) dstp + dst->stride;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		case 16:
-			{ //24->16
-				// Most usual case...
-				int y = yres;
-				u8* psrc = srcp;
-				u16* pdst = dstp;
-				dstds >>= 1;
-				while (y--) {
-					int x = xres;
-					while (x--) {
-						u32 col = psrc[0] | (psrc[1] << 8U) | (psrc[2] << 16U);
-						psrc += 3;
-						
-						// 24bit: rrrrrrrrggggggggbbbbbbbb
-						// 16bit:         rrrrrggggggbbbbb
-						*pdst++ =
-							((col >> 3U) & 0x001FU) |
-							((col >> 5U) & 0x07E0U) |
-							((col >> 8U) & 0xF100U);
-					};
-					psrc += srcds;
-					pdst += dstds;
-				};
+	if (!alloc_tiles(t,xres,yres)) {
+		// No way to track damage: Just send everything
+		tiles_t all;
+		memset(&all,0,sizeof(all));
+		all.xres = xres;
+		all.yres = yres;
+		return transfer_tiles(src,dst,srcp,dstp,dstx,dsty,&all,0,(xres + TILE_SIZE - 1) >> TILE_SHIFT,0,(yres + TILE_SIZE - 1) >> TILE_SHIFT);
+	}
+
+	// Nothing changed, nothing to do
+	if (!find_damage(src,srcp,t))
+		return 1;
+	t->valid = 1;
+
+	// Each row of tiles gives a rectangle spanning its changed tiles. The ones
+	//  spanning the same columns are merged, so contiguous changes are sent 
+	//  at once
+	for (ty = 0; ty <= t->ty; ty++) {
+		int tx0 = -1, tx1 = -1;
+		if (ty < t->ty) {
+			const u8* dirty = t->dirty + ty * t->tx;
+			int tx;
+			for (tx = 0; tx < t->tx; tx++) {
+				if (dirty[tx]) {
+					if (tx0 < 0)
+						tx0 = tx;
+					tx1 = tx + 1;
+				}
 			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
 		}
-	case 16:
-		switch (dst->bpp) {
-		case 32:
-			{ //16->32
-				// Most usual case...
-				int y = yres;
-				u16* psrc = srcp;
-				u32* pdst = dstp;
-				srcds >>= 1;
-				dstds >>= 2;
-				while (y--) {
-					int x = xres;
-					while (x--) {
-						u32 col = *psrc++;
-						// 16bit:                 rrrrrggggggbbbbb
-						// 32bit: aaaaaaaarrrrrrrrggggggggbbbbbbbb
-						*pdst++ =
-							((col << 3U) & 0x0000F1U) |
-							((col << 5U) & 0x00FC00U) |
-							((col << 8U) & 0xF10000U);
-					};
-					psrc += srcds;
-					pdst += dstds;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		case 24:
-			{ //16->24
-				// Most usual case...
-				int y = yres;
-				u16* psrc = srcp;
-				u8* pdst = dstp;
-				srcds >>= 1;
-				while (y--) {
-					int x = xres;
-					while (x--) {
-						u32 col = *psrc++;
-						// 16bit:                 rrrrrggggggbbbbb
-						// 32bit: aaaaaaaarrrrrrrrggggggggbbbbbbbb
-						col =
-							((col << 3U) & 0x0000F1U) |
-							((col << 5U) & 0x00FC00U) |
-							((col << 8U) & 0xF10000U);
-						pdst[0] =  col         & 0xFFU;
-						pdst[1] = (col >> 8U)  & 0xFFU;
-						pdst[2] = (col >> 16U) & 0xFFU;
-						pdst += 3;
-					};
-					psrc += srcds;
-					pdst += dstds;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
-		case 16:
-			{
-				// Trivial copy
-				int y = yres;
-				while (y--) {
-					memcpy(dstp,srcp,srcab);
-					srcp = (char*) srcp + src->stride;
-					dstp = (char*) dstp + dst->stride;
-				};
-			}
-			return ioctl(dst->handle, DLFB_IOCTL_REPORT_DAMAGE, &area) >= 0;
+		
+		if (tx0 == ptx0 && tx1 == ptx1)
+			continue;
+			
+		// Send the pending rectangle
+		if (ptx0 >= 0 && !transfer_tiles(src,dst,srcp,dstp,dstx,dsty,t,ptx0,ptx1,pty0,ty)) {
+			t->valid = 0;
+			return 0;
 		}
+		ptx0 = tx0;
+		ptx1 = tx1;
+		pty0 = ty;
 	}
+	return 1;
+}
+
+/* Wait for the next VBLANK of the framebuffer. Not all drivers can do it */
+static void wait_vsync(fb_t* fb)
+{
+	static int supported = 1;
+	u32 crtc = 0;
 	
-	ALOGE("Unsupported transfer:  src bpp: %d, dst bpp: %d\n",src->bpp,dst->bpp);
-	return 0;
+	if (supported) {
+		if (ioctl(fb->handle, FBIO_WAITFORVSYNC, &crtc) >= 0)
+			return;
+			
+		ALOGW("Framebuffer can't wait for VSYNC, using a timer\n");
+		supported = 0;
+	}
+	usleep(16667);
+}
+
+/* Get the line being scanned out. Android pans the framebuffer to post
+   each new frame */
+static int get_pan(fb_t* fb)
+{
+	struct fb_var_screeninfo vinfo;
+	if (ioctl(fb->handle, FBIOGET_VSCREENINFO, &vinfo))
+		return fb->yoffset;
+		
+	if ((int)vinfo.yoffset > fb->yres_virtual - fb->yres)
+		return 0;
+	return vinfo.yoffset;
+}
+
+static long long now_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
 }
 
 int main(void)
 {
 	fb_t src,dst;
+	tiles_t tiles;
+	memset(&tiles,0,sizeof(tiles));
 	ALOGI("Starting DisplayLink mirroring service...\n");
+	check_converters();
 	
 waitit:
 	/* Wait until a DisplayLink framebuffer appears */
@@ -372,21 +735,49 @@ waitit:
 	}
 	
 	ALOGI("Main framebuffer opened -- Starting mirroring operation\n");
-	while(1) {
-		/* Copy from one to the other */
-		if (!transfer_fb(&src,&dst)) {
-			ALOGE("Failed to transfer... Assume DuisplayLink adapter was removed\n");
-			close_fb(&dst);
-			close_fb(&src);
-			goto waitit;
-		}
+	{
+		long long last = 0, refresh = now_ms();
+		int pending = 1;
+		
+		// The adapter holds nothing yet
+		tiles.valid = 0;
 		
-		/* Limit rate to 24 fps... */
-		usleep(40*1000);
+		while(1) {
+			long long now;
+			int yoffset;
+			
+			/* Follow the display, instead of polling */
+			wait_vsync(&src);
+			
+			/* A new frame was posted */
+			yoffset = get_pan(&src);
+			if (yoffset != src.yoffset) {
+				src.yoffset = yoffset;
+				pending = 1;
+			}
+			
+			now = now_ms();
+			if (now - last < MIRROR_MIN_INTERVAL_MS ||
+				(!pending && now - last < MIRROR_IDLE_INTERVAL_MS))
+				continue;
+				
+			if (now - refresh >= MIRROR_REFRESH_MS) {
+				tiles.valid = 0;
+				refresh = now;
+			}
+			
+			/* Copy from one to the other */
+			if (!transfer_fb(&src,&dst,&tiles)) {
+				ALOGE("Failed to transfer... Assume DuisplayLink adapter was removed\n");
+				close_fb(&dst);
+				close_fb(&src);
+				goto waitit;
+			}
+			pending = 0;
+			last = now;
+		}
 	}
 
 	/* not reached */
 	return 0;
 }
-
-
@@ -0,0 +1,478 @@
+/* Host test and benchmark of the DisplayLink mirror, with two framebuffers
+   in memory standing in for /dev/fb0 and /dev/fb2.
+
+   fbmirror.c is built in, with its ioctls caught, so the damage it reports
+   to udlfb is recorded. The source is double buffered and panned, as Android
+   does, and the destination has another size, so the mirrored area is
+   centered in it. After every transfer the whole destination is compared
+   with what it must hold, and every pixel that changed must be inside a
+   reported rectangle.
+
+   The row converters, both the reference and the word at a time ones, are
+   checked against a conversion done a channel at a time, at every width up
+   to a few words and at every alignment.
+
+   Usage: fbmirror_test [-b]
+   -b also times transfers of a static, a slightly changed and a new screen,
+   and both converters of each pair of formats */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+static int fake_ioctl(int fd, unsigned long req, ...);
+
+#define ioctl fake_ioctl
+#define main fbmirror_main
+#include "fbmirror.c"
+#undef main
+#undef ioctl
+
+#define MAX_REPORTS	256
+#define CANARY		0x5A
+
+static struct dloarea reports[MAX_REPORTS];
+static int nreports = 0;
+static int fail_reports = 0;
+
+static int bench = 0;
+static int failed = 0;
+
+/* Only the damage reports reach the fake udlfb. Asking the source for
+   vsync or its pan fails, as with a driver that can't */
+static int fake_ioctl(int fd, unsigned long req, ...)
+{
+	va_list ap;
+	void* arg;
+
+	va_start(ap, req);
+	arg = va_arg(ap, void*);
+	va_end(ap);
+
+	if (req != DLFB_IOCTL_REPORT_DAMAGE || fail_reports)
+		return -1;
+	if (nreports < MAX_REPORTS)
+		reports[nreports] = *(struct dloarea*)arg;
+	nreports++;
+	return 0;
+}
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void make_fb(fb_t* fb, int xres, int yres, int bpp, int pad, int buffers)
+{
+	memset(fb, 0, sizeof(*fb));
+	fb->handle = -1;
+	fb->xres = xres;
+	fb->yres = yres;
+	fb->yres_virtual = yres * buffers;
+	fb->bpp = bpp;
+	fb->stride = ((xres * bpp) >> 3) + pad;
+	fb->screensize = fb->stride * fb->yres_virtual;
+	fb->pixels = malloc(fb->screensize);
+	memset(fb->pixels, CANARY, fb->screensize);
+}
+
+static u32 get_pixel(const fb_t* fb, int x, int line)
+{
+	const u8* p = (const u8*)fb->pixels + line * fb->stride + ((x * fb->bpp) >> 3);
+	switch (fb->bpp) {
+		case 16: return p[0] | (p[1] << 8);
+		case 24: return p[0] | (p[1] << 8) | (p[2] << 16);
+	}
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+static void put_pixel(fb_t* fb, int x, int line, u32 v)
+{
+	u8* p = (u8*)fb->pixels + line * fb->stride + ((x * fb->bpp) >> 3);
+	int i;
+	for (i = 0; i < fb->bpp >> 3; i++)
+		p[i] = v >> (i * 8);
+}
+
+/* What a source pixel must become, worked out a channel at a time */
+static u32 expected(u32 v, int srcbpp, int dstbpp)
+{
+	u32 r, g, b;
+
+	if (srcbpp == dstbpp)
+		return v;
+	if (srcbpp == 16) {
+		r = ((v >> 11) & 0x1F) << 3;
+		g = ((v >> 5) & 0x3F) << 2;
+		b = (v & 0x1F) << 3;
+	} else {
+		r = (v >> 16) & 0xFF;
+		g = (v >> 8) & 0xFF;
+		b = v & 0xFF;
+	}
+	if (dstbpp == 16)
+		return ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+	return (r << 16) | (g << 8) | b;
+}
+
+static u32 canary(int bpp)
+{
+	return bpp == 32 ? 0x5A5A5A5AU : (bpp == 24 ? 0x5A5A5AU : 0x5A5AU);
+}
+
+/* Pixels that don't match what the destination must hold: the source
+   being scanned out inside the mirrored area, and nothing touched outside */
+static int count_bad(const fb_t* src, const fb_t* dst)
+{
+	int xres = min(src->xres, dst->xres);
+	int yres = min(src->yres, dst->yres);
+	int sx = (src->xres - xres) >> 1, sy = ((src->yres - yres) >> 1) + src->yoffset;
+	int dx = (dst->xres - xres) >> 1, dy = (dst->yres - yres) >> 1;
+	int x, y, bad = 0;
+
+	for (y = 0; y < dst->yres; y++) {
+		for (x = 0; x < dst->xres; x++) {
+			u32 want = canary(dst->bpp);
+			if (x >= dx && x < dx + xres && y >= dy && y < dy + yres)
+				want = expected(get_pixel(src, x - dx + sx, y - dy + sy), src->bpp, dst->bpp);
+			bad += get_pixel(dst, x, y) != want;
+		}
+	}
+	return bad;
+}
+
+/* Pixels that changed and were not reported, or reports outside the
+   mirrored area */
+static int count_unreported(const fb_t* src, const fb_t* dst, const u8* before)
+{
+	int xres = min(src->xres, dst->xres);
+	int yres = min(src->yres, dst->yres);
+	int dx = (dst->xres - xres) >> 1, dy = (dst->yres - yres) >> 1;
+	int bypp = dst->bpp >> 3;
+	int x, y, i, bad = 0;
+
+	for (i = 0; i < nreports && i < MAX_REPORTS; i++) {
+		const struct dloarea* a = &reports[i];
+		if (a->w <= 0 || a->h <= 0 || a->x < dx || a->y < dy ||
+			a->x + a->w > dx + xres || a->y + a->h > dy + yres)
+			bad++;
+	}
+
+	for (y = 0; y < dst->yres; y++) {
+		const u8* p = (const u8*)dst->pixels + y * dst->stride;
+		const u8* q = before + y * dst->stride;
+		for (x = 0; x < dst->xres; x++) {
+			int in = 0;
+			if (!memcmp(p + x * bypp, q + x * bypp, bypp))
+				continue;
+			for (i = 0; !in && i < nreports && i < MAX_REPORTS; i++) {
+				const struct dloarea* a = &reports[i];
+				in = x >= a->x && x < a->x + a->w && y >= a->y && y < a->y + a->h;
+			}
+			bad += !in;
+		}
+	}
+	return bad;
+}
+
+static int reported_area(void)
+{
+	int i, area = 0;
+	for (i = 0; i < nreports && i < MAX_REPORTS; i++)
+		area += reports[i].w * reports[i].h;
+	return area;
+}
+
+static void fill(fb_t* fb, int buffer, u32 seed)
+{
+	int x, y;
+	for (y = buffer * fb->yres; y < (buffer + 1) * fb->yres; y++) {
+		for (x = 0; x < fb->xres; x++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			put_pixel(fb, x, y, seed);
+		}
+	}
+}
+
+/* Transfer, and check the destination and the reports. Returns the
+   reported area, or -1 if the transfer failed */
+static int transfer(fb_t* src, fb_t* dst, tiles_t* t, const char* what)
+{
+	static u8* before = NULL;
+	static int beforesize = 0;
+	char msg[160];
+	int ok;
+
+	if (beforesize < dst->screensize) {
+		free(before);
+		before = malloc(dst->screensize);
+		beforesize = dst->screensize;
+	}
+	memcpy(before, dst->pixels, dst->screensize);
+
+	nreports = 0;
+	ok = transfer_fb(src, dst, t);
+	if (!ok)
+		return -1;
+
+	snprintf(msg, sizeof(msg), "%s: %d reports, %d pixels, destination right, all changes reported",
+		what, nreports, reported_area());
+	check(count_bad(src, dst) == 0 && count_unreported(src, dst, before) == 0 &&
+		nreports <= MAX_REPORTS, msg);
+	return reported_area();
+}
+
+/* Convert a row of random pixels, with both ends of it misaligned */
+static int check_row(row_conv_t conv, int srcbpp, int dstbpp, int w, int soff, int doff)
+{
+	static u8 src[1100 * 4 + 4], dst[1100 * 4 + 4 + 16];
+	int sbypp = srcbpp >> 3, dbypp = dstbpp >> 3;
+	u32 seed = w * 131 + soff * 7 + doff;
+	int i, x, bad = 0;
+
+	for (i = 0; i < w * sbypp; i++) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		src[soff + i] = seed;
+	}
+	memset(dst, CANARY, sizeof(dst));
+	conv(dst + doff, src + soff, w);
+
+	for (x = 0; x < w; x++) {
+		u32 s = 0, d = 0;
+		for (i = 0; i < sbypp; i++)
+			s |= (u32)src[soff + x * sbypp + i] << (i * 8);
+		for (i = 0; i < dbypp; i++)
+			d |= (u32)dst[doff + x * dbypp + i] << (i * 8);
+		bad += d != expected(s, srcbpp, dstbpp);
+	}
+	for (i = 0; i < doff; i++)
+		bad += dst[i] != CANARY;
+	for (i = doff + w * dbypp; i < doff + w * dbypp + 16; i++)
+		bad += dst[i] != CANARY;
+	return bad;
+}
+
+static void wrong_32_16(u8* dst, const u8* src, int w)
+{
+	swar_32_16(dst, src, w);
+	if (w > 5)
+		dst[9] ^= 0x10;
+}
+
+static void converters(void)
+{
+	static const int widths[] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 15, 16, 17, 63, 64, 65, 1024, 1023 };
+	char what[128];
+	unsigned int i, k;
+	u8 d[4];
+
+	for (i = 0; i < sizeof(conv_table) / sizeof(conv_table[0]); i++) {
+		conv_desc_t* c = &conv_table[i];
+		int badref = 0, badfast = 0, soff, doff;
+
+		if (!c->ref)
+			continue;
+		for (k = 0; k < sizeof(widths) / sizeof(widths[0]); k++) {
+			for (soff = 0; soff < 4; soff++) {
+				for (doff = 0; doff < 4; doff++) {
+					badref += check_row(c->ref, c->srcbpp, c->dstbpp, widths[k], soff, doff);
+					badfast += check_row(c->fast, c->srcbpp, c->dstbpp, widths[k], soff, doff);
+				}
+			}
+		}
+		snprintf(what, sizeof(what), "%d -> %d bpp: reference and word at a time converters right, "
+			"the fast one used", c->srcbpp, c->dstbpp);
+		check(badref == 0 && badfast == 0 && c->use == c->fast, what);
+	}
+
+	// The red mask used to be 0xF100
+	ref_32_16(d, (const u8*)"\x00\x00\xFF\x00", 1);
+	check(load16(d) == 0xF800, "32 -> 16 bpp: pure red is 0xF800");
+	ref_32_16(d, (const u8*)"\xFF\xFF\xFF\xFF", 1);
+	check(load16(d) == 0xFFFF, "32 -> 16 bpp: white is 0xFFFF");
+
+	// A fast converter that is wrong must not be used. check_converters
+	//  logs an error for it
+	conv_table[2].fast = wrong_32_16;
+	check_converters();
+	check(conv_table[2].use == ref_32_16, "a wrong fast converter is left out at startup");
+	conv_table[2].fast = swar_32_16;
+	check_converters();
+}
+
+static void bench_converters(int w, int h, int reps)
+{
+	u8* src = malloc(w * h * 4);
+	u8* dst = malloc(w * h * 4);
+	unsigned int i;
+	int k, y;
+
+	memset(src, 0x3C, w * h * 4);
+	for (i = 0; i < sizeof(conv_table) / sizeof(conv_table[0]); i++) {
+		conv_desc_t* c = &conv_table[i];
+		int sstride = (w * c->srcbpp) >> 3, dstride = (w * c->dstbpp) >> 3;
+		double t0, t1, t2;
+
+		if (!c->ref)
+			continue;
+		t0 = now();
+		for (k = 0; k < reps; k++)
+			for (y = 0; y < h; y++)
+				c->ref(dst + y * dstride, src + y * sstride, w);
+		t1 = now();
+		for (k = 0; k < reps; k++)
+			for (y = 0; y < h; y++)
+				c->fast(dst + y * dstride, src + y * sstride, w);
+		t2 = now();
+		printf("%dx%d %d -> %d bpp: reference %.2f ms, word at a time %.2f ms per frame, x%.2f\n",
+			w, h, c->srcbpp, c->dstbpp, (t1 - t0) * 1e3 / reps, (t2 - t1) * 1e3 / reps,
+			(t1 - t0) / (t2 - t1));
+	}
+	free(src);
+	free(dst);
+}
+
+/* The sequence a mirrored screen goes through */
+static void damage(int sw, int sh, int sbpp, int dw, int dh, int dbpp)
+{
+	fb_t src, dst;
+	tiles_t t;
+	char what[160];
+	int xres = min(sw, dw), yres = min(sh, dh);
+	int area = xres * yres, n;
+	int sx = (sw - xres) >> 1, sy = (sh - yres) >> 1;
+
+	printf("%dx%d %d bpp -> %dx%d %d bpp\n", sw, sh, sbpp, dw, dh, dbpp);
+	memset(&t, 0, sizeof(t));
+	make_fb(&src, sw, sh, sbpp, 64, 2);
+	make_fb(&dst, dw, dh, dbpp, 0, 1);
+	fill(&src, 0, 1);
+	fill(&src, 1, 2);
+
+	n = transfer(&src, &dst, &t, "first frame");
+	check(n == area, "  the whole area is sent first");
+
+	n = transfer(&src, &dst, &t, "static screen");
+	check(n == 0, "  nothing is sent for a static screen");
+
+	// A few pixels in two rows of tiles
+	put_pixel(&src, sx + 100, sy + 70, 0x123456);
+	put_pixel(&src, sx + 300, sy + 71, 0x654321);
+	put_pixel(&src, sx + 100, sy + 140, 0xABCDEF);
+	n = transfer(&src, &dst, &t, "3 pixels changed");
+	snprintf(what, sizeof(what), "  no more than 5 tiles are sent for them (%d pixels)", n);
+	check(n > 0 && n <= 5 * TILE_SIZE * TILE_SIZE, what);
+
+	// The last partial tile, in the corner
+	put_pixel(&src, sx + xres - 1, sy + yres - 1, 0x00FF00);
+	n = transfer(&src, &dst, &t, "last pixel changed");
+	check(n > 0 && n <= TILE_SIZE * TILE_SIZE, "  only its tile is sent");
+
+	src.yoffset = sh;
+	transfer(&src, &dst, &t, "panned to the second buffer");
+	src.yoffset = 0;
+	transfer(&src, &dst, &t, "panned back");
+
+	// The adapter fails: everything is sent once it works again
+	put_pixel(&src, sx + 10, sy + 10, 0xFF0000);
+	fail_reports = 1;
+	n = transfer(&src, &dst, &t, "report failed");
+	check(n == -1 && !t.valid, "  a failed report is a failed transfer, and forgets the damage");
+	fail_reports = 0;
+	n = transfer(&src, &dst, &t, "after the failure");
+	check(n == area, "  the whole area is sent again");
+
+	// What the periodic refresh does
+	t.valid = 0;
+	n = transfer(&src, &dst, &t, "refresh");
+	check(n == area, "  the whole area is sent when the hashes are not valid");
+
+	free_tiles(&t);
+	free(src.pixels);
+	free(dst.pixels);
+}
+
+/* How long a transfer takes when nothing, a little or everything changed */
+static void bench_transfer(int w, int h, int sbpp, int dbpp, int reps)
+{
+	fb_t src, dst;
+	tiles_t t;
+	double t0, t1, t2, t3;
+	int i;
+
+	memset(&t, 0, sizeof(t));
+	make_fb(&src, w, h, sbpp, 0, 2);
+	make_fb(&dst, w, h, dbpp, 0, 1);
+	fill(&src, 0, 1);
+	fill(&src, 1, 2);
+	transfer_fb(&src, &dst, &t);
+
+	t0 = now();
+	for (i = 0; i < reps; i++)
+		transfer_fb(&src, &dst, &t);
+	t1 = now();
+	for (i = 0; i < reps; i++) {
+		put_pixel(&src, (i * 37) % w, (i * 53) % h, i);
+		transfer_fb(&src, &dst, &t);
+	}
+	t2 = now();
+	for (i = 0; i < reps; i++) {
+		src.yoffset = (i & 1) ? 0 : h;
+		transfer_fb(&src, &dst, &t);
+	}
+	t3 = now();
+
+	printf("%dx%d %d -> %d bpp: static %.2f ms, one pixel %.2f ms, new screen %.2f ms per transfer\n",
+		w, h, sbpp, dbpp, (t1 - t0) * 1e3 / reps, (t2 - t1) * 1e3 / reps, (t3 - t2) * 1e3 / reps);
+
+	free_tiles(&t);
+	free(src.pixels);
+	free(dst.pixels);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		switch (opt) {
+			case 'b': bench = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	check_converters();
+	converters();
+
+	// The tablet panel on an adapter with another size, both ways around
+	damage(1024, 600, 32, 1280, 720, 16);
+	damage(1024, 600, 32, 800, 480, 16);
+	damage(800, 480, 16, 1024, 768, 16);
+	damage(1366, 768, 24, 1024, 600, 32);
+
+	if (bench) {
+		bench_converters(1024, 600, 30);
+		bench_transfer(1024, 600, 32, 16, 50);
+		bench_transfer(1024, 600, 32, 32, 50);
+	}
+	return failed;
+}
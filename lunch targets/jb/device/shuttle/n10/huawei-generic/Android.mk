@@ -16,8 +16,10 @@ LOCAL_SRC_FILES := \
     misc.c \
 	net-utils.c \
     requestdatahandler.c \
+	resampler.c \
     sms.c \
-    sms_gsm.c
+    sms_gsm.c \
+	voicerepair.c
 
 LOCAL_SHARED_LIBRARIES := \
     libcutils \
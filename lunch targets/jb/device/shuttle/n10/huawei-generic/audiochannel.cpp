@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <semaphore.h>
 #include <signal.h>
 #include <linux/socket.h>
@@ -34,9 +35,10 @@
 #include <errno.h>
 #include <stddef.h>
 #include <sys/time.h>
-#include <sys/select.h>
+#include <time.h>
 
 #include "audiochannel.h"
+#include "voicerepair.h"
 
 #define LOG_NDEBUG 0
 #define LOG_TAG "RILAudioCh"
@@ -49,9 +51,6 @@
 
 // ---- Android sound streaming ----
 
-/* Audio oversampling factor. To use higher sampling rates reduces latency quite a bit ... */
-#define AUDIO_OVERSAMPLING 1
-
 // #define CHECK_MEM_OVERRUN 1
 #define AUDIOCHANNEL_DEBUG 0
 #if AUDIOCHANNEL_DEBUG
@@ -60,302 +59,299 @@
 #  define  D(...)   ((void)0)
 #endif 
 
-static inline int labs(int x)
+/* Frames read from and written to the modem at once, at most */
+#define MODEM_BATCH_FRAMES	4
+
+/* Frames the modem is fed ahead of the ones it sent. Huawei modems only send 
+   audio back once they are being fed, so they are primed with these */
+#define MODEM_LEAD_FRAMES	1
+
+/* If the modem sends nothing for this many frames, feed it again */
+#define MODEM_STALL_FRAMES	4
+
+/* Received frames kept until sent frames use them as echo reference. The 
+   modem sends a frame per frame it gets, so this is never exceeded unless the
+   mic falls far behind. The last slot is always silent */
+#define MODEM_ECHO_FRAMES	(MODEM_LEAD_FRAMES + 2 * MODEM_BATCH_FRAMES)
+
+static long long monotonic_ms(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Shorten the epoll timeout to expire at the given time */
+static int until(int timeout, long long due, long long now)
+{
+	int left = (due > now) ? (int)(due - now) : 0;
+	return (timeout < 0 || left < timeout) ? left : timeout;
+}
+
+#ifdef CHECK_MEM_OVERRUN
+static void checkBuffers(struct GsmAudioTunnel* ctx)
+{
+	int end = (ctx->frame_size * (ctx->bits_per_sample/8) * MODEM_BATCH_FRAMES)>>2;
+	if (((int*)ctx->rec_buf)[-1] != 0x1A3B5C7D) {
+		ALOGE("recbuf: Corruption at start: 0x%08x",((int*)ctx->rec_buf)[-1]);
+	}
+	if (((int*)ctx->rec_buf)[end] != 0xD7C5B3A1) {
+		ALOGE("recbuf: Corruption at end: 0x%08x",((int*)ctx->rec_buf)[end]);
+	}
+	if (((int*)ctx->play_buf)[-1] != 0x1A3B5C7D) {
+		ALOGE("playbuf: Corruption at start: 0x%08x",((int*)ctx->play_buf)[-1]);
+	}
+	if (((int*)ctx->play_buf)[end] != 0xD7C5B3A1) {
+		ALOGE("playbuf: Corruption at end: 0x%08x",((int*)ctx->play_buf)[end]);
+	}
+}
+#else
+#define checkBuffers(ctx) ((void)0)
+#endif
+
+/* Queue a frame received from the modem for playback. It is also kept as the
+   echo reference of a frame sent to the modem, in order */
+static void modemQueueFrame(struct GsmAudioTunnel* ctx, const void* data, int res)
+{
+	int frame_bytes = ctx->frame_size * (ctx->bits_per_sample/8);
+	char* frame;
+	
+	// If full, drop the oldest reference
+	if (ctx->echo_wr - ctx->echo_rd == MODEM_ECHO_FRAMES - 1)
+		ctx->echo_rd++;
+	frame = (char*)ctx->echo_buf + (ctx->echo_wr % (MODEM_ECHO_FRAMES - 1)) * frame_bytes;
+	
+	memcpy(frame, data, res);
+	memset(frame + res, 0, frame_bytes - res);
+	
+	// If muted, silence audio
+	if (ctx->ismuted) {
+		memset(frame, 0, frame_bytes);
+	}
+	
+	// EM770W firmware corrupts received audio... Try to workaround the damage
+	voicerepair_frame(frame, frame_bytes, res);
+
+#if LOG_MODEM_AUDIO
+	/* Log audio into SD */
+	write(ctx->logfd, frame, frame_bytes);
+#endif
+
+	// Write it to the audio queue
+	D("[T]Before AudioQueue_add: %04x %04x %04x %04x %04x",((short*)frame)[0] & 0xFFFF,((short*)frame)[1] & 0xFFFF,((short*)frame)[2] & 0xFFFF,((short*)frame)[3] & 0xFFFF,((short*)frame)[4] & 0xFFFF );
+	AudioQueue_add(&ctx->play_q, frame, ctx->frame_size);
+	D("[T]After AudioQueue_add");
+	
+	ctx->echo_wr++;
+}
+
+/* The echo reference of the next frame sent to the modem: The oldest frame
+   received and not used yet, or silence if there is none, as when priming
+   the modem */
+static const int16_t* modemEchoRef(struct GsmAudioTunnel* ctx)
 {
-	return (x < 0) ? -x : x;
+	int frame_bytes = ctx->frame_size * (ctx->bits_per_sample/8);
+	unsigned int slot = MODEM_ECHO_FRAMES - 1;
+	
+	if (ctx->echo_rd != ctx->echo_wr)
+		slot = ctx->echo_rd++ % (MODEM_ECHO_FRAMES - 1);
+	return (const int16_t*)((char*)ctx->echo_buf + slot * frame_bytes);
 }
 
 /* modemAudioIOThread:
-    Output/inputs an audio frame (160 samples) to the 3G audio port of the cell modem
-	We need to write to be able to read from modem
+    Exchanges audio frames (160 samples) with the 3G audio port of the cell modem.
+	Once fed, the modem sends back a frame for each one it gets, so it paces the
+	whole tunnel: each received frame allows to send another one. Reads and 
+	writes do not wait for each other, and both can move several frames at once
 */
 static void* modemAudioIOThread(void* data)
 {
-	int            n;
-    int            max_fd;
-    fd_set         input;
-    struct timeval timeout;
-
 	struct GsmAudioTunnel* ctx = (struct GsmAudioTunnel*)data;
-    int res = 0;
 	int bps = (ctx->bits_per_sample/8);
 	int frame_bytes = ctx->frame_size * bps;
+	int batch_bytes = frame_bytes * MODEM_BATCH_FRAMES;
+	struct epoll_event ev, events[2];
+	int epfd, events_set, n, i, res;
+	int rx_len = 0;					// Bytes received from the modem, not queued yet
+	int tx_len = 0;					// Bytes to send to the modem
+	int tx_off = 0;					// Bytes of them already sent
+	int owed = MODEM_LEAD_FRAMES;	// Frames the modem is waiting for
+	long long now = monotonic_ms();
+	long long tx_due = now + ctx->timeout;	// When an owed frame is sent, even if incomplete
+	long long rx_due = 0;			// When an incomplete received frame is given up
+	long long last_rx = now;		// When the modem sent something for the last time
+	unsigned int sent = 0, received = 0, underruns = 0, damaged = 0;
 
 	ALOGD("modemAudioIOThread begin");
 						
-	// Discard all pending data*/
+	// Discard all pending data
 	ALOGD("Discarding old data....");
 	tcflush(ctx->fd, TCIOFLUSH); 
 	ALOGD("Discarding old data... Done");
-						
-	// Get audio from the queue and push it into the modem
+	
+	// Wait on the modem, and on the record queue getting samples or ending
+	epfd = epoll_create(2);
+	if (epfd < 0) {
+		ALOGE("Failed to create epoll: %d", errno);
+		return NULL;
+	}
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = ctx->evfd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, ctx->evfd, &ev);
+	ev.events = events_set = EPOLLIN;
+	ev.data.fd = ctx->fd;
+	epoll_ctl(epfd, EPOLL_CTL_ADD, ctx->fd, &ev);
+	
 	while (AudioQueue_isrunning(&ctx->rec_q) &&
 		   AudioQueue_isrunning(&ctx->play_q)) {
-
-		// Write audio to the 3G modem audio port in 320 bytes chunks... This is
-		//  required by huawei modems...
-		D("[T]Before AudioQueue_get");
-		res = AudioQueue_get(&ctx->rec_q,ctx->play_buf,ctx->frame_size, ctx->timeout);
-		D("[T]After AudioQueue_get: 0x%04x, 0x%04x, 0x%04x, 0x%04x, 0x%04x",((short*)ctx->play_buf)[0],((short*)ctx->play_buf)[1],((short*)ctx->play_buf)[2],((short*)ctx->play_buf)[3],((short*)ctx->play_buf)[4] );
-	
-#ifdef CHECK_MEM_OVERRUN
-		if (((int*)ctx->rec_buf)[-1                                        ] != 0x1A3B5C7D) {
-			ALOGE("recbuf: Corruption at start: 0x%08x",((int*)ctx->rec_buf)[-1]);
+		int timeout = -1;
+		int readable = 0;
+		int frames, off, want;
+		
+		// Keep feeding the modem if it stopped sending, or it will not restart
+		now = monotonic_ms();
+		if (!owed && now - last_rx >= MODEM_STALL_FRAMES * ctx->timeout) {
+			owed = 1;
+			last_rx = tx_due = now;
 		}
-		if (((int*)ctx->rec_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING * (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-			ALOGE("recbuf: Corruption at end: 0x%08x",((int*)ctx->rec_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
+		
+		// Once the last batch is sent, get the frames the modem is waiting for
+		//  as soon as they are complete. If the mic falls behind, wait until 
+		//  the frame is due and fill what is missing with silence
+		if (tx_off == tx_len) {
+			tx_len = tx_off = 0;
+			while (owed && tx_len < batch_bytes) {
+				char* frame = (char*)ctx->play_buf + tx_len;
+				
+				if (!AudioQueue_poll(&ctx->rec_q, ctx->frame_size) &&
+					(tx_len || now < tx_due))
+					break;
+				
+				res = AudioQueue_get(&ctx->rec_q, frame, ctx->frame_size, 0);
+				if ((int)ctx->frame_size > res) {
+					memset(frame + res * bps, 0, (ctx->frame_size - res) * bps);
+					underruns++;
+				}
+				
+				/* Suppress the echo of the far end. Each frame sent is paired 
+				   with a frame received, so the suppressor sees the far end as
+				   it was played, and finds the echo delay itself */
+				const int16_t* ref = modemEchoRef(ctx);
+				if (ctx->echo.SampleCount) {
+					echocancel_run(&ctx->echo, (int16_t*)ref, (int16_t*)frame);
+				}
+				
+				tx_len += frame_bytes;
+				tx_due = now + ctx->timeout;
+				owed--;
+			}
+			checkBuffers(ctx);
 		}
-		if (((int*)ctx->play_buf)[-1                                        ] != 0x1A3B5C7D) {
-			ALOGE("playbuf: Corruption at start: 0x%08x",((int*)ctx->play_buf)[-1]);
+		
+		// Write as much as the modem takes
+		if (tx_off < tx_len) {
+			D("[T]Before write");
+			res = write(ctx->fd, (char*)ctx->play_buf + tx_off, tx_len - tx_off);
+			D("[T]After write: res: %d",res);
+			if (res < 0 && errno != EAGAIN && errno != EINTR) {
+				ALOGE("Failed to write to the modem: %d", errno);
+				break;
+			}
+			if (res > 0) {
+				tx_off += res;
+				if (tx_off == tx_len)
+					sent += tx_len / frame_bytes;
+			}
 		}
-		if (((int*)ctx->play_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-			ALOGE("playbuf: Corruption at end: 0x%08x",((int*)ctx->play_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
+		
+		// Only wait for the modem to take more if it did not take it all
+		want = (tx_off < tx_len) ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		if (want != events_set) {
+			ev.events = events_set = want;
+			ev.data.fd = ctx->fd;
+			epoll_ctl(epfd, EPOLL_CTL_MOD, ctx->fd, &ev);
 		}
-#endif
-
-		if (!AudioQueue_isrunning(&ctx->rec_q) || 
-			!AudioQueue_isrunning(&ctx->play_q))
+		
+		// Wake up when something is due
+		if (owed && tx_off == tx_len)
+			timeout = until(timeout, tx_due, now);
+		if (rx_len)
+			timeout = until(timeout, rx_due, now);
+		if (!owed)
+			timeout = until(timeout, last_rx + MODEM_STALL_FRAMES * ctx->timeout, now);
+		
+		n = epoll_wait(epfd, events, 2, timeout);
+		if (n < 0 && errno != EINTR) {
+			ALOGE("Failed to wait for the modem: %d", errno);
 			break;
-
-		/* Fill missing samples with silence, if needed */
-		if ((int)ctx->frame_size > res) {
-			memset((char*)ctx->play_buf + res * bps, 0, (ctx->frame_size - res) * bps);
 		}
-
-#ifdef CHECK_MEM_OVERRUN
-		if (((int*)ctx->rec_buf)[-1                                        ] != 0x1A3B5C7D) {
-			ALOGE("recbuf: Corruption at start: 0x%08x",((int*)ctx->rec_buf)[-1]);
-		}
-		if (((int*)ctx->rec_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-			ALOGE("recbuf: Corruption at end: 0x%08x",((int*)ctx->rec_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
-		}
-		if (((int*)ctx->play_buf)[-1                                        ] != 0x1A3B5C7D) {
-			ALOGE("playbuf: Corruption at start: 0x%08x",((int*)ctx->play_buf)[-1]);
-		}
-		if (((int*)ctx->play_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-			ALOGE("playbuf: Corruption at end: 0x%08x",((int*)ctx->play_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
+		for (i = 0; i < n; i++) {
+			if (events[i].data.fd == ctx->evfd) {
+				eventfd_t v;
+				eventfd_read(ctx->evfd, &v);
+			} else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+				// Even if readable: Once unplugged, reads never return data
+				ALOGE("Modem voice port hung up");
+				goto end;
+			} else if (events[i].events & EPOLLIN) {
+				readable = 1;
+			}
 		}
-#endif
-
-		// Write audio chunk
-		D("[T]Before write");
-		res = write(ctx->fd, ctx->play_buf, frame_bytes);
-		D("[T]After write: res: %d",res);
-				  
-		if (!AudioQueue_isrunning(&ctx->rec_q) || 
-			!AudioQueue_isrunning(&ctx->play_q) ||
-			 res < 0)
-			break;
-
-		// Read data from the modem
-		D("[T]Before Select");
-
-		do {
-			// Initialize the input set
-			FD_ZERO(&input);
-			FD_SET(ctx->fd, &input);
-			max_fd = ctx->fd + 1;
-
-			// Initialize the timeout structure: 40ms is enough for this waiting
-			timeout.tv_sec  = 0;
-			timeout.tv_usec = 40000;
-
-			// Do the select
-			n = select(max_fd, &input, NULL, NULL, &timeout);
-
-		} while (n == 0 &&
-			AudioQueue_isrunning(&ctx->rec_q) &&
-			AudioQueue_isrunning(&ctx->play_q));
-		
-		D("[T]After Select");		
 		
-		/* See if there was an error */
-		if (!AudioQueue_isrunning(&ctx->rec_q) || 
-			!AudioQueue_isrunning(&ctx->play_q) ||
-			 n < 0)
-			break;
-
-		/* If something to read, read it */
-		if (FD_ISSET(ctx->fd, &input)) {
+		// Read everything the modem has sent, up to a batch
+		now = monotonic_ms();
+		if (readable) {
 			D("[T]Before read");
-			res = read(ctx->fd, ctx->rec_buf, frame_bytes);
+			res = read(ctx->fd, (char*)ctx->rec_buf + rx_len, batch_bytes - rx_len);
 			D("[T]After read: res: %d",res);
-
-			if (!AudioQueue_isrunning(&ctx->play_q) || 
-				!AudioQueue_isrunning(&ctx->rec_q) || 
-				 res < 0)
+			if (res < 0 && errno != EAGAIN && errno != EINTR) {
+				ALOGE("Failed to read from the modem: %d", errno);
 				break;
-
-#ifdef CHECK_MEM_OVERRUN
-			if (((int*)ctx->rec_buf)[-1                                        ] != 0x1A3B5C7D) {
-				ALOGE("recbuf: Corruption at start: 0x%08x",((int*)ctx->rec_buf)[-1]);
-			}
-			if (((int*)ctx->rec_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-				ALOGE("recbuf: Corruption at end: 0x%08x",((int*)ctx->rec_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
-			}
-			if (((int*)ctx->play_buf)[-1                                        ] != 0x1A3B5C7D) {
-				ALOGE("playbuf: Corruption at start: 0x%08x",((int*)ctx->play_buf)[-1]);
-			}
-			if (((int*)ctx->play_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-				ALOGE("playbuf: Corruption at end: 0x%08x",((int*)ctx->play_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
-			} 
-#endif
-
-			// If muted, silence audio
-			if (ctx->ismuted) {
-				memset( ctx->rec_buf, 0, frame_bytes);
-			}
-
-#ifdef CHECK_MEM_OVERRUN
-			if (((int*)ctx->rec_buf)[-1                                        ] != 0x1A3B5C7D) {
-				ALOGE("recbuf: Corruption at start: 0x%08x",((int*)ctx->rec_buf)[-1]);
-			}
-			if (((int*)ctx->rec_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-				ALOGE("recbuf: Corruption at end: 0x%08x",((int*)ctx->rec_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
-			}
-			if (((int*)ctx->play_buf)[-1                                        ] != 0x1A3B5C7D) {
-				ALOGE("playbuf: Corruption at start: 0x%08x",((int*)ctx->play_buf)[-1]);
 			}
-			if (((int*)ctx->play_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-				ALOGE("playbuf: Corruption at end: 0x%08x",((int*)ctx->play_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
-			}
-#endif
-
-			// EM770W firmware corrupts received audio... Try to workaround the damage...
-
-			// 1st Pass: If received less data than requested, this means voice data corruption. 
-			// More frequent than you could think. We must compensate it, or we end with garbled 
-			// voice...
-			if (res < frame_bytes) {
-				int p;
-				signed char* b;
-				int tf;
-
-				
-				// Try to reconstruct data . Determine variance of low and high nibbles.
-				b = (signed char*)ctx->rec_buf;
-				tf = frame_bytes - res;
-				for (p = 0; p < 317 && tf!=0; p+=2) {
-					if (labs(b[p+2] - b[p]) < labs(b[p+1] - b[p+3]) ) {
-						/* Probably, this is the point ... Insert an space */
-						memmove(b+p+1,b+p,320-p-1);
-						tf--;
-						p+=2;
-					}
-				}
-			}
-			
-			/* 2nd pass: Detect endianness inversions and correct them */
-			{
-				signed short* d = (signed short*)ctx->rec_buf;
-				signed short ss, sp = 0, s = d[2]; // Handle first sample by reflection
-				int todo = 160;
-				
-				while (todo--) {
-					sp = s; 	/* keep previous sample */
-					s  = *d++; 	/* Calculate the other possible samples */
-					ss = (((unsigned short)s) << 8U) | ((((unsigned short)s) >> 8U) & 0xFFU);
-					
-					/* Choose the one that creates less volume difference */
-					if (labs(sp - ss  ) < labs(sp - s ) ) {
-						/* Inverted is closer to original. Keep inverted */
-						s = ss;
-						d[-1] = s;
-					} 
-				}
-			}
-			
-			/* 3rd pass: Remove clicks - we use a 3 sample window to predict and correct 1-sample clicks...*/
-			{
-				signed short* d = (signed short*)ctx->rec_buf;
-				signed short spp = 0, sp = *d++, s = *d++;
-				signed short p;
-				int todo = 158;
-				
-				while (todo--) {
-					/* Store previous and get new sample */
-					spp = sp;
-					sp = s; 	
-					s  = *d++; 	
-					
-					/* Estimate medium */
-					p = (s + spp) / 2;
-					
-					/* If predicted is very different from real, assume noise and replace it */
-					if ( labs( sp - p ) > labs(p >> 2) ) {
-						sp = p;
-						d[-2] = sp;
-					}
-				}
-			}
-
-			/* 4th pass: Remove 6 Sample clicks... The modem also sometimes creates them. Detect and remove them if possible */
-			{
-				signed short* d = (signed short*)ctx->rec_buf;
-				signed short sp = 0, s = *d++;
-				signed short p;
-				int todo = 154;
-				
-				while (todo--) {
-					/* Store previous and get new sample */
-					sp = s; 	
-					s  = *d++; 	
-					
-					/* If a 4 times jump in value is detected, and 6 samples later we are on track, assume it is a modem generated 
-					   click and remove it - We prefer to remove in excess here*/
-					if (labs(s) > labs(sp  )*4 &&
-						labs(s) > labs(d[6])*4 ) {
-						
-						/* Detected an undesired click, remove it! */
-						int step = ((d[6] - sp) << (16 - 3));
-						int x = sp << 16;
-						x+= step;
-						s = d[-1] = x >> 16;
-						x+= step;
-						d[ 0] = x >> 16;
-						x+= step;
-						d[ 1] = x >> 16; 
-						x+= step;
-						d[ 2] = x >> 16; 
-						x+= step;
-						d[ 3] = x >> 16; 
-						x+= step;
-						d[ 4] = x >> 16;
-						x+= step;
-						d[ 5] = x >> 16;
-					}
-				}
-			}
-			
-#if LOG_MODEM_AUDIO
-			/* Log audio into SD */
-			write(ctx->logfd, ctx->rec_buf, frame_bytes);
-#endif
-
-			// Write it to the audio queue
-			D("[T]Before AudioQueue_add: %04x %04x %04x %04x %04x",((short*)ctx->rec_buf)[0] & 0xFFFF,((short*)ctx->rec_buf)[1] & 0xFFFF,((short*)ctx->rec_buf)[2] & 0xFFFF,((short*)ctx->rec_buf)[3] & 0xFFFF,((short*)ctx->rec_buf)[4] & 0xFFFF );
-			AudioQueue_add(&ctx->play_q, ctx->rec_buf, ctx->frame_size);
-			D("[T]After AudioQueue_add");
-
-#ifdef CHECK_MEM_OVERRUN
-			if (((int*)ctx->rec_buf)[-1                                        ] != 0x1A3B5C7D) {
-				ALOGE("recbuf: Corruption at start: 0x%08x",((int*)ctx->rec_buf)[-1]);
-			}
-			if (((int*)ctx->rec_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-				ALOGE("recbuf: Corruption at end: 0x%08x",((int*)ctx->rec_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
-			}
-			if (((int*)ctx->play_buf)[-1                                        ] != 0x1A3B5C7D) {
-				ALOGE("playbuf: Corruption at start: 0x%08x",((int*)ctx->play_buf)[-1]);
+			if (res == 0) {
+				ALOGE("Modem voice port hung up");
+				break;
 			}
-			if (((int*)ctx->play_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING *  (ctx->bits_per_sample/8))>>2] != 0xD7C5B3A1) {
-				ALOGE("playbuf: Corruption at end: 0x%08x",((int*)ctx->play_buf)[(ctx->frame_size * (ctx->bits_per_sample/8))>>2]);
+			if (res > 0) {
+				rx_len += res;
+				last_rx = now;
+				rx_due = now + ctx->timeout / 2;
 			}
-#endif
 		}
 		
+		// Queue all the complete frames. An incomplete one is given up only if
+		//  the rest does not arrive in time: it lost some bytes on the way
+		frames = 0;
+		for (off = 0; rx_len - off >= frame_bytes; off += frame_bytes) {
+			modemQueueFrame(ctx, (char*)ctx->rec_buf + off, frame_bytes);
+			frames++;
+		}
+		if (rx_len > off && now >= rx_due) {
+			modemQueueFrame(ctx, (char*)ctx->rec_buf + off, rx_len - off);
+			off = rx_len;
+			frames++;
+			damaged++;
+		}
+		if (frames) {
+			memmove(ctx->rec_buf, (char*)ctx->rec_buf + off, rx_len - off);
+			rx_len -= off;
+			received += frames;
+			
+			// Each received frame allows to send another one
+			if (!owed)
+				tx_due = now + ctx->timeout;
+			owed += frames;
+			if (owed > MODEM_LEAD_FRAMES + MODEM_BATCH_FRAMES)
+				owed = MODEM_LEAD_FRAMES + MODEM_BATCH_FRAMES;
+		}
+		checkBuffers(ctx);
 	};
 	
-	ALOGD("modemAudioIOThread ended");
+end:
+	close(epfd);
+	ALOGD("modemAudioIOThread ended: %u frames sent, %u received, %u underruns, %u damaged",
+		sent, received, underruns, damaged);
     return NULL;
 }
 
@@ -378,37 +374,6 @@ static void AndroidRecorderCallback(int event, void* userData, void* info)
 	/* Calculate total frames */
 	frames = uinfo->size / bps;
 	
-#if AUDIO_OVERSAMPLING > 1
-	/* Subsample */
-	{
-		short *src = (short *)uinfo->raw + frames - 1;
-		short *dst = (short *)uinfo->raw + frames - 1;
-		int p;
-		short v = *src++,vold = 0;
-		for (p = 0; p < ctx->frame_size-1; p++) {
-			int x,d,s;
-
-			// Current and target values
-			vold = v;
-			v = *src++;
-			
-			// Calculate delta and start value
-			d = (v - vold) * (65536 / AUDIO_OVERSAMPLING);
-			s =  vold << 16;
-			
-			// Interpolate values (linear interpolation)
-			for (x = 0; x < AUDIO_OVERSAMPLING; x++) {
-				*dst++ = s >> 16;
-				s += d;
-			}
-		}
-		
-		// Last sample can't be interpolated...
-		for (x = 0; x < AUDIO_OVERSAMPLING; x++) {
-			*dst++ = v;
-		}
-	}
-#endif
 		
 	// Post data into the recording queue. Queue should self adapt and adjust sampling rate
 	D("[A]Before AudioQueue_add");
@@ -443,37 +408,6 @@ static void AndroidPlayerCallback( int event, void* userData, void* info)
 	uinfo->size = (frames = AudioQueue_get(&ctx->play_q, uinfo->raw, uinfo->size / bps, ctx->timeout)) * bps;
 	D("[A]After AudioQueue_get");
 	
-#if AUDIO_OVERSAMPLING > 1
-	/* Oversample to send them to the Android playback channel*/
-	if (frames) {
-		short *src = uinfo->raw;
-		short *dst = uinfo->raw;
-		int p;
-		short v = *src++,vold = 0;
-		for (p = 0; p < frames-1; p++) {
-			int x,d,s;
-
-			// Current and target values
-			vold = v;
-			v = *src++;
-			
-			// Calculate delta and start value
-			d = (v - vold) * (65536 / AUDIO_OVERSAMPLING);
-			s =  vold << 16;
-			
-			// Interpolate values (linear interpolation)
-			for (x = 0; x < AUDIO_OVERSAMPLING; x++) {
-				*dst++ = s >> 16;
-				s += d;
-			}
-		}
-		
-		// Last sample can't be interpolated...
-		for (x = 0; x < AUDIO_OVERSAMPLING; x++) {
-			*dst++ = v;
-		}
-	}
-#endif
 	
     return;
 
@@ -501,6 +435,7 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
 	size_t recNotifyBuffSize = 0;
 	int play_qsize;
 	int rec_qsize;
+	int afrate = 0;
 
 	audio_format_t format = (bits_per_sample > 8) 
         ? AUDIO_FORMAT_PCM_16_BIT
@@ -513,11 +448,21 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
 
     memset(ctx,0,sizeof(struct GsmAudioTunnel));
 	ctx->fd = -1;
+	ctx->evfd = -1;
 
     ctx->sampling_rate = sampling_rate;
     ctx->frame_size = frame_size;
     ctx->bits_per_sample = bits_per_sample;
 	ctx->timeout = 1000 * frame_size / sampling_rate;  
+	
+	// Run AudioFlinger's side at the rate of its output, so it does not have 
+	//  to resample again. The audio queues convert from and to the modem rate
+	if (android::AudioSystem::getOutputSamplingRate(&afrate, AUDIO_STREAM_VOICE_CALL) != android::NO_ERROR ||
+		afrate <= 0) {
+		afrate = sampling_rate;
+	}
+	ctx->play_rate = afrate;
+	ctx->rec_rate = afrate;
 
 	ALOGD("Opening GSM voice channel '%s', sampling_rate:%u hz, frame_size:%u, bits_per_sample:%u  ...",
         gsmvoicechannel,sampling_rate,frame_size,bits_per_sample);
@@ -530,14 +475,14 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
 #if 0
     playBuffSize = 0;
     android::AudioSystem::getInputBufferSize(
-                    ctx->sampling_rate * AUDIO_OVERSAMPLING, // Samples per second
+                    ctx->rec_rate, // Samples per second
                     format,
                     AUDIO_CHANNEL_IN_MONO,
                     &playBuffSize);
 	recBuffSize = playBuffSize;
 #else
 	android::AudioRecord::getMinFrameCount((int*)&recBuffSize,
-	                    ctx->sampling_rate * AUDIO_OVERSAMPLING, // Samples per second
+	                    ctx->rec_rate, // Samples per second
 						format,
 						1);
 						
@@ -553,7 +498,7 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
 						
 	android::AudioTrack::getMinFrameCount((int*)&playBuffSize,
 						AUDIO_STREAM_VOICE_CALL,
-	                    ctx->sampling_rate * AUDIO_OVERSAMPLING); // Samples per second
+	                    ctx->play_rate); // Samples per second
 	
 	// Do not accept less than the frame size ... Makes no point going lower than that
 	if (playBuffSize < frame_size)
@@ -580,49 +525,38 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
     recBuffSize <<= 1;
 	ALOGD("play samples: %d [q:%d], record samples: %d [q:%d]",playNotifyBuffSize,play_qsize,recNotifyBuffSize,rec_qsize);
 		
-	// Init the audioqueues
-	if (AudioQueue_init(&ctx->play_q,play_qsize,bits_per_sample>>3) < 0) {
-		ALOGE("Could not init Playback AudioQueue");
-		goto error;
-	}
-	if (AudioQueue_init(&ctx->rec_q,rec_qsize,bits_per_sample>>3) < 0) {
-		ALOGE("Could not init Record AudioQueue");
-		goto error;
-	}
-	
 	ALOGD("Opening voice channel....");
 	
-/*	if (echocancel_init(&ctx->echo, recNotifyBuffSize ) < 0) {
-		ALOGE("Could not init Record AudioQueue");
-		goto error;
-	}
-*/	
     // Open the device(com port) in blocking mode 
-    ctx->fd = open(gsmvoicechannel, O_RDWR | O_NOCTTY);
+    ctx->fd = open(gsmvoicechannel, O_RDWR | O_NOCTTY | O_NONBLOCK);
     if (ctx->fd < 0) {
 		ALOGE("Could not open '%s'",gsmvoicechannel);
 		goto error;
     }
 	 	
-    // Configure it to get data as raw as possible
+    // Configure it to get data as raw as possible. Audio is binary, so no byte
+    //  can be dropped (IGNCR) nor taken as flow control (IXOFF). It is read 
+    //  without blocking, so VMIN and VTIME do not matter
     tcgetattr(ctx->fd, &newtio );
     newtio.c_cflag = B115200 | CS8 | CLOCAL | CREAD;
-    newtio.c_iflag = IGNPAR | IGNBRK | IGNCR | IXOFF;
+    newtio.c_iflag = IGNPAR | IGNBRK;
     newtio.c_oflag = 0;
     newtio.c_lflag = 0;
     newtio.c_cc[VMIN]=1;
-    newtio.c_cc[VTIME]=1;
+    newtio.c_cc[VTIME]=0;
     tcsetattr(ctx->fd,TCSANOW, &newtio);
 
 	ALOGD("Creating streams....");
+	
+	// Frames are exchanged with the modem in batches
 #ifdef CHECK_MEM_OVERRUN
-    ctx->rec_buf = malloc(8 + ctx->frame_size * (ctx->bits_per_sample/8) * AUDIO_OVERSAMPLING);
+    ctx->rec_buf = malloc(8 + MODEM_BATCH_FRAMES * ctx->frame_size * (ctx->bits_per_sample/8));
     if (!ctx->rec_buf) {
 		ALOGE("Failed to allocate buffer for playback");
 		goto error;
     }
 
-    ctx->play_buf = malloc(8 + ctx->frame_size * (ctx->bits_per_sample/8) * AUDIO_OVERSAMPLING);
+    ctx->play_buf = malloc(8 + MODEM_BATCH_FRAMES * ctx->frame_size * (ctx->bits_per_sample/8));
     if (!ctx->play_buf) {
 		ALOGE("Failed to allocate buffer for record");
 		goto error;
@@ -630,25 +564,41 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
 
 	ctx->rec_buf = (int*)ctx->rec_buf + 1;
 	((int*)ctx->rec_buf)[-1                                        ] = 0x1A3B5C7D;
-	((int*)ctx->rec_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING * (ctx->bits_per_sample/8))>>2] = 0xD7C5B3A1;
+	((int*)ctx->rec_buf)[(MODEM_BATCH_FRAMES * ctx->frame_size * (ctx->bits_per_sample/8))>>2] = 0xD7C5B3A1;
 	ctx->play_buf = (int*)ctx->play_buf + 1;
 	((int*)ctx->play_buf)[-1                                        ] = 0x1A3B5C7D;
-	((int*)ctx->play_buf)[(ctx->frame_size * AUDIO_OVERSAMPLING * (ctx->bits_per_sample/8))>>2] = 0xD7C5B3A1;
+	((int*)ctx->play_buf)[(MODEM_BATCH_FRAMES * ctx->frame_size * (ctx->bits_per_sample/8))>>2] = 0xD7C5B3A1;
 
 #else
-    ctx->rec_buf = malloc(ctx->frame_size * (ctx->bits_per_sample/8) * AUDIO_OVERSAMPLING);
+    ctx->rec_buf = malloc(MODEM_BATCH_FRAMES * ctx->frame_size * (ctx->bits_per_sample/8));
     if (!ctx->rec_buf) {
 		ALOGE("Failed to allocate buffer for playback");
 		goto error;
     }
 
-    ctx->play_buf = malloc(ctx->frame_size * (ctx->bits_per_sample/8) * AUDIO_OVERSAMPLING);
+    ctx->play_buf = malloc(MODEM_BATCH_FRAMES * ctx->frame_size * (ctx->bits_per_sample/8));
     if (!ctx->play_buf) {
 		ALOGE("Failed to allocate buffer for record");
 		goto error;
     }
 #endif
 
+	// The frames received from the modem are the echo reference. The last
+	//  slot stays silent
+	ctx->echo_buf = calloc(MODEM_ECHO_FRAMES * ctx->frame_size, ctx->bits_per_sample/8);
+	ctx->echo_wr = ctx->echo_rd = 0;
+	if (!ctx->echo_buf) {
+		ALOGE("Failed to allocate buffer for the echo reference");
+		goto error;
+	}
+	
+	// Signalled when the record queue gets samples the modem is waiting for
+	ctx->evfd = eventfd(0, 0);
+	if (ctx->evfd < 0) {
+		ALOGE("Failed to create eventfd: %d", errno);
+		goto error;
+	}
+
     // Create audio record channel
     ctx->rec_strm = new android::AudioRecord();
     if(!ctx->rec_strm) {
@@ -667,7 +617,25 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
     // android::AudioSystem::muteMicrophone(false);
     create_result = ((android::AudioRecord*)ctx->rec_strm)->set(
                     AUDIO_SOURCE_MIC,
-                    ctx->sampling_rate * AUDIO_OVERSAMPLING,
+                    ctx->rec_rate,
+                    format,
+                    AUDIO_CHANNEL_IN_MONO,
+                    recBuffSize,
+                    &AndroidRecorderCallback,
+                    (void *) ctx,
+                    recNotifyBuffSize, // Notification frames
+                    false,
+                    0);
+
+    // Not all microphones can be recorded at the output rate. Try the modem one
+    if ((create_result != android::NO_ERROR || 
+		 ((android::AudioRecord*)ctx->rec_strm)->initCheck() != android::NO_ERROR) &&
+		ctx->rec_rate != ctx->sampling_rate) {
+		ALOGD("Could not record at %u hz, trying %u hz",ctx->rec_rate,ctx->sampling_rate);
+		ctx->rec_rate = ctx->sampling_rate;
+		create_result = ((android::AudioRecord*)ctx->rec_strm)->set(
+                    AUDIO_SOURCE_MIC,
+                    ctx->rec_rate,
                     format,
                     AUDIO_CHANNEL_IN_MONO,
                     recBuffSize,
@@ -676,6 +644,7 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
                     recNotifyBuffSize, // Notification frames
                     false,
                     0);
+	}
 
     if(create_result != android::NO_ERROR){
 		ALOGE("fail to check audio record : error code %d", create_result);
@@ -690,7 +659,7 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
     // android::AudioSystem::setMasterMute(false);
     create_result = ((android::AudioTrack*)ctx->play_strm)->set(
                     AUDIO_STREAM_VOICE_CALL,
-                    ctx->sampling_rate * AUDIO_OVERSAMPLING, //this is sample rate in Hz (16000 Hz for example)
+                    ctx->play_rate, //this is sample rate in Hz (16000 Hz for example)
                     format,
                     AUDIO_CHANNEL_OUT_MONO, //For now this is mono (we expect 1)
                     playBuffSize,
@@ -719,6 +688,29 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
     //                      android::AudioSystem::ROUTE_EARPIECE,
     //                      android::AudioSystem::ROUTE_ALL);
 
+	ALOGD("Android side: playback at %u hz, record at %u hz",ctx->play_rate,ctx->rec_rate);
+		
+	// The echo suppressor runs at the modem rate, and must look back as far as
+	//  the audio takes to be played and recorded again. Only known now, as
+	//  recording could have fallen back to the modem rate
+	if (bits_per_sample == 16 &&
+		echocancel_init(&ctx->echo, frame_size,
+			playBuffSize * sampling_rate / ctx->play_rate +
+			recBuffSize * sampling_rate / ctx->rec_rate) < 0) {
+		ALOGW("Could not init echo suppressor. Running without it");
+	}
+	
+	// Init the audioqueues, resampling between both sides
+	if (AudioQueue_init(&ctx->play_q,play_qsize,bits_per_sample>>3,ctx->sampling_rate,ctx->play_rate) < 0) {
+		ALOGE("Could not init Playback AudioQueue");
+		goto error;
+	}
+	if (AudioQueue_init(&ctx->rec_q,rec_qsize,bits_per_sample>>3,ctx->rec_rate,ctx->sampling_rate) < 0) {
+		ALOGE("Could not init Record AudioQueue");
+		goto error;
+	}
+	AudioQueue_setnotify(&ctx->rec_q, ctx->evfd);
+	
 	ALOGD("Starting streaming...");
 
     if (ctx->play_strm) {
@@ -736,6 +728,7 @@ int gsm_audio_tunnel_start(struct GsmAudioTunnel *ctx,const char* gsmvoicechanne
 error:
 		AudioQueue_end(&ctx->rec_q);
 		AudioQueue_end(&ctx->play_q);
+		echocancel_end(&ctx->echo);
         if (ctx->play_strm) delete ((android::AudioTrack*)ctx->play_strm);
         if (ctx->rec_strm) delete ((android::AudioRecord*)ctx->rec_strm);
 #ifdef CHECK_MEM_OVERRUN
@@ -745,6 +738,8 @@ error:
         if (ctx->play_buf) free(ctx->play_buf);
         if (ctx->rec_buf) free(ctx->rec_buf);
 #endif
+        if (ctx->echo_buf) free(ctx->echo_buf);
+        if (ctx->evfd >= 0) close(ctx->evfd);
         if (ctx->fd) close(ctx->fd);
 #if LOG_MODEM_AUDIO
 		if (ctx->logfd) close(ctx->logfd);
@@ -815,6 +810,7 @@ int gsm_audio_tunnel_stop(struct GsmAudioTunnel *ctx)
 
 	ALOGD("Closing streaming");
 
+	echocancel_end(&ctx->echo);
 	if (ctx->play_strm) delete ((android::AudioTrack*)ctx->play_strm);
 	if (ctx->rec_strm) delete ((android::AudioRecord*)ctx->rec_strm);
 #ifdef CHECK_MEM_OVERRUN
@@ -824,6 +820,8 @@ int gsm_audio_tunnel_stop(struct GsmAudioTunnel *ctx)
 	if (ctx->play_buf) free(ctx->play_buf);
 	if (ctx->rec_buf) free(ctx->rec_buf);
 #endif
+	if (ctx->echo_buf) free(ctx->echo_buf);
+	if (ctx->evfd >= 0) close(ctx->evfd);
 	if (ctx->fd) close(ctx->fd);
 	
 #if LOG_MODEM_AUDIO
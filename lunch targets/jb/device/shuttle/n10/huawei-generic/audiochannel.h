@@ -36,6 +36,8 @@ struct GsmAudioTunnel {
     // Common properties
     unsigned int frame_size;        // Frame size
     unsigned int sampling_rate;     // Sampling rate
+    unsigned int play_rate;         // Sampling rate of the Android playback stream
+    unsigned int rec_rate;          // Sampling rate of the Android record stream
     unsigned int bits_per_sample;   // Bits per sample. valid values = 16/8
 	unsigned int timeout;			// Maximum wait timeout
 	pthread_t modem_t;				// 3G modem playback/record thread
@@ -55,9 +57,14 @@ struct GsmAudioTunnel {
 	
 	// Echo cancellation
 	struct echocancel_ctx echo;		// Echo cancellator
+	void* echo_buf;					// Frames queued for playback, not used as echo reference yet
+	unsigned int echo_wr;			// Frames put in echo_buf
+	unsigned int echo_rd;			// Frames taken from echo_buf
+	
+	int evfd;						// eventfd signalled by the record queue
 };
 
-#define GSM_AUDIO_CHANNEL_STATIC_INIT { -1, 0,0,0,0,0,0, 0,0,0,{0} ,0,0,0,{0}, {0} }
+#define GSM_AUDIO_CHANNEL_STATIC_INIT { -1, 0,0,0,0,0,0,0,0, 0,0,0,{0} ,0,0,0,{0}, {0}, 0,0,0, -1 }
 
 #ifdef __cplusplus
 extern "C" {
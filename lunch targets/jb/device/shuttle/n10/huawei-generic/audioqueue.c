@@ -1,6 +1,18 @@
 #include "audioqueue.h"
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <limits.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/futex.h>
+#include <cutils/atomic.h>
+
+#ifndef min
+#define min(x,y) (((x) < (y)) ? (x) : (y))
+#endif
 
 #define LOG_NDEBUG 0
 #define LOG_TAG "RILAudioQueue"
@@ -43,41 +55,81 @@
 	  int n = (end + (rd_pos)) & ((size)-1); \
 	  n <= end ? n : end+1;}) 
 
+static int futex_wait(volatile int32_t* addr, int32_t val, const struct timespec* timeout)
+{
+	return syscall(__NR_futex, addr, FUTEX_WAIT, val, timeout, NULL, 0);
+}
+
+static int futex_wake(volatile int32_t* addr)
+{
+	return syscall(__NR_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Wake up the consumer, whether it sleeps on the queue or polls its eventfd */
+static void AudioQueue_wake(struct AudioQueue* ctx)
+{
+	futex_wake(&ctx->wr_pos);
+	if (ctx->notify_fd >= 0) {
+		eventfd_write(ctx->notify_fd, 1);
+	}
+}
+
 
 	  
-// Init the audio queue
-int AudioQueue_init(struct AudioQueue* ctx,unsigned int p2maxsamples, unsigned int sample_sz)
+// Init the audio queue. Samples are added at in_rate, and got at out_rate
+int AudioQueue_init(struct AudioQueue* ctx,unsigned int p2maxsamples, unsigned int sample_sz,
+	unsigned int in_rate, unsigned int out_rate)
 {
 	unsigned int maxsamples = 1U << p2maxsamples;
+	unsigned int allocsamples;
 	memset(ctx,0,sizeof(*ctx));
 	
 	ctx->size = maxsamples;
+	ctx->notify_fd = -1;
 #if NEW_SYNC_ALGO
 	ctx->waitidx = 1;
 #endif
 	ctx->sample_sz = sample_sz;
 
-	/* Linear resampler */
-	ctx->ratio = F_ONE;
+	/* Input samples per output sample, and how much it can be corrected to 
+	   follow the drift between the clocks of both ends */
+	ctx->nominal = f_div(in_rate, out_rate);
+	ctx->ratio = ctx->nominal;
+	ctx->ratio_min = f_mul(ctx->nominal, F_NBR(0.95));
+	ctx->ratio_max = f_mul(ctx->nominal, F_NBR(1.05));
+	
+	/* 16 bit samples go through the polyphase resampler, 8 bit ones are 
+	   linearly interpolated */
+	if (sample_sz == 2 && resampler_init(&ctx->rs, in_rate, out_rate) < 0) {
+		ALOGE("{%p} Failed to init resampler",ctx);
+		return -1;
+	}
+	
+	ALOGD("[%p] Initializing audio queue: size: %d, %u -> %u hz, sample_sz: %d",ctx,ctx->size,in_rate,out_rate,ctx->sample_sz);
 	
-	ALOGD("[%p] Initializing audio queue: size: %d, low: %d, high: %d, sample_sz: %d",ctx,ctx->size,ctx->low,ctx->high,ctx->sample_sz);
+	// The first samples are repeated past the end of the buffer, so the 
+	//  resampler always has the ones it needs in a row
+	allocsamples = maxsamples + ctx->rs.taps;
 	
 #ifdef CHECK_MEM_OVERRUN
-	ctx->data = malloc(8 + maxsamples * sample_sz);
+	ctx->data = malloc(8 + allocsamples * sample_sz);
 	if (!ctx->data) {
-		ALOGE("{%p} Failed to allocate %d memory",ctx, 8 + maxsamples * sample_sz);
+		ALOGE("{%p} Failed to allocate %d memory",ctx, 8 + allocsamples * sample_sz);
+		resampler_end(&ctx->rs);
 		return -1;
 	}
 	ctx->data = (int*)ctx->data + 1;
 	((int*)ctx->data)[-1                           ] = 0x1A2B6C7D;
-	((int*)ctx->data)[(ctx->size*ctx->sample_sz)>>2] = 0xD7C6B2A1;
+	((int*)ctx->data)[((ctx->size+ctx->rs.taps)*ctx->sample_sz)>>2] = 0xD7C6B2A1;
 #else
-	ctx->data = malloc(maxsamples * sample_sz);
+	ctx->data = malloc(allocsamples * sample_sz);
 	if (!ctx->data) {
-		ALOGE("{%p} Failed to allocate %d memory",ctx, maxsamples * sample_sz);
+		ALOGE("{%p} Failed to allocate %d memory",ctx, allocsamples * sample_sz);
+		resampler_end(&ctx->rs);
 		return -1;
 	}
 #endif
+	memset(ctx->data, 0, allocsamples * sample_sz);
 	
 	// Init audio AGC
 	agc_init(&ctx->agc,31000);
@@ -95,6 +147,7 @@ int AudioQueue_isrunning(struct AudioQueue* ctx)
 int AudioQueue_add(struct AudioQueue* ctx, void* data,unsigned int samples)
 {
 	unsigned int samples_todo = samples;
+	unsigned int wr_pos, rd_pos;
 	
 	// If exited, avoid adding
 	if (!ctx->running)
@@ -102,14 +155,19 @@ int AudioQueue_add(struct AudioQueue* ctx, void* data,unsigned int samples)
 	
 	D("add[%p]: begin: Store %d samples",ctx,samples);
 	
+	// We are the only writer of wr_pos. The consumer releases rd_pos once it 
+	//  is done with the samples, so they can be overwritten
+	wr_pos = ctx->wr_pos;
+	rd_pos = android_atomic_acquire_load(&ctx->rd_pos);
+	
 	// Not filled, add to the queue.
 	while (ctx->running && samples_todo) {
 	
 		// Calculate remaining space until end of buffer. We always leave a byte free 
 		//  so we can differenciate between empty and full buffers
-		unsigned int rem = CIRC_SPACE_TO_END(ctx->wr_pos,ctx->rd_pos,ctx->size);
+		unsigned int rem = CIRC_SPACE_TO_END(wr_pos,rd_pos,ctx->size);
 				
-		D("add[%p]: samples_todo: %u, rem: %u, rd: %u, wr: %u, sz: %u",ctx, samples_todo, rem, ctx->rd_pos, ctx->wr_pos, ctx->size);
+		D("add[%p]: samples_todo: %u, rem: %u, rd: %u, wr: %u, sz: %u",ctx, samples_todo, rem, rd_pos, wr_pos, ctx->size);
 		
 		if (rem == 0) {
 			/* not enough data... Ignore the part we can't store */			
@@ -124,38 +182,36 @@ int AudioQueue_add(struct AudioQueue* ctx, void* data,unsigned int samples)
 			}
 			
 			// Store data in queue
-			memcpy( (char*)ctx->data + ctx->wr_pos * ctx->sample_sz, data, rem * ctx->sample_sz);
+			memcpy( (char*)ctx->data + wr_pos * ctx->sample_sz, data, rem * ctx->sample_sz);
+			
+			// And repeat the first ones past the end
+			if (wr_pos < ctx->rs.taps) {
+				unsigned int rep = min(rem, ctx->rs.taps - wr_pos);
+				memcpy( (char*)ctx->data + (ctx->size + wr_pos) * ctx->sample_sz, data, rep * ctx->sample_sz);
+			}
 			data = (char*) data + rem * ctx->sample_sz;
-			ctx->wr_pos = (ctx->wr_pos + rem) & (ctx->size-1);
+			wr_pos = (wr_pos + rem) & (ctx->size-1);
 			samples_todo -= rem;
 		}
 	};
 	
-	D("add[%p]: end: Stored %d samples, size %d, rd:%d, wr:%d",ctx,samples - samples_todo,ctx->size, ctx->rd_pos, ctx->wr_pos);
-
-#if !NEW_SYNC_ALGO
-	// Adjust ratio if queue is getting full, to keep fullness under control
-	if (ctx->high && CIRC_CNT(ctx->wr_pos,ctx->rd_pos,ctx->size) > ctx->high) {
-		unsigned int ratio = ctx->ratio;
-	
-		// Adjust ratio to avoid this the next time 
-		ratio += ratio/200;
-	
-		// Limit to sensible values
-		if (ratio > F_NBR(1.05)) {
-			ratio = F_NBR(1.05);
+	// Make the samples visible to the consumer, and wake it up if it is waiting
+	//  for them. The barrier of the cas orders it after the store of wr_pos
+	if (samples_todo != samples) {
+		android_atomic_release_store(wr_pos, &ctx->wr_pos);
+		if (android_atomic_release_cas(1, 0, &ctx->waiting) == 0) {
+			AudioQueue_wake(ctx);
 		}
-		ctx->ratio = ratio;
-		D("add[%p]: Adjusting ratio to keep queue 3/4 full: New ratio: %u",ctx, ratio);
 	}
-#endif
+	
+	D("add[%p]: end: Stored %d samples, size %d, rd:%d, wr:%d",ctx,samples - samples_todo,ctx->size, rd_pos, wr_pos);
 
 #ifdef CHECK_MEM_OVERRUN
 	if (((int*)ctx->data)[-1                      ] != 0x1A2B6C7D) {
 		ALOGE("add[%p] Memory corruption at start: Found: %08x",ctx, ((int*)ctx->data)[-1                      ]);
 	}
 	
-	if (((int*)ctx->data)[(ctx->size*ctx->sample_sz)>>2] != 0xD7C6B2A1) {
+	if (((int*)ctx->data)[((ctx->size+ctx->rs.taps)*ctx->sample_sz)>>2] != 0xD7C6B2A1) {
 		ALOGE("add[%p] Memory corruption at end: Found: %08x",ctx, ((int*)ctx->data)[ctx->size*ctx->sample_sz]);
 	}
 #endif
@@ -164,15 +220,87 @@ int AudioQueue_add(struct AudioQueue* ctx, void* data,unsigned int samples)
 	return samples - samples_todo;
 }
 
+/* Sleep until the producer adds samples past wr_pos, or the deadline expires.
+   Returns 0 if it expired */
+static int AudioQueue_wait(struct AudioQueue* ctx, int32_t wr_pos, const struct timespec* deadline)
+{
+	struct timespec now, ts;
+	
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	ts.tv_sec  = deadline->tv_sec  - now.tv_sec;
+	ts.tv_nsec = deadline->tv_nsec - now.tv_nsec;
+	if (ts.tv_nsec < 0) {
+		ts.tv_nsec += 1000000000;
+		ts.tv_sec--;
+	}
+	if (ts.tv_sec < 0 || (ts.tv_sec == 0 && ts.tv_nsec == 0))
+		return 0;
+		
+	// Tell the producer we are waiting. The barrier of the cas orders it 
+	//  before the kernel checks wr_pos did not change, so the wake can't be lost
+	android_atomic_acquire_cas(0, 1, &ctx->waiting);
+	futex_wait(&ctx->wr_pos, wr_pos, &ts);
+	android_atomic_release_store(0, &ctx->waiting);
+	return 1;
+}
+
+/* Count of samples that can be got without waiting. Only the consumer can 
+   call it, as it depends on its position and resampling ratio */
+static unsigned int AudioQueue_avail(struct AudioQueue* ctx)
+{
+	int32_t wr_pos = android_atomic_acquire_load(&ctx->wr_pos);
+	unsigned int av = CIRC_CNT(wr_pos,ctx->rd_pos,ctx->size);
+	unsigned int need = (ctx->sample_sz == 2) ? (unsigned int)ctx->rs.taps : 2;
+	long long left;
+	
+	// Each sample is produced while the integer part of the step leaves at
+	//  least the needed input samples
+	if (av < need)
+		return 0;
+	left = ((long long)(av - need + 1) << 28) - ctx->step;
+	if (left <= 0)
+		return 0;
+	return (unsigned int)((left + ctx->ratio - 1) / ctx->ratio);
+}
+
+/* Also signal the given eventfd when the consumer must be woken up, so it
+   can wait for samples along with other fds */
+int AudioQueue_setnotify(struct AudioQueue* ctx, int fd)
+{
+	ctx->notify_fd = fd;
+	return 0;
+}
+
+/* Returns != 0 if the requested samples can be got without waiting. If not, 
+   the eventfd will be signalled as soon as more samples are added */
+int AudioQueue_poll(struct AudioQueue* ctx, unsigned int samples)
+{
+	if (!ctx->running || AudioQueue_avail(ctx) >= samples)
+		return 1;
+		
+	// Same handshake as AudioQueue_wait: once the producer can see we are 
+	//  waiting, check again for the samples added before it could
+	android_atomic_acquire_cas(0, 1, &ctx->waiting);
+	if (AudioQueue_avail(ctx) >= samples) {
+		android_atomic_release_store(0, &ctx->waiting);
+		return 1;
+	}
+	return 0;
+}
+
 int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsigned int timeoutms)
 {
 	unsigned int maxgetreq;
 	unsigned int samples_todo = samples;
 	void* pdata = data;
+	unsigned int rd_pos, step, mask = ctx->size-1;
+	unsigned int av;
+	struct timespec deadline;
 #if NEW_SYNC_ALGO	
 	struct timeval startop;
 	struct timeval curr;
 	unsigned int deltatm = 0;
+	int waited = 0;
 #endif
 	
 	// If exited, avoid adding
@@ -188,6 +316,9 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 		maxgetreq = samples;
 		ctx->maxgetreq = maxgetreq;
 
+		/* The limits are in input samples */
+		maxgetreq = f_mul(maxgetreq, ctx->nominal) + ctx->rs.taps;
+		
 		/* Limit to something we can use */
 		if (maxgetreq > ctx->size / 4) {
 			maxgetreq = ctx->size / 4;
@@ -205,40 +336,54 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 	gettimeofday(&startop,NULL);
 #endif
 
+	// We can wait up to the timeout for the samples
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec  += timeoutms / 1000;
+	deadline.tv_nsec += (timeoutms % 1000) * 1000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_nsec -= 1000000000;
+		deadline.tv_sec++;
+	}
+	
+	// We are the only writer of rd_pos and the resampler step
+	rd_pos = ctx->rd_pos;
+	step = ctx->step;
+
 	// While samples to be read
 	while (ctx->running && samples_todo) {
 	
-		// Read the first free position
-		int av = CIRC_CNT(ctx->wr_pos,ctx->rd_pos,ctx->size);
-		unsigned int step = ctx->step, mask = ctx->size-1;
-		unsigned int rd_pos = ctx->rd_pos;
+		// Samples published by the producer
+		int32_t wr_pos = android_atomic_acquire_load(&ctx->wr_pos);
+		unsigned int rd = rd_pos, st = step;
+		av = CIRC_CNT(wr_pos,rd_pos,ctx->size);
 		
-		D("get[%p]: [1] samples_todo: %u, rd: %u, wr: %u, sz: %u",ctx, samples_todo, ctx->rd_pos, ctx->wr_pos, ctx->size);
+		D("get[%p]: [1] samples_todo: %u, rd: %u, wr: %u, sz: %u",ctx, samples_todo, rd_pos, wr_pos, ctx->size);
 		
-		// linear interpolation resampling until all requested data is provided
+		// resample until all requested data is provided
 		if (ctx->sample_sz == 2 ) {
 			
 			short const *psrc = ctx->data;
 			short *pdst = (short*)pdata;
+			int taps = ctx->rs.taps;
 	
-			/* We use the current one and next one samples */
+			/* We use the taps samples starting at the oldest one still needed */
 			while (samples_todo) {
-				int ipart = f_intp(step);
-				rd_pos  = (rd_pos + ipart) & mask;
+				int ipart = f_intp(st);
+				rd  	= (rd + ipart) & mask;
 				av 	   -= ipart;
-				step    = f_fract(step);
+				st    	= f_fract(st);
 
 				// If not enough data, break now
-				if (av < 2) 
+				if ((int)av < taps) 
 					break;
 				
-				*pdst++ = psrc[rd_pos] + f_mul(psrc[(rd_pos+1) & mask] - psrc[rd_pos], step);
+				*pdst++ = resampler_filter(&ctx->rs, psrc + rd, st);
 				samples_todo--;
-				step   += ctx->ratio;
+				st     += ctx->ratio;
 				
 				// Update buffer pointers and linear resampler step
-				ctx->step = step;
-				ctx->rd_pos = rd_pos;
+				step = st;
+				rd_pos = rd;
 			}
 			pdata = pdst;
 			
@@ -247,45 +392,43 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 			unsigned char const *psrc = ctx->data;
 			unsigned char *pdst = (unsigned char*)pdata;
 	
-			/* We use the current one and next one samples */
+			/* linear interpolation: We use the current one and next one samples */
 			while (samples_todo) {
-				int ipart = f_intp(step);
-				rd_pos  = (rd_pos + ipart) & mask;
+				int ipart = f_intp(st);
+				rd  	= (rd + ipart) & mask;
 				av 	   -= ipart;
-				step    = f_fract(step);
+				st    	= f_fract(st);
 
 				// If not enough data, break now
-				if (av < 2) 
+				if ((int)av < 2) 
 					break;
 
-				*pdst++ = psrc[rd_pos] + f_mul(psrc[(rd_pos+1) & mask] - psrc[rd_pos], step);
+				*pdst++ = psrc[rd] + f_mul(psrc[(rd+1) & mask] - psrc[rd], st);
 				samples_todo--;
-				step   += ctx->ratio;
+				st     += ctx->ratio;
 				
 				// Update buffer pointers and linear resampler step
-				ctx->step = step;
-				ctx->rd_pos = rd_pos;
+				step = st;
+				rd_pos = rd;
 			}
 			pdata = pdst;
 		}
 		
-		D("get[%p]: [2] samples_todo: %u, rd: %u, wr: %u, sz: %u",ctx, samples_todo, ctx->rd_pos, ctx->wr_pos, ctx->size);			
+		// Give back the space of the samples already used
+		ctx->step = step;
+		android_atomic_release_store(rd_pos, &ctx->rd_pos);
+		
+		D("get[%p]: [2] samples_todo: %u, rd: %u, wr: %u, sz: %u",ctx, samples_todo, rd_pos, wr_pos, ctx->size);			
 		if (samples_todo) {
 			
+			/* If we are allowed to wait a bit to get those samples, sleep until 
+			   they are added */
+			if (AudioQueue_wait(ctx, wr_pos, &deadline)) {
 #if NEW_SYNC_ALGO
-			/* Get actual time */
-			gettimeofday(&curr,NULL);
-		
-			/* Yield a bit - 1 ms */
-			usleep(1000);
-			
-			/* Calculate waiting time */
-			deltatm = (curr.tv_sec - startop.tv_sec) * 1000000 + (curr.tv_usec - startop.tv_usec);
-			
-			/* If we are allowed to wait a bit to get those samples, keep trying */
-			if (deltatm < timeoutms) 
-				continue;
+				waited = 1;
 #endif
+				continue;
+			}
 				
 			// No more samples to provide....
 			D("get[%p]: Not enough data on queue...",ctx);		
@@ -295,9 +438,18 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 		}
 	};
 
-	D("get[%p]: end: got %d samples, total: %d, rd:%d, wr:%d",ctx, samples - samples_todo, ctx->size,ctx->rd_pos, ctx->wr_pos);
+	D("get[%p]: end: got %d samples, total: %d, rd:%d, wr:%d",ctx, samples - samples_todo, ctx->size, rd_pos, ctx->wr_pos);
+	
+	// Samples still queued
+	av = CIRC_CNT(android_atomic_acquire_load(&ctx->wr_pos),rd_pos,ctx->size);
 	
 #if NEW_SYNC_ALGO
+	/* Calculate waiting time */
+	if (waited) {
+		gettimeofday(&curr,NULL);
+		deltatm = (curr.tv_sec - startop.tv_sec) * 1000000 + (curr.tv_usec - startop.tv_usec);
+	}
+	
 	// The idea is that we want to keep nearly in sync adds with gets, but this is not easy, as
 	// there is a lot of jitter in the add and get operations. So, instead of that, what we strive 
 	// is to adjust sampling rate so if we had to wait, wait more than 0 but less than 2ms. 
@@ -312,8 +464,8 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 		ratio += ratio * ctx->waitidx / samples;
 
 		// Limit to sensible values
-		if (ratio > F_NBR(1.05)) {
-			ratio = F_NBR(1.05);
+		if (ratio > ctx->ratio_max) {
+			ratio = ctx->ratio_max;
 		}
 		ctx->ratio = ratio;
 		
@@ -331,8 +483,8 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 		ratio -= ratio * deltatm / samples;
 
 		// Limit to sensible values
-		if (ratio < F_NBR(0.95)) {
-			ratio = F_NBR(0.95);
+		if (ratio < ctx->ratio_min) {
+			ratio = ctx->ratio_min;
 		}
 		ctx->ratio = ratio;
 		
@@ -355,17 +507,34 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 #endif
 	
 #if !NEW_SYNC_ALGO
+	// Adjust ratio if queue is getting full, to keep fullness under control. 
+	//  Only the consumer touches the ratio, so it is done here instead of
+	//  when adding samples
+	if (ctx->high && av > ctx->high) {
+		unsigned int ratio = ctx->ratio;
+	
+		// Adjust ratio to avoid this the next time 
+		ratio += ratio/200;
+	
+		// Limit to sensible values
+		if (ratio > ctx->ratio_max) {
+			ratio = ctx->ratio_max;
+		}
+		ctx->ratio = ratio;
+		D("get[%p]: Adjusting ratio to keep queue 3/4 full: New ratio: %u",ctx, ratio);
+	} else
+	
 	// Adjust ratio if queue is getting empty, to keep fullness under control
 	if (samples != samples_todo &&  /* Something output */
 		ctx->low && /* Limit set */
-		CIRC_CNT(ctx->wr_pos,ctx->rd_pos,ctx->size) < ctx->low) {
+		av < ctx->low) {
 	
 		unsigned int ratio = ctx->ratio;
 		ratio -= ratio / 200;
 	
 		// Limit to sensible values
-		if (ratio < F_NBR(0.95)) {
-			ratio = F_NBR(0.95);
+		if (ratio < ctx->ratio_min) {
+			ratio = ctx->ratio_min;
 		}
 		ctx->ratio = ratio;
 		
@@ -385,7 +554,7 @@ int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsig
 		ALOGE("get[%p] Memory corruption at start: Found: %08x",ctx, ((int*)ctx->data)[-1                      ]);
 	}
 	
-	if (((int*)ctx->data)[(ctx->size*ctx->sample_sz)>>2] != 0xD7C6B2A1) {
+	if (((int*)ctx->data)[((ctx->size+ctx->rs.taps)*ctx->sample_sz)>>2] != 0xD7C6B2A1) {
 		ALOGE("get[%p] Memory corruption at end: Found: %08x",ctx, ((int*)ctx->data)[ctx->size*ctx->sample_sz]);
 	}
 #endif
@@ -402,8 +571,9 @@ int AudioQueue_end(struct AudioQueue* ctx)
 	if (!ctx->running)
 		return 0;
 		
-	// Signal end
+	// Signal end, and wake up the consumer if it is waiting for samples
 	ctx->running = 0;
+	AudioQueue_wake(ctx);
 
 	// Some delay to let add and get end...
 	sleep(1);
@@ -413,6 +583,7 @@ int AudioQueue_end(struct AudioQueue* ctx)
 #else
 	free(ctx->data);
 #endif
+	resampler_end(&ctx->rs);
 
 	memset(ctx,0,sizeof(struct AudioQueue));
 	return 0;
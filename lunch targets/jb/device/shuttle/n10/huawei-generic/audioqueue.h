@@ -22,14 +22,32 @@
 #define __AUDIOQUEUE_H 1
 
 #include <pthread.h>
+#include <stdint.h>
 #include <sys/time.h>
 #include "agc.h"
+#include "resampler.h"
 
 #define NEW_SYNC_ALGO 0
 
+/* The queue is filled by a single thread and emptied by another one. Each 
+   of them only writes its own fields, kept in separate cache lines, and 
+   publishes its position with release semantics */
+#define AUDIOQUEUE_CACHE_LINE 32
+#define AUDIOQUEUE_ALIGNED __attribute__((aligned(AUDIOQUEUE_CACHE_LINE)))
+
 struct AudioQueue {
 	volatile int running;	// != 0 if running
 	unsigned int size;		// Queue size in samples
+	unsigned int sample_sz;	// Sample size in bytes
+	void* data;				// Queue Data buffer
+	
+	// Written by the producer
+	volatile int32_t wr_pos AUDIOQUEUE_ALIGNED;	// Write position in samples. The consumer sleeps on it
+	
+	// Written by the consumer
+	volatile int32_t rd_pos AUDIOQUEUE_ALIGNED;	// Read position in samples
+	volatile int32_t waiting;	// != 0 if the consumer is sleeping until more samples are added
+	int notify_fd;			// eventfd also signalled to wake the consumer, or -1
 #if !NEW_SYNC_ALGO
 	unsigned int maxgetreq;	// Maximum request size
 	unsigned int low;		// Low limit
@@ -38,23 +56,25 @@ struct AudioQueue {
 	unsigned int nowaitctr;	// No waiting counter
 	unsigned int waitidx;	// Wait index
 #endif
-	unsigned int sample_sz;	// Sample size in bytes
-	unsigned int wr_pos;	// Write position in samples
-	unsigned int rd_pos;	// Read position in samples
+	unsigned int nominal;	// Resampling ratio between the input and output rates
 	unsigned int ratio;		// Resampling ratio including speedup/speeddown due to fullness
-	unsigned int step;		// Linear interpolation step
+	unsigned int ratio_min;	// Limits of the speedup/speeddown
+	unsigned int ratio_max;
+	unsigned int step;		// Position between input samples
+	struct resampler_ctx rs;	// Polyphase resampler
 	struct agc_ctx agc;		// AGC control
-	void* data;				// Queue Data buffer
 };
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-int AudioQueue_init(struct AudioQueue* ctx,unsigned int p2maxsamples, unsigned int sample_sz);
+int AudioQueue_init(struct AudioQueue* ctx,unsigned int p2maxsamples, unsigned int sample_sz, unsigned int in_rate, unsigned int out_rate);
 int AudioQueue_isrunning(struct AudioQueue* ctx);
 int AudioQueue_add(struct AudioQueue* ctx, void* data,unsigned int samples);
 int AudioQueue_get(struct AudioQueue* ctx, void* data,unsigned int samples,unsigned int timeout);
+int AudioQueue_setnotify(struct AudioQueue* ctx, int fd);
+int AudioQueue_poll(struct AudioQueue* ctx, unsigned int samples);
 int AudioQueue_end(struct AudioQueue* ctx);
 
 #ifdef __cplusplus
@@ -15,9 +15,9 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
-#include <string.h>
 #include <math.h>
 
 #define LOG_TAG "EchoCancel"
@@ -41,8 +41,9 @@
 
 int echocancel_init(struct echocancel_ctx* ctx,int sampleCount, int tailLength)
 {
-	int shift;
+	int shift, history;
 	
+    memset(ctx, 0, sizeof(*ctx));
     tailLength += sampleCount * 4;
 
     shift = 0;
@@ -58,26 +59,33 @@ int echocancel_init(struct echocancel_ctx* ctx,int sampleCount, int tailLength)
     ctx->RecordLength = tailLength * 2 / sampleCount;
     ctx->RecordOffset = 0;
 
-    ctx->Xs = malloc(sizeof(*ctx->Xs)*(ctx->TailLength + ctx->WindowSize));
-    memset(ctx->Xs, 0, sizeof(*ctx->Xs) * (ctx->TailLength + ctx->WindowSize));
-    ctx->XSums = malloc(sizeof(*ctx->XSums)*(ctx->TailLength));
-    memset(ctx->XSums, 0, sizeof(*ctx->XSums) * ctx->TailLength);
-    ctx->X2Sums = malloc(sizeof(*ctx->X2Sums)* ctx->TailLength);
-    memset(ctx->X2Sums, 0, sizeof(*ctx->X2Sums) * ctx->TailLength);
-    ctx->XRecords = malloc(sizeof(*ctx->XRecords) * (ctx->RecordLength * ctx->WindowSize));
-    memset(ctx->XRecords, 0, sizeof(*ctx->XRecords) * ctx->RecordLength * ctx->WindowSize);
+    // The history must hold the longest lag plus a whole window
+    history = 1;
+    while (history < ctx->TailLength + ctx->WindowSize) {
+        history <<= 1;
+    }
+    ctx->HistoryMask = history - 1;
+    ctx->HistoryOffset = 0;
+
+    ctx->Xs = calloc(history * 2, sizeof(*ctx->Xs));
+    ctx->XSums = calloc(history, sizeof(*ctx->XSums));
+    ctx->X2Sums = calloc(history, sizeof(*ctx->X2Sums));
+    ctx->XRecords = calloc(ctx->RecordLength * ctx->WindowSize, sizeof(*ctx->XRecords));
 
     ctx->YSum = 0;
     ctx->Y2Sum = 0;
-    ctx->YRecords = malloc( sizeof(*ctx->YRecords) * ctx->RecordLength);
-    memset(ctx->YRecords, 0, sizeof(*ctx->YRecords) * ctx->RecordLength);
-    ctx->Y2Records = malloc( sizeof (*ctx->Y2Records) * ctx->RecordLength);
-    memset(ctx->Y2Records, 0, sizeof(*ctx->Y2Records) * ctx->RecordLength);
+    ctx->YRecords = calloc(ctx->RecordLength, sizeof(*ctx->YRecords));
+    ctx->Y2Records = calloc(ctx->RecordLength, sizeof(*ctx->Y2Records));
 
-    ctx->XYSums = malloc( sizeof( *ctx->XYSums) * ctx->TailLength);
-    memset(ctx->XYSums, 0, sizeof( *ctx->XYSums) * ctx->TailLength);
-    ctx->XYRecords = malloc( sizeof( *ctx->XYRecords) * ctx->RecordLength * ctx->TailLength);
-    memset(ctx->XYRecords, 0, sizeof(*ctx->XYRecords) * ctx->RecordLength * ctx->TailLength);
+    ctx->XYSums = calloc(ctx->TailLength, sizeof(*ctx->XYSums));
+    ctx->XYRecords = calloc(ctx->RecordLength * ctx->TailLength, sizeof(*ctx->XYRecords));
+
+    if (!ctx->Xs || !ctx->XSums || !ctx->X2Sums || !ctx->XRecords ||
+        !ctx->YRecords || !ctx->Y2Records || !ctx->XYSums || !ctx->XYRecords) {
+        ALOGE("Failed to allocate echo suppressor buffers");
+        echocancel_end(ctx);
+        return -1;
+    }
 
     ctx->LastX = 0;
     ctx->LastY = 0;
@@ -99,25 +107,62 @@ void echocancel_end(struct echocancel_ctx* ctx)
 	memset(ctx,0,sizeof(*ctx));
 }
 
+// Correlates a window of the playback envelope against the recorded one. The
+// envelopes never exceed 13 bits, so they can be multiplied as signed halfword
+// pairs, and the window is at most 64 samples, so the sum can not overflow.
+static inline uint32_t correlate(const int16_t* x, const int16_t* y, int count)
+{
+	int acc = 0;
+	int pairs = count >> 1;
+	
+#if defined(__ARM_ARCH_7A__) || defined(__ARM_ARCH_6__)
+	while (pairs--) {
+		int a, b;
+		memcpy(&a, x, 4);	// Windows can start at any lag
+		memcpy(&b, y, 4);
+		__asm__ ("smlad %0, %1, %2, %0" : "+r" (acc) : "r" (a), "r" (b));
+		x += 2;
+		y += 2;
+	}
+#else
+	while (pairs--) {
+		acc += x[0] * y[0] + x[1] * y[1];
+		x += 2;
+		y += 2;
+	}
+#endif
+	if (count & 1) {
+		acc += x[0] * y[0];
+	}
+	return (uint32_t)acc;
+}
+
 void echocancel_run(struct echocancel_ctx* ctx,int16_t *playbacked, int16_t *recorded)
 {
-	uint16_t *xRecords;
-	uint16_t ys[ctx->WindowSize];
+	int16_t *xRecords;
+	int16_t ys[ctx->WindowSize];
+	uint32_t xSum, x2Sum;
     uint32_t ySum = 0;
     uint32_t y2Sum = 0;
 	uint32_t *xyRecords;
+	int mask = ctx->HistoryMask;
+	int head = ctx->HistoryOffset;
     int latency = 0;
     float corr2 = 0.0f;
     float varX = 0.0f;
     float varY;
 	int i,j;
 	
-    // Update Xs.
-    for (i = ctx->TailLength - 1; i >= 0; --i) {
-        ctx->Xs[i + ctx->WindowSize] = ctx->Xs[i];
-    }
-    for (i = ctx->WindowSize - 1, j = 0; i >= 0; --i, j += ctx->Scale) {
+    // Append the new Xs to the history, oldest first. Each one is also stored
+    // one ring length ahead, so the correlation can read any window straight.
+    // XSums and X2Sums are sliding sums over RecordLength windows, so they
+    // follow from the previous entry and the X that leaves them (XRecords).
+    xRecords = &ctx->XRecords[ctx->RecordOffset * ctx->WindowSize];
+    xSum = ctx->XSums[head];
+    x2Sum = ctx->X2Sums[head];
+    for (i = 0, j = 0; i < ctx->WindowSize; ++i, j += ctx->Scale) {
         uint32_t sum = 0;
+        int16_t xn;
 		int k;
         for (k = 0; k < ctx->Scale; ++k) {
             int32_t x = playbacked[j + k] << 15;
@@ -125,24 +170,20 @@ void echocancel_run(struct echocancel_ctx* ctx,int16_t *playbacked, int16_t *rec
             sum += ((ctx->LastX >= 0) ? ctx->LastX : -ctx->LastX) >> 15;
             ctx->LastX -= (ctx->LastX >> 10) + x;
         }
-        ctx->Xs[i] = sum >> ctx->Shift;
-    }
-
-    // Update XSums, X2Sums, and XRecords.
-    for (i = ctx->TailLength - ctx->WindowSize - 1; i >= 0; --i) {
-        ctx->XSums[i + ctx->WindowSize] = ctx->XSums[i];
-        ctx->X2Sums[i + ctx->WindowSize] = ctx->X2Sums[i];
-    }
-    xRecords = &ctx->XRecords[ctx->RecordOffset * ctx->WindowSize];
-    for (i = ctx->WindowSize - 1; i >= 0; --i) {
-        uint16_t x = ctx->Xs[i];
-        ctx->XSums[i] = ctx->XSums[i + 1] + x - xRecords[i];
-        ctx->X2Sums[i] = ctx->X2Sums[i + 1] + x * x - xRecords[i] * xRecords[i];
-        xRecords[i] = x;
+        xn = sum >> ctx->Shift;
+
+        head = (head + 1) & mask;
+        ctx->Xs[head] = ctx->Xs[head + mask + 1] = xn;
+        xSum += xn - xRecords[i];
+        x2Sum += xn * xn - xRecords[i] * xRecords[i];
+        ctx->XSums[head] = xSum;
+        ctx->X2Sums[head] = x2Sum;
+        xRecords[i] = xn;
     }
+    ctx->HistoryOffset = head;
 
-    // Compute Ys.
-    for (i = ctx->WindowSize - 1, j = 0; i >= 0; --i, j += ctx->Scale) {
+    // Compute Ys, also oldest first.
+    for (i = 0, j = 0; i < ctx->WindowSize; ++i, j += ctx->Scale) {
         uint32_t sum = 0;
 		int k;
         for (k = 0; k < ctx->Scale; ++k) {
@@ -152,27 +193,21 @@ void echocancel_run(struct echocancel_ctx* ctx,int16_t *playbacked, int16_t *rec
             ctx->LastY -= (ctx->LastY >> 10) + y;
         }
         ys[i] = sum >> ctx->Shift;
-    }
-
-    // Update YSum, Y2Sum, YRecords, and Y2Records.
-    ySum = 0;
-    y2Sum = 0;
-    for (i = ctx->WindowSize - 1; i >= 0; --i) {
         ySum += ys[i];
         y2Sum += ys[i] * ys[i];
     }
+
+    // Update YSum, Y2Sum, YRecords, and Y2Records.
     ctx->YSum += ySum - ctx->YRecords[ctx->RecordOffset];
     ctx->Y2Sum += y2Sum - ctx->Y2Records[ctx->RecordOffset];
     ctx->YRecords[ctx->RecordOffset] = ySum;
     ctx->Y2Records[ctx->RecordOffset] = y2Sum;
 
-    // Update XYSums and XYRecords.
+    // Update XYSums and XYRecords. The window for lag i ends i Xs back.
     xyRecords = &ctx->XYRecords[ctx->RecordOffset * ctx->TailLength];
     for (i = ctx->TailLength - 1; i >= 0; --i) {
-        uint32_t xySum = 0;
-        for (j = ctx->WindowSize - 1; j >= 0; --j) {
-            xySum += ctx->Xs[i + j] * ys[j];
-        }
+        const int16_t *xs = &ctx->Xs[(head - i - ctx->WindowSize + 1) & mask];
+        uint32_t xySum = correlate(xs, ys, ctx->WindowSize);
         ctx->XYSums[i] += xySum - xyRecords[i];
         xyRecords[i] = xySum;
     }
@@ -183,9 +218,10 @@ void echocancel_run(struct echocancel_ctx* ctx,int16_t *playbacked, int16_t *rec
     varX = 0.0f;
     varY = ctx->Y2Sum - ctx->Weight * ctx->YSum * ctx->YSum;
     for (i = ctx->TailLength - 1; i >= 0; --i) {
-        float cov = ctx->XYSums[i] - ctx->Weight * ctx->XSums[i] * ctx->YSum;
+        uint32_t xSumi = ctx->XSums[(head - i) & mask];
+        float cov = ctx->XYSums[i] - ctx->Weight * xSumi * ctx->YSum;
         if (cov > 0.0f) {
-            float varXi = ctx->X2Sums[i] - ctx->Weight * ctx->XSums[i] * ctx->XSums[i];
+            float varXi = ctx->X2Sums[(head - i) & mask] - ctx->Weight * xSumi * xSumi;
             float corr2i = cov * cov / (varXi * varY + 1);
             if (corr2i > corr2) {
                 varX = varXi;
@@ -28,10 +28,15 @@ struct echocancel_ctx {
     int RecordLength;
     int RecordOffset;
 
-    uint16_t *Xs;
+    // Xs, XSums and X2Sums are rings indexed by time, so a new frame does
+    // not have to shift them. Lags are counted back from HistoryOffset.
+    int HistoryMask;
+    int HistoryOffset;
+
+    int16_t *Xs;            // Stored twice, so any window is contiguous
     uint32_t *XSums;
     uint32_t *X2Sums;
-    uint16_t *XRecords;
+    int16_t *XRecords;
 
     uint32_t YSum;
     uint32_t Y2Sum;
@@ -51,7 +56,8 @@ struct echocancel_ctx {
 extern "C" {
 #endif
 
-// The sampleCount must be power of 2.
+// The sampleCount should be a multiple of a large power of 2. Samples past
+// the last whole block of the downsampled envelope are ignored.
 int echocancel_init(struct echocancel_ctx* ctx,int sampleCount, int tailLength);
 void echocancel_end(struct echocancel_ctx* ctx);
 void echocancel_run(struct echocancel_ctx* ctx,int16_t *playbacked, int16_t *recorded);
@@ -0,0 +1,162 @@
+/*
+ **
+ ** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+/* Each output sample is the dot product of the input samples around its 
+   position with a lowpass filter, a Kaiser windowed sinc, sampled at that 
+   fractional position. The filter is precomputed for RESAMPLER_PHASES 
+   positions, and the output of the two nearest ones is interpolated, so any 
+   ratio can be used, and changed on every sample to follow clock drift. 
+   When downsampling, the cutoff follows the output rate, to avoid aliasing */
+
+#include "resampler.h"
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define LOG_NDEBUG 0
+#define LOG_TAG "RILResampler"
+#include <utils/Log.h>
+
+#define COEF_BITS 14
+#define KAISER_BETA 7.0
+
+/* Zeroth order modified Bessel function of the first kind */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+	for (k = 1; k < 32; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+int resampler_init(struct resampler_ctx* ctx, unsigned int in_rate, unsigned int out_rate)
+{
+	unsigned int taps, half, p, t;
+	double fc, i0beta;
+	
+	memset(ctx,0,sizeof(*ctx));
+	
+	// Cutoff, relative to the input Nyquist frequency. Keep some room for 
+	//  the transition band
+	fc = 0.93;
+	taps = RESAMPLER_TAPS;
+	if (out_rate < in_rate) {
+		fc = fc * out_rate / in_rate;
+		taps = (RESAMPLER_TAPS * in_rate + out_rate - 1) / out_rate;
+	}
+	taps = (taps + 1) & ~1U;	// Even, so it can be processed in pairs
+	half = taps >> 1;
+	
+	ctx->coefs = malloc((RESAMPLER_PHASES + 1) * taps * sizeof(short));
+	if (!ctx->coefs) {
+		ALOGE("[%p] Failed to allocate %d coefficients",ctx,(RESAMPLER_PHASES + 1) * taps);
+		return -1;
+	}
+	ctx->taps = taps;
+	
+	ALOGD("[%p] Initializing resampler: %u -> %u hz, %u taps",ctx,in_rate,out_rate,taps);
+	
+	i0beta = bessel_i0(KAISER_BETA);
+	
+	// The output of phase p is between src[half-1] and src[half], at p/RESAMPLER_PHASES.
+	//  The last phase is the first one delayed a sample, to interpolate the
+	//  positions past the last phase
+	for (p = 0; p <= RESAMPLER_PHASES; p++) {
+		short* c = ctx->coefs + p * taps;
+		double h[taps];
+		double sum = 0.0;
+		int isum = 0, imax = 0;
+		
+		for (t = 0; t < taps; t++) {
+			double d = (double)t - (half - 1) - (double)p / RESAMPLER_PHASES;
+			double x = fc * d * M_PI;
+			double w = d / half;
+			double sinc = (x == 0.0) ? 1.0 : sin(x) / x;
+			w = (w >= 1.0 || w <= -1.0) ? 0.0 : bessel_i0(KAISER_BETA * sqrt(1.0 - w * w)) / i0beta;
+			h[t] = fc * sinc * w;
+			sum += h[t];
+		}
+		
+		// Unity gain at DC. Rounding errors go into the largest coefficient
+		for (t = 0; t < taps; t++) {
+			c[t] = (short)floor(h[t] / sum * (1 << COEF_BITS) + 0.5);
+			isum += c[t];
+			if (c[t] > c[imax])
+				imax = t;
+		}
+		c[imax] += (1 << COEF_BITS) - isum;
+	}
+	
+	return 0;
+}
+
+/* Dot product of taps samples and coefficients. They are processed in pairs:
+   ARMv6 and later can multiply and accumulate both halves of a word at once */
+static inline int dot_product(const short* src, const short* coefs, unsigned int taps)
+{
+	int acc = 0;
+	taps >>= 1;
+	
+#if defined(__ARM_ARCH_7A__) || defined(__ARM_ARCH_6__)
+	do {
+		int s, c;
+		memcpy(&s, src, 4);	// Samples can be unaligned
+		memcpy(&c, coefs, 4);
+		__asm__ ("smlad %0, %1, %2, %0" : "+r" (acc) : "r" (s), "r" (c));
+		src += 2;
+		coefs += 2;
+	} while (--taps);
+#else
+	do {
+		acc += src[0] * coefs[0] + src[1] * coefs[1];
+		src += 2;
+		coefs += 2;
+	} while (--taps);
+#endif
+	return acc;
+}
+
+/* Compute the output sample at frac (RESAMPLER_FRAC_BITS) past src[taps/2-1]. 
+   src must hold taps samples */
+short resampler_filter(const struct resampler_ctx* ctx, const short* src, unsigned int frac)
+{
+	unsigned int taps = ctx->taps;
+	unsigned int phase = frac >> (RESAMPLER_FRAC_BITS - RESAMPLER_PHASES_SHIFT);
+	int mu = (frac >> (RESAMPLER_FRAC_BITS - RESAMPLER_PHASES_SHIFT - 15)) & 0x7FFF;
+	const short* c = ctx->coefs + phase * taps;
+	int a = dot_product(src, c, taps);
+	int b = dot_product(src, c + taps, taps);
+	
+	// Interpolate between both phases, and round back to samples
+	int v = (int)((a + ((long long)(b - a) * mu >> 15) + (1 << (COEF_BITS - 1))) >> COEF_BITS);
+	if (v > 32767)
+		v = 32767;
+	if (v < -32768)
+		v = -32768;
+	return (short)v;
+}
+
+void resampler_end(struct resampler_ctx* ctx)
+{
+	free(ctx->coefs);
+	memset(ctx,0,sizeof(*ctx));
+}
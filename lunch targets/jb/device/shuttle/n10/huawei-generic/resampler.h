@@ -0,0 +1,50 @@
+/*
+ **
+ ** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+/* A windowed sinc polyphase resampler, with a continuously variable ratio */
+
+#ifndef _RESAMPLER_H
+#define _RESAMPLER_H
+
+/* Filter phases per input sample. Positions between them are interpolated */
+#define RESAMPLER_PHASES_SHIFT 7
+#define RESAMPLER_PHASES (1 << RESAMPLER_PHASES_SHIFT)
+
+/* Taps per phase when upsampling. Downsampling needs proportionally more */
+#define RESAMPLER_TAPS 32
+
+/* Bits of the fractional position between input samples */
+#define RESAMPLER_FRAC_BITS 28
+
+struct resampler_ctx {
+	unsigned int taps;		// Taps of each phase. Input samples used per output sample
+	short* coefs;			// RESAMPLER_PHASES+1 phases of taps coefficients, Q14
+};
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int resampler_init(struct resampler_ctx* ctx, unsigned int in_rate, unsigned int out_rate);
+short resampler_filter(const struct resampler_ctx* ctx, const short* src, unsigned int frac);
+void resampler_end(struct resampler_ctx* ctx);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,248 @@
+/*
+**
+** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/* Host stress test of AudioQueue: a producer and a consumer thread move
+   samples through the queue at every pair of 8, 16, 44.1 and 48khz rates,
+   in random sized chunks, with random producer stalls so the consumer has
+   to sleep. Half of the runs sleep in AudioQueue_get, the other half poll
+   the eventfd as the modem thread does.
+
+   The input is a ramp. The resampler has unity gain and linear phase, so
+   each output sample is the ramp at its input position, and the position
+   can be told back from it. With the ratio fixed, positions must advance
+   exactly by the ratio: a sample lost or got twice shows as a jump.
+
+   AGC is left out, so samples come out as they went in.
+
+   Usage: audioqueue_stress [-s seconds of input per run] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <poll.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "audioqueue.h"
+
+/* Ramp slope, in sample units per input sample. It wraps from 32767 to 
+   -32768 every 65536/SLOPE input samples, and the resampler rings around
+   the wrap */
+#define SLOPE		8
+#define WRAP		(65536 / SLOPE)
+
+/* Largest error of a position told back from a sample, in input samples */
+#define TOLERANCE	0.5
+
+/* Longest a wake up can take, in ms. Beyond it, it was lost */
+#define WAKE_LIMIT	200
+
+void agc_init(struct agc_ctx* ctx, short level) { }
+void agc_process_16bit(struct agc_ctx* ctx, short* buffer, int samples) { }
+void agc_process_8bit(struct agc_ctx* ctx, unsigned char* buffer, int samples) { }
+
+struct run {
+	struct AudioQueue q;
+	unsigned int in_rate, out_rate;
+	unsigned int total;		// Input samples to add
+	int use_poll;			// Consumer waits on the eventfd instead of in the queue
+	int evfd;
+	unsigned int seed;
+};
+
+static double now_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+static void* producer(void* data)
+{
+	struct run* r = (struct run*)data;
+	short buf[4096];
+	unsigned int n = 0, seed = r->seed;
+
+	while (n < r->total) {
+		unsigned int chunk = 1 + rand_r(&seed) % (r->in_rate / 25);
+		unsigned int i, off = 0;
+		if (chunk > r->total - n)
+			chunk = r->total - n;
+		for (i = 0; i < chunk; i++)
+			buf[i] = (short)((n + i) * SLOPE);
+
+		// Whatever does not fit is added once the consumer makes room
+		while (off < chunk) {
+			off += AudioQueue_add(&r->q, buf + off, chunk - off);
+			if (off < chunk)
+				usleep(200);
+		}
+		n += chunk;
+
+		// Stall now and then, so the consumer runs out and has to sleep
+		if (rand_r(&seed) % 8 == 0)
+			usleep(rand_r(&seed) % 3000);
+	}
+	return NULL;
+}
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static void run(unsigned int in_rate, unsigned int out_rate, int use_poll, double secs)
+{
+	struct run r;
+	pthread_t pt;
+	short buf[4096];
+	double ratio, pos0 = 0;
+	unsigned int got = 0, expected, seed = in_rate + out_rate;
+	unsigned int checked = 0, jumps = 0, lost_wakes = 0, sleeps = 0;
+	int anchored = 0;
+	char what[96];
+
+	memset(&r, 0, sizeof(r));
+	r.in_rate = in_rate;
+	r.out_rate = out_rate;
+	r.total = (unsigned int)(in_rate * secs);
+	r.use_poll = use_poll;
+	r.seed = seed * 7 + use_poll;
+	if (AudioQueue_init(&r.q, 12, 2, in_rate, out_rate) < 0) {
+		check(0, "AudioQueue_init");
+		return;
+	}
+
+	// Fixed ratio, so positions advance by it exactly
+	r.q.ratio_min = r.q.ratio_max = r.q.nominal;
+	ratio = r.q.nominal / (double)(1 << 28);
+
+	r.evfd = -1;
+	if (use_poll) {
+		r.evfd = eventfd(0, EFD_NONBLOCK);
+		AudioQueue_setnotify(&r.q, r.evfd);
+	}
+
+	// The output samples the input gives, leaving the taps the last one
+	//  needs and the ones the first one starts at
+	expected = (unsigned int)((r.total - r.q.rs.taps) / ratio);
+
+	pthread_create(&pt, NULL, producer, &r);
+
+	while (got < expected) {
+		unsigned int chunk = 1 + rand_r(&seed) % (out_rate / 25);
+		unsigned int i;
+		int n;
+		double t0 = now_ms(), waited;
+
+		if (chunk > expected - got)
+			chunk = expected - got;
+
+		if (use_poll) {
+			// As the modem thread: wait on the eventfd until they are there
+			while (!AudioQueue_poll(&r.q, chunk)) {
+				struct pollfd p = { r.evfd, POLLIN, 0 };
+				eventfd_t v;
+				double w0 = now_ms();
+				poll(&p, 1, 1000);
+				eventfd_read(r.evfd, &v);
+				sleeps++;
+				if (now_ms() - w0 > WAKE_LIMIT)
+					lost_wakes++;
+			}
+			n = AudioQueue_get(&r.q, buf, chunk, 0);
+		} else {
+			n = AudioQueue_get(&r.q, buf, chunk, 1000);
+			waited = now_ms() - t0;
+			if (waited > 0.1)
+				sleeps++;
+			if (waited > WAKE_LIMIT)
+				lost_wakes++;
+		}
+		if (n != (int)chunk) {
+			snprintf(what, sizeof(what), "%u -> %u hz: got %d of %u samples",
+				in_rate, out_rate, n, chunk);
+			check(0, what);
+			break;
+		}
+
+		// Tell the position of each sample back, away from the ramp wraps
+		for (i = 0; i < chunk; i++, got++) {
+			double pos = (unsigned short)buf[i] / (double)SLOPE;
+			double exp = pos0 + got * ratio;
+			double d = fmod(exp + WRAP / 2, WRAP);
+
+			if (d < r.q.rs.taps || d > WRAP - r.q.rs.taps)
+				continue;
+			if (!anchored) {
+				pos0 = pos - got * ratio;
+				anchored = 1;
+				continue;
+			}
+			pos += floor((exp - pos) / WRAP + 0.5) * WRAP;
+			checked++;
+			if (fabs(pos - exp) > TOLERANCE) {
+				if (jumps++ < 3)
+					printf("  sample %u: at %.2f, expected at %.2f\n", got, pos, exp);
+				pos0 = pos - got * ratio;
+			}
+		}
+	}
+
+	pthread_join(pt, NULL);
+	printf("%5u -> %5u hz, %s: %u samples in, %u out, %u checked, %u jumps, %u sleeps\n",
+		in_rate, out_rate, use_poll ? "poll" : "wait", r.total, got, checked, jumps, sleeps);
+
+	snprintf(what, sizeof(what), "%u -> %u hz, %s: no sample lost or repeated",
+		in_rate, out_rate, use_poll ? "poll" : "wait");
+	check(got == expected && checked > expected / 2 && jumps == 0, what);
+	snprintf(what, sizeof(what), "%u -> %u hz, %s: no wake up lost",
+		in_rate, out_rate, use_poll ? "poll" : "wait");
+	check(lost_wakes == 0, what);
+
+	AudioQueue_end(&r.q);
+	if (r.evfd >= 0)
+		close(r.evfd);
+}
+
+int main(int argc, char** argv)
+{
+	static const unsigned int rates[] = { 8000, 16000, 44100, 48000 };
+	double secs = 2;
+	unsigned int i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "s:")) != -1) {
+		switch (opt) {
+			case 's': secs = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-s seconds of input per run]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	for (i = 0; i < sizeof(rates) / sizeof(rates[0]); i++)
+		for (j = 0; j < sizeof(rates) / sizeof(rates[0]); j++)
+			run(rates[i], rates[j], (i + j) & 1, secs);
+	return failed;
+}
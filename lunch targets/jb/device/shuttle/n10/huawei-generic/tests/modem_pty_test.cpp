@@ -0,0 +1,333 @@
+/*
+**
+** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/* Host test of the modem voice thread of audiochannel.cpp. A fake modem on
+   a pty sends a frame every 20ms once fed, looping back the uplink, as the 
+   Huawei modems do in loopback. AudioRecord and AudioTrack are stubbed with
+   callback threads (stubs/media). The mic sends a burst every second, and the
+   time it takes to reach the speaker is the round trip latency.
+   
+   Checked:
+   - the round trip latency and the uplink underruns seen by the modem;
+   - every frame sent to the modem gets as echo reference the frames received
+     from it, each one once and in order;
+   - each frame received, even if short of bytes, is played as one frame;
+   - if the modem hangs up, the thread ends instead of spinning;
+   - the echo tail is sized for the rates the streams were opened at.
+   
+   Usage: modem_pty_test [-t secs] [-j mic jitter ms] [-d drop a byte every
+   n frames] [-u hang up after secs] [-r AudioFlinger rate] [-f] 
+   -f makes AudioRecord refuse AudioFlinger's rate, so it falls back to the
+   modem rate */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <math.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/resource.h>
+#include <vector>
+#include <algorithm>
+#include "audiochannel.h"
+#include "media/FakeStream.h"
+
+#define FRAME_SAMPLES	160
+#define FRAME_BYTES		(FRAME_SAMPLES * 2)
+
+int fake_af_rate = 44100;
+int fake_rec_jitter_ms = 0;
+int fake_rec_fail_rate = 0;
+
+static struct GsmAudioTunnel ctx = GSM_AUDIO_CHANNEL_STATIC_INIT;
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+
+double fake_now()
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* Mic: a 20ms 1kHz burst every second, apart enough not to fall within
+   the echo tail of the previous one. The times they start are kept */
+static std::vector<double> bursts;
+static long mic_pos = 0;
+
+void fake_mic(short* d, int n, double t0, int rate)
+{
+	int i;
+	for (i = 0; i < n; i++, mic_pos++) {
+		long p = mic_pos % rate;
+		if (p == 0) {
+			pthread_mutex_lock(&lock);
+			bursts.push_back(t0 + (double)i / rate);
+			pthread_mutex_unlock(&lock);
+		}
+		d[i] = (p < rate / 50) ? (short)(12000 * sin(2 * M_PI * 1000.0 * p / rate)) : 0;
+	}
+}
+
+/* Speaker: the latency of each burst heard, from the last one sent before */
+static std::vector<double> latency;
+static int in_burst = 0;
+static long quiet = 0;
+
+void fake_spk(const short* d, int n, double t0, int rate)
+{
+	int i;
+	for (i = 0; i < n; i++) {
+		if (abs(d[i]) <= 3000) {
+			if (++quiet > rate / 100)
+				in_burst = 0;
+			continue;
+		}
+		if (!in_burst && quiet > rate / 10) {
+			double t = t0 + (double)i / rate;
+			double sent = -1;
+			pthread_mutex_lock(&lock);
+			for (size_t k = 0; k < bursts.size(); k++)
+				if (bursts[k] < t)
+					sent = bursts[k];
+			pthread_mutex_unlock(&lock);
+			if (sent > 0)
+				latency.push_back((t - sent) * 1000);
+		}
+		in_burst = 1;
+		quiet = 0;
+	}
+}
+
+/* The frames queued for playback, and the echo references used, caught by
+   wrapping the calls (-Wl,--wrap) */
+static std::vector<std::vector<short> > played;
+static std::vector<std::vector<short> > refs;
+
+extern "C" {
+int __real_AudioQueue_add(struct AudioQueue* q, void* data, unsigned int samples);
+void __real_echocancel_run(struct echocancel_ctx* ec, int16_t* x, int16_t* y);
+
+int __wrap_AudioQueue_add(struct AudioQueue* q, void* data, unsigned int samples)
+{
+	if (q == &ctx.play_q) {
+		pthread_mutex_lock(&lock);
+		played.push_back(std::vector<short>((short*)data, (short*)data + samples));
+		pthread_mutex_unlock(&lock);
+	}
+	return __real_AudioQueue_add(q, data, samples);
+}
+
+void __wrap_echocancel_run(struct echocancel_ctx* ec, int16_t* x, int16_t* y)
+{
+	pthread_mutex_lock(&lock);
+	refs.push_back(std::vector<short>(x, x + ec->SampleCount));
+	pthread_mutex_unlock(&lock);
+	__real_echocancel_run(ec, x, y);
+}
+}
+
+/* Fake modem: once fed, sends a frame every 20ms, with the oldest frame it 
+   got, or silence if there is none. Each frame sent is tagged with a low 
+   level pattern of its own, so the frames can be told apart */
+static int mfd;
+static int drop_every = 0;
+static double hangup_at = 0;
+static volatile int modem_run = 1;
+static int modem_frames = 0, modem_underruns = 0;
+
+static void* modem(void*)
+{
+	std::vector<unsigned char> up;
+	unsigned char buf[4096];
+	double next = 0, start = fake_now();
+	int fed = 0;
+	
+	while (modem_run) {
+		struct pollfd p = { mfd, POLLIN, 0 };
+		double now = fake_now();
+		int timeout = fed ? (int)std::max(0.0, (next - now) * 1000) : 10;
+		poll(&p, 1, timeout);
+		if (p.revents & POLLIN) {
+			int r = read(mfd, buf, sizeof(buf));
+			if (r > 0) {
+				up.insert(up.end(), buf, buf + r);
+				if (!fed) {
+					fed = 1;
+					next = fake_now();
+				}
+			}
+		}
+		
+		now = fake_now();
+		if (hangup_at && now - start >= hangup_at) {
+			close(mfd);
+			return NULL;
+		}
+		if (!fed || now < next)
+			continue;
+		
+		short f[FRAME_SAMPLES];
+		int i, len = FRAME_BYTES;
+		memset(f, 0, sizeof(f));
+		if (up.size() >= FRAME_BYTES) {
+			memcpy(f, &up[0], FRAME_BYTES);
+			up.erase(up.begin(), up.begin() + FRAME_BYTES);
+		} else {
+			modem_underruns++;
+		}
+		modem_frames++;
+		for (i = 0; i < FRAME_SAMPLES; i++)
+			f[i] += 1 + ((modem_frames * 131 + i * 17) & 63);
+		
+		// Lose a byte on the way, as the EM770W does
+		if (drop_every && modem_frames % drop_every == 0) {
+			memmove((char*)f + 101, (char*)f + 102, FRAME_BYTES - 102);
+			len--;
+		}
+		write(mfd, f, len);
+		next += 0.020;
+	}
+	return NULL;
+}
+
+static double cpu_seconds()
+{
+	struct rusage ru;
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + 
+		(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1e-6;
+}
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+int main(int argc, char** argv)
+{
+	int secs = 5, opt;
+	while ((opt = getopt(argc, argv, "t:j:d:u:r:f")) != -1) {
+		switch (opt) {
+			case 't': secs = atoi(optarg); break;
+			case 'j': fake_rec_jitter_ms = atoi(optarg); break;
+			case 'd': drop_every = atoi(optarg); break;
+			case 'u': hangup_at = atof(optarg); break;
+			case 'r': fake_af_rate = atoi(optarg); break;
+			case 'f': fake_rec_fail_rate = -1; break;
+			default:
+				fprintf(stderr, "usage: %s [-t secs] [-j jitter ms] [-d drop every] [-u hangup secs] [-r rate] [-f]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (fake_rec_fail_rate)
+		fake_rec_fail_rate = fake_af_rate;
+	
+	mfd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (mfd < 0 || grantpt(mfd) < 0 || unlockpt(mfd) < 0) {
+		perror("pty");
+		return 2;
+	}
+	struct termios t;
+	tcgetattr(mfd, &t);
+	cfmakeraw(&t);
+	tcsetattr(mfd, TCSANOW, &t);
+	// Once the tunnel closes its side, nobody drains what the modem writes
+	fcntl(mfd, F_SETFL, fcntl(mfd, F_GETFL) | O_NONBLOCK);
+	
+	pthread_t mt;
+	pthread_create(&mt, NULL, modem, NULL);
+	if (gsm_audio_tunnel_start(&ctx, ptsname(mfd), 8000, FRAME_SAMPLES, 16) < 0) {
+		printf("FAIL: could not start the tunnel\n");
+		return 1;
+	}
+	
+	double cpu_idle = -1;
+	if (hangup_at) {
+		// Once the modem is gone, the thread must not spin
+		usleep((useconds_t)((hangup_at + 0.5) * 1e6));
+		double c0 = cpu_seconds(), t0 = fake_now();
+		sleep(1);
+		cpu_idle = (cpu_seconds() - c0) / (fake_now() - t0);
+		secs -= (int)hangup_at + 2;
+	}
+	if (secs > 0)
+		sleep(secs);
+	
+	// The echo tail covers the 40ms double buffers of both streams, at the
+	//  rates they were finally opened at
+	int buffer = 2 * (fake_af_rate * 40 / 1000);
+	int tail = buffer * 8000 / ctx.play_rate + buffer * 8000 / ctx.rec_rate + 4 * FRAME_SAMPLES;
+	printf("streams: play at %u hz, record at %u hz, echo tail %d samples\n", 
+		ctx.play_rate, ctx.rec_rate, tail);
+	check(ctx.rec_rate == (fake_rec_fail_rate ? 8000u : (unsigned)fake_af_rate), "record rate");
+	check(ctx.echo.RecordLength == tail * 2 / FRAME_SAMPLES, "echo tail sized for the final rates");
+	
+	pthread_mutex_lock(&lock);
+	int mframes = modem_frames, munder = modem_underruns;
+	pthread_mutex_unlock(&lock);
+	gsm_audio_tunnel_stop(&ctx);
+	modem_run = 0;
+	pthread_join(mt, NULL);
+	
+	printf("modem: %d frames sent, %d uplink underruns\n", mframes, munder);
+	
+	// Echo references: every frame played, once and in order. Silence only
+	//  when nothing was received yet
+	size_t next = 0, silent = 0, wrong = 0, i;
+	for (i = 0; i < refs.size(); i++) {
+		bool zero = true;
+		for (size_t k = 0; k < refs[i].size() && zero; k++)
+			zero = (refs[i][k] == 0);
+		if (zero)
+			silent++;
+		else if (next < played.size() && refs[i] == played[next])
+			next++;
+		else
+			wrong++;
+	}
+	printf("echo: %zu references, %zu silent, %zu out of order, %zu of %zu played frames used\n",
+		refs.size(), silent, wrong, next, played.size());
+	check(refs.size() > 0, "echo suppressor ran");
+	check(wrong == 0, "echo references are the played frames, in order");
+	check(silent <= 2, "echo references are silent only when priming the modem");
+	
+	if (hangup_at) {
+		printf("cpu after hang-up: %.0f%%\n", cpu_idle * 100);
+		check(cpu_idle < 0.2, "modem thread does not spin after a hang-up");
+		return failed;
+	}
+	
+	std::sort(latency.begin(), latency.end());
+	if (latency.size())
+		printf("latency: %zu bursts, min %.0f ms, median %.0f ms, max %.0f ms\n", latency.size(),
+			latency.front(), latency[latency.size() / 2], latency.back());
+	check(latency.size() >= bursts.size() / 2, "mic bursts reach the speaker");
+	// Falling back to record at 8khz, the record buffer is that of the 
+	//  AudioFlinger rate, 6 times longer
+	double limit = fake_rec_fail_rate ? 450 : 350;
+	check(latency.size() && latency[latency.size() / 2] < limit, "median round trip within limits");
+	check(munder <= 2, "modem uplink underruns only at start");
+	check(abs((int)played.size() - mframes) <= 2, "each frame received is played as one frame");
+	check(next + 2 * 4 + 1 >= played.size(), "every played frame is an echo reference");
+	return failed;
+}
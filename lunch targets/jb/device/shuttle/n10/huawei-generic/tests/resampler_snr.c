@@ -0,0 +1,223 @@
+/*
+**
+** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/* Host SNR test and benchmark of the polyphase resampler, against the
+   linear interpolator AudioQueue_get used before it, and the one it still
+   uses for 8 bit samples.
+
+   A tone is resampled and compared with the same tone computed at the
+   output positions. When downsampling, a tone above the output Nyquist
+   frequency can be added: whatever of it is left is aliased noise. The
+   tone is also streamed through an AudioQueue, in chunks that wrap around
+   its buffer.
+
+   Usage: resampler_snr [-b]
+   -b also times both of them */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include "resampler.h"
+#include "audioqueue.h"
+
+/* Least SNR the polyphase resampler must reach, in dB */
+#define MIN_SNR		60.0
+
+#define AMPLITUDE	12000.0
+#define ALIAS_AMPLITUDE	8000.0
+
+void agc_init(struct agc_ctx* ctx, short level) { }
+void agc_process_16bit(struct agc_ctx* ctx, short* buffer, int samples) { }
+void agc_process_8bit(struct agc_ctx* ctx, unsigned char* buffer, int samples) { }
+
+static int bench = 0;
+static int failed = 0;
+
+static double now(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static double snr(double signal, double noise)
+{
+	return 10 * log10(signal / noise);
+}
+
+/* Resample 2 seconds of a tone at freq, plus one at alias if not 0, with
+   both the polyphase filter and linear interpolation */
+static void tone(unsigned int in_rate, unsigned int out_rate, double freq, double alias)
+{
+	struct resampler_ctx rs;
+	unsigned int ratio, half, i, n = in_rate * 2, m, k, reps;
+	unsigned long long pos;
+	short *x, *y, *yl;
+	double es = 0, en = 0, enl = 0, t0, t1, t2;
+	char what[96];
+
+	if (resampler_init(&rs, in_rate, out_rate) < 0) {
+		check(0, "resampler_init");
+		return;
+	}
+	half = rs.taps / 2;
+	ratio = (unsigned int)(((unsigned long long)in_rate << RESAMPLER_FRAC_BITS) / out_rate);
+	m = (unsigned int)((unsigned long long)(n - rs.taps - 2) * out_rate / in_rate);
+
+	x = malloc(n * sizeof(short));
+	y = malloc(m * sizeof(short));
+	yl = malloc(m * sizeof(short));
+	for (i = 0; i < n; i++) {
+		double v = AMPLITUDE * sin(2 * M_PI * freq * i / in_rate);
+		if (alias)
+			v += ALIAS_AMPLITUDE * sin(2 * M_PI * alias * i / in_rate);
+		x[i] = (short)floor(v + 0.5);
+	}
+
+	reps = bench ? 20 : 1;
+	t0 = now();
+	for (i = 0; i < reps; i++) {
+		for (k = 0, pos = 0; k < m; k++, pos += ratio)
+			y[k] = resampler_filter(&rs, x + (pos >> RESAMPLER_FRAC_BITS),
+				pos & ((1 << RESAMPLER_FRAC_BITS) - 1));
+	}
+	t1 = now();
+
+	// As AudioQueue_get did: the current sample and the next one
+	for (i = 0; i < reps; i++) {
+		for (k = 0, pos = 0; k < m; k++, pos += ratio) {
+			unsigned int j = pos >> RESAMPLER_FRAC_BITS;
+			long long fract = pos & ((1 << RESAMPLER_FRAC_BITS) - 1);
+			yl[k] = x[j] + (short)(((x[j+1] - x[j]) * fract) >> RESAMPLER_FRAC_BITS);
+		}
+	}
+	t2 = now();
+
+	// The polyphase output is centered half-1 samples later. The filter
+	//  takes some samples to settle
+	for (k = 0, pos = 0; k < m; k++, pos += ratio) {
+		double p = (double)pos / (1 << RESAMPLER_FRAC_BITS);
+		double ideal = AMPLITUDE * sin(2 * M_PI * freq * (p + half - 1) / in_rate);
+		double ideal_l = AMPLITUDE * sin(2 * M_PI * freq * p / in_rate);
+		if (k < 64)
+			continue;
+		es += ideal * ideal;
+		en += (y[k] - ideal) * (y[k] - ideal);
+		enl += (yl[k] - ideal_l) * (yl[k] - ideal_l);
+	}
+
+	printf("%5u -> %5u hz, %4.0f hz tone", in_rate, out_rate, freq);
+	if (alias)
+		printf(" + %5.0f hz alias", alias);
+	printf(", %3u taps: polyphase %5.1f dB, linear %5.1f dB\n", rs.taps, snr(es, en), snr(es, enl));
+	if (bench)
+		printf("   %6.1f ns per output sample polyphase, %5.1f ns linear\n",
+			(t1 - t0) / m / reps * 1e9, (t2 - t1) / m / reps * 1e9);
+
+	snprintf(what, sizeof(what), "%u -> %u hz, %.0f hz tone%s: SNR above %.0f dB",
+		in_rate, out_rate, freq, alias ? " with alias" : "", MIN_SNR);
+	check(snr(es, en) >= MIN_SNR, what);
+
+	free(x);
+	free(y);
+	free(yl);
+	resampler_end(&rs);
+}
+
+/* Stream a 1khz tone through an AudioQueue with the ratio pinned, in 20ms
+   chunks. The buffer holds 4096 samples, so it wraps many times */
+static void queue(unsigned int in_rate, unsigned int out_rate)
+{
+	struct AudioQueue q;
+	static short in[4096], out[4096];
+	unsigned int it, i, taps, added = 0, got = 0;
+	unsigned int in_chunk = in_rate / 50, out_chunk = out_rate / 50;
+	double ratio, es = 0, en = 0;
+	char what[96];
+
+	if (AudioQueue_init(&q, 12, 2, in_rate, out_rate) < 0) {
+		check(0, "AudioQueue_init");
+		return;
+	}
+	q.ratio_min = q.ratio_max = q.nominal;
+	ratio = q.nominal / (double)(1 << 28);
+	taps = q.rs.taps;
+
+	for (it = 0; it < 200; it++) {
+		int n;
+		for (i = 0; i < in_chunk; i++)
+			in[i] = (short)floor(AMPLITUDE * sin(2 * M_PI * 1000.0 * (added + i) / in_rate) + 0.5);
+		added += AudioQueue_add(&q, in, in_chunk);
+
+		n = AudioQueue_get(&q, out, out_chunk, 0);
+		for (i = 0; i < (unsigned int)n; i++, got++) {
+			double ideal = AMPLITUDE * sin(2 * M_PI * 1000.0 * (got * ratio + taps / 2 - 1) / in_rate);
+			if (got < 64)
+				continue;
+			es += ideal * ideal;
+			en += (out[i] - ideal) * (out[i] - ideal);
+		}
+	}
+	AudioQueue_end(&q);
+
+	printf("%5u -> %5u hz through the queue: %u samples in, %u out, %5.1f dB\n",
+		in_rate, out_rate, added, got, snr(es, en));
+	snprintf(what, sizeof(what), "%u -> %u hz through the queue: all samples out, SNR above %.0f dB",
+		in_rate, out_rate, MIN_SNR);
+	check(got + out_chunk + (unsigned int)(taps / ratio) >= (unsigned int)(added / ratio) &&
+		snr(es, en) >= MIN_SNR, what);
+}
+
+int main(int argc, char** argv)
+{
+	int opt;
+
+	while ((opt = getopt(argc, argv, "b")) != -1) {
+		switch (opt) {
+			case 'b': bench = 1; break;
+			default:
+				fprintf(stderr, "usage: %s [-b]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	// Upsampling, and following a drift between the clocks
+	tone(8000, 48000, 1000, 0);
+	tone(8000, 44100, 3000, 0);
+	tone(8000, 8024, 1000, 0);
+
+	// Downsampling, with a tone the filter must remove
+	tone(48000, 8000, 1000, 0);
+	tone(48000, 8000, 1000, 10000);
+	tone(44100, 8000, 3000, 0);
+
+	queue(8000, 48000);
+	queue(48000, 8000);
+	queue(8000, 44100);
+	queue(44100, 8000);
+	return failed;
+}
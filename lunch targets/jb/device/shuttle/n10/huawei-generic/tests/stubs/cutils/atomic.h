@@ -0,0 +1,29 @@
+/* Host stand-in for the cutils atomics the tunnel uses, with the same 
+   barrier semantics */
+#ifndef _STUB_CUTILS_ATOMIC_H
+#define _STUB_CUTILS_ATOMIC_H
+
+#include <stdint.h>
+
+static inline int32_t android_atomic_acquire_load(volatile const int32_t* addr)
+{
+	return __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+}
+
+static inline void android_atomic_release_store(int32_t value, volatile int32_t* addr)
+{
+	__atomic_store_n(addr, value, __ATOMIC_RELEASE);
+}
+
+/* Both return 0 if the value was swapped */
+static inline int android_atomic_acquire_cas(int32_t oldvalue, int32_t newvalue, volatile int32_t* addr)
+{
+	return !__atomic_compare_exchange_n(addr, &oldvalue, newvalue, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline int android_atomic_release_cas(int32_t oldvalue, int32_t newvalue, volatile int32_t* addr)
+{
+	return !__atomic_compare_exchange_n(addr, &oldvalue, newvalue, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
@@ -0,0 +1,2 @@
+/* Host stand-in, see FakeStream.h */
+#include "FakeStream.h"
@@ -0,0 +1,132 @@
+/* Host stand-ins for AudioRecord and AudioTrack. Each stream calls its 
+   callback from a thread of its own, every notification period, as 
+   AudioFlinger does. The samples come from and go to the test, through the
+   hooks below */
+#ifndef _STUB_FAKESTREAM_H
+#define _STUB_FAKESTREAM_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
+#include <system/audio.h>
+
+/* Provided by the test */
+extern int fake_af_rate;			// AudioFlinger output rate
+extern int fake_rec_jitter_ms;		// Random delay of the record callbacks
+extern int fake_rec_fail_rate;		// A record rate AudioRecord refuses, or 0
+double fake_now();
+void fake_mic(short* d, int n, double t0, int rate);
+void fake_spk(const short* d, int n, double t0, int rate);
+
+namespace android {
+
+typedef int status_t;
+enum { NO_ERROR = 0, BAD_VALUE = -22 };
+
+typedef void (*callback_t)(int event, void* user, void* info);
+
+struct FakeStream {
+	struct Buffer {
+		uint32_t flags;
+		int channelCount;
+		int format;
+		size_t frameCount;
+		size_t size;
+		union {
+			void* raw;
+			short* i16;
+			int8_t* i8;
+		};
+	};
+	enum { EVENT_MORE_DATA = 0 };
+	
+	callback_t cb;
+	void* user;
+	int rate;
+	int notif;
+	int isrec;
+	status_t status;
+	volatile int run;
+	pthread_t thread;
+	
+	FakeStream() : cb(0), user(0), rate(0), notif(0), isrec(0), status(NO_ERROR), run(0) {}
+	virtual ~FakeStream() { stop(); }
+	
+	status_t initCheck() { return status; }
+	
+	static void* loop(void* p) {
+		FakeStream* s = (FakeStream*)p;
+		short buf[8192];
+		double period = (double)s->notif / s->rate;
+		double next = fake_now() + period;
+		double t0 = fake_now();
+		while (s->run) {
+			double wait = next - fake_now();
+			if (s->isrec && fake_rec_jitter_ms)
+				wait += (rand() % (2 * fake_rec_jitter_ms + 1) - fake_rec_jitter_ms) / 1000.0;
+			if (wait > 0)
+				usleep((useconds_t)(wait * 1e6));
+			next += period;
+			
+			Buffer b;
+			b.size = s->notif * 2;
+			b.frameCount = s->notif;
+			b.raw = buf;
+			if (s->isrec)
+				fake_mic(buf, s->notif, t0, s->rate);
+			s->cb(EVENT_MORE_DATA, s->user, &b);
+			if (!s->isrec)
+				fake_spk(buf, b.size / 2, t0, s->rate);
+			t0 += period;
+		}
+		return NULL;
+	}
+	void start() {
+		run = 1;
+		pthread_create(&thread, NULL, loop, this);
+	}
+	void stop() {
+		if (run) {
+			run = 0;
+			pthread_join(thread, NULL);
+		}
+	}
+};
+
+/* Both streams ask for 40ms buffers */
+struct AudioRecord : FakeStream {
+	AudioRecord() { isrec = 1; }
+	static status_t getMinFrameCount(int* frames, uint32_t rate, audio_format_t, int) {
+		*frames = rate * 40 / 1000;
+		return NO_ERROR;
+	}
+	status_t set(int, uint32_t r, audio_format_t, int, int, callback_t c, void* u, int n, bool, int) {
+		rate = r; cb = c; user = u; notif = n;
+		status = ((int)r == fake_rec_fail_rate) ? BAD_VALUE : NO_ERROR;
+		return status;
+	}
+};
+
+struct AudioTrack : FakeStream {
+	static status_t getMinFrameCount(int* frames, int, uint32_t rate) {
+		*frames = rate * 40 / 1000;
+		return NO_ERROR;
+	}
+	status_t set(int, uint32_t r, audio_format_t, int, int, int, callback_t c, void* u, int n, int, bool, int) {
+		rate = r; cb = c; user = u; notif = n;
+		return NO_ERROR;
+	}
+};
+
+struct AudioSystem {
+	static status_t getOutputSamplingRate(int* rate, int) {
+		*rate = fake_af_rate;
+		return NO_ERROR;
+	}
+};
+
+};
+
+#endif
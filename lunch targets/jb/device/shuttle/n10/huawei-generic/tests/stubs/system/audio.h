@@ -0,0 +1,21 @@
+/* Host stand-in for the audio definitions the tunnel uses */
+#ifndef _STUB_SYSTEM_AUDIO_H
+#define _STUB_SYSTEM_AUDIO_H
+
+typedef int audio_format_t;
+typedef int audio_stream_type_t;
+typedef int audio_source_t;
+typedef int audio_channel_mask_t;
+typedef int audio_output_flags_t;
+
+enum {
+	AUDIO_FORMAT_PCM_16_BIT = 1,
+	AUDIO_FORMAT_PCM_8_BIT = 2,
+	AUDIO_STREAM_VOICE_CALL = 0,
+	AUDIO_SOURCE_MIC = 1,
+	AUDIO_CHANNEL_OUT_MONO = 1,
+	AUDIO_CHANNEL_IN_MONO = 16,
+	AUDIO_OUTPUT_FLAG_NONE = 0
+};
+
+#endif
@@ -0,0 +1,25 @@
+/* Host stand-in for the Android log. Bionic pulls these headers in through 
+   it, and the tunnel relies on that */
+#ifndef _STUB_UTILS_LOG_H
+#define _STUB_UTILS_LOG_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG "test"
+#endif
+
+/* Debug messages are only shown if LOG_VERBOSE is set */
+#define STUB_LOG(l, ...) \
+	(((l) != 'D' || getenv("LOG_VERBOSE")) ? \
+	 (fprintf(stderr, "%c/%s: ", (l), LOG_TAG), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr)) : 0)
+
+#define ALOGV(...) ((void)0)
+#define ALOGD(...) STUB_LOG('D', __VA_ARGS__)
+#define ALOGI(...) STUB_LOG('I', __VA_ARGS__)
+#define ALOGW(...) STUB_LOG('W', __VA_ARGS__)
+#define ALOGE(...) STUB_LOG('E', __VA_ARGS__)
+
+#endif
@@ -0,0 +1,385 @@
+/*
+**
+** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+**
+** Licensed under the Apache License, Version 2.0 (the "License");
+** you may not use this file except in compliance with the License.
+** You may obtain a copy of the License at
+**
+**     http://www.apache.org/licenses/LICENSE-2.0
+**
+** Unless required by applicable law or agreed to in writing, software
+** distributed under the License is distributed on an "AS IS" BASIS,
+** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+** See the License for the specific language governing permissions and
+** limitations under the License.
+*/
+
+/* Host test of voicerepair_frame. Its output must be bit-exact with the
+   four passes audiochannel.cpp used to do, kept here as the reference.
+   They are made to work for any frame size, and the 7-sample click pass
+   stops 9 samples before the end of the frame, as voicerepair.c does: the
+   original read and wrote past it.
+
+   Checked on random, speech-like and damaged frames of 9 to 320 samples,
+   and on the frames of the captures given, or captures/ *.raw. A capture
+   holds records of a little endian 16 bit frame size in bytes, a 16 bit
+   count of bytes received, and the frame as read, padded with zeros. If
+   there is a .out file along, with the repaired frames, they must match it
+   too.
+
+   Usage: voicerepair_test [-b] [-g] [capture.raw ...]
+   -b times both of them
+   -g writes the synthetic captures and their .out into captures/ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include "voicerepair.h"
+
+#define MAX_FRAME_SAMPLES	320
+#define CAPTURES_DIR		"captures"
+
+static inline int iabs(int x)
+{
+	return (x < 0) ? -x : x;
+}
+
+/* The passes of the old modemRepairFrame, for a frame of any size */
+static void reference_repair(void* frame, int frame_bytes, int res)
+{
+	int n = frame_bytes / 2;
+
+	// 1st Pass: Reinsert the missing bytes
+	if (res < frame_bytes) {
+		signed char* b = (signed char*)frame;
+		int p, tf = frame_bytes - res;
+		for (p = 0; p < frame_bytes - 3 && tf != 0; p += 2) {
+			if (iabs(b[p+2] - b[p]) < iabs(b[p+1] - b[p+3])) {
+				memmove(b + p + 1, b + p, frame_bytes - p - 1);
+				tf--;
+				p += 2;
+			}
+		}
+	}
+
+	// 2nd pass: Endianness inversions
+	{
+		signed short* d = (signed short*)frame;
+		signed short ss, sp = 0, s = d[2];
+		int todo = n;
+		while (todo--) {
+			sp = s;
+			s = *d++;
+			ss = (((unsigned short)s) << 8U) | ((((unsigned short)s) >> 8U) & 0xFFU);
+			if (iabs(sp - ss) < iabs(sp - s)) {
+				s = ss;
+				d[-1] = s;
+			}
+		}
+	}
+
+	// 3rd pass: 1-sample clicks
+	{
+		signed short* d = (signed short*)frame;
+		signed short spp = 0, sp = *d++, s = *d++;
+		signed short p;
+		int todo = n - 2;
+		while (todo--) {
+			spp = sp;
+			sp = s;
+			s = *d++;
+			p = (s + spp) / 2;
+			if (iabs(sp - p) > iabs(p >> 2)) {
+				sp = p;
+				d[-2] = sp;
+			}
+		}
+	}
+
+	// 4th pass: 7-sample clicks
+	{
+		signed short* d = (signed short*)frame;
+		signed short sp = 0, s = *d++;
+		int todo = n - 8;
+		while (todo-- > 0) {
+			sp = s;
+			s = *d++;
+			if (iabs(s) > iabs(sp) * 4 && iabs(s) > iabs(d[6]) * 4) {
+				int step = ((d[6] - sp) << (16 - 3));
+				int x = sp << 16, k;
+				x += step;
+				s = d[-1] = x >> 16;
+				for (k = 0; k < 6; k++) {
+					x += step;
+					d[k] = x >> 16;
+				}
+			}
+		}
+	}
+}
+
+/* kind 0: noise, 1: speech-like, 2: speech-like with the swaps and clicks
+   the modem makes */
+static void make_frame(short* d, int n, int kind, unsigned int* seed)
+{
+	int i;
+	double phase = rand_r(seed) % 100;
+	for (i = 0; i < n; i++) {
+		if (kind == 0)
+			d[i] = (short)rand_r(seed);
+		else
+			d[i] = (short)(8000 * sin(i * 0.07 + phase) + 3000 * sin(i * 0.31) + (rand_r(seed) % 200 - 100));
+	}
+	if (kind < 2)
+		return;
+	for (i = 0; i < n; i++) {
+		int r = rand_r(seed) % 100;
+		if (r < 5) {
+			d[i] = (short)((((unsigned short)d[i]) << 8) | (((unsigned short)d[i]) >> 8));
+		} else if (r < 8) {
+			d[i] = (rand_r(seed) & 1) ? 30000 : -30000;
+		} else if (r < 9 && i + 8 < n) {
+			int j;
+			for (j = 1; j < 8; j++)
+				d[i + j] = 25000;
+		}
+	}
+}
+
+/* Lose bytes at random places, as the modem does. Returns the bytes left */
+static int drop_bytes(void* frame, int frame_bytes, int drop, unsigned int* seed)
+{
+	char* c = (char*)frame;
+	int k;
+	for (k = 0; k < drop; k++) {
+		int pos = rand_r(seed) % (frame_bytes - k);
+		memmove(c + pos, c + pos + 1, frame_bytes - k - pos - 1);
+	}
+	memset(c + frame_bytes - drop, 0, drop);
+	return frame_bytes - drop;
+}
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static void fuzz(int frames)
+{
+	short a[MAX_FRAME_SAMPLES], b[MAX_FRAME_SAMPLES];
+	unsigned int seed = 1;
+	int i, bad = 0;
+	char what[96];
+
+	for (i = 0; i < frames; i++) {
+		int n = (i & 1) ? 320 : 160;
+		int kind = rand_r(&seed) % 3;
+		int frame_bytes, res;
+		if (i % 7 == 0)
+			n = 9 + rand_r(&seed) % 20;
+		frame_bytes = res = n * 2;
+
+		make_frame(a, n, kind, &seed);
+		if (rand_r(&seed) % 2)
+			res = drop_bytes(a, frame_bytes, rand_r(&seed) % (frame_bytes / 3 + 1), &seed);
+		memcpy(b, a, frame_bytes);
+
+		reference_repair(a, frame_bytes, res);
+		voicerepair_frame(b, frame_bytes, res);
+		if (memcmp(a, b, frame_bytes)) {
+			if (bad < 5)
+				printf("  mismatch: %d samples, kind %d, %d of %d bytes received\n", n, kind, res, frame_bytes);
+			bad++;
+		}
+	}
+	snprintf(what, sizeof(what), "%d random frames bit-exact with the reference (%d differ)", frames, bad);
+	check(bad == 0, what);
+}
+
+static int read_u16(FILE* f, int* v)
+{
+	unsigned char b[2];
+	if (fread(b, 1, 2, f) != 2)
+		return -1;
+	*v = b[0] | (b[1] << 8);
+	return 0;
+}
+
+static void write_u16(FILE* f, int v)
+{
+	fputc(v & 0xFF, f);
+	fputc((v >> 8) & 0xFF, f);
+}
+
+static void capture(const char* path)
+{
+	char out_path[512], what[600];
+	short frame[MAX_FRAME_SAMPLES], a[MAX_FRAME_SAMPLES], b[MAX_FRAME_SAMPLES], golden[MAX_FRAME_SAMPLES];
+	int frame_bytes, res, frames = 0, bad = 0, bad_golden = 0, damaged = 0;
+	FILE* f = fopen(path, "rb");
+	FILE* g;
+	size_t len = strlen(path);
+
+	if (!f) {
+		snprintf(what, sizeof(what), "open %s", path);
+		check(0, what);
+		return;
+	}
+	snprintf(out_path, sizeof(out_path), "%.*s.out", (int)(len > 4 ? len - 4 : len), path);
+	g = fopen(out_path, "rb");
+
+	while (!read_u16(f, &frame_bytes) && !read_u16(f, &res)) {
+		if (frame_bytes > (int)sizeof(frame) || (frame_bytes & 1) || res > frame_bytes ||
+			fread(frame, 1, frame_bytes, f) != (size_t)frame_bytes) {
+			bad++;
+			break;
+		}
+		memcpy(a, frame, frame_bytes);
+		memcpy(b, frame, frame_bytes);
+		reference_repair(a, frame_bytes, res);
+		voicerepair_frame(b, frame_bytes, res);
+		if (memcmp(a, b, frame_bytes))
+			bad++;
+		if (memcmp(frame, b, frame_bytes))
+			damaged++;
+		if (g && (fread(golden, 1, frame_bytes, g) != (size_t)frame_bytes ||
+				  memcmp(golden, b, frame_bytes)))
+			bad_golden++;
+		frames++;
+	}
+	fclose(f);
+
+	printf("%s: %d frames, %d repaired\n", path, frames, damaged);
+	snprintf(what, sizeof(what), "%s bit-exact with the reference", path);
+	check(frames > 0 && bad == 0, what);
+	if (g) {
+		fclose(g);
+		snprintf(what, sizeof(what), "%s matches %s", path, out_path);
+		check(bad_golden == 0, what);
+	}
+}
+
+static int captures_in(const char* dir)
+{
+	DIR* d = opendir(dir);
+	struct dirent* e;
+	int count = 0;
+	if (!d)
+		return 0;
+	while ((e = readdir(d)) != NULL) {
+		size_t len = strlen(e->d_name);
+		char path[512];
+		if (len > 4 && !strcmp(e->d_name + len - 4, ".raw")) {
+			snprintf(path, sizeof(path), "%s/%s", dir, e->d_name);
+			capture(path);
+			count++;
+		}
+	}
+	closedir(d);
+	return count;
+}
+
+/* Synthetic captures, as no EM770W one is at hand: speech-like frames with
+   the damage the modem is known to do */
+static void generate(const char* name, int n, int frames, int drop_every, int kind, unsigned int seed)
+{
+	char path[256];
+	short frame[MAX_FRAME_SAMPLES];
+	FILE *f, *g;
+	int i;
+
+	snprintf(path, sizeof(path), "%s/%s.raw", CAPTURES_DIR, name);
+	f = fopen(path, "wb");
+	snprintf(path, sizeof(path), "%s/%s.out", CAPTURES_DIR, name);
+	g = fopen(path, "wb");
+	if (!f || !g) {
+		perror(path);
+		exit(2);
+	}
+	for (i = 0; i < frames; i++) {
+		int res = n * 2;
+		make_frame(frame, n, kind, &seed);
+		if (drop_every && i % drop_every == 0)
+			res = drop_bytes(frame, n * 2, 1 + rand_r(&seed) % 3, &seed);
+		write_u16(f, n * 2);
+		write_u16(f, res);
+		fwrite(frame, 1, n * 2, f);
+		reference_repair(frame, n * 2, res);
+		fwrite(frame, 1, n * 2, g);
+	}
+	fclose(f);
+	fclose(g);
+}
+
+static void bench(int n)
+{
+	static short frames[1024][MAX_FRAME_SAMPLES];
+	short w[MAX_FRAME_SAMPLES];
+	unsigned int seed = 7;
+	int i, r, mode, reps = 200;
+	long sum = 0;
+
+	for (i = 0; i < 1024; i++)
+		make_frame(frames[i], n, 2, &seed);
+
+	for (mode = 0; mode < 2; mode++) {
+		clock_t t0 = clock();
+		for (r = 0; r < reps; r++) {
+			for (i = 0; i < 1024; i++) {
+				int res = (i % 10 == 0) ? n * 2 - 4 : n * 2;
+				memcpy(w, frames[i], n * 2);
+				if (mode)
+					voicerepair_frame(w, n * 2, res);
+				else
+					reference_repair(w, n * 2, res);
+				sum += w[i % n];
+			}
+		}
+		printf("%3d samples: %s %6.1f ns per frame\n", n, mode ? "voicerepair_frame" : "old passes       ",
+			(double)(clock() - t0) / CLOCKS_PER_SEC * 1e9 / (reps * 1024));
+	}
+	if (sum == 42)
+		printf("\n");
+}
+
+int main(int argc, char** argv)
+{
+	int opt, i, do_bench = 0;
+
+	while ((opt = getopt(argc, argv, "bg")) != -1) {
+		switch (opt) {
+			case 'b': do_bench = 1; break;
+			case 'g':
+				generate("drops_8k", 160, 50, 3, 1, 11);
+				generate("clicks_8k", 160, 50, 0, 2, 12);
+				generate("damaged_16k", 320, 25, 4, 2, 13);
+				return 0;
+			default:
+				fprintf(stderr, "usage: %s [-b] [-g] [capture.raw ...]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	fuzz(400000);
+	if (optind < argc) {
+		for (i = optind; i < argc; i++)
+			capture(argv[i]);
+	} else if (!captures_in(CAPTURES_DIR)) {
+		printf("no captures in %s\n", CAPTURES_DIR);
+	}
+
+	if (do_bench) {
+		bench(160);
+		bench(320);
+	}
+	return failed;
+}
@@ -0,0 +1,176 @@
+/*
+ **
+ ** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+/* The EM770W firmware damages the voice frames it sends in several ways: 
+   bytes go missing, samples get their bytes swapped, and single samples or
+   runs of 7 of them are replaced by clicks. Each kind of damage used to be
+   repaired by its own pass over the frame. Here the last three passes are 
+   run as a single one, each trailing the previous one by the samples it 
+   looks ahead, so the result is the same as running them one after the 
+   other, but the frame is only walked once */
+
+#include "voicerepair.h"
+#include <string.h>
+#include <stdint.h>
+
+static inline int iabs(int x)
+{
+	return (x < 0) ? -x : x;
+}
+
+static inline short swap_bytes(short s)
+{
+	return (short)((((unsigned short)s) << 8U) | (((unsigned short)s) >> 8U));
+}
+
+/* Swap the bytes of both samples of a word */
+static inline uint32_t swap_pair(uint32_t w)
+{
+#if defined(__ARM_ARCH_7A__) || defined(__ARM_ARCH_6__)
+	__asm__ ("rev16 %0, %1" : "=r" (w) : "r" (w));
+	return w;
+#else
+	return ((w & 0x00FF00FFU) << 8) | ((w >> 8) & 0x00FF00FFU);
+#endif
+}
+
+/* 1st pass: If received less data than requested, bytes went missing, and 
+   the samples after each missing one are split across two. A missing byte
+   is assumed where the low bytes of two samples are closer than the high
+   ones, and the byte there is repeated to fill it. The points are searched 
+   on the data as received, keeping count of how far it is behind, and then
+   the data is moved into place once, last stretch first */
+static void reinsert_bytes(signed char* b, int frame_bytes, int missing)
+{
+	int at[frame_bytes / 4 + 1];
+	int p, k = 0, end;
+
+	for (p = 0; p < frame_bytes - 3 && k < missing; p += 2) {
+		const signed char* q = b + p - k;
+		if (iabs(q[2] - q[0]) < iabs(q[1] - q[3])) {
+			/* Probably, this is the point ... Insert an space */
+			at[k++] = p;
+			p += 2;
+		}
+	}
+
+	end = frame_bytes;
+	for (; k > 0; k--) {
+		int start = at[k-1] + 1;
+		memmove(b + start, b + start - k, end - start);
+		end = start;
+	}
+}
+
+/* The 2nd pass keeps the samples as received until the first one that 
+   looks closer to the previous one with its bytes swapped. Find it, two 
+   samples at a time, so the combined pass only has to start there */
+static int first_swapped(const short* d, int samples)
+{
+	int prev = d[2]; // Handle first sample by reflection
+	int i;
+
+	for (i = 0; i + 1 < samples; i += 2) {
+		uint32_t w, sw;
+		short s0, s1;
+
+		memcpy(&w, d + i, sizeof(w));
+		sw = swap_pair(w);
+		s0 = (short)w;
+		s1 = (short)(w >> 16);
+
+		if (iabs(prev - (short)sw) < iabs(prev - s0))
+			return i;
+		if (iabs(s0 - (short)(sw >> 16)) < iabs(s0 - s1))
+			return i + 1;
+		prev = s1;
+	}
+	if (i < samples && iabs(prev - swap_bytes(d[i])) < iabs(prev - d[i]))
+		return i;
+	return samples;
+}
+
+/* 4th pass: If a 4 times jump in value is detected, and 7 samples later we 
+   are on track, assume it is a modem generated click and interpolate over
+   it - We prefer to remove in excess here */
+static inline void remove_click(short* d)
+{
+	int sp = d[0], s = d[1], far = d[8];
+
+	if (iabs(s) > iabs(sp)*4 &&
+		iabs(s) > iabs(far)*4) {
+		int step = ((far - sp) << (16 - 3));
+		int x = sp << 16;
+		int j;
+		for (j = 1; j < 8; j++) {
+			x += step;
+			d[j] = x >> 16;
+		}
+	}
+}
+
+/* Try to workaround the damage in place. received is the count of bytes of 
+   the frame that were actually received, the rest being zeroed */
+void voicerepair_frame(void* frame, int frame_bytes, int received)
+{
+	short* d = (short*)frame;
+	int samples = frame_bytes / 2;
+	int from, i;
+	short s2, sp3 = 0, spp3 = 0;
+
+	// Too short to tell the damage from the voice
+	if (samples < 9)
+		return;
+
+	if (received < frame_bytes)
+		reinsert_bytes((signed char*)frame, frame_bytes, frame_bytes - received);
+
+	from = first_swapped(d, samples);
+	s2 = d[from ? from - 1 : 2];
+
+	for (i = 0; i < samples; i++) {
+		short s = d[i];
+
+		/* 2nd pass: Detect endianness inversions and correct them, choosing 
+		   the sample that creates less volume difference */
+		if (i >= from) {
+			short ss = swap_bytes(s);
+			if (iabs(s2 - ss) < iabs(s2 - s)) {
+				s = ss;
+				d[i] = s;
+			}
+			s2 = s;
+		}
+
+		/* 3rd pass: Remove 1-sample clicks, predicting the previous sample 
+		   from its neighbours and replacing it if too different */
+		if (i >= 2) {
+			short p = (s + spp3) / 2;
+			if (iabs(sp3 - p) > iabs(p >> 2)) {
+				sp3 = p;
+				d[i-1] = sp3;
+			}
+		}
+		spp3 = sp3;
+		sp3 = s;
+
+		/* 4th pass: the sample 7 after the click is final now */
+		if (i >= 9)
+			remove_click(d + i - 9);
+	}
+	remove_click(d + samples - 9);
+}
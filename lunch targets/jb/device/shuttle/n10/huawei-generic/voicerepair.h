@@ -0,0 +1,33 @@
+/*
+ **
+ ** Copyright 2012 Eduardo Jos Tagle <ejtagle@tutopia.com>
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at
+ **
+ **     http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ ** See the License for the specific language governing permissions and
+ ** limitations under the License.
+ */
+
+/* Repair of the damage the EM770W firmware does to the voice it sends */
+
+#ifndef _VOICEREPAIR_H
+#define _VOICEREPAIR_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void voicerepair_frame(void* frame, int frame_bytes, int received);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
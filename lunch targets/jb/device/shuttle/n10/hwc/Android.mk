@@ -20,7 +20,7 @@ include $(CLEAR_VARS)
 LOCAL_PRELINK_MODULE := false
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)/hw
 LOCAL_SHARED_LIBRARIES := liblog libcutils libhardware \
-    libhardware_legacy libutils libdl
+    libhardware_legacy libutils libdl libsync
 
 LOCAL_SRC_FILES := hwc_tegra2.cpp
 
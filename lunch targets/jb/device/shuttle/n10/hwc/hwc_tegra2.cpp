@@ -26,6 +26,7 @@
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <dlfcn.h>
 #include <time.h> 
 #if HAVE_ANDROID_OS
@@ -44,6 +45,7 @@
 #include <hardware/hardware.h>
 #include <hardware/hwcomposer.h>
 #include <hardware_legacy/uevent.h>
+#include <sync/sync.h>
 #include <utils/String8.h>
 #include <utils/Vector.h> 
 
@@ -76,6 +78,36 @@ static hwc_module_t* get_hwc(void)
 	return orghwc;
 }
 
+// CPU time spent in a HWC operation, including the original hw composer,
+//  and the layers it had to translate
+struct hwc_op_stats {
+	unsigned int calls;
+	unsigned long long total_ns;
+	unsigned long long max_ns;
+	unsigned long long last_ns;
+	unsigned long long layers;		// Layers received
+	unsigned long long xlated;		// Layers translated to or from the legacy list
+};
+
+/* Software model of the VBLANK instants: A phase locked loop that follows
+   t(n) = base + n * period. The time a VBLANK is observed at includes the 
+   latency of waking up the thread, so it is always late: Samples earlier 
+   than predicted pull the phase much harder than later ones */
+struct vsync_model {
+	long long	base_ns;		// Predicted instant of the last VBLANK
+	long long	period_ns;		// Estimated time between VBLANKs
+	long long	nominal_ns;		// Time between VBLANKs reported by the display
+	bool		locked;
+	unsigned int outliers;		// Consecutive samples too far from the prediction
+	
+	// Statistics of the error between observed and predicted VBLANKs
+	unsigned int relocks;
+	unsigned long long samples;
+	unsigned long long err_sum_ns;
+	long long	err_max_ns;
+	unsigned long long vsyncs;	// VSYNC events delivered
+};
+
 struct tegra2_hwc_composer_device_1_t {
     hwc_composer_device_1_t base;
 	hwc_composer_device_t* org;
@@ -89,16 +121,29 @@ struct tegra2_hwc_composer_device_1_t {
 	pthread_mutex_t vsync_mutex;
     pthread_cond_t vsync_cond; 
 	volatile bool enabled_vsync;
+	struct vsync_model vsync_model;
 	
 	// NVidia implementation
 	int 		nvhost_fd;		
 	unsigned int vblank_syncpt_id;
 	
-	// Buffer to do translations to speed them up
-	void* 		prepare_xlatebuf;
-	int 		prepare_xlatebufsz;
-	void* 		set_xlatebuf;
-	int 		set_xlatebufsz;
+	// Legacy layer list the HWC 1.x one is translated into. It is kept
+	//  between frames, so only the layers that changed are rewritten
+	hwc_layer_list_t* xlatelst;
+	int 		xlatelstsz;
+	
+	// Software sync timeline the release fences are created on. The fences
+	//  of frame n are at value n, and are signalled at the first VBLANK 
+	//  after frame n+1 was set, as its buffers are no longer scanned out
+	int			sync_timeline;		// -1 if the kernel has no sw_sync
+	unsigned int sync_next;			// Value of the fences of the next frame
+	unsigned int sync_pending;		// Value to signal at the next VBLANK
+	unsigned int sync_signaled;		// Value the timeline is at
+	pthread_mutex_t sync_mutex;
+	
+	// Compose statistics, shown by dump
+	struct hwc_op_stats prepare_stats;
+	struct hwc_op_stats set_stats;
 	
 	// Misc info
 	int         fb_fd;
@@ -136,22 +181,254 @@ static void copy_layer_to_layer1(hwc_layer_1_t* dst,hwc_layer_t* src)
 	memcpy(&dst->visibleRegionScreen,&src->visibleRegionScreen,sizeof( hwc_region_t ));
 }
 
-static void copy_display_contents_1_to_layer_list(hwc_layer_list_t* dst,hwc_display_contents_1_t* src)
+/* Tell if a legacy layer still holds what was copied back to a HWC 1.x
+   one. The region is compared by reference, as it is copied that way */
+static bool layer_matches_layer1(const hwc_layer_t* l,const hwc_layer_1_t* l1)
+{
+	return l->handle == l1->handle &&
+		l->hints == l1->hints &&
+		l->flags == l1->flags &&
+		l->transform == l1->transform &&
+		l->blending == l1->blending &&
+		!memcmp(&l->sourceCrop,&l1->sourceCrop,sizeof( hwc_rect_t )) &&
+		!memcmp(&l->displayFrame,&l1->displayFrame,sizeof( hwc_rect_t )) &&
+		l->visibleRegionScreen.numRects == l1->visibleRegionScreen.numRects &&
+		l->visibleRegionScreen.rects == l1->visibleRegionScreen.rects;
+}
+
+/* Bring the cached legacy list up to date with the HWC 1.x one, rewriting
+   only the layers that changed since the last time. The composition type
+   is not compared: prepare of the original hw composer changes it, and it
+   is not copied back, so it is just set to the one surfaceFlinger passed.
+   Returns the number of layers rewritten, or -1 if out of memory */
+static int sync_layer_list(struct tegra2_hwc_composer_device_1_t *pdev,hwc_display_contents_1_t* src)
 {
+	int reqsz = sizeof (hwc_layer_list_t) + sizeof(hwc_layer_t) * src->numHwLayers;
+	
+	// Make sure we have enough space on the translation buffer
+	if (pdev->xlatelstsz < reqsz) {
+		hwc_layer_list_t* lst = (hwc_layer_list_t*) realloc(pdev->xlatelst,reqsz);
+		if (!lst)
+			return -1;
+		if (!pdev->xlatelst)
+			lst->numHwLayers = 0;
+		pdev->xlatelst = lst;
+		pdev->xlatelstsz = reqsz;
+	}	
+	hwc_layer_list_t* dst = pdev->xlatelst;
+	
+	// A different number of layers means a different list: Rewrite it all
+	bool all = dst->numHwLayers != src->numHwLayers;
+	
 	dst->flags = src->flags;	
-	unsigned int s,d;
-	for (s = 0, d = 0; s < src->numHwLayers; s++) {
-		copy_layer1_to_layer(&dst->hwLayers[d++],&src->hwLayers[s]);
+	int count = 0;
+	unsigned int i;
+	for (i = 0; i < src->numHwLayers; i++) {
+		if (all || !layer_matches_layer1(&dst->hwLayers[i],&src->hwLayers[i])) {
+			copy_layer1_to_layer(&dst->hwLayers[i],&src->hwLayers[i]);
+			count++;
+		} else {
+			dst->hwLayers[i].compositionType = src->hwLayers[i].compositionType;
+		}
 	}
-	dst->numHwLayers = d;
+	dst->numHwLayers = src->numHwLayers;
+	return count;
 }
 
-static void copy_layer_list_to_display_contents_1(hwc_display_contents_1_t* dst,hwc_layer_list_t* src)
+/* Copy back to the HWC 1.x list the layers the original hw composer 
+   modified. Returns the number of layers copied */
+static int copy_back_layer_list(hwc_display_contents_1_t* dst,hwc_layer_list_t* src)
 {
 	dst->flags = src->flags;	
-	unsigned int s,d;
-	for (s = 0, d = 0; d < dst->numHwLayers; d++) {
-		copy_layer_to_layer1(&dst->hwLayers[d],&src->hwLayers[s++]);
+	int count = 0;
+	unsigned int i;
+	for (i = 0; i < dst->numHwLayers; i++) {
+		if (!layer_matches_layer1(&src->hwLayers[i],&dst->hwLayers[i])) {
+			copy_layer_to_layer1(&dst->hwLayers[i],&src->hwLayers[i]);
+			count++;
+		}
+	}
+	return count;
+}
+
+static unsigned long long thread_time_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID,&ts);
+	return (ts.tv_sec) * 1000000000ULL + (ts.tv_nsec);
+}
+
+static void update_op_stats(struct hwc_op_stats* st,unsigned long long start,int layers,int xlated)
+{
+	unsigned long long spent = thread_time_ns() - start;
+	st->calls++;
+	st->total_ns += spent;
+	st->last_ns = spent;
+	if (spent > st->max_ns)
+		st->max_ns = spent;
+	st->layers += layers;
+	st->xlated += xlated;
+}
+
+// Max time to wait for the buffers to be available, in ms
+#define ACQUIRE_FENCE_TIMEOUT 1000
+
+/* Signal the release fences of the frames no longer scanned out, or of all
+   of them if the display is going away */
+static void tegra2_signal_fences(struct tegra2_hwc_composer_device_1_t *pdev,bool all)
+{
+	if (pdev->sync_timeline < 0)
+		return;
+		
+	pthread_mutex_lock(&pdev->sync_mutex);
+	unsigned int target = all ? pdev->sync_next - 1 : pdev->sync_pending;
+	if ((int)(target - pdev->sync_signaled) > 0) {
+		sw_sync_timeline_inc(pdev->sync_timeline, target - pdev->sync_signaled);
+		pdev->sync_signaled = target;
+	}
+	pthread_mutex_unlock(&pdev->sync_mutex);
+}
+
+static void vsync_model_init(struct vsync_model* m,long long period)
+{
+	memset(m,0,sizeof(*m));
+	m->period_ns = period;
+	m->nominal_ns = period;
+}
+
+static void vsync_model_account(struct vsync_model* m,long long err)
+{
+	if (err < 0)
+		err = -err;
+	m->samples++;
+	m->err_sum_ns += err;
+	if (err > m->err_max_ns)
+		m->err_max_ns = err;
+}
+
+/* Feed the time a VBLANK was observed at, and get the predicted instant of
+   that VBLANK */
+static long long vsync_model_update(struct vsync_model* m,long long t)
+{
+	if (m->locked) {
+		long long n = (t - m->base_ns + (m->period_ns >> 1)) / m->period_ns;
+		if (n < 1)
+			n = 1;
+		long long pred = m->base_ns + n * m->period_ns;
+		long long err = t - pred;
+		
+		// Correct the phase, and feed the applied correction to the period,
+		//  so it settles once the phase stops moving. Keep the period close 
+		//  to the one of the display
+		if (err < (m->period_ns >> 2) && err > -(m->period_ns >> 2)) {
+			long long corr = (err < 0) ? (err >> 1) : (err >> 4);
+			vsync_model_account(m,err);
+			m->outliers = 0;
+			
+			m->base_ns = pred + corr;
+			m->period_ns += corr / (16 * n);
+			if (m->period_ns > m->nominal_ns + (m->nominal_ns >> 5))
+				m->period_ns = m->nominal_ns + (m->nominal_ns >> 5);
+			if (m->period_ns < m->nominal_ns - (m->nominal_ns >> 5))
+				m->period_ns = m->nominal_ns - (m->nominal_ns >> 5);
+			return m->base_ns;
+		}
+		
+		// A thread woken up very late says nothing about the VBLANK. Just
+		//  follow the prediction, unless it keeps happening. The model is
+		//  left alone, as it could even be the wrong VBLANK
+		if (err > 0 && ++m->outliers < 3)
+			return pred;
+	}
+	
+	// Start over from this VBLANK
+	m->base_ns = t;
+	m->locked = true;
+	m->outliers = 0;
+	m->relocks++;
+	return t;
+}
+
+/* Tell if the VBLANKs must be waited for: Either VSYNC events were asked 
+   for, or there are release fences to signal */
+static bool tegra2_vsync_needed(struct tegra2_hwc_composer_device_1_t *pdev)
+{
+	return !pdev->fbblanked && 
+		(pdev->enabled_vsync || (int)(pdev->sync_pending - pdev->sync_signaled) > 0);
+}
+
+/* Wake up the VSYNC thread if it was waiting to be needed */
+static void tegra2_vsync_wakeup(struct tegra2_hwc_composer_device_1_t *pdev)
+{
+	pthread_mutex_lock(&pdev->vsync_mutex);
+	pthread_cond_signal(&pdev->vsync_cond);
+	pthread_mutex_unlock(&pdev->vsync_mutex);
+}
+
+/* Wait until the VSYNC thread is needed. Returns false if it must end */
+static bool tegra2_vsync_wait_needed(struct tegra2_hwc_composer_device_1_t *pdev)
+{
+	pthread_mutex_lock(&pdev->vsync_mutex);
+	while (!tegra2_vsync_needed(pdev) && pdev->vsync_running) {
+
+		// When framebuffer is blanked, there must be no interrupts, so we 
+		//  can't wait on it. And if nobody needs them, don't wake up on 
+		//  every frame
+		pdev->vsync_model.locked = false;
+		pthread_cond_wait(&pdev->vsync_cond, &pdev->vsync_mutex);
+	};
+	bool running = pdev->vsync_running;
+	pthread_mutex_unlock(&pdev->vsync_mutex);
+	return running;
+}
+
+static void tegra2_report_vsync(struct tegra2_hwc_composer_device_1_t *pdev,long long timestamp)
+{
+	// The previous frame is no longer scanned out
+	tegra2_signal_fences(pdev, false);
+	
+	// Do the VSYNC call
+	if (pdev->enabled_vsync && pdev->procs && !pdev->fbblanked) {
+		pdev->vsync_model.vsyncs++;
+		pdev->procs->vsync(pdev->procs, 0, timestamp);
+	}
+}
+
+/* Wait until the buffers of all the layers are available. The acquire fences
+   are merged, so there is a single wait no matter how many layers have one.
+   The fences are closed, as we own them */
+static void tegra2_wait_acquire_fences(hwc_display_contents_1_t* contents)
+{
+	int acquire = -1;
+	unsigned int d;
+	for (d = 0; d < contents->numHwLayers; d++) {
+		int fd = contents->hwLayers[d].acquireFenceFd;
+		contents->hwLayers[d].acquireFenceFd = -1;
+		if (fd < 0)
+			continue;
+			
+		if (acquire < 0) {
+			acquire = fd;
+			continue;
+		}
+		
+		int merged = sync_merge("hwc_acquire", acquire, fd);
+		if (merged < 0) {
+			// Unable to merge them: Wait for the ones we have
+			sync_wait(acquire, ACQUIRE_FENCE_TIMEOUT);
+			close(acquire);
+			acquire = fd;
+		} else {
+			close(acquire);
+			close(fd);
+			acquire = merged;
+		}
+	}
+	
+	if (acquire >= 0) {
+		if (sync_wait(acquire, ACQUIRE_FENCE_TIMEOUT) < 0)
+			ALOGW("Timed out waiting for the layer buffers");
+		close(acquire);
 	}
 }
 
@@ -174,37 +451,51 @@ static int tegra2_set(struct hwc_composer_device_1 *dev,
 	if (pdev->fbblanked)
 		return -ENODEV;
 		
-	int reqsz = sizeof (hwc_layer_list_t) + sizeof(hwc_layer_t) * contents->numHwLayers;
+	unsigned long long start = thread_time_ns();
 	
-	// Make sure we have enough space on the translation buffer
-	if (pdev->set_xlatebufsz < reqsz) {
-		if (!pdev->set_xlatebuf) {
-			pdev->set_xlatebuf = malloc(reqsz);
-		} else {
-			pdev->set_xlatebuf = realloc(pdev->set_xlatebuf,reqsz);
-		}
-		pdev->set_xlatebufsz = reqsz;
-	}	
-    hwc_layer_list_t* lst = (hwc_layer_list_t*) pdev->set_xlatebuf;
-
-	copy_display_contents_1_to_layer_list(lst,contents);
+	// The list was translated by prepare: Only the layers surfaceFlinger
+	//  changed since then are rewritten, usually none
+	int xlated = sync_layer_list(pdev,contents);
+	if (xlated < 0)
+		return -ENOMEM;
+    hwc_layer_list_t* lst = pdev->xlatelst;
 	
-	//Wait until all buffers are available
+	// The original hw composer knows nothing about fences, so wait until 
+	//  all buffers are available. This can't be done by another thread, as 
+	//  set swaps the EGL surface of the caller
+	tegra2_wait_acquire_fences(contents);
+	
+	// Give each layer a release fence, so surfaceFlinger can queue the next
+	//  frame while this one is scanned out. Without sw_sync, let it reuse 
+	//  the buffers inmediately
+	unsigned int value = 0;
+	int release = -1;
+	if (pdev->sync_timeline >= 0) {
+		pthread_mutex_lock(&pdev->sync_mutex);
+		value = pdev->sync_next++;
+		pthread_mutex_unlock(&pdev->sync_mutex);
+		release = sw_sync_fence_create(pdev->sync_timeline, "hwc_release", value);
+	}
 	unsigned int d;
 	for (d = 0; d < contents->numHwLayers; d++) {
-	
-		// Release handles we own...
-		if (contents->hwLayers[d].acquireFenceFd >= 0)
-			close(contents->hwLayers[d].acquireFenceFd);
-		contents->hwLayers[d].acquireFenceFd = -1;
-		
-		// And let surfaceFlinger read inmediately...
-		contents->hwLayers[d].releaseFenceFd = -1;
+		contents->hwLayers[d].releaseFenceFd = (release >= 0) ? dup(release) : -1;
 	}
+	if (release >= 0)
+		close(release);
 
 	int ret = pdev->org->set(pdev->org, contents->dpy, contents->sur, lst);
 	
-	copy_layer_list_to_display_contents_1(contents,lst);
+	// The previous frame is no longer scanned out after the next VBLANK
+	if (pdev->sync_timeline >= 0) {
+		pthread_mutex_lock(&pdev->sync_mutex);
+		pdev->sync_pending = value - 1;
+		pthread_mutex_unlock(&pdev->sync_mutex);
+		tegra2_vsync_wakeup(pdev);
+	}
+	
+	xlated += copy_back_layer_list(contents,lst);
+	
+	update_op_stats(&pdev->set_stats,start,contents->numHwLayers,xlated);
 
     return ret;
 }
@@ -228,23 +519,18 @@ static int tegra2_prepare(hwc_composer_device_1_t *dev,
 		
 	ALOGV("preparing %u layers", contents->numHwLayers);
 
-	int reqsz = sizeof (hwc_layer_list_t) + sizeof(hwc_layer_t) * contents->numHwLayers;
-	// Make sure we have enough space on the translation buffer
-	if (pdev->prepare_xlatebufsz < reqsz) {
-		if (!pdev->prepare_xlatebuf) {
-			pdev->prepare_xlatebuf = malloc(reqsz);
-		} else {
-			pdev->prepare_xlatebuf = realloc(pdev->prepare_xlatebuf,reqsz);
-		}
-		pdev->prepare_xlatebufsz = reqsz;
-	}	
-    hwc_layer_list_t* lst = (hwc_layer_list_t*) pdev->prepare_xlatebuf;
+	unsigned long long start = thread_time_ns();
+	
+	int xlated = sync_layer_list(pdev,contents);
+	if (xlated < 0)
+		return -ENOMEM;
+    hwc_layer_list_t* lst = pdev->xlatelst;
 	
-	copy_display_contents_1_to_layer_list(lst,contents);
-
 	int ret = pdev->org->prepare(pdev->org, lst);
 
-	copy_layer_list_to_display_contents_1(contents,lst);
+	xlated += copy_back_layer_list(contents,lst);
+	
+	update_op_stats(&pdev->prepare_stats,start,contents->numHwLayers,xlated);
 	
 	return ret;
 }
@@ -264,21 +550,9 @@ static void *tegra2_hwc_emulated_vsync_thread(void *data)
 	clock_gettime(CLOCK_MONOTONIC,&nexttm);
 	signed long long nexttm_ns = (nexttm.tv_sec) * 1000000000LL + (nexttm.tv_nsec);
 
-    while (1) {	
+    while (tegra2_vsync_wait_needed(pdev)) {	
 		int err;
 
-		// Wait while display is blanked
-		pthread_mutex_lock(&pdev->vsync_mutex);
-		while (pdev->fbblanked && pdev->vsync_running) {
-
-			// When framebuffer is blanked, there must be no interrupts, so we can't wait on it
-			pthread_cond_wait(&pdev->vsync_cond, &pdev->vsync_mutex);
-			
-		};
-		if (!pdev->vsync_running)
-			break;
-		pthread_mutex_unlock(&pdev->vsync_mutex);
-		
 		// Estimate time of next emulated VSYNC
 		nexttm_ns += pdev->time_between_frames_ns;
 		
@@ -299,6 +573,7 @@ static void *tegra2_hwc_emulated_vsync_thread(void *data)
 			nexttm_ns = (nexttm.tv_sec) * 1000000000LL + (nexttm.tv_nsec);
 	
 			deltatm_ns = 0;
+			pdev->vsync_model.relocks++;
 		}
 		
 		// If something to wait ... wait!
@@ -312,23 +587,17 @@ static void *tegra2_hwc_emulated_vsync_thread(void *data)
 				err = nanosleep (&ts, &ts);
 			} while (err < 0 && errno == EINTR); 
 		}
+		
+		// The emulated VSYNC happens exactly when it was scheduled, no matter
+		//  how late we woke up. Keep track of how late that was
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		vsync_model_account(&pdev->vsync_model,
+			(now.tv_sec) * 1000000000LL + (now.tv_nsec) - nexttm_ns);
 	
-		// Do the VSYNC call
-		if (pdev->enabled_vsync && pdev->procs && !pdev->fbblanked) {
-
-			// Get current time in exactly the same timebase as Choreographer
-			struct timespec now;
-			clock_gettime(CLOCK_MONOTONIC,&now);
-			
-			unsigned long long now_ns = (now.tv_sec) * 1000000000ULL + (now.tv_nsec);
-			
-			pdev->procs->vsync(pdev->procs, 0, now_ns);
-		}
-
+		tegra2_report_vsync(pdev, nexttm_ns);
     };
 	
-	pthread_mutex_unlock(&pdev->vsync_mutex);
-
 	ALOGD("VSYNC thread emulator ended");
 	
     return NULL;
@@ -441,39 +710,30 @@ static void *tegra2_hwc_nv_vsync_thread(void *data)
 	
     setpriority(PRIO_PROCESS, 0, HAL_PRIORITY_URGENT_DISPLAY);
 	
-    while (1) {	
-		int err;
-
-		// Wait while display is blanked
-		pthread_mutex_lock(&pdev->vsync_mutex);
-		while (pdev->fbblanked && pdev->vsync_running) {
-
-			// When framebuffer is blanked, there must be no interrupts, so we can't wait on it
-			pthread_cond_wait(&pdev->vsync_cond, &pdev->vsync_mutex);
-			
-		};
-		if (!pdev->vsync_running)
-			break;
-		pthread_mutex_unlock(&pdev->vsync_mutex);
+    while (tegra2_vsync_wait_needed(pdev)) {	
 		
-		// Wait for the next vsync
-		tegra2_wait_vsync(pdev);
-		
-		// Do the VSYNC call
-		if (pdev->enabled_vsync && pdev->procs && !pdev->fbblanked) {
-
-			// Get current time in exactly the same timebase as Choreographer
-			struct timespec now;
-			clock_gettime(CLOCK_MONOTONIC,&now);
-			
-			unsigned long long now_ns = (now.tv_sec) * 1000000000ULL + (now.tv_nsec);
-			
-			pdev->procs->vsync(pdev->procs, 0, now_ns);
+		// Wait for the next vsync. If it was missed, the model must lock
+		//  again
+		if (tegra2_wait_vsync(pdev) < 0) {
+			pdev->vsync_model.locked = false;
+			continue;
 		}
+		
+		// Get current time in exactly the same timebase as Choreographer
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC,&now);
+		long long now_ns = (now.tv_sec) * 1000000000LL + (now.tv_nsec);
+		
+		// Report the predicted instant of the VBLANK instead of the time we
+		//  woke up at, as that has the jitter of the scheduler. Choreographer
+		//  rejects timestamps in the future
+		long long timestamp = vsync_model_update(&pdev->vsync_model, now_ns);
+		if (timestamp > now_ns)
+			timestamp = now_ns;
+		
+		tegra2_report_vsync(pdev, timestamp);
     };
 
-	pthread_mutex_unlock(&pdev->vsync_mutex);
-	
 	ALOGD("NVidia VSYNC thread ended");
 	
     return NULL;
@@ -493,6 +753,7 @@ static int tegra2_eventControl(struct hwc_composer_device_1 *dev, int dpy,
 		// ALOGD("Emulated VSYNC ints are %s", enabled ? "On" : "Off" );
 		
 		pdev->enabled_vsync = (enabled) ? true : false;
+		tegra2_vsync_wakeup(pdev);
 		ret = 0;
 	}
 	return ret;
@@ -510,6 +771,10 @@ static int tegra2_blank(struct hwc_composer_device_1 *dev, int disp, int blank)
 	pdev->fbblanked = blank;
 	pthread_cond_signal(&pdev->vsync_cond);
 	pthread_mutex_unlock(&pdev->vsync_mutex);
+	
+	// There will be no VBLANKs to release the buffers being scanned out
+	if (blank)
+		tegra2_signal_fences(pdev, true);
 
 	/* Blanking is handled by other means, no need to blank screen here */
     return 0;
@@ -568,6 +833,34 @@ static void tegra2_dump(hwc_composer_device_1* dev, char *buff, int buff_len)
 		pdev->org->dump(pdev->org,buff,buff_len);
 	else
 		*buff = 0;
+		
+	// Append the time spent composing, per frame
+	const struct hwc_op_stats* st[2] = { &pdev->prepare_stats, &pdev->set_stats };
+	const char* name[2] = { "prepare", "set" };
+	int i;
+	for (i = 0; i < 2; i++) {
+		int len = strlen(buff);
+		if (len >= buff_len - 1)
+			break;
+		unsigned int calls = st[i]->calls ? st[i]->calls : 1;
+		snprintf(buff + len, buff_len - len,
+			"  %-7s: %u calls, cpu time last %llu us, avg %llu us, max %llu us, "
+			"%llu of %llu layers translated\n",
+			name[i], st[i]->calls, st[i]->last_ns / 1000, st[i]->total_ns / calls / 1000,
+			st[i]->max_ns / 1000, st[i]->xlated, st[i]->layers);
+	}
+	
+	// And how accurate the VSYNC timestamps are
+	const struct vsync_model* m = &pdev->vsync_model;
+	int len = strlen(buff);
+	if (len < buff_len - 1) {
+		unsigned long long samples = m->samples ? m->samples : 1;
+		snprintf(buff + len, buff_len - len,
+			"  vsync  : %s, period %lld ns (%.2f Hz), %llu events, jitter avg %llu us, max %lld us, %u relocks\n",
+			pdev->nvhost_fd >= 0 ? "VBLANK syncpoint" : "emulated",
+			m->period_ns, m->period_ns ? 1000000000.0 / m->period_ns : 0.0, m->vsyncs,
+			m->err_sum_ns / samples / 1000, m->err_max_ns / 1000, m->relocks);
+	}
 }
 
 static int tegra2_close(hw_device_t *device)
@@ -590,6 +883,14 @@ static int tegra2_close(hw_device_t *device)
     pthread_mutex_destroy(&pdev->vsync_mutex);
 	pthread_cond_destroy(&pdev->vsync_cond);
 	
+	// Release all the buffers still waiting for a VBLANK
+	if (pdev->sync_timeline >= 0) {
+		tegra2_signal_fences(pdev, true);
+		close(pdev->sync_timeline);
+		pdev->sync_timeline = -1;
+	}
+	pthread_mutex_destroy(&pdev->sync_mutex);
+	
 	// Close NVidia host handle, if being used...
 	if (pdev->nvhost_fd >= 0) {
 		nvhost_close(pdev->nvhost_fd);
@@ -604,10 +905,8 @@ static int tegra2_close(hw_device_t *device)
 	
 	int ret = pdev->org->common.close( (hw_device_t *) pdev->org );
 	
-	if (pdev->prepare_xlatebuf)
-		free(pdev->prepare_xlatebuf);
-	if (pdev->set_xlatebuf)
-		free(pdev->set_xlatebuf);
+	if (pdev->xlatelst)
+		free(pdev->xlatelst);
 
 	free(pdev);
 	return ret;
@@ -711,9 +1010,18 @@ static int tegra2_open(const struct hw_module_t *module, const char *name,
 	}	
 	dev->time_between_frames_ns = value;
 	dev->time_between_frames_us = (unsigned long)(value / 1000ULL);
+	vsync_model_init(&dev->vsync_model, value);
    
     pthread_mutex_init(&dev->vsync_mutex, NULL);
 	pthread_cond_init(&dev->vsync_cond, NULL);
+	
+	// Create the timeline of the release fences, if the kernel supports it
+	pthread_mutex_init(&dev->sync_mutex, NULL);
+	dev->sync_next = 1;
+	dev->sync_timeline = sw_sync_timeline_create();
+	if (dev->sync_timeline < 0) {
+		ALOGW("No sw_sync support - Buffers will be released without fences");
+	}
        
 	// Find out if we can use the NVidia VBLANK0 syncpoint to get VSYNC 
 	//  interrupts, or we must completely emulate them...
@@ -23,16 +23,30 @@ LOCAL_SHARED_LIBRARIES := liblog libcutils libutils libdl libcamera_client
 LOCAL_PRELINK_MODULE := false
 include $(BUILD_SHARED_LIBRARY)
 
+# NEON converters must be built with -mfpu=neon, but the rest of the library
+# must not, as Tegra2 has no NEON unit. They are only used if the cpu has one
+ifeq ($(TARGET_ARCH),arm)
+include $(CLEAR_VARS)
+LOCAL_MODULE_TAGS:= optional
+LOCAL_MODULE:= libusb_camera_neon
+LOCAL_CFLAGS:=-fno-short-enums -mfpu=neon -DCONVERTER_HAVE_NEON
+LOCAL_SRC_FILES:= ConverterNeon.cpp
+include $(BUILD_STATIC_LIBRARY)
+endif
+
 include $(CLEAR_VARS)
 LOCAL_MODULE_TAGS:= optional
 LOCAL_MODULE:= libusb_camera
 LOCAL_MODULE_PATH := $(TARGET_OUT_SHARED_LIBRARIES)
 LOCAL_CFLAGS:=-fno-short-enums -DHAVE_CONFIG_H 
+# Uncomment to log every preview frame. Too slow for normal use
+#LOCAL_CFLAGS += -DCAMERA_LOG_FRAMES
 LOCAL_C_INCLUDES += external/jpeg
 LOCAL_SRC_FILES:= \
 	CameraFactory.cpp \
 	CameraHal.cpp \
 	CameraHardware.cpp \
+	CameraStats.cpp \
 	Converter.cpp \
 	Utils.cpp \
 	V4L2Camera.cpp \
@@ -40,6 +54,16 @@ LOCAL_SRC_FILES:= \
 	SurfaceDesc.cpp \
 	SurfaceSize.cpp 
 
+ifeq ($(TARGET_ARCH),arm)
+LOCAL_CFLAGS += -DCONVERTER_HAVE_NEON
+LOCAL_STATIC_LIBRARIES += libusb_camera_neon
+endif
+
+ifeq ($(TARGET_ARCH),x86)
+LOCAL_CFLAGS += -DCONVERTER_HAVE_SSE2
+LOCAL_SRC_FILES += ConverterSse2.cpp
+endif
+
 LOCAL_SHARED_LIBRARIES:= libutils libbinder libui liblog libcamera_client libcutils libmedia libandroid_runtime libhardware_legacy libc libstdc++ libm libjpeg libandroid
 LOCAL_PRELINK_MODULE := false
 include $(BUILD_SHARED_LIBRARY) 
\ No newline at end of file
@@ -23,7 +23,25 @@
 #define LOG_TAG "Camera_Factory"
 #include <cutils/log.h>
 #include <cutils/properties.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
 #include "CameraFactory.h"
+#include "V4L2Camera.h"
+
+/* Device nodes probed for cameras. ueventd.n10.rc gives access to these */
+#define VIDEO_DEVICE_FMT	"/dev/video%d"
+#define VIDEO_DEVICE_MAX	3
+
+/* Time allowed for the device nodes to show up once powered, in 10ms units */
+#define VIDEO_DEVICE_WAIT	100
+
+/* If no camera was found, minimum time before probing again, in ns. Each
+   probe powers the camera up and down. Opening the camera probes again 
+   sooner, as a camera could have been plugged meanwhile */
+#define VIDEO_PROBE_INTERVAL	(30 * 1000000000LL)
+#define VIDEO_RESCAN_INTERVAL	(2 * 1000000000LL)
 
 extern camera_module_t HAL_MODULE_INFO_SYM;
 
@@ -35,18 +53,136 @@ android::CameraFactory  gCameraFactory;
 namespace android {
 
 CameraFactory::CameraFactory()
-        : mCamera(NULL)
+        : mCameraNum(-1),
+          mCamerasFound(false),
+          mProbing(false),
+          mLastProbe(0)
 {
 	ALOGD("CameraFactory::CameraFactory");
+	memset(mCameras, 0, sizeof(mCameras));
 }
 
 CameraFactory::~CameraFactory()
 {
 	ALOGD("CameraFactory::~CameraFactory");
-    if (mCamera != NULL) {
-        delete mCamera;
-		mCamera = NULL;
-    }
+	for (int i = 0; i < kMaxCameras; i++) {
+		if (mCameras[i].hw != NULL) {
+			delete mCameras[i].hw;
+			mCameras[i].hw = NULL;
+		}
+	}
+}
+
+/* Find the device nodes of the cameras. Called with the lock held */
+void CameraFactory::enumerateCameras(bool rescan)
+{
+	// Another thread is probing: Keep what was found last meanwhile. Wait
+	//  for it if there is nothing yet, or before opening the camera
+	while (mProbing && (mCameraNum < 0 || rescan))
+		mProbed.wait(mLock);
+	if (mProbing)
+		return;
+	
+	// If none was found, try again, unless the fallback one is already in
+	//  use: Its device node can't change anymore. Don't probe on every query
+	//  meanwhile, unless asked to
+	if (mCameraNum >= 0 && (mCamerasFound || mCameras[0].hw != NULL))
+		return;
+	nsecs_t interval = rescan ? VIDEO_RESCAN_INTERVAL : VIDEO_PROBE_INTERVAL;
+	if (mCameraNum >= 0 && systemTime(SYSTEM_TIME_MONOTONIC) - mLastProbe < interval)
+		return;
+	
+	// Probing takes seconds: Don't block the other calls meanwhile
+	CameraDesc found[kMaxCameras];
+	mProbing = true;
+	mLock.unlock();
+	int num = probeCameras(found);
+	mLock.lock();
+	mProbing = false;
+	mLastProbe = systemTime(SYSTEM_TIME_MONOTONIC);
+	mProbed.broadcast();
+	
+	// The fallback camera could have been opened meanwhile
+	if (mCameraNum >= 0 && mCameras[0].hw != NULL)
+		return;
+	
+	for (int i = 0; i < num; i++) {
+		CameraDesc& d = mCameras[i];
+		strcpy(d.device, found[i].device);
+		d.facing = found[i].facing;
+		d.orientation = found[i].orientation;
+	}
+	mCameraNum = num;
+	
+	// A USB camera could be plugged later, so always report one
+	mCamerasFound = (mCameraNum > 0);
+	if (mCameraNum == 0) {
+		ALOGD("CameraFactory: No camera found");
+		CameraDesc& d = mCameras[0];
+		snprintf(d.device, sizeof(d.device), VIDEO_DEVICE_FMT, 0);
+		d.facing = CAMERA_FACING_FRONT;
+		d.orientation = 0;
+		mCameraNum = 1;
+	}
+}
+
+/* Probe the device nodes for cameras. Returns how many were found */
+int CameraFactory::probeCameras(CameraDesc* cameras)
+{
+	// The internal camera only shows up once powered. Other cameras could be
+	//  using the rail already, so it is shared with them. If it was up 
+	//  already, the nodes are there already
+	bool wasOn = false;
+	bool powered = V4L2Camera::AcquirePower(&wasOn);
+	if (powered && !wasOn) {
+		int timeOut = VIDEO_DEVICE_WAIT;
+		while (!anyVideoDevice() && --timeOut > 0)
+			usleep(10000);
+	}
+	
+	int num = 0;
+	for (int i = 0; i < VIDEO_DEVICE_MAX && num < kMaxCameras; i++) {
+		char device[32];
+		snprintf(device, sizeof(device), VIDEO_DEVICE_FMT, i);
+		
+		int fd = open(device, O_RDWR | O_NONBLOCK);
+		if (fd < 0)
+			continue;
+			
+		// Only streaming capture devices are cameras
+		struct v4l2_capability cap;
+		memset(&cap, 0, sizeof(cap));
+		bool isCamera = ioctl(fd, VIDIOC_QUERYCAP, &cap) >= 0 &&
+			(cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) &&
+			(cap.capabilities & V4L2_CAP_STREAMING);
+		close(fd);
+		if (!isCamera)
+			continue;
+		
+		CameraDesc& d = cameras[num];
+		strcpy(d.device, device);
+		d.facing = (num == 0) ? CAMERA_FACING_FRONT : CAMERA_FACING_BACK;
+		d.orientation = 0;
+		d.hw = NULL;
+		ALOGD("CameraFactory: camera %d is %s (%s)", num, device, cap.card);
+		num++;
+	}
+	
+	if (powered)
+		V4L2Camera::ReleasePower();
+	return num;
+}
+
+/* If any of the probed device nodes exists */
+bool CameraFactory::anyVideoDevice()
+{
+	for (int i = 0; i < VIDEO_DEVICE_MAX; i++) {
+		char device[32];
+		snprintf(device, sizeof(device), VIDEO_DEVICE_FMT, i);
+		if (access(device, F_OK) == 0)
+			return true;
+	}
+	return false;
 }
 
 /****************************************************************************
@@ -69,17 +205,28 @@ int CameraFactory::cameraDeviceOpen(const hw_module_t* module,int camera_id, hw_
         return -EINVAL;
     }
 	
-	if (!mCamera)
-		mCamera = new CameraHardware(module);	
+	Mutex::Autolock lock(mLock);
+	
+	// If no camera was found, look again for one plugged since, before the
+	//  fallback node is bound for good
+	if (!mCamerasFound && camera_id == 0 && !mCameras[0].hw)
+		enumerateCameras(true);
+	
+	CameraDesc& d = mCameras[camera_id];
+	if (!d.hw)
+		d.hw = new CameraHardware(module, d.device);
 
-    return mCamera->connectCamera(device);
+    return d.hw->connectCamera(device);
 }
 
 /* Returns the number of available cameras */
 int CameraFactory::getCameraNum()
 {
 	ALOGD("CameraFactory::getCameraNum");
-	return 2;
+	
+	Mutex::Autolock lock(mLock);
+	enumerateCameras(false);
+	return mCameraNum;
 }
 
 
@@ -94,8 +241,10 @@ int CameraFactory::getCameraInfo(int camera_id, struct camera_info* info)
     }
 	
 
-	ALOGD("CameraFactory::getCameraInfo: about to fetch info");
-    return CameraHardware::getCameraInfo(info);
+	Mutex::Autolock lock(mLock);
+	info->facing = mCameras[camera_id].facing;
+	info->orientation = mCameras[camera_id].orientation;
+    return NO_ERROR;
 }
 
 /****************************************************************************
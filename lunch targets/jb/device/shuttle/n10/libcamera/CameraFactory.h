@@ -72,11 +72,11 @@ public:
     /* Gets emulated camera information.
      * This method is called in response to camera_module_t::get_camera_info callback.
      */
-    static int getCameraInfo(int camera_id, struct camera_info *info);
+    int getCameraInfo(int camera_id, struct camera_info *info);
 
 	
 	/* Returns the number of available cameras */
-	static int getCameraNum();
+	int getCameraNum();
 	
     /****************************************************************************
      * Camera HAL API callbacks.
@@ -96,9 +96,38 @@ private:
                            hw_device_t** device);
 
 private:
-
-    /* Camera hardware */
-    CameraHardware* mCamera;
+	/* Finds the V4L2 capture devices, with the camera powered. Done only 
+	 * once, the first time the cameras are needed, as probing the devices 
+	 * takes time. If none is found, the result is kept too, and the probe is
+	 * only retried after a while, or when the camera is opened, until one is
+	 * opened. Called with the lock held, which is dropped while probing.
+	 */
+	void enumerateCameras(bool rescan);
+	static bool anyVideoDevice();
+
+	/* Maximum number of cameras. The first one found is reported as the 
+	 * front camera, the second one as the back camera.
+	 */
+	static const int kMaxCameras = 2;
+	
+	struct CameraDesc {
+		char			device[32];		// V4L2 device node
+		int				facing;
+		int				orientation;
+		CameraHardware*	hw;				// Created the first time it is opened
+	};
+	
+	static int probeCameras(CameraDesc* cameras);
+
+	/* Each camera has its own instance, so all of them can stream at the
+	 * same time */
+	CameraDesc		mCameras[kMaxCameras];
+	int				mCameraNum;			// -1 until enumerated
+	bool			mCamerasFound;		// If the enumeration found any camera
+	bool			mProbing;			// If a thread is probing the devices
+	nsecs_t			mLastProbe;			// When the last probe ended
+	Mutex			mLock;
+	Condition		mProbed;			// Signaled when a probe ends
 
 public:
     /* Contains device open entry point, as required by HAL API. */
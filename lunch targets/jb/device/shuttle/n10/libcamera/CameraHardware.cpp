@@ -25,6 +25,7 @@ extern "C" {
 	
 #include <fcntl.h>
 #include <sys/stat.h> /* for mode definitions */
+#include <cutils/ashmem.h>
 };
 
 #include <ui/Rect.h>
@@ -32,7 +33,7 @@ extern "C" {
 #include "CameraHardware.h"
 #include "Converter.h"
 
-#define VIDEO_DEVICE	"/dev/video0"
+#define CAMERA_STATS_FMT "/data/misc/camera/stats_%s.bin"
 #define MIN_WIDTH  		320
 #define MIN_HEIGHT 		240
 
@@ -105,20 +106,42 @@ extern "C" {
 #define PIXEL_FORMAT_YV16  0x36315659 /* YCrCb 4:2:2 Planar */
 #endif
 
+// The gralloc format that matches YUYV captures. Used to capture straight
+//  into the preview window buffers
+#ifndef HAL_PIXEL_FORMAT_YCbCr_422_I
+#define HAL_PIXEL_FORMAT_YCbCr_422_I 0x14
+#endif
+
 
 namespace android {
 
-CameraHardware::CameraHardware(const hw_module_t* module)
+CameraHardware::CameraHardware(const hw_module_t* module, const char* videoDevice)
         :
+		mVideoDevice(videoDevice),
 		mWin(0),	
 		mPreviewWinFmt(PIXEL_FORMAT_UNKNOWN),
 		mPreviewWinWidth(0),
 		mPreviewWinHeight(0),
+		
+		mDirectPreview(false),
+		mDirectBufCount(0),
+		mDirectQueued(0),
+		
+		mPipelineStop(false),
+		mFrameInterval(0),
+		mCaptureSlot(-1),
+		mZsl(false),
+		mZslCount(0),
+		mCompressing(false),
+		mShutterTime(0),
+		mShutterLag(0),
+		mShutterZsl(false),
 
 		mParameters(),
 		
 		mRawPreviewHeap(0),
 		mRawPreviewFrameSize(0),
+		mRawSlotCount(0),
 
 		mRawPreviewWidth(0),
 		mRawPreviewHeight(0),
@@ -126,6 +149,8 @@ CameraHardware::CameraHardware(const hw_module_t* module)
         mPreviewHeap(0),
         mPreviewFrameSize(0),		
 		mPreviewFmt(PIXEL_FORMAT_UNKNOWN),
+		mPreviewScaleBuffer(NULL),
+		mPreviewScaleSize(0),
 		
         mRawPictureHeap(0),
 		mRawPictureBufferSize(0),
@@ -136,6 +161,10 @@ CameraHardware::CameraHardware(const hw_module_t* module)
 		
         mJpegPictureHeap(0),
 		mJpegPictureBufferSize(0),
+		mJpegPoolFd(-1),
+		mJpegPoolBuffer(MAP_FAILED),
+		mJpegLatency(0),
+		mJpegSize(0),
 		
 		mRecordingEnabled(0),		
 		
@@ -164,6 +193,10 @@ CameraHardware::CameraHardware(const hw_module_t* module)
     ops = &mDeviceOps;
     priv = this;
 
+	memset(mDirectBuf,0,sizeof(mDirectBuf));
+	memset(mDirectAddr,0,sizeof(mDirectAddr));
+	memset(mRawPreviewBuffer,0,sizeof(mRawPreviewBuffer));
+
 	// Init default parameters
     initDefaultParameters();
 }
@@ -185,6 +218,11 @@ CameraHardware::~CameraHardware()
 		mPreviewHeap->release(mPreviewHeap);
 		mPreviewHeap = NULL;
 	}
+	
+	if (mPreviewScaleBuffer) {
+		free(mPreviewScaleBuffer);
+		mPreviewScaleBuffer = NULL;
+	}
 
 	if (mRawPictureHeap) {
 		mRawPictureHeap->release(mRawPictureHeap);
@@ -201,16 +239,29 @@ CameraHardware::~CameraHardware()
 		mJpegPictureHeap = NULL;
 	}
 	
+	if (mJpegPoolBuffer != MAP_FAILED) {
+		munmap(mJpegPoolBuffer, mJpegPictureBufferSize);
+		mJpegPoolBuffer = MAP_FAILED;
+	}
+	
+	if (mJpegPoolFd >= 0) {
+		::close(mJpegPoolFd);
+		mJpegPoolFd = -1;
+	}
 }
 
 bool CameraHardware::NegotiatePreviewFormat(struct preview_stream_ops* win)
 {
 	ALOGD("CameraHardware::NegotiatePreviewFormat");
 	
-	// Get the preview size... If we are recording, use the recording video size instead of the preview size
+	// Get the preview size... If we are recording, use the recording video size instead of the preview size,
+	//  and if keeping frames for zero shutter lag pictures, the picture size
 	int pw, ph;
 	if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
 		mParameters.getVideoSize(&pw, &ph);
+	} else
+	if (useZslLocked()) {
+		mParameters.getPictureSize(&pw, &ph);
 	} else {
 		mParameters.getPreviewSize(&pw, &ph);
 	}
@@ -220,6 +271,19 @@ bool CameraHardware::NegotiatePreviewFormat(struct preview_stream_ops* win)
 	mPreviewWinWidth = 0;
 	mPreviewWinHeight = 0;
 	
+	// If the captured frames could be used as they are, ask for a YUYV surface, 
+	//  so we can try to capture straight into it.
+	if (pw == mRawPreviewWidth && ph == mRawPreviewHeight &&
+		camera.IsOpen() && camera.CanCaptureDirect(pw << 1) &&
+		win->set_buffers_geometry(win,pw,ph,HAL_PIXEL_FORMAT_YCbCr_422_I) == NO_ERROR) {
+
+		ALOGD("Using a YUYV preview window");
+		mPreviewWinFmt = PIXEL_FORMAT_YCrCb_422_I;
+		mPreviewWinWidth = pw;
+		mPreviewWinHeight = ph;
+		return true;
+	}
+	
 	// Set the buffer geometry of the surface and YV12 as the preview format
 	if (win->set_buffers_geometry(win,pw,ph,PIXEL_FORMAT_YV12) != NO_ERROR) {
 		ALOGE("Unable to set buffer geometry");
@@ -253,16 +317,6 @@ status_t CameraHardware::closeCamera()
     return NO_ERROR;
 }
 
-status_t CameraHardware::getCameraInfo(struct camera_info* info)
-{
-    ALOGD("CameraHardware::getCameraInfo");
-
-    info->facing = CAMERA_FACING_FRONT;
-    info->orientation = 0;
-
-    return NO_ERROR;
-}
-
 status_t CameraHardware::setPreviewWindow(struct preview_stream_ops* window)
 {
     ALOGD("CameraHardware::setPreviewWindow: preview_stream_ops: %p", window);
@@ -282,6 +336,15 @@ status_t CameraHardware::setPreviewWindow(struct preview_stream_ops* window)
 			}
 		}
 		
+		// If capturing straight into the current window buffers, the preview
+		//  must be restarted to give them back and use the new window
+		if (mDirectPreview && window != mWin) {
+			ALOGD("CameraHardware::setPreviewWindow - Restarting direct preview");
+			stopPreviewLocked();
+			mWin = window;
+			return startPreviewLocked();
+		}
+		
 		mWin = window;
 		
 		// setup the preview window geometry to be able to use the full preview window
@@ -371,21 +434,23 @@ int CameraHardware::isMsgTypeEnabled(int32_t msgType)
     return enabled;
 }
 
-CameraHardware::PreviewThread::PreviewThread(CameraHardware* hw) :
+CameraHardware::PreviewThread::PreviewThread(CameraHardware* hw, int (CameraHardware::*stage)(), const char* name) :
 	Thread(false),
-	mHardware(hw) 
+	mHardware(hw),
+	mStage(stage),
+	mName(name)
 { 
 }
 
 	
 void CameraHardware::PreviewThread::onFirstRef() 
 {
-	run("CameraPreviewThread", PRIORITY_URGENT_DISPLAY);
+	run(mName, PRIORITY_URGENT_DISPLAY);
 }
 
 bool CameraHardware::PreviewThread::threadLoop() 
 {
-	mHardware->previewThread();
+	(mHardware->*mStage)();
 	// loop until we need to quit
 	return true;
 }
@@ -398,12 +463,20 @@ status_t CameraHardware::startPreviewLocked()
         ALOGD("CameraHardware::startPreviewLocked: preview already running");
         return NO_ERROR;
     }
+	
+	// The free ring is reset below: The slot of a picture being compressed 
+	//  must be back first
+	waitCompressLocked();
 
     int width, height;
 	
-	// If we are recording, use the recording video size instead of the preview size
+	// If we are recording, use the recording video size instead of the preview size. 
+	//  If keeping frames for zero shutter lag pictures, use the picture size
 	if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
 		mParameters.getVideoSize(&width, &height);
+	} else
+	if (useZslLocked()) {
+		mParameters.getPictureSize(&width, &height);
 	} else {
 		mParameters.getPreviewSize(&width, &height);
 	}
@@ -412,7 +485,7 @@ status_t CameraHardware::startPreviewLocked()
 	
     ALOGD("CameraHardware::startPreviewLocked: Open, %dx%d", width, height);
 
-    status_t ret = camera.Open(VIDEO_DEVICE);
+    status_t ret = camera.Open(mVideoDevice.string());
 	if (ret != NO_ERROR) {
 		ALOGE("Failed to initialize Camera");
 		return ret;
@@ -436,6 +509,11 @@ status_t CameraHardware::startPreviewLocked()
 	
 		/* Store it as the video size to use */
 		mParameters.setVideoSize(width, height);
+	} else
+	if (useZslLocked()) {
+	
+		/* Store it as the picture size to use */
+		mParameters.setPictureSize(width, height);
 	} else {
 	
 		/* Store it as the preview size to use */
@@ -445,23 +523,49 @@ status_t CameraHardware::startPreviewLocked()
 	/* And reinit the memory heaps to reflect the real used size if needed */
 	initHeapLocked();
 
+	// setup the preview window geometry in order to use it to zoom the image
+	if (mWin != 0) {
+		ALOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
+		NegotiatePreviewFormat(mWin);
+		
+		// If the window is YUYV, try to capture straight into it. Not if
+		//  the raw frames must be kept for zero shutter lag pictures
+		if (mPreviewWinFmt == PIXEL_FORMAT_YCrCb_422_I && !useZslLocked()) {
+			startDirectPreviewLocked();
+		}
+	}
+	
     ALOGD("CameraHardware::startPreviewLocked: StartStreaming");
 
     ret = camera.StartStreaming();
 	if (ret != NO_ERROR) {
 		ALOGE("Failed to start streaming");
+		if (mDirectPreview)
+			stopDirectPreviewLocked();
 		return ret;
 	}
 
-	// setup the preview window geometry in order to use it to zoom the image
-	if (mWin != 0) {
-		ALOGD("CameraHardware::setPreviewWindow - Negotiating preview format");
-		NegotiatePreviewFormat(mWin);
-	}
+    ALOGD("CameraHardware::startPreviewLocked: starting preview pipeline");
+	
+	mStats.reset();
 	
-    ALOGD("CameraHardware::startPreviewLocked: starting PreviewThread");
+	// All the raw preview slots are free to capture into
+	mCaptureRing.reset();
+	mFreeRing.reset();
+	mDeliverRing.reset();
+	for (int i = 0; i < mRawSlotCount; i++) {
+		mFreeRing.push(i);
+	}
+	mCaptureSlot = -1;
+	mZsl = (mRawSlotCount > kRawSlotCount);
+	mZslCount = 0;
+	mFrameInterval = (int)(1000000 / mParameters.getPreviewFrameRate());
+	mPipelineStop = false;
 
-    mPreviewThread = new PreviewThread(this);
+	// Start the stages from the last one, so nothing waits on a missing stage
+    mDeliverThread = new PreviewThread(this, &CameraHardware::deliverThread, "CameraDeliverThread");
+    mPreviewThread = new PreviewThread(this, &CameraHardware::previewThread, "CameraPreviewThread");
+    mCaptureThread = new PreviewThread(this, &CameraHardware::captureThread, "CameraCaptureThread");
 
     ALOGD("CameraHardware::startPreviewLocked: O - this:0x%p",this);
 
@@ -482,10 +586,23 @@ void CameraHardware::stopPreviewLocked()
     ALOGD("CameraHardware::stopPreviewLocked");
 
     if (mPreviewThread != 0) {
-        ALOGD("CameraHardware::stopPreviewLocked: stopping PreviewThread");
+        ALOGD("CameraHardware::stopPreviewLocked: stopping preview pipeline");
 
+		// The convert stage could be waiting for the lock we hold. Tell it 
+		//  to give up, then stop the stages in the order frames go through them
+		mPipelineStop = true;
+        mCaptureThread->requestExitAndWait();
+		mCaptureThread.clear();	
         mPreviewThread->requestExitAndWait();
 		mPreviewThread.clear();	
+        mDeliverThread->requestExitAndWait();
+		mDeliverThread.clear();	
+		
+		// Get back the preview window buffers from the driver
+		if (mDirectPreview) {
+			camera.StopStreaming();
+			stopDirectPreviewLocked();
+		}
 
         ALOGD("CameraHardware::stopPreviewLocked: Uninit");
         camera.Uninit();
@@ -605,6 +722,10 @@ status_t CameraHardware::cancelAutoFocus()
 status_t CameraHardware::takePicture()
 {
     ALOGD("CameraHardware::takePicture");
+	{
+		Mutex::Autolock lock(mLock);
+		mShutterTime = systemTime(SYSTEM_TIME_MONOTONIC);
+	}
     if (createThread(beginPictureThread, this) == false)
         return UNKNOWN_ERROR;
 		
@@ -931,6 +1052,11 @@ status_t CameraHardware::sendCommand(int32_t command, int32_t arg1, int32_t arg2
 void CameraHardware::releaseCamera()
 {
     ALOGD("CameraHardware::releaseCamera");
+	{
+		// The heaps are freed after this, so wait for any picture being compressed
+		Mutex::Autolock lock(mLock);
+		waitCompressLocked();
+	}
     if (mPreviewThread != 0) {
         stopPreview();
     }
@@ -939,7 +1065,35 @@ void CameraHardware::releaseCamera()
 status_t CameraHardware::dumpCamera(int fd)
 {
     ALOGD("dump");
-    return -EINVAL;
+	
+    Mutex::Autolock lock(mLock);
+	
+	String8 result;
+	result.appendFormat("USB camera HAL (%s)\n", mVideoDevice.string());
+	result.appendFormat("  Preview: %s, %dx%d @ %d fps%s\n",
+		(mPreviewThread != 0) ? "running" : "stopped",
+		mRawPreviewWidth, mRawPreviewHeight, 
+		mParameters.getPreviewFrameRate(),
+		mDirectPreview ? ", captured into the preview window" : "");
+	
+	// The statistics of the last preview, also exported so they can be 
+	//  pulled and compared across builds
+	mStats.dump(result);
+	const char* node = strrchr(mVideoDevice.string(), '/');
+	String8 statsFile;
+	statsFile.appendFormat(CAMERA_STATS_FMT, node ? node + 1 : mVideoDevice.string());
+	if (mStats.exportTo(statsFile.string()))
+		result.appendFormat("  Statistics exported to %s\n", statsFile.string());
+	result.appendFormat("  Zero shutter lag: %s (%d frames kept)\n",
+		useZslLocked() ? "on" : "off", mZslCount);
+	if (mJpegSize) {
+		result.appendFormat("  Last picture: %d bytes, shot to jpeg %.2f ms, shutter to callback %.2f ms%s\n",
+			mJpegSize, mJpegLatency / 1000000.0, mShutterLag / 1000000.0,
+			mShutterZsl ? " (zero shutter lag)" : "");
+	}
+	
+	::write(fd, result.string(), result.size());
+    return NO_ERROR;
 }
 
 // ---------------------------------------------------------------------------
@@ -959,7 +1113,7 @@ void CameraHardware::initDefaultParameters()
 	SortedVector<SurfaceSize> avSizes;
 	SortedVector<int> avFps;
 	
-    if (camera.Open(VIDEO_DEVICE) != NO_ERROR) {
+    if (camera.Open(mVideoDevice.string()) != NO_ERROR) {
 	    ALOGE("cannot open device.");
 
     } else {
@@ -973,25 +1127,10 @@ void CameraHardware::initDefaultParameters()
 		fw = camera.getBestPictureFmt().getWidth();
 		fh = camera.getBestPictureFmt().getHeight();
 
-		// Get all the available sizes
+		// Get all the available sizes. That includes the standard ones the 
+		//  V4L2Camera can scale the captured frames to
 		avSizes = camera.getAvailableSizes();
 		
-		// Add some sizes that some specific apps expect to find:
-		//  GTalk expects 320x200
-		//  Fring expects 240x160
-		// And also add standard resolutions found in low end cameras, as 
-		//  android apps could be expecting to find them
-		// The V4LCamera handles those resolutions by choosing the next
-		//  larger one and cropping the captured frames to the requested size
-		
-		avSizes.add(SurfaceSize(480,320)); // HVGA
-		avSizes.add(SurfaceSize(432,320)); // 1.35-to-1, for photos. (Rounded up from 1.3333 to 1)
-		avSizes.add(SurfaceSize(352,288)); // CIF
-		avSizes.add(SurfaceSize(320,240)); // QVGA
-		avSizes.add(SurfaceSize(320,200));
-		avSizes.add(SurfaceSize(240,160)); // SQVGA
-		avSizes.add(SurfaceSize(176,144)); // QCIF 
-		
 		// Get all the available Fps
 		avFps = camera.getAvailableFps();
 	}
@@ -1077,6 +1216,11 @@ void CameraHardware::initDefaultParameters()
 	p.setPictureSize(fw,fh);
 	p.set(CameraParameters::KEY_JPEG_QUALITY, 85);
 	
+	// Zero shutter lag: Preview at the picture size, and take the pictures
+	//  from the last previewed frames
+	p.set(V4L2CameraParameters::KEY_SUPPORTED_ZSL_MODES,"off,on");
+	p.set(V4L2CameraParameters::KEY_ZSL,V4L2CameraParameters::ZSL_OFF);
+	
 	// Preview - Supporting yuv422i-yuyv,yuv422sp,yuv420sp, defaulting to yuv420sp, as that is the android Defacto default
 
 	
@@ -1163,6 +1307,10 @@ void CameraHardware::initDefaultParameters()
 void CameraHardware::initHeapLocked()
 {
     ALOGD("CameraHardware::initHeapLocked");
+	
+	// A zero shutter lag picture could be being compressed from a raw
+	//  preview slot into the Jpeg pool
+	waitCompressLocked();
 
     int preview_width, preview_height;
     int picture_width, picture_height;
@@ -1205,6 +1353,26 @@ void CameraHardware::initHeapLocked()
 			mRawPreviewHeight = video_height;
 		}
 		
+	} else
+	if (useZslLocked()) {
+		how_raw_preview_big = picture_width * picture_height << 1; 	// Raw preview heap always in YUYV
+
+		// If something changed ...
+		if (mRawPreviewWidth != picture_width ||
+			mRawPreviewHeight != picture_height) {
+
+			// Stop the preview thread if needed
+			if (mPreviewThread != 0) {
+				restart_preview	= true;
+				stopPreviewLocked();
+				ALOGD("Stopping preview to allow changes");
+			}
+		
+			// Store the effective size
+			mRawPreviewWidth = picture_width;
+			mRawPreviewHeight = picture_height;
+		}
+		
 	} else {
 		how_raw_preview_big = preview_width * preview_height << 1; 	// Raw preview heap always in YUYV
 
@@ -1225,7 +1393,11 @@ void CameraHardware::initHeapLocked()
 		}
 	}
 	
-    if (how_raw_preview_big != mRawPreviewFrameSize) {
+	// One slot per frame that can be in flight in the preview pipeline, plus
+	//  the ones kept for zero shutter lag pictures
+	int raw_slots = useZslLocked() ? kRawSlotCount + kZslFrameCount : kRawSlotCount;
+	
+    if (how_raw_preview_big != mRawPreviewFrameSize || raw_slots != mRawSlotCount) {
 
 		// Stop the preview thread if needed
 		if (!restart_preview && mPreviewThread != 0) {
@@ -1235,17 +1407,20 @@ void CameraHardware::initHeapLocked()
 		}
 
         mRawPreviewFrameSize = how_raw_preview_big;
+		mRawSlotCount = raw_slots;
 		
         // Create raw picture heap.
 		if (mRawPreviewHeap) {
 			mRawPreviewHeap->release(mRawPreviewHeap);
 			mRawPreviewHeap = NULL;
 		}
-		mRawPreviewBuffer = NULL;
+		memset(mRawPreviewBuffer,0,sizeof(mRawPreviewBuffer));
 
-		mRawPreviewHeap = mRequestMemory(-1,mRawPreviewFrameSize,1,mCallbackCookie);
+		mRawPreviewHeap = mRequestMemory(-1,mRawPreviewFrameSize,raw_slots,mCallbackCookie);
 		if (mRawPreviewHeap) { 
-			mRawPreviewBuffer = mRawPreviewHeap->data;
+			for (int i = 0; i < raw_slots; i++) {
+				mRawPreviewBuffer[i] = (uint8_t*)mRawPreviewHeap->data + i * mRawPreviewFrameSize;
+			}
 		} else {
 			ALOGE("Unable to allocate memory for RawPreview");
 		}
@@ -1327,6 +1502,36 @@ void CameraHardware::initHeapLocked()
         ALOGD("CameraHardware::initHeapLocked: preview heap allocated");
     }
 	
+	// With zero shutter lag the raw frames are at the picture size, and while
+	//  recording at the video size: The preview frames are scaled from them
+	int how_scale_big = 0;
+	if (mRawPreviewWidth != preview_width || mRawPreviewHeight != preview_height)
+		how_scale_big = (preview_width * preview_height + mRawPreviewWidth) << 1;
+	if (how_scale_big != mPreviewScaleSize) {
+	
+		// Stop the preview thread if needed
+		if (!restart_preview && mPreviewThread != 0) {
+			restart_preview	= true;
+			stopPreviewLocked();
+			ALOGD("Stopping preview to allow changes");
+		}
+		
+		if (mPreviewScaleBuffer) {
+			free(mPreviewScaleBuffer);
+			mPreviewScaleBuffer = NULL;
+		}
+		mPreviewScaleSize = 0;
+		
+		if (how_scale_big) {
+			mPreviewScaleBuffer = (uint8_t*)malloc(how_scale_big);
+			if (mPreviewScaleBuffer) {
+				mPreviewScaleSize = how_scale_big;
+			} else {
+				ALOGE("Unable to allocate memory for the preview scaler");
+			}
+		}
+	}
+	
 	int how_recording_big = 0;
 	if (!strcmp(mParameters.get(CameraParameters::KEY_VIDEO_FRAME_FORMAT),"yuv422i-yuyv")) {
 		mRecFmt = PIXEL_FORMAT_YCrCb_422_I;
@@ -1431,19 +1636,34 @@ void CameraHardware::initHeapLocked()
 		//  the picture memory pool is not being used, and the camera is not
 		//  capturing pictures right now
 
-        mJpegPictureBufferSize = how_jpeg_big;
-		
-        // Create Jpeg picture heap.
+        // Release the previous Jpeg picture and its pool
 		if (mJpegPictureHeap) {
 			mJpegPictureHeap->release(mJpegPictureHeap);
 			mJpegPictureHeap = NULL;
 		}
-		mJpegPictureHeap = mRequestMemory(-1,how_jpeg_big,1,mCallbackCookie);
-		if (!mJpegPictureHeap) { 
-			ALOGE("Unable to allocate memory for RawPicture");
+		if (mJpegPoolBuffer != MAP_FAILED) {
+			munmap(mJpegPoolBuffer, mJpegPictureBufferSize);
+			mJpegPoolBuffer = MAP_FAILED;
+		}
+		if (mJpegPoolFd >= 0) {
+			::close(mJpegPoolFd);
+			mJpegPoolFd = -1;
+		}
+
+        mJpegPictureBufferSize = how_jpeg_big;
+		
+        // Create the Jpeg pool: a shared memory region the pictures are
+		//  compressed into. Each picture is handed to the client as an
+		//  exact sized mapping of it, so no copy is required
+		mJpegPoolFd = ashmem_create_region("camera-jpeg", how_jpeg_big);
+		if (mJpegPoolFd >= 0) {
+			mJpegPoolBuffer = mmap(NULL, how_jpeg_big, PROT_READ | PROT_WRITE, MAP_SHARED, mJpegPoolFd, 0);
+		}
+		if (mJpegPoolBuffer == MAP_FAILED) { 
+			ALOGE("Unable to allocate memory for JpegPicture");
 		}
 
-        ALOGD("CameraHardware::initHeapLocked: Jpeg picture heap allocated");
+        ALOGD("CameraHardware::initHeapLocked: Jpeg picture pool allocated");
     }
 
 	// Don't forget to restart the preview if it was stopped...
@@ -1455,229 +1675,466 @@ void CameraHardware::initHeapLocked()
     ALOGD("CameraHardware::initHeapLocked: OK");
 }
 
-int CameraHardware::previewThread()
+/* Map an android pixel format into the fused converter destination format */
+static int toConvFmt(int fmt)
 {
-    ALOGD("CameraHardware::previewThread: this=%p",this);
-
-    int previewFrameRate = mParameters.getPreviewFrameRate();
-
-    // Calculate how long to wait between frames.
-    int delay = (int)(1000000 / previewFrameRate);
+	switch (fmt) {
 	
-	// Buffers to send messages
-	int recBufferIdx = 0;
-	int previewBufferIdx = 0;
-	
-	bool record = false;
-	bool preview = false;
-
-	// Get the current timestamp
-	nsecs_t timestamp = systemTime(SYSTEM_TIME_MONOTONIC);
+	// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
+	// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
+	case PIXEL_FORMAT_YCbCr_422_SP:
+	case PIXEL_FORMAT_YCbCr_420_SP:
+		return CONV_YVU420SP;
+	case PIXEL_FORMAT_YV12:
+		return CONV_YVU420P;
+	case PIXEL_FORMAT_YV16:
+		return CONV_YVU422P;
+	case PIXEL_FORMAT_YCrCb_422_I:
+		return CONV_YUYV;
+	case PIXEL_FORMAT_RGB_888:
+		return CONV_RGB24;
+	case PIXEL_FORMAT_RGBA_8888:
+	case PIXEL_FORMAT_RGBX_8888:
+		return CONV_RGB32;
+	case PIXEL_FORMAT_BGRA_8888:
+		return CONV_BGR32;
+	case PIXEL_FORMAT_RGB_565:
+		return CONV_RGB565;
+	}
+	return -1;
+}
 
-	// We must avoid a race condition here when destroying the thread...
-	//  So, if we fail to lock the mutex, just retry a bit later, but
-	//  let the android thread end if requested!
-	if (mLock.tryLock() == NO_ERROR)
-    {
+/* First stage of the preview pipeline: Grab the frames from the driver, 
+   already converted to YUYV, and pass them to the convert stage */
+int CameraHardware::captureThread()
+{
+	// Never wait more than 2 frames, so we notice soon if the thread was
+	//  asked to stop
+	int delay = mFrameInterval;
+	int timeout = (delay << 1) / 1000;
 
-		// If no raw preview buffer, we can't do anything...
-		if (mRawPreviewBuffer == 0) {
-			ALOGE("No Raw preview buffer!");
-			mLock.unlock();
+	// Get a free raw preview slot to capture into. Not needed if capturing 
+	//  into the preview window buffers
+	if (!mDirectPreview && mCaptureSlot < 0) {
+		int slot;
+		if (!mFreeRing.pop(slot, timeout)) {
 			return NO_ERROR;
 		}
-
-        // Get the preview buffer for the current frame		
-		// This is always valid, even if the client died -- the memory
-		// is still mapped in our process.
-		uint8_t *frame = (uint8_t *)mPreviewBuffer[mCurrentPreviewFrame];
-		
-		// If no preview buffer, we cant do anything...
-		if (frame == 0) {
-			ALOGE("No preview buffer!");
-			mLock.unlock();
+		mCaptureSlot = slot;
+	}
+	
+	// Wait until the driver has a frame for us
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+	int ready = camera.WaitFrame(timeout);
+	if (ready == 0) {
+		return NO_ERROR;
+	}
+	
+	// If capturing into the preview window buffers, an error means the
+	//  driver has no buffers: The convert stage will give it more. Otherwise,
+	//  give up for this frame
+	if (ready < 0) {
+		mStats.count(CameraStats::cnCaptureErrors);
+		usleep(delay);
+		return NO_ERROR;
+	}
+	
+	nsecs_t waitTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+	mStats.add(CameraStats::stWait, waitTime);
+	start += waitTime;
+
+	CapturedFrame f;
+	f.slot = -1;
+	f.directIdx = -1;
+	if (mDirectPreview) {
+	
+		// The frame is captured straight into a preview window buffer
+		int idx = -1;
+		if (camera.DequeueUserPtr(idx) < 0 || idx < 0 || idx >= kBufferCount) {
+			ALOGE("No preview window buffer captured!");
+			mStats.count(CameraStats::cnCaptureErrors);
+			usleep(delay);
 			return NO_ERROR;
 		}
-
-
-		//  Get a pointer to the memory area to use... In case of previewing in YUV422I, we
-		// can save a buffer copy by directly using the output buffer. But ONLY if NOT recording
-		// or, in case of recording, when size matches
-		uint8_t* rawBase = (mPreviewFmt == PIXEL_FORMAT_YCrCb_422_I && 
-							(!mRecordingEnabled || mRawPreviewFrameSize == mPreviewFrameSize)) 
-							? frame
-							:(uint8_t*)mRawPreviewBuffer;
-							
+		android_atomic_dec(&mDirectQueued);
+		f.directIdx = idx;
+		
+	} else {
+	
 		// Grab a frame in the raw format YUYV
-		camera.GrabRawFrame(rawBase, mRawPreviewFrameSize);
+		camera.GrabRawFrame(mRawPreviewBuffer[mCaptureSlot], mRawPreviewFrameSize);
+		f.slot = mCaptureSlot;
+	}
+	
+	// Use the capture time of the frame as its timestamp
+	f.timestamp = camera.getFrameTimestamp();
+	f.waitTime = waitTime;
+	f.grabTime = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+	mStats.addGrab(camera.getPixelFormat(), f.grabTime);
+	mStats.count(CameraStats::cnCaptured);
+	
+	// There are never more frames in flight than raw slots or preview
+	//  window buffers, so this can't fail
+	if (mCaptureRing.push(f)) {
+		mCaptureSlot = -1;
+	}
 
-		// If the recording is enabled...
-		if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
-			//ALOGD("CameraHardware::previewThread: posting video frame...");
+	return NO_ERROR;
+}
 
-			// Get the video size. We are warrantied here that the current capture
-			// size IS exacty equal to the video size, as this condition is enforced
-			// by this driver, that priorizes recording size over preview size requirements
-			
-			uint8_t *recFrame = (uint8_t *) mRecBuffers[mCurrentRecordingFrame];
-			if (recFrame != 0) {
+/* Second stage of the preview pipeline: Convert the captured frames to all
+   the outputs, display them and pass the callbacks to the deliver stage */
+int CameraHardware::previewThread()
+{
+	ALOGF("CameraHardware::previewThread: this=%p",this);
 
-				// Convert from our raw frame to the one the Record requires
-				switch (mRecFmt) {
-				
-				// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
-				// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
-				case PIXEL_FORMAT_YCbCr_422_SP:
-					yuyv_to_yvu420sp(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
-					
-				case PIXEL_FORMAT_YCbCr_420_SP:
-					yuyv_to_yvu420sp(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
-				
-				case PIXEL_FORMAT_YV12:
-					/* OMX recorder needs YUV */
-					yuyv_to_yuv420p(recFrame, mRawPreviewWidth, mRawPreviewHeight, rawBase, (mRawPreviewWidth<<1), mRawPreviewWidth, mRawPreviewHeight);
-					break;
-				
-				case PIXEL_FORMAT_YCrCb_422_I:
-					memcpy(recFrame, rawBase, mRecordingFrameSize);
-					break; 
-				}
-				
-				// Remember we must schedule the callback
-				record = true;
-				
-				// Advance the buffer pointer.
-				recBufferIdx = mCurrentRecordingFrame;
-				mCurrentRecordingFrame = (mCurrentRecordingFrame + 1) % kBufferCount;
-			}
+	// Get the next captured frame
+	CapturedFrame f;
+	if (!mCaptureRing.pop(f, (mFrameInterval << 1) / 1000)) {
+	
+		// If capturing into the preview window buffers and the window could
+		//  not give us any buffer, there is nothing to wait for: Try to get
+		//  some more
+		if (mDirectPreview && mDirectQueued == 0 && mLock.tryLock() == NO_ERROR) {
+			if (mPreviewThread != 0 && mDirectPreview)
+				postDirectFrameLocked(-1);
+			mLock.unlock();
 		}
+		return NO_ERROR;
+	}
 
-		if (mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
-			//ALOGD("CameraHardware::previewThread: posting preview frame...");
-
-			// Here we could eventually have a problem: If we are recording, the recording size
-			//  takes precedence over the preview size. So, the rawBase buffer could be of a 
-			//  different size than the preview buffer. Handle this situation by centering/cropping
-			//  if needed.
-			
-			// Get the preview size
-			int width = 0, height = 0;
-			mParameters.getPreviewSize(&width,&height);
-			
-			// Assume we will be able to copy at least those pixels
-			int cwidth = width;
-			int cheight = height;
-			
-			// If we are trying to display a preview larger than the effective capture, truncate to it
-			if (cwidth > mRawPreviewWidth)
-				cwidth = mRawPreviewWidth;
-			if (cheight > mRawPreviewHeight)
-				cheight = mRawPreviewHeight;
-
-			// Convert from our raw frame to the one the Preview requires
-			switch (mPreviewFmt) {
+	// We must avoid a race condition here when destroying the thread...
+	//  So, if we fail to lock the mutex, just retry a bit later, but
+	//  give up if the pipeline is being stopped, as the one holding the 
+	//  lock is waiting for us to end!
+	while (mLock.tryLock() != NO_ERROR) {
+		if (mPipelineStop) {
+			if (f.slot >= 0)
+				mFreeRing.push(f.slot);
+			return NO_ERROR;
+		}
+		usleep(1000);
+	}
+	
+	// Buffers to send messages
+	DeliverMsg msg;
+	msg.preview = false;
+	msg.previewIdx = 0;
+	msg.record = false;
+	msg.recIdx = 0;
+	msg.timestamp = f.timestamp;
+	
+	// If the deliver stage is late, do not reuse the buffers it is still 
+	//  delivering: Just display this frame
+	bool deliver = !mDeliverRing.full();
+	if (!deliver)
+		mStats.count(CameraStats::cnDroppedCallbacks);
+	
+	uint8_t* rawBase = (f.directIdx >= 0) 
+		? (uint8_t*)mDirectAddr[f.directIdx] 
+		: (uint8_t*)mRawPreviewBuffer[f.slot];
+	
+	// Get the preview buffer for the current frame		
+	// This is always valid, even if the client died -- the memory
+	// is still mapped in our process.
+	uint8_t *frame = (uint8_t *)mPreviewBuffer[mCurrentPreviewFrame];
+
+	// If no raw frame or no preview buffer, we can't do anything...
+	if (rawBase == 0 || frame == 0) {
+		ALOGE("No raw preview or preview buffer!");
+		if (f.slot >= 0)
+			mFreeRing.push(f.slot);
+		mLock.unlock();
+		return NO_ERROR;
+	}
+	
+	// All the conversions of the raw frame are done in a single pass, so each 
+	//  line of it is read from memory only once, no matter how many outputs 
+	//  we have to generate
+	conv_dest dests[3];
+	int ndests = 0;
+	bool scaleFrame = false;
+	int scaleWidth = 0, scaleHeight = 0;
+
+	// If the recording is enabled...
+	if (deliver && mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME) {
+		//ALOGD("CameraHardware::previewThread: posting video frame...");
+
+		// Get the video size. We are warrantied here that the current capture
+		// size IS exacty equal to the video size, as this condition is enforced
+		// by this driver, that priorizes recording size over preview size requirements
+		
+		uint8_t *recFrame = (uint8_t *) mRecBuffers[mCurrentRecordingFrame];
+		if (recFrame != 0) {
+
+			// Convert from our raw frame to the one the Record requires
+			conv_dest& d = dests[ndests];
+			d.fmt = toConvFmt(mRecFmt);
+			d.dst = recFrame;
+			d.dstStride = mRawPreviewWidth;
+			d.dstHeight = mRawPreviewHeight;
+			d.srcX = 0;
+			d.srcY = 0;
+			d.width = mRawPreviewWidth;
+			d.height = mRawPreviewHeight;
 			
-				// Note: Apparently, Android's "YCbCr_422_SP" is merely an arbitrary label
-				// The preview data comes in a YUV 4:2:0 format, with Y plane, then VU plane
-			case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
-				yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
-				break;
-				
-			case PIXEL_FORMAT_YCbCr_420_SP:
-				yuyv_to_yvu420sp(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
-				break;
-
+			switch (mRecFmt) {
 			case PIXEL_FORMAT_YV12:
-				yuyv_to_yvu420p(frame, width, height, rawBase, (mRawPreviewWidth<<1), cwidth, cheight);
+				/* OMX recorder needs YUV */
+				d.fmt = CONV_YUV420P;
 				break;
-				
+			
 			case PIXEL_FORMAT_YCrCb_422_I:
-				// Nothing to do here. Is is handled as a special case without buffer copies...
-				//  but ONLY in special cases... Otherwise, handle the copy!
-				if (mRecordingEnabled && mRawPreviewFrameSize != mPreviewFrameSize) {
-					// We need to copy ... do it
-					uint8_t* dst = frame;
-					uint8_t* src = rawBase;
-					int h;
-					for (h = 0; h < cheight; h++) {
-						memcpy(dst,src,cwidth<<1);
-						dst += width << 1;
-						src += mRawPreviewWidth<<1;
-					}
-				}
+				d.dstStride = mRawPreviewWidth << 1;
 				break; 
-				
-			default:
-				ALOGE("Unhandled pixel format");
-
 			}
+			if (d.fmt >= 0)
+				ndests++;
 			
 			// Remember we must schedule the callback
-			preview = true;
+			msg.record = true;
 			
 			// Advance the buffer pointer.
-			previewBufferIdx = mCurrentPreviewFrame;
-			mCurrentPreviewFrame = (mCurrentPreviewFrame + 1) % kBufferCount;
+			msg.recIdx = mCurrentRecordingFrame;
+			mCurrentRecordingFrame = (mCurrentRecordingFrame + 1) % kBufferCount;
+		}
+	}
+
+	if (deliver && mMsgEnabled & CAMERA_MSG_PREVIEW_FRAME) {
+		//ALOGD("CameraHardware::previewThread: posting preview frame...");
+
+		// Get the preview size
+		int width = 0, height = 0;
+		mParameters.getPreviewSize(&width,&height);
+		
+		// If we are recording, the recording size takes precedence over the
+		//  preview size, and with zero shutter lag the picture size does. So,
+		//  the rawBase buffer could be of a different size than the preview
+		//  buffer: It is scaled to it then, after the other conversions
+		if (width != mRawPreviewWidth || height != mRawPreviewHeight) {
+			scaleFrame = true;
+			scaleWidth = width;
+			scaleHeight = height;
 		}
 
-		// Display the preview image
-		fillPreviewWindow(rawBase, mRawPreviewWidth, mRawPreviewHeight);
+		// Convert from our raw frame to the one the Preview requires
+		conv_dest& d = dests[ndests];
+		d.fmt = -1;
+		d.dst = frame;
+		d.dstStride = width;
+		d.dstHeight = height;
+		d.srcX = 0;
+		d.srcY = 0;
+		d.width = width;
+		d.height = height;
 		
-		// Release the lock
-		mLock.unlock();
+		switch (mPreviewFmt) {
+		case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
+		case PIXEL_FORMAT_YCbCr_420_SP:
+		case PIXEL_FORMAT_YV12:
+			d.fmt = toConvFmt(mPreviewFmt);
+			break;
+			
+		case PIXEL_FORMAT_YCrCb_422_I:
+			// The raw frame slot is reused as soon as we are done with it, 
+			//  so it must be copied
+			d.fmt = CONV_YUYV;
+			d.dstStride = width << 1;
+			break; 
+			
+		default:
+			ALOGE("Unhandled pixel format");
+
+		}
+		if (d.fmt >= 0 && !scaleFrame)
+			ndests++;
 		
-    } else {
-	
-		// Delay a little ... and reattempt the lock on the next iteration
-		delay >>= 7;
+		// Remember we must schedule the callback
+		msg.preview = true;
+		
+		// Advance the buffer pointer.
+		msg.previewIdx = mCurrentPreviewFrame;
+		mCurrentPreviewFrame = (mCurrentPreviewFrame + 1) % kBufferCount;
 	}
 
-	// We must schedule the callbacks Outside the lock, or the caller
-	//  could call us and cause a deadlock!
-	if (preview) {
-	    mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, previewBufferIdx, NULL, mCallbackCookie);
+	// Display the preview image
+	buffer_handle_t* winBuf = NULL;
+	if (f.directIdx < 0) {
+		winBuf = dequeuePreviewWindow(dests[ndests], mRawPreviewWidth, mRawPreviewHeight);
+		if (winBuf != NULL)
+			ndests++;
 	}
 	
-	if (record) {
-		// Record callback uses a timestamped frame
-        mDataCbTimestamp(timestamp, CAMERA_MSG_VIDEO_FRAME, mRecordingHeap, recBufferIdx, mCallbackCookie);
+	// Do all the conversions
+	nsecs_t convStart = systemTime(SYSTEM_TIME_MONOTONIC);
+	yuyv_to_multi(dests, ndests, rawBase, mRawPreviewWidth << 1);
+	if (scaleFrame)
+		scalePreviewFrame(frame, scaleWidth, scaleHeight, rawBase);
+	nsecs_t convTime = systemTime(SYSTEM_TIME_MONOTONIC) - convStart;
+	mStats.add(CameraStats::stConvert, convTime);
+
+	// And show the frame
+	if (f.directIdx >= 0) {
+		postDirectFrameLocked(f.directIdx);
+	} else 
+	if (winBuf != NULL) {
+		postPreviewWindow(winBuf);
 	}
+	
+	// The raw frame can now be reused by the capture stage, unless it 
+	//  must be kept for zero shutter lag pictures
+	if (f.slot >= 0) {
+		if (mZsl) {
+			keepZslFrameLocked(f.slot, f.timestamp);
+		} else {
+			mFreeRing.push(f.slot);
+		}
+	}
+	
+	// Keep track of the time it takes a frame to reach the display since 
+	//  it was captured, and of where that time went
+	nsecs_t latency = systemTime(SYSTEM_TIME_MONOTONIC) - f.timestamp;
+	mStats.add(CameraStats::stLatency, latency);
+	mStats.count(CameraStats::cnDisplayed);
+	
+	CameraStats::FrameRecord rec;
+	memset(&rec, 0, sizeof(rec));
+	rec.timestamp = f.timestamp;
+	rec.us[CameraStats::stWait] = ns2us(f.waitTime);
+	rec.us[CameraStats::stGrab] = ns2us(f.grabTime);
+	rec.us[CameraStats::stConvert] = ns2us(convTime);
+	if (winBuf != NULL) {
+		rec.us[CameraStats::stWinDequeue] = ns2us(mStats.stage(CameraStats::stWinDequeue).last);
+		rec.us[CameraStats::stWinLock] = ns2us(mStats.stage(CameraStats::stWinLock).last);
+		rec.us[CameraStats::stWinEnqueue] = ns2us(mStats.stage(CameraStats::stWinEnqueue).last);
+	}
+	rec.us[CameraStats::stLatency] = ns2us(latency);
+	mStats.record(rec);
+	
+	// Release the lock
+	mLock.unlock();
 
-    ALOGD("previewThread OK");
-
-    // Wait for it...
-    usleep(delay);
+	// The callbacks are called by the deliver stage, outside the lock, or 
+	//  the caller could call us and cause a deadlock! It also counts the
+	//  delivered frames, so pass it the ones without callbacks too
+	if (deliver) {
+		mDeliverRing.push(msg);
+	}
+	
+    ALOGF("previewThread OK");
 
     return NO_ERROR;
 }
 
-void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeight) 
+/* Last stage of the preview pipeline: Call the preview and recording 
+   callbacks for the converted frames */
+int CameraHardware::deliverThread()
+{
+	DeliverMsg msg;
+	if (!mDeliverRing.pop(msg, (mFrameInterval << 1) / 1000)) {
+		return NO_ERROR;
+	}
+	
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+	
+	if (msg.preview) {
+	    mDataCb(CAMERA_MSG_PREVIEW_FRAME, mPreviewHeap, msg.previewIdx, NULL, mCallbackCookie);
+	}
+	
+	if (msg.record) {
+		// Record callback uses a timestamped frame
+        mDataCbTimestamp(msg.timestamp, CAMERA_MSG_VIDEO_FRAME, mRecordingHeap, msg.recIdx, mCallbackCookie);
+	}
+	
+	mStats.add(CameraStats::stCallback, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+	mStats.count(CameraStats::cnDelivered);
+	
+	return NO_ERROR;
+}
+
+/* Fill the preview frame from a raw frame of another size. The largest 
+   centered area of the raw frame with the aspect ratio of the preview is
+   scaled to it, so the preview shows the same field of view as the window */
+void CameraHardware::scalePreviewFrame(uint8_t* frame, int width, int height, uint8_t* raw)
+{
+	if (!mPreviewScaleBuffer || mPreviewScaleSize != (width * height + mRawPreviewWidth) << 1) {
+		ALOGE("No preview scaler buffer");
+		return;
+	}
+	
+	int srcWidth = mRawPreviewWidth;
+	int srcHeight = mRawPreviewHeight;
+	if (srcWidth * height > srcHeight * width)
+		srcWidth = (srcHeight * width / height) & (-2);
+	else
+		srcHeight = (srcWidth * height / width) & (-2);
+	int startX = ((mRawPreviewWidth - srcWidth) >> 1) & (-2);
+	int startY = ((mRawPreviewHeight - srcHeight) >> 1) & (-2);
+	int rawStride = mRawPreviewWidth << 1;
+	uint8_t* src = raw + (startY * rawStride) + (startX << 1);
+	uint8_t* line = mPreviewScaleBuffer + (width * height << 1);
+	
+	// YUYV previews are scaled straight into the preview frame
+	if (mPreviewFmt == PIXEL_FORMAT_YCrCb_422_I) {
+		yuyv_scale(frame, width << 1, width, height, src, rawStride, srcWidth, srcHeight, line);
+		return;
+	}
+	
+	yuyv_scale(mPreviewScaleBuffer, width << 1, width, height, src, rawStride, srcWidth, srcHeight, line);
+	
+	conv_dest d;
+	d.fmt = toConvFmt(mPreviewFmt);
+	d.dst = frame;
+	d.dstStride = width;
+	d.dstHeight = height;
+	d.srcX = 0;
+	d.srcY = 0;
+	d.width = width;
+	d.height = height;
+	if (d.fmt >= 0)
+		yuyv_to_multi(&d, 1, mPreviewScaleBuffer, width << 1);
+}
+
+/* Get a buffer from the preview window, and describe where and how the 
+   YUYV frame must be converted into it */
+buffer_handle_t* CameraHardware::dequeuePreviewWindow(conv_dest& dest, int srcWidth, int srcHeight) 
 {
 	// Preview to a preview window...
 	if (mWin == 0) {
 		ALOGE("%s: No preview window",__FUNCTION__);
-		return;
+		return NULL;
+	}
+	
+	// Make sure we know how to convert to the window format
+	int fmt = toConvFmt(mPreviewWinFmt);
+	if (fmt < 0) {
+		ALOGE("Unhandled pixel format");
+		return NULL;
 	}
 	
 	// Get a videobuffer
 	buffer_handle_t* buf = NULL;
 	int stride = 0;
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
 	status_t res = mWin->dequeue_buffer(mWin, &buf, &stride);
+	nsecs_t now = systemTime(SYSTEM_TIME_MONOTONIC);
+	mStats.add(CameraStats::stWinDequeue, now - start);
 	if (res != NO_ERROR || buf == NULL) {
         ALOGE("%s: Unable to dequeue preview window buffer: %d -> %s",
             __FUNCTION__, -res, strerror(-res));
-        return;
+		mStats.count(CameraStats::cnWindowErrors);
+        return NULL;
 	}
+	start = now;
 
     /* Let the preview window to lock the buffer. */
     res = mWin->lock_buffer(mWin, buf);
     if (res != NO_ERROR) {
         ALOGE("%s: Unable to lock preview window buffer: %d -> %s",
              __FUNCTION__, -res, strerror(-res));
+		mStats.count(CameraStats::cnWindowErrors);
         mWin->cancel_buffer(mWin, buf);
-        return;
+        return NULL;
     }
 		
     /* Now let the graphics framework to lock the buffer, and provide
@@ -1690,15 +2147,14 @@ void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeigh
     if (res != NO_ERROR || vaddr == NULL) {
         ALOGE("%s: grbuffer_mapper.lock failure: %d -> %s",
              __FUNCTION__, res, strerror(res));
+		mStats.count(CameraStats::cnWindowErrors);
         mWin->cancel_buffer(mWin, buf);
-        return;
+        return NULL;
     }
+	mStats.add(CameraStats::stWinLock, systemTime(SYSTEM_TIME_MONOTONIC) - start);
 		
-	// Calculate the source stride...
-	int srcStride = srcWidth<<1;
-	uint8_t* src  = (uint8_t*)yuyv;
-
 	// Center into the preview surface if needed
+	int srcX = 0, srcY = 0;
 	int xStart = (mPreviewWinWidth   - srcWidth ) >> 1;
 	int yStart = (mPreviewWinHeight  - srcHeight) >> 1;
 
@@ -1708,13 +2164,13 @@ void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeigh
 		
 		if (xStart < 0) {
 			srcWidth += xStart;
-			src += ((-xStart) >> 1) << 1; 		// Center the crop rectangle
+			srcX = ((-xStart) >> 1) & (-2);		// Center the crop rectangle, keeping YUYV pairs
 			xStart = 0;
 		}
 		
 		if (yStart < 0) {
 			srcHeight += yStart;
-			src += ((-yStart) >> 1) * srcStride; // Center the crop rectangle
+			srcY = (-yStart) >> 1; 				// Center the crop rectangle
 			yStart = 0;
 		}
 	} 		
@@ -1739,72 +2195,186 @@ void CameraHardware::fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeigh
 		bytesPerPixel = 2;
 	}
 
-	ALOGD("ANativeWindow: bits:%p, stride in pixels:%d, w:%d, h: %d, format: %d",vaddr,stride,mPreviewWinWidth,mPreviewWinHeight,mPreviewWinFmt);
+	ALOGF("ANativeWindow: bits:%p, stride in pixels:%d, w:%d, h: %d, format: %d",vaddr,stride,mPreviewWinWidth,mPreviewWinHeight,mPreviewWinFmt);
 
 	// Based on the destination pixel type, we must convert from YUYV to it
 	int dstStride = bytesPerPixel * stride;
-	uint8_t* dst  = ((uint8_t*)vaddr) + (xStart * bytesPerPixel) + (dstStride * yStart);
+	
+	dest.fmt = fmt;
+	dest.dst = ((uint8_t*)vaddr) + (xStart * bytesPerPixel) + (dstStride * yStart);
+	dest.dstStride = dstStride;
+	dest.dstHeight = mPreviewWinHeight;
+	dest.srcX = srcX;
+	dest.srcY = srcY;
+	dest.width = srcWidth;
+	dest.height = srcHeight;
+	
+	return buf;
+}
 
-	switch (mPreviewWinFmt) {
-	case PIXEL_FORMAT_YCbCr_422_SP: // This is misused by android...
-		yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
-		
-	case PIXEL_FORMAT_YCbCr_420_SP:
-		yuyv_to_yvu420sp( dst, dstStride, mPreviewWinHeight,src, srcStride, srcWidth, srcHeight);
-		break;
-		
-	case PIXEL_FORMAT_YV12:
-		yuyv_to_yvu420p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
+/* Show a preview window buffer filled by the converter */
+void CameraHardware::postPreviewWindow(buffer_handle_t* buf) 
+{
+	/* Show it. */
+	nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+	mWin->enqueue_buffer(mWin, buf);
+	mStats.add(CameraStats::stWinEnqueue, systemTime(SYSTEM_TIME_MONOTONIC) - start);
+				
+	// Post the filled buffer!
+	GraphicBufferMapper::get().unlock(*buf);
+}
 
-	case PIXEL_FORMAT_YV16:
-		yuyv_to_yvu422p( dst, dstStride, mPreviewWinHeight, src, srcStride, srcWidth, srcHeight);
-		break;
-		
-	case PIXEL_FORMAT_YCrCb_422_I:
-	{
-		// We need to copy ... do it
-		uint8_t* pdst = dst;
-		uint8_t* psrc = src;
-		int h;
-		for (h = 0; h < srcHeight; h++) {
-			memcpy(pdst,psrc,srcWidth<<1);
-			pdst += dstStride;
-			psrc += srcStride;
+/* Try to capture straight into the preview window buffers. If not possible, 
+   the capture keeps using its own buffers and frames are copied to the window */
+bool CameraHardware::startDirectPreviewLocked()
+{
+	ALOGD("CameraHardware::startDirectPreviewLocked");
+
+	mDirectPreview = false;
+	mDirectBufCount = 0;
+	mDirectQueued = 0;
+	memset(mDirectBuf,0,sizeof(mDirectBuf));
+	memset(mDirectAddr,0,sizeof(mDirectAddr));
+	
+	// Frames are also read back to feed the preview and recording callbacks
+	status_t res = mWin->set_usage(mWin, GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN);
+	if (res != NO_ERROR) {
+		ALOGE("%s: Error setting preview window usage %d -> %s",
+			 __FUNCTION__, -res, strerror(-res));
+		return false;
+	}
+	
+	// The driver holds all its buffers, and the window must still be able
+	//  to hold the ones it needs to display
+	int undequeued = 0;
+	mWin->get_min_undequeued_buffer_count(mWin, &undequeued);
+	res = mWin->set_buffer_count(mWin, kBufferCount + undequeued);
+	if (res != NO_ERROR) {
+		ALOGE("%s: Unable to set preview window buffer count %d -> %s",
+			 __FUNCTION__, -res, strerror(-res));
+		return false;
+	}
+	
+	// Switch the capture to user supplied buffers
+	int count = camera.EnableUserPtr(kBufferCount);
+	if (count <= 0) {
+		ALOGD("Driver can't capture into user buffers - Copying frames");
+		return false;
+	}
+	if (count > kBufferCount)
+		count = kBufferCount;
+	mDirectBufCount = count;
+	
+	// And hand it the preview window buffers
+	for (int i = 0; i < count; i++) {
+		if (!queueDirectBufferLocked(i)) {
+			ALOGD("Unable to capture into preview window buffers - Copying frames");
+			stopDirectPreviewLocked();
+			camera.EnableUserPtr(0);
+			return false;
 		}
-		break; 
 	}
 	
-	case PIXEL_FORMAT_RGB_888:
-		yuyv_to_rgb24(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
-			
-	case PIXEL_FORMAT_RGBA_8888:
-		yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
-			
-	case PIXEL_FORMAT_RGBX_8888:
-		yuyv_to_rgb32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
-			
-	case PIXEL_FORMAT_BGRA_8888:
-		yuyv_to_bgr32(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break; 				
-		
-	case PIXEL_FORMAT_RGB_565:
-		yuyv_to_rgb565(src, srcStride, dst, dstStride, srcWidth, srcHeight);
-		break;
-		
-	default:
-		ALOGE("Unhandled pixel format");
+	ALOGD("Capturing straight into %d preview window buffers",count);
+	mDirectPreview = true;
+	return true;
+}
+
+/* Give back to the preview window all the buffers owned by the driver. The
+   capture must be stopped */
+void CameraHardware::stopDirectPreviewLocked()
+{
+	ALOGD("CameraHardware::stopDirectPreviewLocked");
+	
+    GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
+	for (int i = 0; i < kBufferCount; i++) {
+		if (mDirectBuf[i] != 0) {
+			grbuffer_mapper.unlock(*mDirectBuf[i]);
+			if (mWin != 0)
+				mWin->cancel_buffer(mWin, mDirectBuf[i]);
+			mDirectBuf[i] = 0;
+			mDirectAddr[i] = 0;
+		}
+	}
+	mDirectBufCount = 0;
+	mDirectQueued = 0;
+	mDirectPreview = false;
+}
+
+/* Dequeue a preview window buffer and queue it into the driver to be captured into */
+bool CameraHardware::queueDirectBufferLocked(int idx)
+{
+	// Get a videobuffer
+	buffer_handle_t* buf = NULL;
+	int stride = 0;
+	status_t res = mWin->dequeue_buffer(mWin, &buf, &stride);
+	if (res != NO_ERROR || buf == NULL) {
+        ALOGE("%s: Unable to dequeue preview window buffer: %d -> %s",
+            __FUNCTION__, -res, strerror(-res));
+        return false;
+	}
+
+    /* Let the preview window to lock the buffer. */
+    res = mWin->lock_buffer(mWin, buf);
+    if (res != NO_ERROR) {
+        ALOGE("%s: Unable to lock preview window buffer: %d -> %s",
+             __FUNCTION__, -res, strerror(-res));
+        mWin->cancel_buffer(mWin, buf);
+        return false;
+    }
+	
+	// The driver writes whole lines, so the window stride must match it
+	if (!camera.CanCaptureDirect(stride << 1)) {
+		ALOGD("%s: Preview window stride (%d) does not match the capture one",
+			__FUNCTION__, stride);
+        mWin->cancel_buffer(mWin, buf);
+        return false;
+	}
+
+	void* vaddr = NULL;
+    const Rect bounds(mPreviewWinWidth, mPreviewWinHeight);
+    GraphicBufferMapper& grbuffer_mapper(GraphicBufferMapper::get());
+    res = grbuffer_mapper.lock(*buf, GRALLOC_USAGE_SW_READ_OFTEN | GRALLOC_USAGE_SW_WRITE_OFTEN, bounds, &vaddr);
+    if (res != NO_ERROR || vaddr == NULL) {
+        ALOGE("%s: grbuffer_mapper.lock failure: %d -> %s",
+             __FUNCTION__, res, strerror(res));
+        mWin->cancel_buffer(mWin, buf);
+        return false;
+    }
+	
+	if (camera.QueueUserPtr(idx, vaddr, (stride << 1) * mPreviewWinHeight) < 0) {
+		grbuffer_mapper.unlock(*buf);
+        mWin->cancel_buffer(mWin, buf);
+        return false;
+	}
+	
+	mDirectBuf[idx] = buf;
+	mDirectAddr[idx] = vaddr;
+	android_atomic_inc(&mDirectQueued);
+	return true;
+}
+
+/* Show a captured preview window buffer, and replace it in the driver 
+   queue by a new one */
+void CameraHardware::postDirectFrameLocked(int idx) 
+{
+	if (idx >= 0 && mDirectBuf[idx] != 0) {
+	
+		// Post the filled buffer!
+		GraphicBufferMapper::get().unlock(*mDirectBuf[idx]);
+		mWin->enqueue_buffer(mWin, mDirectBuf[idx]);
+		mDirectBuf[idx] = 0;
+		mDirectAddr[idx] = 0;
+	}
+	
+	// Refill all the free slots. Slots that could not be filled before
+	//  are retried here, so the capture recovers once the window is able
+	//  to give us buffers again
+	for (int i = 0; i < mDirectBufCount; i++) {
+		if (mDirectBuf[i] == 0) {
+			queueDirectBufferLocked(i);
+		}
 	}
-				
-	/* Show it. */
-	mWin->enqueue_buffer(mWin, buf);
-				
-	// Post the filled buffer!
-	grbuffer_mapper.unlock(*buf);
 }
 
 int CameraHardware::beginAutoFocusThread(void *cookie)
@@ -1837,8 +2407,14 @@ int CameraHardware::pictureThread()
     bool raw = false;
     bool jpeg = false;
 	bool shutter = false;
+	int zslSlot = -1;
+	int zslWidth = 0, zslHeight = 0, quality = 0;
+	nsecs_t shotTime = 0;
     {
         Mutex::Autolock lock(mLock);
+		
+		// Pictures are compressed one at a time
+		waitCompressLocked();
 
         int w, h;
         mParameters.getPictureSize(&w, &h);
@@ -1849,119 +2425,120 @@ int CameraHardware::pictureThread()
 			shutter = true;
 		}
 		
-		/* The camera application will restart preview ... */
-        if (mPreviewThread != 0) {
-            stopPreviewLocked();
-        }
+		/* If the preview keeps frames at the picture size, just use one of them */
+		mShutterZsl = takeZslPictureLocked(raw, zslSlot);
+		if (zslSlot >= 0) {
+			mCompressing = true;
+			zslWidth = mRawPreviewWidth;
+			zslHeight = mRawPreviewHeight;
+			quality = mParameters.getInt(CameraParameters::KEY_JPEG_QUALITY);
+			shotTime = systemTime(SYSTEM_TIME_MONOTONIC);
+		}
+		if (!mShutterZsl) {
+		
+			/* The camera application will restart preview ... */
+	        if (mPreviewThread != 0) {
+	            stopPreviewLocked();
+	        }
 
-		ALOGD("CameraHardware::pictureThread: taking picture (%d x %d)", w, h);
+			ALOGD("CameraHardware::pictureThread: taking picture (%d x %d)", w, h);
 
-		if (camera.Open(VIDEO_DEVICE) == NO_ERROR) {
-			camera.Init(w, h, 1);
+			if (camera.Open(mVideoDevice.string()) == NO_ERROR) {
+				camera.Init(w, h, 1);
 			
-			/* Retrieve the real size being used */
-			camera.getSize(w,h);
+				/* Retrieve the real size being used */
+				camera.getSize(w,h);
 
-			ALOGD("CameraHardware::pictureThread: effective size: %dx%d",w, h);
+				ALOGD("CameraHardware::pictureThread: effective size: %dx%d",w, h);
 
-			/* Store it as the picture size to use */
-			mParameters.setPictureSize(w, h);
+				/* Store it as the picture size to use */
+				mParameters.setPictureSize(w, h);
 
-			/* And reinit the capture heap to reflect the real used size if needed */
-			initHeapLocked();
+				/* And reinit the capture heap to reflect the real used size if needed */
+				initHeapLocked();
 
-			camera.StartStreaming();
+				camera.StartStreaming();
 			
-			ALOGD("CameraHardware::pictureThread: waiting until camera picture stabilizes...");
+				ALOGD("CameraHardware::pictureThread: waiting until camera picture stabilizes...");
 	
-			int maxFramesToWait = 8;
-			int luminanceStableFor = 0;
-			int prevLuminance = 0;
-			int prevDif = -1;
-			int stride = w << 1;
-			int thresh = (w >> 4) * (h >> 4) * 12; // 5% of full range
+				int maxFramesToWait = 8;
+				int luminanceStableFor = 0;
+				int prevLuminance = 0;
+				int prevDif = -1;
+				int stride = w << 1;
+				int thresh = (w >> 4) * (h >> 4) * 12; // 5% of full range
 	
-			while (maxFramesToWait > 0 && luminanceStableFor < 4) {
-				uint8_t* ptr = (uint8_t *)mRawBuffer;
+				while (maxFramesToWait > 0 && luminanceStableFor < 4) {
+					uint8_t* ptr = (uint8_t *)mRawBuffer;
 				
-				// Get the image
-				camera.GrabRawFrame(ptr, (w * h << 1)); // Always YUYV
+					// Get the image
+					camera.GrabRawFrame(ptr, (w * h << 1)); // Always YUYV
 			
-				// luminance metering points
-				int luminance = 0;
-				for (int x = 0; x < (w<<1); x += 32) {
-					for (int y = 0; y < h*stride; y += 16*stride) {
-						luminance += ptr[y + x];
+					// luminance metering points
+					int luminance = 0;
+					for (int x = 0; x < (w<<1); x += 32) {
+						for (int y = 0; y < h*stride; y += 16*stride) {
+							luminance += ptr[y + x];
+						}
 					}
-				}
 			  
-				// Calculate variation of luminance
-				int dif = prevLuminance - luminance;
-				if (dif < 0) dif = -dif;
-				prevLuminance = luminance;
-
-				// Wait until variation is less than 5%
-				if (dif > thresh) {
-					luminanceStableFor = 1;
-				} else {
-					luminanceStableFor++;
-				}
+					// Calculate variation of luminance
+					int dif = prevLuminance - luminance;
+					if (dif < 0) dif = -dif;
+					prevLuminance = luminance;
+
+					// Wait until variation is less than 5%
+					if (dif > thresh) {
+						luminanceStableFor = 1;
+					} else {
+						luminanceStableFor++;
+					}
 			    
-				maxFramesToWait--;
+					maxFramesToWait--;
 	    
-				ALOGD("luminance: %4d, dif: %4d, thresh: %d, stableFor: %d, maxWait: %d", luminance, dif, thresh, luminanceStableFor, maxFramesToWait);
-			}
+					ALOGD("luminance: %4d, dif: %4d, thresh: %d, stableFor: %d, maxWait: %d", luminance, dif, thresh, luminanceStableFor, maxFramesToWait);
+				}
 	
-			ALOGD("CameraHardware::pictureThread: picture taken"); 			
+				ALOGD("CameraHardware::pictureThread: picture taken"); 			
+				shotTime = systemTime(SYSTEM_TIME_MONOTONIC);
 			
-			if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) {
+				if (mMsgEnabled & CAMERA_MSG_RAW_IMAGE) {
 								
-				ALOGD("CameraHardware::pictureThread: took raw picture");
-				raw = true;
-			}
-			
-	        if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
+					ALOGD("CameraHardware::pictureThread: took raw picture");
+					raw = true;
+				}
 			
-				int quality = mParameters.getInt(CameraParameters::KEY_JPEG_QUALITY);
-
-				uint8_t* jpegBuff = (uint8_t*) malloc(mJpegPictureBufferSize);
-				if (jpegBuff) {
-					
-					// Compress the raw captured image to our buffer
-					int fileSize = yuyv_to_jpeg((uint8_t *)mRawBuffer, jpegBuff, mJpegPictureBufferSize, w, h, w << 1,quality);
-					
-					// Create a buffer with the exact compressed size
-					if (mJpegPictureHeap) {
-						mJpegPictureHeap->release(mJpegPictureHeap);
-						mJpegPictureHeap = NULL;
-					}
-
-					mJpegPictureHeap = mRequestMemory(-1,fileSize,1,mCallbackCookie);
-					if (mJpegPictureHeap) { 
-						memcpy(mJpegPictureHeap->data,jpegBuff,fileSize);
-						ALOGD("CameraHardware::pictureThread: took jpeg picture compressed to %d bytes, q=%d", fileSize, quality);
-						jpeg = true;				
-					} else {
-						ALOGE("Unable to allocate memory for RawPicture");
-					}
-					free(jpegBuff);					
-					
-				} else {
-				
-					ALOGE("Unable to allocate temporary memory for Jpeg compression");
+		        if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE) {
+					jpeg = compressPictureLocked((uint8_t *)mRawBuffer, w, h, shotTime);
 				}
-				
-			}
 			
-			camera.Uninit();
-			camera.StopStreaming();
-			camera.Close();
+				camera.Uninit();
+				camera.StopStreaming();
+				camera.Close();
 		
-		} else {
-			ALOGE("CameraHardware::pictureThread: failed to grab image");
+			} else {
+				ALOGE("CameraHardware::pictureThread: failed to grab image");
+			}
 		}
     }
 	
+	/* Zero shutter lag pictures are compressed without the lock, so the 
+	   preview and the client calls are not held up meanwhile. The slot is 
+	   pinned until then, and the heaps are not reallocated while compressing */
+	if (zslSlot >= 0) {
+		int fileSize = compressPicture((uint8_t*)mRawPreviewBuffer[zslSlot], zslWidth, zslHeight, quality);
+		
+		Mutex::Autolock lock(mLock);
+		jpeg = pictureCompressedLocked(fileSize, quality, shotTime);
+		
+		// Give the frame back to the capture stage. Slots are only given back 
+		//  while holding the lock, so the free ring still has a single producer
+		//  at a time
+		mFreeRing.push(zslSlot);
+		mCompressing = false;
+		mCompressDone.broadcast();
+	}
+	
 	/* All this callbacks can potentially call one of our methods. 
 	   Make sure to dispatch them OUTSIDE the lock! */
 	if (shutter) {
@@ -1979,11 +2556,165 @@ int CameraHardware::pictureThread()
         mDataCb(CAMERA_MSG_COMPRESSED_IMAGE, mJpegPictureHeap, 0, NULL, mCallbackCookie);
     }
 
+	{
+		Mutex::Autolock lock(mLock);
+		mShutterLag = systemTime(SYSTEM_TIME_MONOTONIC) - mShutterTime;
+	}
+	
     ALOGD("CameraHardware::pictureThread OK");
 
     return NO_ERROR;
 }
 
+/* Compress a YUYV picture into the Jpeg pool, and get the view of it that
+   will be passed to the client */
+bool CameraHardware::compressPictureLocked(uint8_t* yuyv, int w, int h, nsecs_t shotTime)
+{
+	int quality = mParameters.getInt(CameraParameters::KEY_JPEG_QUALITY);
+	int fileSize = compressPicture(yuyv, w, h, quality);
+	return pictureCompressedLocked(fileSize, quality, shotTime);
+}
+
+/* The compression itself. It does not need mLock, as long as the heaps are
+   not reallocated meanwhile. Returns the compressed size, or -1 */
+int CameraHardware::compressPicture(uint8_t* yuyv, int w, int h, int quality)
+{
+	// Release the view of the previous picture
+	if (mJpegPictureHeap) {
+		mJpegPictureHeap->release(mJpegPictureHeap);
+		mJpegPictureHeap = NULL;
+	}
+
+	if (mJpegPoolBuffer == MAP_FAILED) {
+		ALOGE("No memory for Jpeg compression");
+		return -1;
+	}
+	
+	// Compress the raw captured image straight into the pool
+	int fileSize = yuyv_to_jpeg(yuyv, (uint8_t *)mJpegPoolBuffer, mJpegPictureBufferSize, w, h, w << 1,quality);
+	
+	// And map exactly the compressed size of it for the client
+	if (fileSize > 0) {
+		mJpegPictureHeap = mRequestMemory(mJpegPoolFd,fileSize,1,mCallbackCookie);
+	}
+	if (!mJpegPictureHeap) { 
+		ALOGE("Unable to compress the JpegPicture");
+		return -1;
+	}
+	return fileSize;
+}
+
+/* Account for a compressed picture. Returns if there is one to deliver */
+bool CameraHardware::pictureCompressedLocked(int fileSize, int quality, nsecs_t shotTime)
+{
+	if (fileSize <= 0)
+		return false;
+	
+	mJpegLatency = systemTime(SYSTEM_TIME_MONOTONIC) - shotTime;
+	mJpegSize = fileSize;
+	ALOGD("CameraHardware::pictureThread: took jpeg picture compressed to %d bytes, q=%d in %.2f ms", fileSize, quality,
+		mJpegLatency / 1000000.0);
+	return true;
+}
+
+/* Zero shutter lag is used if requested, and only when not recording */
+bool CameraHardware::useZslLocked()
+{
+	if (mRecordingEnabled && mMsgEnabled & CAMERA_MSG_VIDEO_FRAME)
+		return false;
+	const char* zsl = mParameters.get(V4L2CameraParameters::KEY_ZSL);
+	return zsl != NULL && !strcmp(zsl, V4L2CameraParameters::ZSL_ON);
+}
+
+/* Estimate how sharp a YUYV frame is, as the sum of the luminance 
+   differences between neighbour pixels, sampled every 16 lines. Blurred
+   frames (because of motion) have smaller differences */
+static int frameSharpness(const uint8_t* yuyv, int width, int height)
+{
+	int stride = width << 1;
+	int sharpness = 0;
+	for (int y = 0; y < height; y += 16) {
+		const uint8_t* p = yuyv + y * stride;
+		int line = 0;
+		for (int x = 0; x < stride - 4; x += 8) {
+			int d = p[x] - p[x + 2];
+			line += (d < 0) ? -d : d;
+		}
+		sharpness += line >> 4;
+	}
+	return sharpness;
+}
+
+/* Keep a converted raw frame for zero shutter lag pictures. The oldest kept
+   frame is given back to the capture stage */
+void CameraHardware::keepZslFrameLocked(int slot, nsecs_t timestamp)
+{
+	if (mZslCount == kZslFrameCount) {
+		mFreeRing.push(mZslFrames[0].slot);
+		memmove(&mZslFrames[0], &mZslFrames[1], (kZslFrameCount - 1) * sizeof(ZslFrame));
+		mZslCount--;
+	}
+	
+	ZslFrame& z = mZslFrames[mZslCount++];
+	z.slot = slot;
+	z.timestamp = timestamp;
+	z.sharpness = frameSharpness((uint8_t*)mRawPreviewBuffer[slot], mRawPreviewWidth, mRawPreviewHeight);
+}
+
+/* Wait until the picture being compressed without the lock, if any, is done */
+void CameraHardware::waitCompressLocked()
+{
+	while (mCompressing) {
+		mCompressDone.wait(mLock);
+	}
+}
+
+/* Take the picture from the sharpest of the kept frames, without stopping
+   the preview. Returns false if no frame was available. If the picture must
+   be compressed, slot is the raw preview slot holding it: It is not given
+   back to the capture stage, and the caller must give it back once done */
+bool CameraHardware::takeZslPictureLocked(bool& raw, int& slot)
+{
+	if (mPreviewThread == 0 || !mZsl || mZslCount == 0)
+		return false;
+	
+	// Pick the best frame. On ties, the most recent one
+	int best = 0;
+	for (int i = 1; i < mZslCount; i++) {
+		if (mZslFrames[i].sharpness >= mZslFrames[best].sharpness)
+			best = i;
+	}
+	slot = mZslFrames[best].slot;
+	
+	ALOGD("CameraHardware::pictureThread: zero shutter lag picture of %dx%d, captured %.2f ms before the shutter",
+		mRawPreviewWidth, mRawPreviewHeight, (mShutterTime - mZslFrames[best].timestamp) / 1000000.0);
+	
+	// It is not kept anymore, so the convert stage will not give it back to
+	//  the capture stage while we use it
+	memmove(&mZslFrames[best], &mZslFrames[best + 1], (mZslCount - best - 1) * sizeof(ZslFrame));
+	mZslCount--;
+	
+	uint8_t* yuyv = (uint8_t*)mRawPreviewBuffer[slot];
+	
+	// The raw picture heap has the picture size, that is the one being captured
+	if ((mMsgEnabled & CAMERA_MSG_RAW_IMAGE) && mRawBuffer != NULL &&
+		mRawPictureBufferSize == mRawPreviewFrameSize) {
+		memcpy(mRawBuffer, yuyv, mRawPreviewFrameSize);
+		raw = true;
+	}
+	
+	// The caller compresses it
+	if (mMsgEnabled & CAMERA_MSG_COMPRESSED_IMAGE)
+		return true;
+	
+	// Give the frame back to the capture stage. Slots are only given back 
+	//  while holding the lock, so the free ring still has a single producer
+	//  at a time
+	mFreeRing.push(slot);
+	slot = -1;
+	return true;
+}
+
 /****************************************************************************
  * Camera API callbacks as defined by camera_device_ops structure.
  *
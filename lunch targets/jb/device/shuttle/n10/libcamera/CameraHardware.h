@@ -23,6 +23,9 @@
 #include <utils/threads.h>
 #include <utils/threads.h>
 #include "V4L2Camera.h"
+#include "Converter.h"
+#include "FrameRing.h"
+#include "CameraStats.h"
 
 namespace android {
 
@@ -176,11 +179,11 @@ private:
 public:
     /* Constructs Camera instance.
      * Param:
-     *  cameraId - Zero based camera identifier, which is an index of the camera
-     *      instance in camera factory's array.
      *  module - Emulated camera HAL module descriptor.
+     *  videoDevice - V4L2 device node of the camera. Each camera has its own
+     *      instance, so several of them can stream at the same time.
      */
-    CameraHardware(const hw_module_t* module);
+    CameraHardware(const hw_module_t* module, const char* videoDevice);
 
     /* Destructs EmulatedCamera instance. */
     virtual ~CameraHardware();
@@ -204,26 +207,27 @@ public:
      */
     status_t closeCamera();
 
-    /* Gets camera information.
-     * This method is called in response to camera_module_t::get_camera_info
-     * callback.
-     * NOTE: When this method is called the object is locked.
-     * Note that failures in this method are reported as negave EXXX statuses.
-     */
-    static status_t getCameraInfo(struct camera_info* info);
-	
 private:
 
     static const int kBufferCount = 4;
+	
+	// Raw frames being captured or converted at the same time
+	static const int kRawSlotCount = 3;
+	
+	// Recent raw frames kept for zero shutter lag pictures
+	static const int kZslFrameCount = 3;
 
     void initDefaultParameters();
     void initHeapLocked();
 
+	// Runs one of the stages of the preview pipeline
 	class PreviewThread : public Thread {
 		CameraHardware* mHardware;
+		int (CameraHardware::*mStage)();
+		const char*		mName;
 		
 	public:
-		PreviewThread(CameraHardware* hw);
+		PreviewThread(CameraHardware* hw, int (CameraHardware::*stage)(), const char* name);
 		virtual void onFirstRef();
 		virtual bool threadLoop();
 	};
@@ -231,29 +235,116 @@ private:
     status_t startPreviewLocked();
     void 	 stopPreviewLocked();
 	
+	// The preview pipeline: The capture stage grabs frames from the driver,
+	//  the convert stage converts them to all the outputs and displays them,
+	//  and the deliver stage calls the preview and recording callbacks.
+    int captureThread();
     int previewThread();
+    int deliverThread();
 
     static int beginAutoFocusThread(void *cookie);
     int autoFocusThread();
 
     static int beginPictureThread(void *cookie);
     int pictureThread();
-
-    void fillPreviewWindow(uint8_t* yuyv, int srcWidth, int srcHeight);
+	
+	bool useZslLocked();
+	void keepZslFrameLocked(int slot, nsecs_t timestamp);
+	bool takeZslPictureLocked(bool& raw, int& slot);
+	bool compressPictureLocked(uint8_t* yuyv, int w, int h, nsecs_t shotTime);
+	int  compressPicture(uint8_t* yuyv, int w, int h, int quality);
+	bool pictureCompressedLocked(int fileSize, int quality, nsecs_t shotTime);
+	void waitCompressLocked();
+
+    void scalePreviewFrame(uint8_t* frame, int width, int height, uint8_t* raw);
+    buffer_handle_t* dequeuePreviewWindow(conv_dest& dest, int srcWidth, int srcHeight);
+    void postPreviewWindow(buffer_handle_t* buf);
+
+	bool startDirectPreviewLocked();
+	void stopDirectPreviewLocked();
+	bool queueDirectBufferLocked(int idx);
+	void postDirectFrameLocked(int idx);
 
     mutable Mutex       mLock;
 
+	String8				mVideoDevice;		// V4L2 device node of this camera
+	
     preview_stream_ops*	mWin;
 	int					mPreviewWinFmt;
 	int					mPreviewWinWidth;
 	int					mPreviewWinHeight;
 
+	// Zero copy preview: The capture is done straight into the preview
+	//  window buffers. Those are the window buffers owned by the driver
+	bool				mDirectPreview;
+	int					mDirectBufCount;
+	volatile int32_t	mDirectQueued;	// Updated by the capture and convert stages
+	buffer_handle_t*	mDirectBuf[kBufferCount];
+	void*				mDirectAddr[kBufferCount];
+	
+	// Captured frame, passed from the capture to the convert stage
+	struct CapturedFrame {
+		int				slot;		// Raw preview slot holding it, or -1
+		int				directIdx;	// Preview window buffer holding it, or -1
+		nsecs_t			timestamp;	// Capture time
+		nsecs_t			waitTime;	// Time spent waiting for the driver to capture it
+		nsecs_t			grabTime;	// Time spent grabbing it
+	};
+	
+	// Callbacks to call for a converted frame, passed from the convert to 
+	//  the deliver stage
+	struct DeliverMsg {
+		bool			preview;
+		int				previewIdx;
+		bool			record;
+		int				recIdx;
+		nsecs_t			timestamp;
+	};
+	
+	// The deliver ring is kept short, so the preview and recording buffers
+	//  being delivered are never reused by the convert stage: 2 waiting, 
+	//  1 being delivered and 1 being converted make up kBufferCount
+	FrameRing<CapturedFrame,8>	mCaptureRing;
+	FrameRing<int,8>			mFreeRing;		// Raw preview slots ready to capture into
+	FrameRing<DeliverMsg,2>		mDeliverRing;
+	volatile bool		mPipelineStop;
+	int					mFrameInterval;		// Time between frames, in us
+	int					mCaptureSlot;		// Raw preview slot being captured into
+	
+	// Pipeline statistics
+	CameraStats			mStats;
+	
+	// Zero shutter lag: While previewing at the picture size, the last 
+	//  converted raw frames are kept instead of being reused at once, so
+	//  pictures can be taken from them without reinitializing the sensor.
+	//  Protected by mLock
+	struct ZslFrame {
+		int				slot;		// Raw preview slot holding it
+		nsecs_t			timestamp;	// Capture time
+		int				sharpness;	// Higher is sharper
+	};
+	bool				mZsl;			// The running preview keeps frames
+	ZslFrame			mZslFrames[kZslFrameCount];	// Oldest first
+	int					mZslCount;
+	
+	// Zero shutter lag pictures are compressed without holding mLock. While
+	//  compressing, the picture heaps and the raw preview slots must not be
+	//  reallocated, and no other picture is compressed
+	bool				mCompressing;
+	Condition			mCompressDone;
+	
+	// Time from takePicture to the picture callbacks
+	nsecs_t				mShutterTime;
+	nsecs_t				mShutterLag;
+	bool				mShutterZsl;	// The last picture was a zero shutter lag one
+
     V4L2CameraParameters    mParameters;
 
 
     camera_memory_t*  	mRawPreviewHeap;
 	int					mRawPreviewFrameSize;
-	void*			    mRawPreviewBuffer;
+	int					mRawSlotCount;
+	void*			    mRawPreviewBuffer[kRawSlotCount + kZslFrameCount];
 	int					mRawPreviewWidth;
 	int					mRawPreviewHeight;
 	
@@ -261,6 +352,11 @@ private:
 	int                 mPreviewFrameSize;
 	void*               mPreviewBuffer[kBufferCount];
 	int					mPreviewFmt;
+	
+	// If the raw frames are not at the preview size, the preview frames are
+	//  scaled from them into this buffer, followed by the scaler line buffer
+	uint8_t*			mPreviewScaleBuffer;
+	int					mPreviewScaleSize;
 		
     camera_memory_t*  	mRawPictureHeap;
 	void*			    mRawBuffer;
@@ -271,14 +367,21 @@ private:
 	int                 mRecordingFrameSize;
 	int					mRecFmt;
 	
-    camera_memory_t*  	mJpegPictureHeap;
+    camera_memory_t*  	mJpegPictureHeap;		// exact sized view of the pool
 	int					mJpegPictureBufferSize;
+	int					mJpegPoolFd;			// ashmem region pictures are compressed into
+	void*				mJpegPoolBuffer;
+	nsecs_t				mJpegLatency;			// shot to jpeg time of the last picture
+	int					mJpegSize;
 
     V4L2Camera          camera;
     bool                mRecordingEnabled;
     
-    // protected by mLock
+    // protected by mLock. mPreviewThread is the convert stage, and tells
+	//  if the preview is running
+    sp<PreviewThread>   mCaptureThread;
     sp<PreviewThread>   mPreviewThread;
+    sp<PreviewThread>   mDeliverThread;
 
     camera_notify_callback    	mNotifyCb;
     camera_data_callback      	mDataCb;
@@ -0,0 +1,218 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#define LOG_TAG "CameraStats"
+
+extern "C" {
+#include <utils/Log.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+};
+#include "CameraStats.h"
+
+namespace android {
+
+static const char* const stageName[CameraStats::stCount] = {
+	"wait frame",
+	"grab",
+	"convert",
+	"win dequeue",
+	"win lock",
+	"win enqueue",
+	"latency",
+	"callbacks"
+};
+
+void CameraStats::reset()
+{
+	mStart = systemTime(SYSTEM_TIME_MONOTONIC);
+	memset((void*)mCounters, 0, sizeof(mCounters));
+	memset(mStages, 0, sizeof(mStages));
+	memset(mFormats, 0, sizeof(mFormats));
+	memset(mRing, 0, sizeof(mRing));
+	mRingHead = 0;
+}
+
+void CameraStats::addTo(StageStats& s, nsecs_t t)
+{
+	// Bucket i holds the times below 32us << i
+	int us = (int)(t >> 15);	// Units of ~32us
+	int b = 0;
+	while (us > 0 && b < kBuckets - 1) {
+		us >>= 1;
+		b++;
+	}
+	s.hist[b]++;
+	s.total += t;
+	s.last = t;
+	if (t > s.max)
+		s.max = t;
+	s.count++;
+}
+
+void CameraStats::addGrab(uint32_t fourcc, nsecs_t t)
+{
+	add(stGrab, t);
+	
+	// Find the format, or take a free entry for it. Only the capture stage
+	//  writes them, so no locking is needed
+	int i;
+	for (i = 0; i < kFormats; i++) {
+		if (mFormats[i].fourcc == fourcc)
+			break;
+		if (mFormats[i].fourcc == 0) {
+			mFormats[i].fourcc = fourcc;
+			break;
+		}
+	}
+	if (i < kFormats)
+		addTo(mFormats[i].grab, t);
+}
+
+void CameraStats::record(const FrameRecord& r)
+{
+	int32_t head = mRingHead;
+	mRing[head & (kHistory - 1)] = r;
+	android_atomic_release_store(head + 1, &mRingHead);
+}
+
+/* Copy the frame records, oldest first. The convert stage could be writing
+   the oldest ones meanwhile: Those are dropped */
+int CameraStats::history(FrameRecord* out) const
+{
+	int32_t head = android_atomic_acquire_load(&mRingHead);
+	int32_t first = head - (kHistory - 1);
+	if (first < 0)
+		first = 0;
+	int32_t i;
+	for (i = first; i < head; i++)
+		out[i - first] = mRing[i & (kHistory - 1)];
+		
+	// Drop the records overwritten while copying them
+	int32_t valid = android_atomic_acquire_load(&mRingHead) - (kHistory - 1);
+	int skip = (valid > first) ? valid - first : 0;
+	if (skip > head - first)
+		skip = head - first;
+	memmove(out, out + skip, (head - first - skip) * sizeof(*out));
+	return head - first - skip;
+}
+
+/* Time below which are the given per mil of the samples, as the upper 
+   bound of the histogram bucket holding them, in ms */
+static double percentile(const CameraStats::StageStats& s, int permil)
+{
+	uint32_t target = (uint32_t)(((uint64_t)s.count * permil + 999) / 1000);
+	uint32_t acc = 0;
+	int b;
+	for (b = 0; b < CameraStats::kBuckets - 1; b++) {
+		acc += s.hist[b];
+		if (acc >= target)
+			break;
+	}
+	if (b == CameraStats::kBuckets - 1)
+		return s.max / 1000000.0;
+	return (32768LL << b) / 1000000.0;
+}
+
+void CameraStats::dumpStage(String8& out, const char* name, const StageStats& s)
+{
+	if (s.count == 0) {
+		out.appendFormat("    %-12s no samples\n", name);
+		return;
+	}
+	out.appendFormat("    %-12s %6u  last %7.2f  avg %7.2f  max %7.2f  p50 <%7.2f  p99 <%7.2f ms\n", 
+		name, s.count, s.last / 1000000.0, s.total / (s.count * 1000000.0), s.max / 1000000.0,
+		percentile(s, 500), percentile(s, 990));
+}
+
+void CameraStats::dump(String8& out) const
+{
+	nsecs_t el = elapsed();
+	out.appendFormat("  Pipeline: %.2f fps sustained over %.1f s\n", 
+		el > 0 ? mCounters[cnDisplayed] * 1000000000.0 / el : 0.0, el / 1000000000.0);
+	out.appendFormat("  Frames: %d captured, %d displayed, %d delivered, %d without callbacks, "
+		"%d capture errors, %d preview window errors\n",
+		mCounters[cnCaptured], mCounters[cnDisplayed], mCounters[cnDelivered],
+		mCounters[cnDroppedCallbacks], mCounters[cnCaptureErrors], mCounters[cnWindowErrors]);
+	out.appendFormat("  Stage times:\n");
+	int i;
+	for (i = 0; i < stCount; i++)
+		dumpStage(out, stageName[i], mStages[i]);
+		
+	out.appendFormat("  Grab times by capture format:\n");
+	for (i = 0; i < kFormats && mFormats[i].fourcc != 0; i++) {
+		char name[8];
+		uint32_t f = mFormats[i].fourcc;
+		snprintf(name, sizeof(name), "'%c%c%c%c'", f & 0xFF, (f >> 8) & 0xFF, (f >> 16) & 0xFF, (f >> 24) & 0xFF);
+		dumpStage(out, name, mFormats[i].grab);
+	}
+	
+	// And the last frames
+	FrameRecord recs[kHistory];
+	int n = history(recs);
+	int first = (n > 8) ? n - 8 : 0;
+	out.appendFormat("  Last frames (us): wait grab convert dequeue lock enqueue latency\n");
+	for (i = first; i < n; i++) {
+		const FrameRecord& r = recs[i];
+		out.appendFormat("    %lld: %d %d %d %d %d %d %d\n", (long long)(r.timestamp / 1000),
+			r.us[stWait], r.us[stGrab], r.us[stConvert], r.us[stWinDequeue],
+			r.us[stWinLock], r.us[stWinEnqueue], r.us[stLatency]);
+	}
+}
+
+bool CameraStats::exportTo(const char* path) const
+{
+	FrameRecord recs[kHistory];
+	FileHeader hdr;
+	int32_t counters[cnCount];
+	int i;
+	
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = kFileMagic;
+	hdr.version = kFileVersion;
+	hdr.stages = stCount;
+	hdr.counters = cnCount;
+	hdr.buckets = kBuckets;
+	hdr.formats = kFormats;
+	hdr.records = history(recs);
+	hdr.elapsed = elapsed();
+	for (i = 0; i < cnCount; i++)
+		counters[i] = mCounters[i];
+	
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+	if (fd < 0) {
+		ALOGE("Unable to export the statistics to %s: %s", path, strerror(errno));
+		return false;
+	}
+	bool ok = 
+		write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+		write(fd, counters, sizeof(counters)) == sizeof(counters) &&
+		write(fd, mStages, sizeof(mStages)) == sizeof(mStages) &&
+		write(fd, mFormats, sizeof(mFormats)) == sizeof(mFormats) &&
+		write(fd, recs, hdr.records * sizeof(recs[0])) == (ssize_t)(hdr.records * sizeof(recs[0]));
+	close(fd);
+	return ok;
+}
+
+}; // namespace android
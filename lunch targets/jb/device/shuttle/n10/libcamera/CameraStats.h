@@ -0,0 +1,162 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef CAMERA_STATS_H
+#define CAMERA_STATS_H
+
+extern "C" {
+#include <stdint.h>
+};
+#include <cutils/atomic.h>
+#include <utils/Timers.h>
+#include <utils/String8.h>
+
+/* Per frame logging is a cost on the hot path by itself, so it is only built
+   if CAMERA_LOG_FRAMES is defined */
+#ifdef CAMERA_LOG_FRAMES
+#define ALOGF(...) ALOGD(__VA_ARGS__)
+#else
+#define ALOGF(...) ((void)0)
+#endif
+
+namespace android {
+
+/* Timing of the preview pipeline. Each stage is always timed by the same 
+   thread, so its statistics have a single writer and are updated without 
+   locking. The dump can read them while they are being updated, but that 
+   only skews a single sample. The stage times of the last frames are also
+   kept in a ring, written by the convert stage, to see how the stages of
+   each frame relate to each other */
+class CameraStats {
+public:
+	enum Stage {
+		stWait,				// Waiting for the driver to capture a frame (capture stage)
+		stGrab,				// Dequeuing it and converting it to YUYV (capture stage)
+		stConvert,			// Converting it to all the outputs (convert stage)
+		stWinDequeue,		// Dequeuing a preview window buffer (convert stage)
+		stWinLock,			// Locking it (convert stage)
+		stWinEnqueue,		// Showing it (convert stage)
+		stLatency,			// From capture to display (convert stage)
+		stCallback,			// Preview and recording callbacks (deliver stage)
+		stCount
+	};
+	
+	enum Counter {
+		cnCaptured,			// Frames captured
+		cnDisplayed,		// Frames converted and displayed
+		cnDelivered,		// Frames handled by the deliver stage
+		cnDroppedCallbacks,	// Frames without callbacks, as the deliver stage was late
+		cnCaptureErrors,	// Frames the driver failed to give us
+		cnWindowErrors,		// Frames not displayed, as the preview window failed
+		cnCount
+	};
+	
+	enum { 
+		kBuckets = 16,		// Histogram buckets: [0,32us), [32us,64us) ... [0.54s,inf)
+		kFormats = 4,		// Capture pixel formats timed separately
+		kHistory = 64		// Frames kept in the ring. Must be a power of 2
+	};
+
+	// Statistics of a stage. Times in ns
+	struct StageStats {
+		int64_t  total;
+		int64_t  last;
+		int64_t  max;
+		uint32_t count;
+		uint32_t hist[kBuckets];
+		uint32_t reserved;
+	};
+	
+	// Grab times of a capture pixel format
+	struct FormatStats {
+		uint32_t fourcc;		// V4L2 pixel format, 0 if unused
+		uint32_t reserved;
+		StageStats grab;
+	};
+	
+	// Stage times of a frame
+	struct FrameRecord {
+		int64_t timestamp;		// Capture time, in ns
+		int32_t us[stCount];	// Time spent in each stage, in us. stCallback is not known yet
+	};
+
+	// Layout of the binary export: The header, the counters, the stages,
+	//  the formats and the frame records, oldest first
+	struct FileHeader {
+		uint32_t magic;			// kFileMagic
+		uint32_t version;		// kFileVersion
+		uint32_t stages;		// stCount
+		uint32_t counters;		// cnCount
+		uint32_t buckets;		// kBuckets
+		uint32_t formats;		// kFormats
+		uint32_t records;		// Number of frame records
+		uint32_t reserved;
+		int64_t  elapsed;		// Time since the statistics were reset, in ns
+	};
+	enum { 
+		kFileMagic = 0x41545343,	// 'CSTA'
+		kFileVersion = 1
+	};
+
+	CameraStats() { reset(); }
+	
+	// Start over. Only while the pipeline is stopped
+	void reset();
+	
+	// Time spent in a stage. Only from the thread owning the stage
+	void add(Stage s, nsecs_t t) { addTo(mStages[s], t); }
+	
+	// Time spent grabbing a frame captured in the given V4L2 pixel format.
+	//  Also counted as stGrab. Only from the capture stage
+	void addGrab(uint32_t fourcc, nsecs_t t);
+	
+	// Count an event. From any thread
+	void count(Counter c) { android_atomic_inc(&mCounters[c]); }
+	
+	// Keep the stage times of a displayed frame. Only from the convert stage
+	void record(const FrameRecord& r);
+	
+	// Human readable summary, for dumpsys media.camera
+	void dump(String8& out) const;
+	
+	// Write all the statistics to a file, in the binary layout described above
+	bool exportTo(const char* path) const;
+	
+	const StageStats& stage(Stage s) const { return mStages[s]; }
+	int32_t counter(Counter c) const { return mCounters[c]; }
+	nsecs_t elapsed() const { return systemTime(SYSTEM_TIME_MONOTONIC) - mStart; }
+	
+private:
+	static void addTo(StageStats& s, nsecs_t t);
+	static void dumpStage(String8& out, const char* name, const StageStats& s);
+	int history(FrameRecord* out) const;
+	
+	nsecs_t				mStart;
+	volatile int32_t	mCounters[cnCount];
+	StageStats			mStages[stCount];
+	FormatStats			mFormats[kFormats];
+	FrameRecord			mRing[kHistory];
+	volatile int32_t	mRingHead;			// Next record to write. Written by the convert stage
+};
+
+}; // namespace android
+
+#endif
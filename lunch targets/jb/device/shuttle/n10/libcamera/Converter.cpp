@@ -39,13 +39,27 @@
     along with this program.  If not, see <http://www.gnu.org/licenses/>.
 	
  */
+
+#define LOG_TAG "Converter"
+
 extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <endian.h>
 #include <jpeglib.h>
+#ifdef CONVERTER_HAVE_SSE2
+#include <cpuid.h>
+#endif
 };
+#include <utils/Log.h>
+#include <utils/Timers.h>
+#include <cutils/properties.h>
 #include "Converter.h"
+#include "ConverterSimd.h"
 #include "V4L2Camera.h"
 
 /*clip value between 0 and 255*/
@@ -55,6 +69,8 @@ extern "C" {
 /* convert yuyv to YVU420SP */
 void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
+
 	// Start of Y plane
 	uint8_t* dstY = dst;
 	
@@ -62,30 +78,11 @@ void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, i
 	uint8_t* dstVU = dst + dstStride * dstHeight;
 	
 	int h=0;
-	int w=0;
-	int dyvu = dstStride - width;
-	int sw   = srcStride - (width<<1);
 	for (h = 0; h<height; h +=2) {
-		for (w=0; w < width; w += 2) {
-			*dstY++  = *src++;							// Y0
-			dstVU[1] = (src[0] + src[srcStride]) >> 1;	// U
-			src++;
-			*dstY++  = *src++;							// Y1
-			dstVU[0] = (src[0] + src[srcStride]) >> 1;	// V
-			src++;
-			dstVU+=2;
-		}
-		src   += sw;
-		dstY  += dyvu;
-		dstVU += dyvu;
-		for (w=0; w < width; w += 2) {
-			*dstY++  = *src;	// Y0
-			src += 2;
-			*dstY++  = *src;	// Y1
-			src += 2;
-		}
-		src   += sw;
-		dstY  += dyvu;
+		ops->yuyv2_to_nv21(dstY, dstY + dstStride, dstVU, src, src + srcStride, width);
+		src   += srcStride << 1;
+		dstY  += dstStride << 1;
+		dstVU += dstStride;
 	}
 }
 
@@ -93,6 +90,8 @@ void yuyv_to_yvu420sp(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, i
 /* This format assumes that the horizontal strides (luma and chroma) are multiple of 16 pixels */
 void yuyv_to_yvu420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
+
 	// Calculate the chroma plane stride
 	int dstVUStride = ((dstStride >> 1) + 15) & (-16);
 
@@ -106,37 +105,20 @@ void yuyv_to_yvu420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 	uint8_t* dstU = dstV + (dstVUStride * dstHeight >> 1);
 	
 	int h=0;
-	int w=0;
-	int dy  = dstStride - width;
-	int dvu = dstVUStride - (width >> 1);
-	int sw  = srcStride - (width<<1);
 	for (h = 0; h<height; h +=2) {
-		for (w=0; w < width; w += 2) {
-			*dstY++ = *src++;							// Y0
-			*dstU++ = (src[0] + src[srcStride]) >> 1;	// U
-			src++;
-			*dstY++ = *src++;							// Y1
-			*dstV++ = (src[0] + src[srcStride]) >> 1;	// V
-			src++;
-		}
-		src   += sw;
-		dstY  += dy;
-		dstU += dvu;
-		dstV += dvu;
-		for (w=0; w < width; w += 2) {
-			*dstY++  = *src;	// Y0
-			src += 2;
-			*dstY++  = *src;	// Y1
-			src += 2;
-		}
-		src   += sw;
-		dstY  += dy;
+		ops->yuyv2_to_yuv420p(dstY, dstY + dstStride, dstU, dstV, src, src + srcStride, width);
+		src  += srcStride << 1;
+		dstY += dstStride << 1;
+		dstU += dstVUStride;
+		dstV += dstVUStride;
 	}
 }
 
 /* This format assumes that the horizontal strides (luma and chroma) are multiple of 16 pixels */
 void yuyv_to_yuv420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
+
 	// Calculate the chroma plane stride
 	int dstUVStride = ((dstStride >> 1) + 15) & (-16);
 
@@ -150,31 +132,12 @@ void yuyv_to_yuv420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 	uint8_t* dstV = dstU + (dstUVStride * dstHeight >> 1);
 	
 	int h=0;
-	int w=0;
-	int dy  = dstStride - width;
-	int dvu = dstUVStride - (width >> 1);
-	int sw  = srcStride - (width<<1);
 	for (h = 0; h<height; h +=2) {
-		for (w=0; w < width; w += 2) {
-			*dstY++ = *src++;							// Y0
-			*dstU++ = (src[0] + src[srcStride]) >> 1;	// U
-			src++;
-			*dstY++ = *src++;							// Y1
-			*dstV++ = (src[0] + src[srcStride]) >> 1;	// V
-			src++;
-		}
-		src   += sw;
-		dstY  += dy;
-		dstU += dvu;
-		dstV += dvu;
-		for (w=0; w < width; w += 2) {
-			*dstY++  = *src;	// Y0
-			src += 2;
-			*dstY++  = *src;	// Y1
-			src += 2;
-		}
-		src   += sw;
-		dstY  += dy;
+		ops->yuyv2_to_yuv420p(dstY, dstY + dstStride, dstU, dstV, src, src + srcStride, width);
+		src  += srcStride << 1;
+		dstY += dstStride << 1;
+		dstU += dstUVStride;
+		dstV += dstUVStride;
 	}
 }
 
@@ -183,6 +146,8 @@ void yuyv_to_yuv420p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 /* This format assumes that the horizontal strides (luma and chroma) are multiple of 16 pixels */
 void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, int srcStride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
+
 	// Calculate the chroma plane stride
 	int dstVUStride = ((dstStride >> 1) + 15) & (-16);
 
@@ -196,21 +161,12 @@ void yuyv_to_yvu422p(uint8_t *dst,int dstStride, int dstHeight, uint8_t *src, in
 	uint8_t* dstU = dstV + (dstVUStride * dstHeight);
 	
 	int h=0;
-	int w=0;
-	int dy  = dstStride - width;
-	int dvu = dstVUStride - (width >> 1);
-	int sw  = srcStride - (width<<1);
 	for (h = 0; h<height; h ++) {
-		for (w=0; w < width; w += 2) {
-			*dstY++ = *src++;	// Y0
-			*dstU++ = *src++;	// U
-			*dstY++ = *src++;	// Y1
-			*dstV++ = *src++;	// V
-		}
-		src  += sw;
-		dstY += dy;
-		dstU += dvu;
-		dstV += dvu;
+		ops->yuyv_to_yuv422p(dstY, dstU, dstV, src, width);
+		src  += srcStride;
+		dstY += dstStride;
+		dstU += dstVUStride;
+		dstV += dstVUStride;
 	}
 }
 
@@ -262,33 +218,14 @@ void y16_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int w
 */
 void yyuv_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int width, int height)
 {
-	uint8_t *ptmp=NULL;
-	uint8_t *pfmb=NULL;
-	ptmp = src;
-	pfmb = dst;
-	
+	const conv_simd_ops* ops = converter_ops();
 	int h=0;
-	int w=0;
-	int dw = dstStride - (width << 1);
-	int sw = srcStride - (width << 1);
 	
 	for(h=0;h<height;h++) 
 	{
-		for(w=0;w<width;w+=2) 
-		{
-			/* Y0 */
-			*pfmb++ = ptmp[0];
-			/* U */
-			*pfmb++ = ptmp[2];
-			/* Y1 */
-			*pfmb++ = ptmp[1];
-			/* V */
-			*pfmb++ = ptmp[3];
-			
-			ptmp += 4;
-		}
-		pfmb += dw; // Correct for stride
-		ptmp += sw;
+		ops->yyuv_to_yuyv(dst, src, width);
+		dst += dstStride;
+		src += srcStride;
 	}
 }
 
@@ -303,30 +240,14 @@ void yyuv_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int
 */
 void uyvy_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int width, int height)
 {
-	uint8_t *ptmp = src;
-	uint8_t *pfmb = dst;
+	const conv_simd_ops* ops = converter_ops();
 	int h=0;
-	int w=0;
-	int dw = dstStride - (width << 1);
-	int sw = srcStride - (width << 1);
 	
 	for(h=0;h<height;h++) 
 	{
-		for(w=0;w<width;w+=2) 
-		{
-			/* Y0 */
-			*pfmb++ = ptmp[1];
-			/* U */
-			*pfmb++ = ptmp[0];
-			/* Y1 */
-			*pfmb++ = ptmp[3];
-			/* V */
-			*pfmb++ = ptmp[2];
-			
-			ptmp += 4;
-		}
-		pfmb += dw; // Correct for stride
-		ptmp += sw;
+		ops->uyvy_to_yuyv(dst, src, width);
+		dst += dstStride;
+		src += srcStride;
 	}
 }
 
@@ -341,33 +262,14 @@ void uyvy_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int
 */
 void yvyu_to_yuyv (uint8_t *dst,int dstStride, uint8_t *src, int srcStride, int width, int height)
 {
-	uint8_t *ptmp=NULL;
-	uint8_t *pfmb=NULL;
-	ptmp = src;
-	pfmb = dst;
-	
+	const conv_simd_ops* ops = converter_ops();
 	int h=0;
-	int w=0;
-	int dw = dstStride - (width << 1);
-	int sw = srcStride - (width << 1);
 	
 	for(h=0;h<height;h++) 
 	{
-		for(w=0;w<width;w+=2) 
-		{
-			/* Y0 */
-			*pfmb++ = ptmp[0];
-			/* U */
-			*pfmb++ = ptmp[3];
-			/* Y1 */
-			*pfmb++ = ptmp[2];
-			/* V */
-			*pfmb++ = ptmp[1];
-			
-			ptmp += 4;
-		}
-		pfmb += dw; // Correct for stride
-		ptmp += sw;
+		ops->yvyu_to_yuyv(dst, src, width);
+		dst += dstStride;
+		src += srcStride;
 	}
 }
 
@@ -1314,6 +1216,230 @@ void bayer_to_rgb24(uint8_t *pBay, uint8_t *pRGB24, int width, int height, int p
 	}
 }
 
+/* Demosaic a line that is not the first or the last one into 3 color planes.
+   bayer points to the line above it. This is the line loop of bayer_to_rgbbgr24,
+   with the pixel pairs handed to the line kernel, and gives the same output */
+static void bayer_line_to_rgbp(const uint8_t *bayer, int stride, uint8_t *c0, uint8_t *c1, uint8_t *c2,
+	int width, bool start_with_green, bool blue_line, const conv_simd_ops* ops)
+{
+	int t0, t1, n;
+	/* (width - 2) because of the border */
+	const uint8_t *bayerEnd = bayer + (width - 2);
+
+#define PUT_PIXEL(a,b,c) { *c0++ = (a); *c1++ = (b); *c2++ = (c); }
+
+	if (start_with_green) 
+	{
+		t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
+		/* Write first pixel */
+		t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
+		if (blue_line) 
+			PUT_PIXEL(t0, t1, bayer[stride])
+		else 
+			PUT_PIXEL(bayer[stride], t1, t0)
+
+		/* Write second pixel */
+		t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
+		if (blue_line) 
+			PUT_PIXEL(t0, bayer[stride + 1], t1)
+		else 
+			PUT_PIXEL(t1, bayer[stride + 1], t0)
+		bayer++;
+	} 
+	else 
+	{
+		/* Write first pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		if (blue_line) 
+			PUT_PIXEL(t0, bayer[stride], bayer[stride + 1])
+		else 
+			PUT_PIXEL(bayer[stride + 1], bayer[stride], t0)
+	}
+
+	/* The pixel pairs. The color sampled on this line goes to c0 on red
+	   lines and to c2 on blue ones */
+	n = (bayer <= bayerEnd - 2) ? (((bayerEnd - 2 - bayer) >> 1) + 1) * 2 : 0;
+	if (blue_line)
+		ops->bayer_to_rgbp(c2, c1, c0, bayer, bayer + stride, bayer + stride * 2, n);
+	else
+		ops->bayer_to_rgbp(c0, c1, c2, bayer, bayer + stride, bayer + stride * 2, n);
+	c0 += n; c1 += n; c2 += n;
+	bayer += n;
+
+	if (bayer < bayerEnd) 
+	{
+		/* write second to last pixel */
+		t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
+			bayer[stride * 2 + 2] + 2) >> 2;
+		t1 = (bayer[1] + bayer[stride] +
+			bayer[stride + 2] + bayer[stride * 2 + 1] +
+			2) >> 2;
+		if (blue_line) 
+			PUT_PIXEL(t0, t1, bayer[stride + 1])
+		else 
+			PUT_PIXEL(bayer[stride + 1], t1, t0)
+
+		/* write last pixel */
+		t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
+		if (blue_line) 
+			PUT_PIXEL(t0, bayer[stride + 2], bayer[stride + 1])
+		else 
+			PUT_PIXEL(bayer[stride + 1], bayer[stride + 2], t0)
+	} 
+	else
+	{
+		/* write last pixel */
+		t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
+		t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
+		if (blue_line) 
+			PUT_PIXEL(t0, t1, bayer[stride + 1])
+		else 
+			PUT_PIXEL(bayer[stride + 1], t1, t0)
+	}
+
+#undef PUT_PIXEL
+}
+
+/* Demosaic a border line through the interleaved scratch line, and split it
+   into 3 color planes */
+static void bayer_border_line_to_rgbp(uint8_t *bayer, uint8_t *adjacent_bayer, uint8_t *scratch,
+	uint8_t *c0, uint8_t *c1, uint8_t *c2, int width, bool start_with_green, bool blue_line)
+{
+	int w;
+	convert_border_bayer_line_to_bgr24(bayer, adjacent_bayer, scratch, width, start_with_green, blue_line);
+	for (w = 0; w < width; w++) {
+		*c0++ = scratch[0];
+		*c1++ = scratch[1];
+		*c2++ = scratch[2];
+		scratch += 3;
+	}
+}
+
+/* Convert bayer raw data straight to YUYV. Each line is demosaiced into 3 color
+   planes of a line buffer that stays in the cache, and converted to YUYV right
+   away, so the full RGB24 frame bayer_to_rgb24 needs is never built.
+   The demosaic is the one of bayer_to_rgb24, the color conversion the fixed
+   point one of the rgbp_to_yuyv line kernel. work must hold width * 6 bytes */
+void bayer_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height, int pix_order, uint8_t *work)
+{
+	const conv_simd_ops* ops = converter_ops();
+	uint8_t *c0 = work, *c1 = work + width, *c2 = work + width * 2, *scratch = work + width * 3;
+	bool start_with_green, blue_line;
+	int h;
+
+	switch (pix_order) 
+	{
+		case 1: /* grgrgr... | bgbgbg... (V4L2_PIX_FMT_SGRBG8)*/
+			start_with_green = true; blue_line = true;
+			break;
+		case 2: /* bgbgbg... | grgrgr... (V4L2_PIX_FMT_SBGGR8)*/
+			start_with_green = false; blue_line = false;
+			break;
+		case 3: /* rgrgrg... ! gbgbgb... (V4L2_PIX_FMT_SRGGB8)*/
+			start_with_green = false; blue_line = true;
+			break;
+		default: /* gbgbgb... | rgrgrg... (V4L2_PIX_FMT_SGBRG8), the default */
+			start_with_green = true; blue_line = false;
+			break;
+	}
+
+	/* render the first line */
+	bayer_border_line_to_rgbp(src, src + srcStride, scratch, c0, c1, c2, width,
+		start_with_green, blue_line);
+	ops->rgbp_to_yuyv(dst, c0, c1, c2, width);
+	dst += dstStride;
+
+	/* reduce height by 2 because of the special case top/bottom line */
+	for (h = height - 2; h > 0; h--) 
+	{
+		bayer_line_to_rgbp(src, srcStride, c0, c1, c2, width, start_with_green, blue_line, ops);
+		ops->rgbp_to_yuyv(dst, c0, c1, c2, width);
+		dst += dstStride;
+		src += srcStride;
+
+		blue_line = !blue_line;
+		start_with_green = !start_with_green;
+	}
+
+	/* render the last line */
+	bayer_border_line_to_rgbp(src + srcStride, src, scratch, c0, c1, c2, width,
+		!start_with_green, !blue_line);
+	ops->rgbp_to_yuyv(dst, c0, c1, c2, width);
+}
+
+/* Bilinear sample at pos (16.16 fixed point, in samples) of a line with max + 1
+   samples that are step bytes apart */
+static inline uint8_t lerp_sample(const uint8_t* src, int step, int pos, int max)
+{
+	if (pos <= 0)
+		return src[0];
+	if (pos >= (max << 16))
+		return src[max * step];
+	int i = pos >> 16, f = (pos >> 9) & 127;
+	src += i * step;
+	return (src[0] * (128 - f) + src[step] * f + 64) >> 7;
+}
+
+/* Scale a YUYV line horizontally. step is the source to destination width ratio
+   in 16.16 fixed point. Chroma uses the same step, in pixel pairs */
+static void yuyv_hscale_line(uint8_t* dst, const uint8_t* src, int dstWidth, int srcWidth, int step)
+{
+	int x = (step >> 1) - 0x8000;	/* Center of the first output pixel */
+	int c = x;						/* and of the first output pixel pair */
+	int w;
+	for (w = 0; w < dstWidth; w += 2) {
+		dst[0] = lerp_sample(src, 2, x, srcWidth - 1);			/* Y0 */
+		dst[1] = lerp_sample(src + 1, 4, c, (srcWidth >> 1) - 1);	/* U */
+		dst[2] = lerp_sample(src, 2, x + step, srcWidth - 1);	/* Y1 */
+		dst[3] = lerp_sample(src + 3, 4, c, (srcWidth >> 1) - 1);	/* V */
+		x += step << 1;
+		c += step;
+		dst += 4;
+	}
+}
+
+/* Scale a YUYV image. Sample positions are pixel centers, and each output
+   sample is the bilinear blend of the 4 nearest source ones, so a 2:1
+   reduction is exactly a 2x2 box filter. Each output line is first blended
+   vertically into line, unless it falls on a source line, and then scaled
+   horizontally. line must hold srcWidth * 2 bytes */
+void yuyv_scale(uint8_t *dst, int dstStride, int dstWidth, int dstHeight,
+				uint8_t *src, int srcStride, int srcWidth, int srcHeight, uint8_t *line)
+{
+	const conv_simd_ops* ops = converter_ops();
+	int xstep = (srcWidth << 16) / dstWidth;
+	int ystep = (srcHeight << 16) / dstHeight;
+	int y = (ystep >> 1) - 0x8000;	/* Center of the first output line */
+	int h;
+	for (h = 0; h < dstHeight; h++) {
+		const uint8_t* s;
+		int i = 0, f = 0;
+		if (y > 0) {
+			i = y >> 16;
+			f = (y >> 9) & 127;
+		}
+		if (i >= srcHeight - 1) {
+			i = srcHeight - 1;
+			f = 0;
+		}
+		s = src + i * srcStride;
+		if (f) {
+			ops->yuyv_lerp(line, s, s + srcStride, f, srcWidth);
+			s = line;
+		}
+
+		if (srcWidth == dstWidth)
+			memcpy(dst, s, dstWidth << 1);
+		else if (srcWidth == dstWidth * 2)
+			ops->yuyv_halve(dst, s, dstWidth);	/* Same as yuyv_hscale_line, but vectorized */
+		else
+			yuyv_hscale_line(dst, s, dstWidth, srcWidth, xstep);
+
+		dst += dstStride;
+		y += ystep;
+	}
+}
+
 
 void rgb_to_yuyv(uint8_t *pyuv, int dstStride, uint8_t *prgb, int srcStride, int width, int height) 
 {
@@ -1390,7 +1516,7 @@ static inline int clip(int x)
 }
 
 
-void yuyv_to_rgb565_line (uint8_t *pyuv, uint8_t *prgb, int width)
+static void yuyv_to_rgb565_line (uint8_t *prgb, const uint8_t *pyuv, int width)
 {
 	int l=0;
 	int ln = width >> 1;
@@ -1434,17 +1560,18 @@ void yuyv_to_rgb565_line (uint8_t *pyuv, uint8_t *prgb, int width)
 /* regular yuv (YUYV) to rgb565*/
 void yuyv_to_rgb565 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_rgb565_line (pyuv,prgb,width);
+		ops->yuyv_to_rgb565(prgb, pyuv, width);
 		pyuv += pyuvstride;
 		prgb += prgbstride;
 	}
 }
 
 
-void yuyv_to_rgb24_line (uint8_t *pyuv, uint8_t *prgb, int width)
+static void yuyv_to_rgb24_line (uint8_t *prgb, const uint8_t *pyuv, int width)
 {
 	int l=0;
 	int ln = width >> 1;
@@ -1483,16 +1610,17 @@ void yuyv_to_rgb24_line (uint8_t *pyuv, uint8_t *prgb, int width)
 /* regular yuv (YUYV) to rgb24*/
 void yuyv_to_rgb24 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_rgb24_line (pyuv,prgb,width);	
+		ops->yuyv_to_rgb24(prgb, pyuv, width);	
 		pyuv += pyuvstride;
 		prgb += prgbstride;
 	}
 }
 
-void yuyv_to_rgb32_line (uint8_t *pyuv, uint8_t *prgb, int width)
+static void yuyv_to_rgb32_line (uint8_t *prgb, const uint8_t *pyuv, int width)
 {
 	int l=0;
 	int ln = width >> 1;
@@ -1533,10 +1661,11 @@ void yuyv_to_rgb32_line (uint8_t *pyuv, uint8_t *prgb, int width)
 /* regular yuv (YUYV) to rgb32*/
 void yuyv_to_rgb32 (uint8_t *pyuv, int pyuvstride, uint8_t *prgb,int prgbstride, int width, int height)
 {
+	const conv_simd_ops* ops = converter_ops();
 	int h=0;
 	for(h=0;h<height;h++) 
 	{	
-		yuyv_to_rgb32_line (pyuv,prgb,width);		
+		ops->yuyv_to_rgb32(prgb, pyuv, width);		
 		pyuv += pyuvstride;
 		prgb += prgbstride;
 	}
@@ -1640,6 +1769,779 @@ void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride
 	}
 }
 
+#define CONV_MAX_DESTS 4
+
+/* Convert a yuyv frame to several destinations in a single pass */
+void yuyv_to_multi(const conv_dest* dests, int count, uint8_t *src, int srcStride)
+{
+	const conv_simd_ops* ops = converter_ops();
+	
+	// Handle the extra destinations, if any, on a second pass
+	if (count > CONV_MAX_DESTS) {
+		yuyv_to_multi(dests + CONV_MAX_DESTS, count - CONV_MAX_DESTS, src, srcStride);
+		count = CONV_MAX_DESTS;
+	}
+	
+	// Output pointers of each destination. Exactly the same layout used by 
+	//  the single destination converters
+	struct {
+		uint8_t* y;			// Y plane or packed pixels
+		uint8_t* u;			// U plane, or VU plane for semiplanar formats
+		uint8_t* v;			// V plane
+		int cStride;		// Chroma stride
+	} out[CONV_MAX_DESTS];
+	
+	int top = 0, bottom = 0;
+	int i;
+	for (i = 0; i < count; i++) {
+		const conv_dest* d = &dests[i];
+		int cStride = ((d->dstStride >> 1) + 15) & (-16);
+		
+		out[i].y = d->dst;
+		out[i].u = NULL;
+		out[i].v = NULL;
+		out[i].cStride = cStride;
+		
+		switch (d->fmt) {
+		case CONV_YVU420SP:
+			out[i].u = d->dst + d->dstStride * d->dstHeight;
+			out[i].cStride = d->dstStride;
+			break;
+			
+		case CONV_YVU420P:
+			out[i].v = d->dst + d->dstStride * d->dstHeight;
+			out[i].u = out[i].v + (cStride * d->dstHeight >> 1);
+			break;
+			
+		case CONV_YUV420P:
+			out[i].u = d->dst + d->dstStride * d->dstHeight;
+			out[i].v = out[i].u + (cStride * d->dstHeight >> 1);
+			break;
+			
+		case CONV_YVU422P:
+			out[i].v = d->dst + d->dstStride * d->dstHeight;
+			out[i].u = out[i].v + (cStride * d->dstHeight);
+			break;
+		}
+		
+		// Get the range of source lines we need
+		if (i == 0 || d->srcY < top)
+			top = d->srcY;
+		if (i == 0 || d->srcY + d->height > bottom)
+			bottom = d->srcY + d->height;
+	}
+	
+	int y;
+	for (y = top; y < bottom; y++) {
+		const uint8_t* line = src + y * srcStride;
+		
+		for (i = 0; i < count; i++) {
+			const conv_dest* d = &dests[i];
+			int row = y - d->srcY;
+			if (row < 0 || row >= d->height) 
+				continue;
+				
+			const uint8_t* s = line + (d->srcX << 1);
+			switch (d->fmt) {
+			
+			// 4:2:0 formats take lines in pairs
+			case CONV_YVU420SP:
+				if (row & 1)
+					break;
+				ops->yuyv2_to_nv21(out[i].y, out[i].y + d->dstStride, out[i].u, s, s + srcStride, d->width);
+				out[i].y += d->dstStride << 1;
+				out[i].u += out[i].cStride;
+				break;
+				
+			case CONV_YVU420P:
+			case CONV_YUV420P:
+				if (row & 1)
+					break;
+				ops->yuyv2_to_yuv420p(out[i].y, out[i].y + d->dstStride, out[i].u, out[i].v, s, s + srcStride, d->width);
+				out[i].y += d->dstStride << 1;
+				out[i].u += out[i].cStride;
+				out[i].v += out[i].cStride;
+				break;
+				
+			case CONV_YVU422P:
+				ops->yuyv_to_yuv422p(out[i].y, out[i].u, out[i].v, s, d->width);
+				out[i].y += d->dstStride;
+				out[i].u += out[i].cStride;
+				out[i].v += out[i].cStride;
+				break;
+				
+			case CONV_YUYV:
+				memcpy(out[i].y, s, d->width << 1);
+				out[i].y += d->dstStride;
+				break;
+			
+			case CONV_RGB565:
+				ops->yuyv_to_rgb565(out[i].y, s, d->width);
+				out[i].y += d->dstStride;
+				break;
+				
+			case CONV_RGB24:
+				ops->yuyv_to_rgb24(out[i].y, s, d->width);
+				out[i].y += d->dstStride;
+				break;
+				
+			case CONV_RGB32:
+				ops->yuyv_to_rgb32(out[i].y, s, d->width);
+				out[i].y += d->dstStride;
+				break;
+				
+			case CONV_BGR32:
+				yuyv_to_bgr32_line((uint8_t*)s, out[i].y, d->width);
+				out[i].y += d->dstStride;
+				break;
+			}
+		}
+	}
+}
+
+//--------------------------------------------------------------------------------------
+
+/*------------------------------- Line kernels -------------------------------*/
+
+/* Reference line kernels. Those are the exact byte at a time conversions the
+   frame converters always used. The SIMD implementations must match them bit
+   for bit, and use them to convert the pixels that do not fill a whole block */
+
+static void yuyv2_to_nv21_line(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstVU,
+							   const uint8_t* src0, const uint8_t* src1, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dstY0++ = src0[0];							// Y0
+		dstVU[1] = (src0[1] + src1[1]) >> 1;		// U
+		*dstY0++ = src0[2];							// Y1
+		dstVU[0] = (src0[3] + src1[3]) >> 1;		// V
+		dstVU += 2;
+		*dstY1++ = src1[0];							// Y0
+		*dstY1++ = src1[2];							// Y1
+		src0 += 4;
+		src1 += 4;
+	}
+}
+
+static void yuyv2_to_yuv420p_line(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV,
+								  const uint8_t* src0, const uint8_t* src1, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dstY0++ = src0[0];							// Y0
+		*dstU++  = (src0[1] + src1[1]) >> 1;		// U
+		*dstY0++ = src0[2];							// Y1
+		*dstV++  = (src0[3] + src1[3]) >> 1;		// V
+		*dstY1++ = src1[0];							// Y0
+		*dstY1++ = src1[2];							// Y1
+		src0 += 4;
+		src1 += 4;
+	}
+}
+
+static void yuyv_to_yuv422p_line(uint8_t* dstY, uint8_t* dstU, uint8_t* dstV, const uint8_t* src, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dstY++ = *src++;	// Y0
+		*dstU++ = *src++;	// U
+		*dstY++ = *src++;	// Y1
+		*dstV++ = *src++;	// V
+	}
+}
+
+static void uyvy_to_yuyv_line(uint8_t* dst, const uint8_t* src, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dst++ = src[1];	/* Y0 */
+		*dst++ = src[0];	/* U */
+		*dst++ = src[3];	/* Y1 */
+		*dst++ = src[2];	/* V */
+		src += 4;
+	}
+}
+
+static void yvyu_to_yuyv_line(uint8_t* dst, const uint8_t* src, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dst++ = src[0];	/* Y0 */
+		*dst++ = src[3];	/* U */
+		*dst++ = src[2];	/* Y1 */
+		*dst++ = src[1];	/* V */
+		src += 4;
+	}
+}
+
+static void yyuv_to_yuyv_line(uint8_t* dst, const uint8_t* src, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dst++ = src[0];	/* Y0 */
+		*dst++ = src[2];	/* U */
+		*dst++ = src[1];	/* Y1 */
+		*dst++ = src[3];	/* V */
+		src += 4;
+	}
+}
+
+/* The pixel pair loop of bayer_to_rgbbgr24 */
+static void bayer_to_rgbp_line(uint8_t* row, uint8_t* g, uint8_t* other,
+	const uint8_t* top, const uint8_t* mid, const uint8_t* bot, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		/* Red or blue sample */
+		*other++ = (top[0] + top[2] + bot[0] + bot[2] + 2) >> 2;
+		*g++ = (top[1] + mid[0] + mid[2] + bot[1] + 2) >> 2;
+		*row++ = mid[1];
+		/* Green sample */
+		*other++ = (top[2] + bot[2] + 1) >> 1;
+		*g++ = mid[2];
+		*row++ = (mid[1] + mid[3] + 1) >> 1;
+		top += 2; mid += 2; bot += 2;
+	}
+}
+
+/* BT.601 in 8 bit fixed point. The chroma coefficients are halved, as they
+   are applied to the sum of both pixels */
+static void rgbp_to_yuyv_line(uint8_t* dst, const uint8_t* r, const uint8_t* g, const uint8_t* b, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		int rs = r[0] + r[1], gs = g[0] + g[1], bs = b[0] + b[1];
+		int u = ((56 * bs - 19 * rs - 37 * gs) >> 8) + 128;
+		int v = ((79 * rs - 66 * gs - 13 * bs) >> 8) + 128;
+		*dst++ = (77 * r[0] + 150 * g[0] + 29 * b[0]) >> 8;	/* Y0 */
+		*dst++ = CLIP(u);									/* U */
+		*dst++ = (77 * r[1] + 150 * g[1] + 29 * b[1]) >> 8;	/* Y1 */
+		*dst++ = CLIP(v);									/* V */
+		r += 2; g += 2; b += 2;
+	}
+}
+
+static void yuyv_lerp_line(uint8_t* dst, const uint8_t* a, const uint8_t* b, int frac, int width)
+{
+	int n = width << 1;
+	int i;
+	for (i=0; i < n; i++)
+		dst[i] = (a[i] * (128 - frac) + b[i] * frac + 64) >> 7;
+}
+
+static void yuyv_halve_line(uint8_t* dst, const uint8_t* src, int width)
+{
+	int w;
+	for (w=0; w < width; w += 2) {
+		*dst++ = (src[0] + src[2] + 1) >> 1;	/* Y0 */
+		*dst++ = (src[1] + src[5] + 1) >> 1;	/* U */
+		*dst++ = (src[4] + src[6] + 1) >> 1;	/* Y1 */
+		*dst++ = (src[3] + src[7] + 1) >> 1;	/* V */
+		src += 8;
+	}
+}
+
+const conv_simd_ops conv_c_ops = {
+	"c",
+	yuyv2_to_nv21_line,
+	yuyv2_to_yuv420p_line,
+	yuyv_to_yuv422p_line,
+	yuyv_to_rgb565_line,
+	yuyv_to_rgb24_line,
+	yuyv_to_rgb32_line,
+	uyvy_to_yuyv_line,
+	yvyu_to_yuyv_line,
+	yyuv_to_yuyv_line,
+	bayer_to_rgbp_line,
+	rgbp_to_yuyv_line,
+	yuyv_lerp_line,
+	yuyv_halve_line
+};
+
+/* 32bit word at a time (SWAR) line kernels. Tegra2 has no NEON unit, but
+   working on whole words instead of bytes still cuts the loads and stores
+   by 4. Bytes are assumed to be stored in little endian order in the words.
+   The truncated average of 4 bytes at once is computed as 
+     (a & b) + (((a ^ b) & 0xFEFEFEFE) >> 1) 
+   which is exactly (a + b) >> 1 on each byte, as no carry crosses bytes */
+
+static inline uint32_t ld32(const uint8_t* p)
+{
+	uint32_t v;
+	memcpy(&v,p,4);	// Compiles to a single (unaligned) load
+	return v;
+}
+
+static inline void st32(uint8_t* p, uint32_t v)
+{
+	memcpy(p,&v,4);	// Compiles to a single (unaligned) store
+}
+
+static inline uint32_t havg32(uint32_t a, uint32_t b)
+{
+	return (a & b) + (((a ^ b) & 0xFEFEFEFEU) >> 1);
+}
+
+/* Rounded up average of 4 bytes at once: (a + b + 1) >> 1 on each byte */
+static inline uint32_t ravg32(uint32_t a, uint32_t b)
+{
+	return (a | b) - (((a ^ b) & 0xFEFEFEFEU) >> 1);
+}
+
+/* The lumas of 2 YUYV words */
+static inline uint32_t luma32(uint32_t a0, uint32_t a1)
+{
+	return  (a0 & 0xFFU) | ((a0 >> 8) & 0xFF00U) |
+			((a1 << 16) & 0xFF0000U) | ((a1 << 8) & 0xFF000000U);
+}
+
+static void yuyv2_to_nv21_swar(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstVU,
+							   const uint8_t* src0, const uint8_t* src1, int width)
+{
+	int n = width & (-4);
+	int w;
+	for (w = 0; w < n; w += 4) {
+		uint32_t a0 = ld32(src0), a1 = ld32(src0 + 4);
+		uint32_t b0 = ld32(src1), b1 = ld32(src1 + 4);
+		uint32_t c0 = havg32(a0,b0), c1 = havg32(a1,b1);
+		
+		st32(dstY0, luma32(a0,a1));
+		st32(dstY1, luma32(b0,b1));
+		st32(dstVU, (c0 >> 24) | (c0 & 0xFF00U) | 
+					((c1 >> 8) & 0xFF0000U) | ((c1 << 16) & 0xFF000000U));
+		dstY0 += 4; dstY1 += 4; dstVU += 4;
+		src0 += 8; src1 += 8;
+	}
+	if (n < width)
+		yuyv2_to_nv21_line(dstY0, dstY1, dstVU, src0, src1, width - n);
+}
+
+static void yuyv2_to_yuv420p_swar(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV,
+								  const uint8_t* src0, const uint8_t* src1, int width)
+{
+	int n = width & (-8);
+	int w;
+	for (w = 0; w < n; w += 8) {
+		uint32_t a0 = ld32(src0), a1 = ld32(src0 + 4), a2 = ld32(src0 + 8), a3 = ld32(src0 + 12);
+		uint32_t b0 = ld32(src1), b1 = ld32(src1 + 4), b2 = ld32(src1 + 8), b3 = ld32(src1 + 12);
+		uint32_t c0 = havg32(a0,b0), c1 = havg32(a1,b1), c2 = havg32(a2,b2), c3 = havg32(a3,b3);
+		
+		st32(dstY0    , luma32(a0,a1));
+		st32(dstY0 + 4, luma32(a2,a3));
+		st32(dstY1    , luma32(b0,b1));
+		st32(dstY1 + 4, luma32(b2,b3));
+		st32(dstU, ((c0 >> 8) & 0xFFU) | (c1 & 0xFF00U) | 
+				   ((c2 << 8) & 0xFF0000U) | ((c3 << 16) & 0xFF000000U));
+		st32(dstV, (c0 >> 24) | ((c1 >> 16) & 0xFF00U) | 
+				   ((c2 >> 8) & 0xFF0000U) | (c3 & 0xFF000000U));
+		dstY0 += 8; dstY1 += 8; dstU += 4; dstV += 4;
+		src0 += 16; src1 += 16;
+	}
+	if (n < width)
+		yuyv2_to_yuv420p_line(dstY0, dstY1, dstU, dstV, src0, src1, width - n);
+}
+
+static void yuyv_to_yuv422p_swar(uint8_t* dstY, uint8_t* dstU, uint8_t* dstV, const uint8_t* src, int width)
+{
+	int n = width & (-8);
+	int w;
+	for (w = 0; w < n; w += 8) {
+		uint32_t a0 = ld32(src), a1 = ld32(src + 4), a2 = ld32(src + 8), a3 = ld32(src + 12);
+		
+		st32(dstY    , luma32(a0,a1));
+		st32(dstY + 4, luma32(a2,a3));
+		st32(dstU, ((a0 >> 8) & 0xFFU) | (a1 & 0xFF00U) | 
+				   ((a2 << 8) & 0xFF0000U) | ((a3 << 16) & 0xFF000000U));
+		st32(dstV, (a0 >> 24) | ((a1 >> 16) & 0xFF00U) | 
+				   ((a2 >> 8) & 0xFF0000U) | (a3 & 0xFF000000U));
+		dstY += 8; dstU += 4; dstV += 4;
+		src += 16;
+	}
+	if (n < width)
+		yuyv_to_yuv422p_line(dstY, dstU, dstV, src, width - n);
+}
+
+static void uyvy_to_yuyv_swar(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-2);
+	int w;
+	for (w = 0; w < n; w += 2) {
+		uint32_t x = ld32(src);
+		st32(dst, ((x >> 8) & 0x00FF00FFU) | ((x << 8) & 0xFF00FF00U));
+		dst += 4; src += 4;
+	}
+	if (n < width)
+		uyvy_to_yuyv_line(dst, src, width - n);
+}
+
+static void yvyu_to_yuyv_swar(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-2);
+	int w;
+	for (w = 0; w < n; w += 2) {
+		uint32_t x = ld32(src);
+		st32(dst, (x & 0x00FF00FFU) | ((x >> 16) & 0xFF00U) | (x << 16 & 0xFF000000U));
+		dst += 4; src += 4;
+	}
+	if (n < width)
+		yvyu_to_yuyv_line(dst, src, width - n);
+}
+
+static void yyuv_to_yuyv_swar(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-2);
+	int w;
+	for (w = 0; w < n; w += 2) {
+		uint32_t x = ld32(src);
+		st32(dst, (x & 0xFF0000FFU) | ((x & 0xFF00U) << 8) | ((x >> 8) & 0xFF00U));
+		dst += 4; src += 4;
+	}
+	if (n < width)
+		yyuv_to_yuyv_line(dst, src, width - n);
+}
+
+static void yuyv_halve_swar(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-2);
+	int w;
+	for (w = 0; w < n; w += 2) {
+		uint32_t x0 = ld32(src), x1 = ld32(src + 4);	// Y0 U0 Y1 V0, Y2 U1 Y3 V1
+		st32(dst, ravg32((x0 & 0xFF00FFFFU) | ((x1 & 0xFFU) << 16),		// Y0 U0 Y2 V0
+						 ((x0 >> 16) & 0xFFU) | (x1 & 0xFFFFFF00U)));	// Y1 U1 Y3 V1
+		dst += 4; src += 8;
+	}
+	if (n < width)
+		yuyv_halve_line(dst, src, width - n);
+}
+
+const conv_simd_ops conv_swar_ops = {
+	"swar",
+	yuyv2_to_nv21_swar,
+	yuyv2_to_yuv420p_swar,
+	yuyv_to_yuv422p_swar,
+	yuyv_to_rgb565_line,	// No gain for the color space conversions
+	yuyv_to_rgb24_line,
+	yuyv_to_rgb32_line,
+	uyvy_to_yuyv_swar,
+	yvyu_to_yuyv_swar,
+	yyuv_to_yuyv_swar,
+	bayer_to_rgbp_line,		// No gain either: the words would have to be split in 16 bit lanes
+	rgbp_to_yuyv_line,
+	yuyv_lerp_line,
+	yuyv_halve_swar
+};
+
+#ifdef CONVERTER_HAVE_NEON
+
+#ifndef AT_HWCAP
+#define AT_HWCAP 16
+#endif
+
+#ifndef HWCAP_NEON
+#define HWCAP_NEON (1 << 12)
+#endif
+
+/* Ask the kernel if the cpu we are running on has a NEON unit. Tegra2 does
+   not have one, so this must be checked at runtime */
+static bool cpu_has_neon()
+{
+	bool ret = false;
+	int fd = open("/proc/self/auxv", O_RDONLY);
+	if (fd < 0)
+		return false;
+		
+	unsigned long entry[2];
+	while (read(fd, entry, sizeof(entry)) == sizeof(entry)) {
+		if (entry[0] == AT_HWCAP) {
+			ret = (entry[1] & HWCAP_NEON) != 0;
+			break;
+		}
+		if (entry[0] == 0)
+			break;
+	}
+	close(fd);
+	return ret;
+}
+#endif
+
+#ifdef CONVERTER_HAVE_SSE2
+static bool cpu_has_sse2()
+{
+	unsigned int eax, ebx, ecx, edx;
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		return false;
+	return (edx & bit_SSE2) != 0;
+}
+#endif
+
+/* Description of the line kernels, to drive all of them the same way when 
+   validating and timing them. Each call converts 'lines' lines of width 
+   pixels, reading 'src' and writing 'dst' bytes per pixel. The source
+   advances 'srcStep' bytes per pixel to the next call */
+typedef struct {
+	const char* name;
+	int src;
+	int srcStep;
+	int dst;
+	int lines;
+} conv_kernel_desc;
+
+enum {
+	CK_NV21, CK_YUV420P, CK_YUV422P, CK_RGB565, CK_RGB24, CK_RGB32,
+	CK_UYVY, CK_YVYU, CK_YYUV, CK_BAYER, CK_RGBP, CK_LERP, CK_HALVE, 
+	CK_COUNT
+};
+
+static const conv_kernel_desc conv_kernels[CK_COUNT] = {
+	{ "yuyv2_to_nv21",		4, 4, 3, 2 },
+	{ "yuyv2_to_yuv420p",	4, 4, 3, 2 },
+	{ "yuyv_to_yuv422p",	2, 2, 2, 1 },
+	{ "yuyv_to_rgb565",		2, 2, 2, 1 },
+	{ "yuyv_to_rgb24",		2, 2, 3, 1 },
+	{ "yuyv_to_rgb32",		2, 2, 4, 1 },
+	{ "uyvy_to_yuyv",		2, 2, 2, 1 },
+	{ "yvyu_to_yuyv",		2, 2, 2, 1 },
+	{ "yyuv_to_yuyv",		2, 2, 2, 1 },
+	{ "bayer_to_rgbp",		3, 1, 3, 1 },	// Reads the lines above and below
+	{ "rgbp_to_yuyv",		3, 3, 2, 1 },
+	{ "yuyv_lerp",			4, 2, 2, 1 },	// Blends this line and the next one
+	{ "yuyv_halve",			4, 4, 2, 1 }
+};
+
+/* Call a line kernel. The planes of the source and destination lines are
+   laid out one after the other, width pixels each. The source must have 
+   width + 2 bytes of slack after srcStep * width bytes */
+static void conv_run_kernel(const conv_simd_ops* ops, int k, uint8_t* d, const uint8_t* s, int width)
+{
+	int w = width;
+	switch (k) {
+	case CK_NV21:		ops->yuyv2_to_nv21(d, d + w, d + 2*w, s, s + 2*w, w); break;
+	case CK_YUV420P:	ops->yuyv2_to_yuv420p(d, d + w, d + 2*w, d + 2*w + w/2, s, s + 2*w, w); break;
+	case CK_YUV422P:	ops->yuyv_to_yuv422p(d, d + w, d + w + w/2, s, w); break;
+	case CK_RGB565:		ops->yuyv_to_rgb565(d, s, w); break;
+	case CK_RGB24:		ops->yuyv_to_rgb24(d, s, w); break;
+	case CK_RGB32:		ops->yuyv_to_rgb32(d, s, w); break;
+	case CK_UYVY:		ops->uyvy_to_yuyv(d, s, w); break;
+	case CK_YVYU:		ops->yvyu_to_yuyv(d, s, w); break;
+	case CK_YYUV:		ops->yyuv_to_yuyv(d, s, w); break;
+	case CK_BAYER:		ops->bayer_to_rgbp(d, d + w, d + 2*w, s, s + w, s + 2*w, w); break;
+	case CK_RGBP:		ops->rgbp_to_yuyv(d, s, s + w, s + 2*w, w); break;
+	case CK_LERP:		ops->yuyv_lerp(d, s, s + 2*w, (w * 7) & 127, w); break;
+	case CK_HALVE:		ops->yuyv_halve(d, s, w); break;
+	}
+}
+
+static void conv_fill_random(uint8_t* p, int len, uint32_t seed)
+{
+	while (len--) {
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		*p++ = (uint8_t)seed;
+	}
+}
+
+/* Golden output check: Run every kernel of an implementation and the 
+   reference C one on the same random lines, at all the widths that
+   exercise the block and tail paths, and compare the whole destination
+   buffers, so writes past the end are caught too. Returns the name of the
+   first kernel that does not match, or NULL if all of them do */
+#define CONV_CHECK_WIDTH 162
+static const char* conv_check_ops(const conv_simd_ops* ops)
+{
+	if (ops == &conv_c_ops)
+		return NULL;
+	
+	uint8_t src[4 * CONV_CHECK_WIDTH + CONV_CHECK_WIDTH + 2];
+	uint8_t ref[4 * CONV_CHECK_WIDTH + 16];
+	uint8_t out[4 * CONV_CHECK_WIDTH + 16];
+	int k, w;
+	for (k = 0; k < CK_COUNT; k++) {
+		for (w = 2; w <= CONV_CHECK_WIDTH; w += 2) {
+			conv_fill_random(src, sizeof(src), (k << 16) + w);
+			memset(ref, 0xA5, sizeof(ref));
+			memset(out, 0xA5, sizeof(out));
+			conv_run_kernel(&conv_c_ops, k, ref, src, w);
+			conv_run_kernel(ops, k, out, src, w);
+			if (memcmp(ref, out, sizeof(ref)))
+				return conv_kernels[k].name;
+		}
+	}
+	return NULL;
+}
+
+/* All the converter implementations built in */
+static const conv_simd_ops* const conv_all_ops[] = {
+	&conv_c_ops,
+	&conv_swar_ops,
+#ifdef CONVERTER_HAVE_NEON
+	&conv_neon_ops,
+#endif
+#ifdef CONVERTER_HAVE_SSE2
+	&conv_sse2_ops,
+#endif
+};
+#define CONV_ALL_OPS_COUNT (sizeof(conv_all_ops) / sizeof(conv_all_ops[0]))
+
+/* Whether an implementation can run on this cpu */
+static bool conv_ops_usable(const conv_simd_ops* ops)
+{
+#ifdef CONVERTER_HAVE_NEON
+	if (ops == &conv_neon_ops && !cpu_has_neon())
+		return false;
+#endif
+#ifdef CONVERTER_HAVE_SSE2
+	if (ops == &conv_sse2_ops && !cpu_has_sse2())
+		return false;
+#endif
+	return true;
+}
+
+/* Find a usable implementation by name */
+static const conv_simd_ops* conv_find_ops(const char* name)
+{
+	unsigned int i;
+	for (i = 0; i < CONV_ALL_OPS_COUNT; i++) {
+		if (!strcmp(conv_all_ops[i]->name, name))
+			return conv_ops_usable(conv_all_ops[i]) ? conv_all_ops[i] : NULL;
+	}
+	return NULL;
+}
+
+/* Log the throughput of every kernel of every implementation available,
+   converting whole frames at the usual capture sizes. It takes a few 
+   seconds, so it runs on its own thread, started if the 
+   debug.camera.convbench property is set. It only reads the kernel tables,
+   so the converters can be used meanwhile */
+static void* conv_benchmark(void*)
+{
+	static const int sizes[][2] = {
+		{ 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1600, 1200 }
+	};
+	
+	unsigned int i, j;
+	for (j = 0; j < (sizeof(sizes) / sizeof(sizes[0])); j++) {
+		int w = sizes[j][0];
+		int h = sizes[j][1];
+		uint8_t* src = (uint8_t*) malloc(4 * w * h + w + 2);
+		uint8_t* dst = (uint8_t*) malloc(4 * w * h);
+		if (src == NULL || dst == NULL) {
+			free(src);
+			free(dst);
+			return NULL;
+		}
+		conv_fill_random(src, 4 * w * h + w + 2, w * h);
+	
+		for (i = 0; i < CONV_ALL_OPS_COUNT; i++) {
+			const conv_simd_ops* ops = conv_all_ops[i];
+			if (!conv_ops_usable(ops))
+				continue;
+			int k;
+			for (k = 0; k < CK_COUNT; k++) {
+				const conv_kernel_desc& kd = conv_kernels[k];
+				int frames = 0;
+				nsecs_t start = systemTime(SYSTEM_TIME_MONOTONIC);
+				nsecs_t spent;
+				do {
+					const uint8_t* s = src;
+					uint8_t* d = dst;
+					int y;
+					for (y = 0; y < h; y += kd.lines) {
+						conv_run_kernel(ops, k, d, s, w);
+						s += kd.srcStep * w;
+						d += kd.dst * w;
+					}
+					frames++;
+					spent = systemTime(SYSTEM_TIME_MONOTONIC) - start;
+				} while (spent < 50000000LL);
+				
+				ALOGI("%s %-16s %4dx%-4d: %7.1f MPix/s, %8d bytes/frame", ops->name, kd.name, w, h,
+					(double) w * h * frames * 1000.0 / spent, (kd.src + kd.dst) * w * (h / kd.lines));
+			}
+		}
+		free(src);
+		free(dst);
+	}
+	return NULL;
+}
+
+static const conv_simd_ops* conv_ops = &conv_c_ops;
+static pthread_once_t conv_ops_once = PTHREAD_ONCE_INIT;
+
+static void converter_select_ops()
+{
+	conv_ops = &conv_swar_ops;
+#if __BYTE_ORDER != __LITTLE_ENDIAN
+	conv_ops = &conv_c_ops;
+#endif
+#ifdef CONVERTER_HAVE_NEON
+	if (cpu_has_neon())
+		conv_ops = &conv_neon_ops;
+#endif
+#ifdef CONVERTER_HAVE_SSE2
+	if (cpu_has_sse2())
+		conv_ops = &conv_sse2_ops;
+#endif
+
+	// Never trust a kernel that does not match the reference one: Its 
+	//  output would just be wrong
+	const char* bad = conv_check_ops(conv_ops);
+	if (bad != NULL) {
+		ALOGE("'%s' converters: %s does not match the reference one", conv_ops->name, bad);
+		conv_ops = &conv_c_ops;
+	}
+	ALOGI("Using '%s' converters", conv_ops->name);
+	
+	char value[PROPERTY_VALUE_MAX];
+	property_get("debug.camera.convbench", value, "0");
+	if (atoi(value)) {
+		// Never on the caller's thread: It is converting a captured frame
+		pthread_t thread;
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+		if (pthread_create(&thread, &attr, conv_benchmark, NULL) != 0)
+			ALOGE("Could not start the converter benchmark");
+		pthread_attr_destroy(&attr);
+	}
+}
+
+const conv_simd_ops* converter_ops()
+{
+	pthread_once(&conv_ops_once, converter_select_ops);
+	return conv_ops;
+}
+
+/* Force a given converter implementation. Used to validate the SIMD kernels
+   against the reference ones */
+bool converter_set_impl(const char* name)
+{
+	const conv_simd_ops* ops = conv_find_ops(name);
+	if (ops == NULL)
+		return false;
+	
+	// Make sure autodetection won't override our choice later
+	converter_ops();
+	conv_ops = ops;
+	return true;
+}
+
+const char* converter_impl_name()
+{
+	return converter_ops()->name;
+}
+
+/* Checks the given implementation without selecting it, so it can be done
+   while converting */
+const char* converter_check_impl(const char* name)
+{
+	const conv_simd_ops* ops = conv_find_ops(name);
+	if (ops == NULL)
+		return "unavailable";
+	return conv_check_ops(ops);
+}
+
 /*	This a custom destination manager for jpeglib that
 	enables the use of memory to memory compression.
 	See IJG documentation for details.
@@ -1662,6 +2564,7 @@ METHODDEF(void) init_destination (j_compress_ptr cinfo)
 	dest->pub.next_output_byte 	= dest->buffer; 	/* set destination buffer */
 	dest->pub.free_in_buffer 	= dest->bufsize; 	/* input buffer size */
 	dest->datasize = 0; 							/* reset output size */
+	dest->overflowed = 0;
 }
 
 /* This function is called by the library if the buffer fills up */
@@ -1715,50 +2618,36 @@ static GLOBAL(void) jpeg_memory_dest (j_compress_ptr cinfo,void* buf,int sz)
 
 /* yuyv_to_jpeg
  *  converts an input image in the YUYV format into a jpeg image and puts
- * it in a memory buffer.
+ * it in a memory buffer. The image is fed to libjpeg as already downsampled
+ * planar YCbCr (raw data mode), so libjpeg color conversion and downsampling
+ * are skipped entirely, and the 4:2:0 planes are produced by the line kernels.
+ * Returns the compressed size, or -1 if it did not fit in dst
  */
 int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,int stride,int quality)
 {
+	const conv_simd_ops* ops = converter_ops();
+
 	// Round height to a multiple of 16:
 	height &= (-16);
 	
 	// Round width to a multiple of 16
 	width &= (-16);
 	
-	// Calculate deltaStride
-	int dstride = stride - (width << 1);
-
 	int i, j;
 
-	JSAMPROW y[16],cb[8],cr[8];
+	JSAMPARRAY y,cb,cr;
 	JSAMPARRAY data[3]; 
 
 	struct jpeg_compress_struct cinfo;
 	struct jpeg_error_mgr jerr;
 
-	// Allocate memory for line buffers 
-	y[0] = (JSAMPROW) malloc(sizeof(JSAMPLE) * width * 16);
-	cb[0] = (JSAMPROW) malloc(sizeof(JSAMPLE) * (width >> 1) * 8);
-	cr[0] = (JSAMPROW) malloc(sizeof(JSAMPLE) * (width >> 1) * 8);
-	
-	for (i = 1; i< 16; i++) {
-		y[i]  =  y[0] + (i*(sizeof(JSAMPLE) * width));
-	}
-	for (i = 1; i< 8; i++) {
-		cb[i] = cb[0] + (i*(sizeof(JSAMPLE) * (width >> 1)));
-		cr[i] = cr[0] + (i*(sizeof(JSAMPLE) * (width >> 1)));
-	}
-	
-	data[0] = y;
-	data[1] = cb;
-	data[2] = cr;
-
 	cinfo.err = jpeg_std_error(&jerr);  // errors get written to stderr 
 	
 	jpeg_create_compress(&cinfo);
 	cinfo.image_width = width;
 	cinfo.image_height = height;
 	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_YCbCr;
 	jpeg_set_defaults (&cinfo);
 
 	jpeg_set_colorspace(&cinfo, JCS_YCbCr);
@@ -1778,45 +2667,31 @@ int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,
 	
 	jpeg_start_compress (&cinfo, TRUE);
 
+	// Line buffers for one MCU row. They belong to the image pool, so
+	//  they are released by jpeg_finish_compress
+	y  = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, width, 16);
+	cb = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, width >> 1, 8);
+	cr = (*cinfo.mem->alloc_sarray)((j_common_ptr) &cinfo, JPOOL_IMAGE, width >> 1, 8);
+	
+	data[0] = y;
+	data[1] = cb;
+	data[2] = cr;
+
 	uint8_t* yuyv = src;
 	
 	for (j=0; j<height; j+=16) {
-	
-		JSAMPROW pcb = cb[0];
-		JSAMPROW pcr = cr[0];
-		JSAMPROW py  = y[0];
 		for (i=0; i<8; i++) {
-			
-			int x;
-			for (x = 0; x < (width>>1); x++) {
-				*py++ = *yuyv++;		// Y0
-				*pcb++ = (yuyv[0] + yuyv[stride]) >> 1; // U
-				yuyv++;
-				*py++ = *yuyv++;		// Y1
-				*pcr++ = (yuyv[0] + yuyv[stride]) >> 1;	// V
-				yuyv++;
-			}
-			yuyv += dstride;
-			for (x = 0; x < (width>>1); x++) {	
-				*py++ = *yuyv++;		// Y2
-				yuyv++;
-				*py++ = *yuyv++;		// Y3
-				yuyv++;
-			}
-			yuyv += dstride;
+			ops->yuyv2_to_yuv420p(y[i<<1], y[(i<<1)+1], cb[i], cr[i], yuyv, yuyv + stride, width);
+			yuyv += stride << 1;
 		}
 		jpeg_write_raw_data(&cinfo, data, 8*2);
 	}
 
 	jpeg_finish_compress(&cinfo);
 
-	// Release memory for line buffers 
-	free(y[0]);
-	free(cb[0]);
-	free(cr[0]);
-
-	// Create a buffer with the compressed data
-    int fileSize = ((mem_dest_ptr)cinfo.dest)->datasize;
+	// Get the size of the compressed data
+	mem_dest_ptr dest = (mem_dest_ptr)cinfo.dest;
+	int fileSize = dest->overflowed ? -1 : (int)dest->datasize;
 	
 	// Destroy compressor context
 	jpeg_destroy_compress(&cinfo);
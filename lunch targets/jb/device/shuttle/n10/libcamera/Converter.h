@@ -80,6 +80,39 @@ void yuyv_to_bgr565 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstrid
 void yuyv_to_bgr24 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height);
 void yuyv_to_bgr32 (uint8_t *pyuv, int pyuvstride, uint8_t *pbgr, int pbgrstride, int width, int height);
 
+/* Destinations of the fused yuyv converter */
+enum {
+	CONV_YVU420SP,		/* Same as yuyv_to_yvu420sp */
+	CONV_YVU420P,		/* Same as yuyv_to_yvu420p */
+	CONV_YUV420P,		/* Same as yuyv_to_yuv420p */
+	CONV_YVU422P,		/* Same as yuyv_to_yvu422p */
+	CONV_YUYV,			/* Plain copy */
+	CONV_RGB565,		/* Same as yuyv_to_rgb565 */
+	CONV_RGB24,			/* Same as yuyv_to_rgb24 */
+	CONV_RGB32,			/* Same as yuyv_to_rgb32 */
+	CONV_BGR32			/* Same as yuyv_to_bgr32 */
+};
+
+typedef struct {
+	int 	 fmt;		/* One of CONV_xxx */
+	uint8_t* dst;		/* Destination. For planar formats, the start of the Y plane */
+	int		 dstStride;	/* Destination stride in bytes. For planar formats, the Y plane one */
+	int		 dstHeight;	/* Height of the Y plane. Only used by planar formats */
+	int		 srcX;		/* Top left corner of the area to convert, in source pixels */
+	int		 srcY;
+	int		 width;		/* Size of the area to convert */
+	int		 height;
+} conv_dest;
+
+/* yuyv_to_multi
+ *  converts a yuyv frame into several destinations in a single pass. Each
+ * source line is converted to all the destinations while it is still in the
+ * cache, instead of reading the whole frame from memory once per destination.
+ * The output is exactly the same as the one of the single destination
+ * converters.
+ */
+void yuyv_to_multi(const conv_dest* dests, int count, uint8_t *src, int srcStride);
+
 
 /*convert yuv 420 planar (yu12) to yuv 422
 * args: 
@@ -247,6 +280,35 @@ void s508_to_yuyv(uint8_t *dst,int dstStride, uint8_t *src, int width, int heigh
 */
 void bayer_to_rgb24(uint8_t *pBay, uint8_t *pRGB24, int width, int height, int pix_order);
 
+/*convert bayer raw data straight to yuyv, one line at a time, without an
+* intermediate rgb24 frame
+* args: 
+*      dst: pointer to buffer containing yuv data (yuyv)
+*      dstStride: stride of dst
+*      src: pointer to buffer containing Raw bayer data data
+*      srcStride: stride of src
+*      width: picture width
+*      height: picture height
+*      pix_order: bayer pixel order (0=gb/rg   1=gr/bg  2=bg/gr  3=rg/bg)
+*      work: line buffer of width * 6 bytes
+*/
+void bayer_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int width, int height, int pix_order, uint8_t *work);
+
+/*scale yuyv to another size (bilinear, a 2x2 box filter when halving)
+* args: 
+*      dst: pointer to buffer containing the scaled yuv data (yuyv)
+*      dstStride: stride of dst
+*      dstWidth: scaled picture width
+*      dstHeight: scaled picture height
+*      src: pointer to buffer containing yuv data (yuyv)
+*      srcStride: stride of src
+*      srcWidth: picture width
+*      srcHeight: picture height
+*      line: line buffer of srcWidth * 2 bytes
+*/
+void yuyv_scale(uint8_t *dst, int dstStride, int dstWidth, int dstHeight,
+				uint8_t *src, int srcStride, int srcWidth, int srcHeight, uint8_t *line);
+
 /*convert rgb24 to yuyv
 * args: 
 *	   src: pointer to buffer containing rgb24 data
@@ -269,9 +331,27 @@ void bgr_to_yuyv(uint8_t *dst, int dstStride, uint8_t *src, int srcStride, int w
 
 /* yuyv_to_jpeg
  *  converts an input image in the YUYV format into a jpeg image and puts
- * it in a memory buffer.
+ * it in a memory buffer. Returns the compressed size, or -1 if it did not
+ * fit in maxsize bytes.
  */
 int yuyv_to_jpeg(uint8_t* src, uint8_t* dst, int maxsize, int srcwidth, int srcheight, int srcstride, int quality);
 
+/* Name of the converter implementation in use ("c", "swar", "neon" or "sse2").
+ * The best one for the running cpu is selected the first time a converter is
+ * used. All of them produce exactly the same output.
+ */
+const char* converter_impl_name();
+
+/* Force a converter implementation by name. Returns false if it is not
+ * available on this cpu.
+ */
+bool converter_set_impl(const char* name);
+
+/* Check every line kernel of a converter implementation against the
+ * reference C one. Returns NULL if all of them produce exactly the same
+ * output, or the name of the first one that does not.
+ */
+const char* converter_check_impl(const char* name);
+
 
 #endif
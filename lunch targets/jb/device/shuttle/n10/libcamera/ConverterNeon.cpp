@@ -0,0 +1,351 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+
+/* ARM NEON line kernels. This module is built with -mfpu=neon, and is only
+   used if the kernel reports the cpu has a NEON unit (Tegra2 does not) */
+
+extern "C" {
+#include <stdint.h>
+#include <arm_neon.h>
+};
+#include "ConverterSimd.h"
+
+static void yuyv2_to_nv21_neon(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstVU,
+							   const uint8_t* src0, const uint8_t* src1, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x16x2_t a = vld2q_u8(src0);	// val[0] = Y, val[1] = UV
+		uint8x16x2_t b = vld2q_u8(src1);
+		vst1q_u8(dstY0, a.val[0]);
+		vst1q_u8(dstY1, b.val[0]);
+		
+		// U0 V0 U1 V1 ... -> V0 U0 V1 U1 ...
+		vst1q_u8(dstVU, vrev16q_u8(vhaddq_u8(a.val[1], b.val[1])));
+		
+		dstY0 += 16; dstY1 += 16; dstVU += 16;
+		src0 += 32; src1 += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv2_to_nv21(dstY0, dstY1, dstVU, src0, src1, width - n);
+}
+
+static void yuyv2_to_yuv420p_neon(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV,
+								  const uint8_t* src0, const uint8_t* src1, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x4_t a = vld4_u8(src0);		// Y0, U, Y1, V
+		uint8x8x4_t b = vld4_u8(src1);
+		
+		uint8x8x2_t y;
+		y.val[0] = a.val[0]; y.val[1] = a.val[2];
+		vst2_u8(dstY0, y);
+		y.val[0] = b.val[0]; y.val[1] = b.val[2];
+		vst2_u8(dstY1, y);
+		
+		vst1_u8(dstU, vhadd_u8(a.val[1], b.val[1]));
+		vst1_u8(dstV, vhadd_u8(a.val[3], b.val[3]));
+		
+		dstY0 += 16; dstY1 += 16; dstU += 8; dstV += 8;
+		src0 += 32; src1 += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv2_to_yuv420p(dstY0, dstY1, dstU, dstV, src0, src1, width - n);
+}
+
+static void yuyv_to_yuv422p_neon(uint8_t* dstY, uint8_t* dstU, uint8_t* dstV, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x4_t a = vld4_u8(src);
+		
+		uint8x8x2_t y;
+		y.val[0] = a.val[0]; y.val[1] = a.val[2];
+		vst2_u8(dstY, y);
+		vst1_u8(dstU, a.val[1]);
+		vst1_u8(dstV, a.val[3]);
+		
+		dstY += 16; dstU += 8; dstV += 8;
+		src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_yuv422p(dstY, dstU, dstV, src, width - n);
+}
+
+/* 16 YUYV pixels to clipped R, G and B bytes. Same fixed point math as the C
+   version: the chroma terms are computed on 32 bits and truncated by an 
+   arithmetic shift, so results are identical */
+static inline void yuyv_to_rgb16px(const uint8_t* src, uint8x16_t& r, uint8x16_t& g, uint8x16_t& b)
+{
+	uint8x8x4_t a = vld4_u8(src);		// Y0, U, Y1, V
+	
+	int16x8_t u = vreinterpretq_s16_u16(vsubl_u8(a.val[1], vdup_n_u8(128)));
+	int16x8_t v = vreinterpretq_s16_u16(vsubl_u8(a.val[3], vdup_n_u8(128)));
+	
+	int16x8_t ri = vcombine_s16(
+		vshrn_n_s32(vmull_n_s16(vget_low_s16(v), 358), 8),
+		vshrn_n_s32(vmull_n_s16(vget_high_s16(v), 358), 8));
+	int16x8_t gi = vcombine_s16(
+		vshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_low_s16(u), -88), vget_low_s16(v), -182), 8),
+		vshrn_n_s32(vmlal_n_s16(vmull_n_s16(vget_high_s16(u), -88), vget_high_s16(v), -182), 8));
+	int16x8_t bi = vcombine_s16(
+		vshrn_n_s32(vmull_n_s16(vget_low_s16(u), 453), 8),
+		vshrn_n_s32(vmull_n_s16(vget_high_s16(u), 453), 8));
+	
+	int16x8_t y0 = vreinterpretq_s16_u16(vmovl_u8(a.val[0]));
+	int16x8_t y1 = vreinterpretq_s16_u16(vmovl_u8(a.val[2]));
+	
+	// Clip, then put back the even and odd pixels in order
+	uint8x8x2_t t;
+	t = vzip_u8(vqmovun_s16(vaddq_s16(y0, ri)), vqmovun_s16(vaddq_s16(y1, ri)));
+	r = vcombine_u8(t.val[0], t.val[1]);
+	t = vzip_u8(vqmovun_s16(vaddq_s16(y0, gi)), vqmovun_s16(vaddq_s16(y1, gi)));
+	g = vcombine_u8(t.val[0], t.val[1]);
+	t = vzip_u8(vqmovun_s16(vaddq_s16(y0, bi)), vqmovun_s16(vaddq_s16(y1, bi)));
+	b = vcombine_u8(t.val[0], t.val[1]);
+}
+
+static inline uint16x8_t pack565(uint8x8_t r, uint8x8_t g, uint8x8_t b)
+{
+	uint16x8_t p = vshll_n_u8(r, 8);
+	p = vsriq_n_u16(p, vshll_n_u8(g, 8), 5);
+	p = vsriq_n_u16(p, vshll_n_u8(b, 8), 11);
+	return p;
+}
+
+static void yuyv_to_rgb565_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x16_t r, g, b;
+		yuyv_to_rgb16px(src, r, g, b);
+		
+		vst1q_u16((uint16_t*)(dst     ), pack565(vget_low_u8(r),  vget_low_u8(g),  vget_low_u8(b)));
+		vst1q_u16((uint16_t*)(dst + 16), pack565(vget_high_u8(r), vget_high_u8(g), vget_high_u8(b)));
+		
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_rgb565(dst, src, width - n);
+}
+
+static void yuyv_to_rgb24_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x16x3_t rgb;
+		yuyv_to_rgb16px(src, rgb.val[0], rgb.val[1], rgb.val[2]);
+		vst3q_u8(dst, rgb);
+		
+		dst += 48; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_rgb24(dst, src, width - n);
+}
+
+static void yuyv_to_rgb32_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		// The 4th byte of each pixel is left as it was
+		uint8x16x4_t rgbx = vld4q_u8(dst);
+		yuyv_to_rgb16px(src, rgbx.val[0], rgbx.val[1], rgbx.val[2]);
+		vst4q_u8(dst, rgbx);
+		
+		dst += 64; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_rgb32(dst, src, width - n);
+}
+
+static void uyvy_to_yuyv_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		vst1q_u8(dst     , vrev16q_u8(vld1q_u8(src     )));
+		vst1q_u8(dst + 16, vrev16q_u8(vld1q_u8(src + 16)));
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.uyvy_to_yuyv(dst, src, width - n);
+}
+
+static void yvyu_to_yuyv_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x4_t a = vld4_u8(src);		// Y0, V, Y1, U
+		uint8x8_t t = a.val[1];
+		a.val[1] = a.val[3];
+		a.val[3] = t;
+		vst4_u8(dst, a);
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yvyu_to_yuyv(dst, src, width - n);
+}
+
+static void yyuv_to_yuyv_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x4_t a = vld4_u8(src);		// Y0, Y1, U, V
+		uint8x8_t t = a.val[1];
+		a.val[1] = a.val[2];
+		a.val[2] = t;
+		vst4_u8(dst, a);
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yyuv_to_yuyv(dst, src, width - n);
+}
+
+static void bayer_to_rgbp_neon(uint8_t* row, uint8_t* g, uint8_t* other,
+							   const uint8_t* top, const uint8_t* mid, const uint8_t* bot, int width)
+{
+	// Each block reads 2 samples past its end, so the last one must not be a full block
+	int n = width > CONV_SIMD_BLOCK ? (width - 1) & (-CONV_SIMD_BLOCK) : 0;
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x2_t t0 = vld2_u8(top), t2 = vld2_u8(top + 2);	// even, odd samples
+		uint8x8x2_t m0 = vld2_u8(mid), m2 = vld2_u8(mid + 2);
+		uint8x8x2_t b0 = vld2_u8(bot), b2 = vld2_u8(bot + 2);
+		uint8x8x2_t o, gg, r;
+		
+		// Red or blue sample
+		o.val[0]  = vrshrn_n_u16(vaddq_u16(vaddl_u8(t0.val[0], t2.val[0]), vaddl_u8(b0.val[0], b2.val[0])), 2);
+		gg.val[0] = vrshrn_n_u16(vaddq_u16(vaddl_u8(t0.val[1], m0.val[0]), vaddl_u8(m2.val[0], b0.val[1])), 2);
+		r.val[0]  = m0.val[1];
+		
+		// Green sample
+		o.val[1]  = vrhadd_u8(t2.val[0], b2.val[0]);
+		gg.val[1] = m2.val[0];
+		r.val[1]  = vrhadd_u8(m0.val[1], m2.val[1]);
+		
+		vst2_u8(other, o);
+		vst2_u8(g, gg);
+		vst2_u8(row, r);
+		row += 16; g += 16; other += 16;
+		top += 16; mid += 16; bot += 16;
+	}
+	if (n < width)
+		conv_c_ops.bayer_to_rgbp(row, g, other, top, mid, bot, width - n);
+}
+
+/* floor((p - n) / 256) of unsigned 16bit words, plus 128, saturated to 8 bits.
+   vhsub halves the difference without losing its sign bit */
+static inline uint8x8_t diff_shr8_128(uint16x8_t p, uint16x8_t n)
+{
+	int16x8_t h = vreinterpretq_s16_u16(vhsubq_u16(p, n));
+	return vqmovun_s16(vaddq_s16(vshrq_n_s16(h, 7), vdupq_n_s16(128)));
+}
+
+static void rgbp_to_yuyv_neon(uint8_t* dst, const uint8_t* r, const uint8_t* g, const uint8_t* b, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x2_t r8 = vld2_u8(r), g8 = vld2_u8(g), b8 = vld2_u8(b);	// even, odd pixels
+		uint16x8_t rs = vaddl_u8(r8.val[0], r8.val[1]);
+		uint16x8_t gs = vaddl_u8(g8.val[0], g8.val[1]);
+		uint16x8_t bs = vaddl_u8(b8.val[0], b8.val[1]);
+		uint8x8x4_t a;
+		
+		a.val[0] = vshrn_n_u16(vmlal_u8(vmlal_u8(vmull_u8(r8.val[0], vdup_n_u8(77)), 
+						g8.val[0], vdup_n_u8(150)), b8.val[0], vdup_n_u8(29)), 8);
+		a.val[2] = vshrn_n_u16(vmlal_u8(vmlal_u8(vmull_u8(r8.val[1], vdup_n_u8(77)), 
+						g8.val[1], vdup_n_u8(150)), b8.val[1], vdup_n_u8(29)), 8);
+		a.val[1] = diff_shr8_128(vmulq_n_u16(bs, 56), vmlaq_n_u16(vmulq_n_u16(rs, 19), gs, 37));
+		a.val[3] = diff_shr8_128(vmulq_n_u16(rs, 79), vmlaq_n_u16(vmulq_n_u16(gs, 66), bs, 13));
+		vst4_u8(dst, a);
+		dst += 32; r += 16; g += 16; b += 16;
+	}
+	if (n < width)
+		conv_c_ops.rgbp_to_yuyv(dst, r, g, b, width - n);
+}
+
+static void yuyv_lerp_neon(uint8_t* dst, const uint8_t* a, const uint8_t* b, int frac, int width)
+{
+	const uint8x8_t fa = vdup_n_u8(128 - frac);
+	const uint8x8_t fb = vdup_n_u8(frac);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w, i;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		for (i = 0; i < 32; i += 16) {
+			uint8x16_t x = vld1q_u8(a + i);
+			uint8x16_t y = vld1q_u8(b + i);
+			uint8x8_t lo = vrshrn_n_u16(vmlal_u8(vmull_u8(vget_low_u8(x), fa), vget_low_u8(y), fb), 7);
+			uint8x8_t hi = vrshrn_n_u16(vmlal_u8(vmull_u8(vget_high_u8(x), fa), vget_high_u8(y), fb), 7);
+			vst1q_u8(dst + i, vcombine_u8(lo, hi));
+		}
+		dst += 32; a += 32; b += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_lerp(dst, a, b, frac, width - n);
+}
+
+static void yuyv_halve_neon(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		uint8x8x4_t a = vld4_u8(src);			// Y0, U, Y1, V of source pairs 0..7
+		uint8x8x4_t b = vld4_u8(src + 32);		// and 8..15
+		uint8x8x2_t y = vuzp_u8(vrhadd_u8(a.val[0], a.val[2]), vrhadd_u8(b.val[0], b.val[2]));
+		uint8x8x4_t d;
+		d.val[0] = y.val[0];
+		d.val[1] = vrshrn_n_u16(vcombine_u16(vpaddl_u8(a.val[1]), vpaddl_u8(b.val[1])), 1);
+		d.val[2] = y.val[1];
+		d.val[3] = vrshrn_n_u16(vcombine_u16(vpaddl_u8(a.val[3]), vpaddl_u8(b.val[3])), 1);
+		vst4_u8(dst, d);
+		dst += 32; src += 64;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_halve(dst, src, width - n);
+}
+
+const conv_simd_ops conv_neon_ops = {
+	"neon",
+	yuyv2_to_nv21_neon,
+	yuyv2_to_yuv420p_neon,
+	yuyv_to_yuv422p_neon,
+	yuyv_to_rgb565_neon,
+	yuyv_to_rgb24_neon,
+	yuyv_to_rgb32_neon,
+	uyvy_to_yuyv_neon,
+	yvyu_to_yuyv_neon,
+	yyuv_to_yuyv_neon,
+	bayer_to_rgbp_neon,
+	rgbp_to_yuyv_neon,
+	yuyv_lerp_neon,
+	yuyv_halve_neon
+};
@@ -0,0 +1,104 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef CONVERTER_SIMD_H
+#define CONVERTER_SIMD_H
+
+extern "C" {
+#include <stdint.h>
+};
+
+/* Line kernels used by the converters. Every implementation must produce
+   exactly the same output as the reference C one (conv_c_ops), and must
+   accept any width: the SIMD implementations convert the bulk of the line
+   in blocks of CONV_SIMD_BLOCK pixels and hand the remaining pixels to the
+   reference C kernel. Widths are always in pixels. */
+#define CONV_SIMD_BLOCK 16
+
+typedef struct {
+	const char* name;
+
+	/* 2 YUYV lines to 2 Y lines + 1 interleaved VU line (NV21). Chroma is
+	   the truncated average of both source lines */
+	void (*yuyv2_to_nv21)(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstVU,
+						  const uint8_t* src0, const uint8_t* src1, int width);
+
+	/* 2 YUYV lines to 2 Y lines + 1 U line + 1 V line (YV12/I420). Chroma is
+	   the truncated average of both source lines */
+	void (*yuyv2_to_yuv420p)(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV,
+						  const uint8_t* src0, const uint8_t* src1, int width);
+
+	/* 1 YUYV line to 1 Y line + 1 U line + 1 V line (YV16) */
+	void (*yuyv_to_yuv422p)(uint8_t* dstY, uint8_t* dstU, uint8_t* dstV, const uint8_t* src, int width);
+
+	/* 1 YUYV line to RGB. rgb32 leaves the 4th byte of each pixel untouched */
+	void (*yuyv_to_rgb565)(uint8_t* dst, const uint8_t* src, int width);
+	void (*yuyv_to_rgb24)(uint8_t* dst, const uint8_t* src, int width);
+	void (*yuyv_to_rgb32)(uint8_t* dst, const uint8_t* src, int width);
+
+	/* Packed 4:2:2 reorderings to YUYV */
+	void (*uyvy_to_yuyv)(uint8_t* dst, const uint8_t* src, int width);
+	void (*yvyu_to_yuyv)(uint8_t* dst, const uint8_t* src, int width);
+	void (*yyuv_to_yuyv)(uint8_t* dst, const uint8_t* src, int width);
+
+	/* Bayer demosaic of width pixels (pairs of a red or blue sample followed
+	   by a green one) of a line, to 3 color planes. top, mid and bot point to
+	   the lines above, at and below it, 1 sample before the first pair. row
+	   gets the color sampled on this line, other the one sampled on the lines
+	   above and below, and g the green. Reads up to top[width], mid[width + 1]
+	   and bot[width] */
+	void (*bayer_to_rgbp)(uint8_t* row, uint8_t* g, uint8_t* other,
+						  const uint8_t* top, const uint8_t* mid, const uint8_t* bot, int width);
+
+	/* 1 line of R, G and B planes to YUYV. Chroma is computed from the sum of
+	   both pixels of each pair */
+	void (*rgbp_to_yuyv)(uint8_t* dst, const uint8_t* r, const uint8_t* g, const uint8_t* b, int width);
+
+	/* Blend of 2 YUYV lines, used to scale vertically. Each byte is
+	   (a * (128 - frac) + b * frac + 64) >> 7, with frac in 0..127 */
+	void (*yuyv_lerp)(uint8_t* dst, const uint8_t* a, const uint8_t* b, int frac, int width);
+
+	/* 1 YUYV line to half its width. Each output sample is the rounded up
+	   average of the 2 source ones. width is the output width */
+	void (*yuyv_halve)(uint8_t* dst, const uint8_t* src, int width);
+
+} conv_simd_ops;
+
+/* Reference implementation. Always available */
+extern const conv_simd_ops conv_c_ops;
+
+/* 32bit word at a time implementation, for cpus without a vector unit (Tegra2) */
+extern const conv_simd_ops conv_swar_ops;
+
+#ifdef CONVERTER_HAVE_NEON
+/* ARM NEON implementation. Lives in its own module, as it must be built with -mfpu=neon */
+extern const conv_simd_ops conv_neon_ops;
+#endif
+
+#ifdef CONVERTER_HAVE_SSE2
+/* x86 SSE2 implementation */
+extern const conv_simd_ops conv_sse2_ops;
+#endif
+
+/* Get the line kernels selected for this cpu */
+const conv_simd_ops* converter_ops();
+
+#endif
@@ -0,0 +1,441 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/* x86 SSE2 line kernels. Those are mainly used to validate the converters 
+   on the host, as SSE2 is always there on x86 */
+
+extern "C" {
+#include <stdint.h>
+#include <emmintrin.h>
+};
+#include "ConverterSimd.h"
+
+/* Truncated average: (a + b) >> 1 on each byte. pavgb rounds up, so undo it
+   when the sum is odd */
+static inline __m128i havg8(__m128i a, __m128i b)
+{
+	return _mm_sub_epi8(_mm_avg_epu8(a, b), 
+						_mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+/* Swap the 2 16bit halves of each 32bit word */
+static inline __m128i swap16(__m128i x)
+{
+	return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(2,3,0,1)), _MM_SHUFFLE(2,3,0,1));
+}
+
+static void yuyv2_to_nv21_sse2(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstVU,
+							   const uint8_t* src0, const uint8_t* src1, int width)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(src0     ));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(src0 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(src1     ));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(src1 + 16));
+		
+		_mm_storeu_si128((__m128i*)dstY0, _mm_packus_epi16(_mm_and_si128(a0, lo), _mm_and_si128(a1, lo)));
+		_mm_storeu_si128((__m128i*)dstY1, _mm_packus_epi16(_mm_and_si128(b0, lo), _mm_and_si128(b1, lo)));
+		
+		// U0 V0 U1 V1 ... as 16 bit words, reordered to V0 U0 V1 U1 ...
+		__m128i c0 = swap16(_mm_srli_epi16(havg8(a0, b0), 8));
+		__m128i c1 = swap16(_mm_srli_epi16(havg8(a1, b1), 8));
+		_mm_storeu_si128((__m128i*)dstVU, _mm_packus_epi16(c0, c1));
+		
+		dstY0 += 16; dstY1 += 16; dstVU += 16;
+		src0 += 32; src1 += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv2_to_nv21(dstY0, dstY1, dstVU, src0, src1, width - n);
+}
+
+/* Split 16 bit words U0 V0 U1 V1 ... into U0..U7 V0..V7 bytes */
+static inline __m128i split_uv(__m128i c0, __m128i c1)
+{
+	const __m128i lo = _mm_set1_epi32(0x0000FFFF);
+	__m128i u = _mm_packs_epi32(_mm_and_si128(c0, lo), _mm_and_si128(c1, lo));
+	__m128i v = _mm_packs_epi32(_mm_srli_epi32(c0, 16), _mm_srli_epi32(c1, 16));
+	return _mm_packus_epi16(u, v);
+}
+
+static void yuyv2_to_yuv420p_sse2(uint8_t* dstY0, uint8_t* dstY1, uint8_t* dstU, uint8_t* dstV,
+								  const uint8_t* src0, const uint8_t* src1, int width)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(src0     ));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(src0 + 16));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(src1     ));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(src1 + 16));
+		
+		_mm_storeu_si128((__m128i*)dstY0, _mm_packus_epi16(_mm_and_si128(a0, lo), _mm_and_si128(a1, lo)));
+		_mm_storeu_si128((__m128i*)dstY1, _mm_packus_epi16(_mm_and_si128(b0, lo), _mm_and_si128(b1, lo)));
+		
+		__m128i uv = split_uv(_mm_srli_epi16(havg8(a0, b0), 8), _mm_srli_epi16(havg8(a1, b1), 8));
+		_mm_storel_epi64((__m128i*)dstU, uv);
+		_mm_storel_epi64((__m128i*)dstV, _mm_srli_si128(uv, 8));
+		
+		dstY0 += 16; dstY1 += 16; dstU += 8; dstV += 8;
+		src0 += 32; src1 += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv2_to_yuv420p(dstY0, dstY1, dstU, dstV, src0, src1, width - n);
+}
+
+static void yuyv_to_yuv422p_sse2(uint8_t* dstY, uint8_t* dstU, uint8_t* dstV, const uint8_t* src, int width)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(src     ));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(src + 16));
+		
+		_mm_storeu_si128((__m128i*)dstY, _mm_packus_epi16(_mm_and_si128(a0, lo), _mm_and_si128(a1, lo)));
+		
+		__m128i uv = split_uv(_mm_srli_epi16(a0, 8), _mm_srli_epi16(a1, 8));
+		_mm_storel_epi64((__m128i*)dstU, uv);
+		_mm_storel_epi64((__m128i*)dstV, _mm_srli_si128(uv, 8));
+		
+		dstY += 16; dstU += 8; dstV += 8;
+		src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_yuv422p(dstY, dstU, dstV, src, width - n);
+}
+
+/* Convert 16 YUYV pixels to clipped R, G and B bytes. Same fixed point math
+   as the C version: the chroma terms are computed on 32 bits and then 
+   truncated by an arithmetic shift, so results are identical */
+static inline void yuyv_to_rgb16px(const uint8_t* src, __m128i& r, __m128i& g, __m128i& b)
+{
+	const __m128i lo  = _mm_set1_epi16(0x00FF);
+	const __m128i c128 = _mm_set1_epi16(128);
+	const __m128i kr = _mm_set_epi16(358,0,358,0,358,0,358,0);				// 1.402 * v
+	const __m128i kg = _mm_set_epi16(-182,-88,-182,-88,-182,-88,-182,-88);	// -0.34414 * u - 0.71414 * v
+	const __m128i kb = _mm_set_epi16(0,453,0,453,0,453,0,453);				// 1.772 * u
+	
+	__m128i a0 = _mm_loadu_si128((const __m128i*)(src     ));
+	__m128i a1 = _mm_loadu_si128((const __m128i*)(src + 16));
+	
+	__m128i y0 = _mm_and_si128(a0, lo);
+	__m128i y1 = _mm_and_si128(a1, lo);
+	__m128i uv0 = _mm_sub_epi16(_mm_srli_epi16(a0, 8), c128);
+	__m128i uv1 = _mm_sub_epi16(_mm_srli_epi16(a1, 8), c128);
+	
+	// One value per YUYV pair
+	__m128i ri = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(uv0, kr), 8), _mm_srai_epi32(_mm_madd_epi16(uv1, kr), 8));
+	__m128i gi = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(uv0, kg), 8), _mm_srai_epi32(_mm_madd_epi16(uv1, kg), 8));
+	__m128i bi = _mm_packs_epi32(_mm_srai_epi32(_mm_madd_epi16(uv0, kb), 8), _mm_srai_epi32(_mm_madd_epi16(uv1, kb), 8));
+	
+	// Add them to both lumas of the pair and clip
+	r = _mm_packus_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(ri, ri)), _mm_add_epi16(y1, _mm_unpackhi_epi16(ri, ri)));
+	g = _mm_packus_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(gi, gi)), _mm_add_epi16(y1, _mm_unpackhi_epi16(gi, gi)));
+	b = _mm_packus_epi16(_mm_add_epi16(y0, _mm_unpacklo_epi16(bi, bi)), _mm_add_epi16(y1, _mm_unpackhi_epi16(bi, bi)));
+}
+
+static inline __m128i pack565(__m128i r, __m128i g, __m128i b)
+{
+	return _mm_or_si128(_mm_or_si128(
+				_mm_and_si128(_mm_slli_epi16(r, 8), _mm_set1_epi16((short)0xF800)),
+				_mm_and_si128(_mm_slli_epi16(g, 3), _mm_set1_epi16(0x07E0))),
+				_mm_srli_epi16(b, 3));
+}
+
+static void yuyv_to_rgb565_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i r, g, b;
+		yuyv_to_rgb16px(src, r, g, b);
+		
+		_mm_storeu_si128((__m128i*)(dst     ), pack565(_mm_unpacklo_epi8(r, zero), _mm_unpacklo_epi8(g, zero), _mm_unpacklo_epi8(b, zero)));
+		_mm_storeu_si128((__m128i*)(dst + 16), pack565(_mm_unpackhi_epi8(r, zero), _mm_unpackhi_epi8(g, zero), _mm_unpackhi_epi8(b, zero)));
+		
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_rgb565(dst, src, width - n);
+}
+
+static void yuyv_to_rgb24_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		union { __m128i v; uint8_t b[16]; } r, g, b;
+		yuyv_to_rgb16px(src, r.v, g.v, b.v);
+		
+		// No byte shuffles on SSE2: interleave using the integer unit
+		int i;
+		for (i = 0; i < 16; i++) {
+			*dst++ = r.b[i];
+			*dst++ = g.b[i];
+			*dst++ = b.b[i];
+		}
+		src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_rgb24(dst, src, width - n);
+}
+
+static void yuyv_to_rgb32_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i xmask = _mm_set1_epi32(0xFF000000);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i r, g, b;
+		yuyv_to_rgb16px(src, r, g, b);
+		
+		__m128i rglo = _mm_unpacklo_epi8(r, g);
+		__m128i rghi = _mm_unpackhi_epi8(r, g);
+		__m128i b0lo = _mm_unpacklo_epi8(b, zero);
+		__m128i b0hi = _mm_unpackhi_epi8(b, zero);
+		
+		// The 4th byte of each pixel is left as it was
+		__m128i* d = (__m128i*)dst;
+		_mm_storeu_si128(d + 0, _mm_or_si128(_mm_unpacklo_epi16(rglo, b0lo), _mm_and_si128(_mm_loadu_si128(d + 0), xmask)));
+		_mm_storeu_si128(d + 1, _mm_or_si128(_mm_unpackhi_epi16(rglo, b0lo), _mm_and_si128(_mm_loadu_si128(d + 1), xmask)));
+		_mm_storeu_si128(d + 2, _mm_or_si128(_mm_unpacklo_epi16(rghi, b0hi), _mm_and_si128(_mm_loadu_si128(d + 2), xmask)));
+		_mm_storeu_si128(d + 3, _mm_or_si128(_mm_unpackhi_epi16(rghi, b0hi), _mm_and_si128(_mm_loadu_si128(d + 3), xmask)));
+		
+		dst += 64; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_to_rgb32(dst, src, width - n);
+}
+
+static void uyvy_to_yuyv_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(src     ));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(src + 16));
+		_mm_storeu_si128((__m128i*)(dst     ), _mm_or_si128(_mm_slli_epi16(a0, 8), _mm_srli_epi16(a0, 8)));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_or_si128(_mm_slli_epi16(a1, 8), _mm_srli_epi16(a1, 8)));
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.uyvy_to_yuyv(dst, src, width - n);
+}
+
+static inline __m128i yvyu_to_yuyv16(__m128i x)
+{
+	const __m128i ymask = _mm_set1_epi16(0x00FF);
+	return _mm_or_si128(_mm_and_si128(x, ymask), swap16(_mm_andnot_si128(ymask, x)));
+}
+
+static void yvyu_to_yuyv_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		_mm_storeu_si128((__m128i*)(dst     ), yvyu_to_yuyv16(_mm_loadu_si128((const __m128i*)(src     ))));
+		_mm_storeu_si128((__m128i*)(dst + 16), yvyu_to_yuyv16(_mm_loadu_si128((const __m128i*)(src + 16))));
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yvyu_to_yuyv(dst, src, width - n);
+}
+
+static inline __m128i yyuv_to_yuyv16(__m128i x)
+{
+	const __m128i keep = _mm_set1_epi32(0xFF0000FF);
+	const __m128i mid  = _mm_set1_epi32(0x0000FF00);
+	return _mm_or_si128(_mm_and_si128(x, keep), 
+			_mm_or_si128(_mm_slli_epi32(_mm_and_si128(x, mid), 8), 
+						 _mm_and_si128(_mm_srli_epi32(x, 8), mid)));
+}
+
+static void yyuv_to_yuyv_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		_mm_storeu_si128((__m128i*)(dst     ), yyuv_to_yuyv16(_mm_loadu_si128((const __m128i*)(src     ))));
+		_mm_storeu_si128((__m128i*)(dst + 16), yyuv_to_yuyv16(_mm_loadu_si128((const __m128i*)(src + 16))));
+		dst += 32; src += 32;
+	}
+	if (n < width)
+		conv_c_ops.yyuv_to_yuyv(dst, src, width - n);
+}
+
+static void bayer_to_rgbp_sse2(uint8_t* row, uint8_t* g, uint8_t* other,
+							   const uint8_t* top, const uint8_t* mid, const uint8_t* bot, int width)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	const __m128i two = _mm_set1_epi16(2);
+	// Each block reads 2 samples past its end, so the last one must not be a full block
+	int n = width > CONV_SIMD_BLOCK ? (width - 1) & (-CONV_SIMD_BLOCK) : 0;
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i t0 = _mm_loadu_si128((const __m128i*)(top    ));
+		__m128i t2 = _mm_loadu_si128((const __m128i*)(top + 2));
+		__m128i m0 = _mm_loadu_si128((const __m128i*)(mid    ));
+		__m128i m2 = _mm_loadu_si128((const __m128i*)(mid + 2));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(bot    ));
+		__m128i b2 = _mm_loadu_si128((const __m128i*)(bot + 2));
+		
+		// Samples of each pair as 16 bit words: 0, 1 and the next pair ones, 2, 3
+		__m128i te0 = _mm_and_si128(t0, lo), to1 = _mm_srli_epi16(t0, 8), te2 = _mm_and_si128(t2, lo);
+		__m128i me0 = _mm_and_si128(m0, lo), mo1 = _mm_srli_epi16(m0, 8);
+		__m128i me2 = _mm_and_si128(m2, lo), mo3 = _mm_srli_epi16(m2, 8);
+		__m128i be0 = _mm_and_si128(b0, lo), bo1 = _mm_srli_epi16(b0, 8), be2 = _mm_and_si128(b2, lo);
+		
+		// Red or blue sample in the low byte of each word, green one in the high byte
+		__m128i oa = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(te0, te2), _mm_add_epi16(_mm_add_epi16(be0, be2), two)), 2);
+		__m128i ga = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(to1, me0), _mm_add_epi16(_mm_add_epi16(me2, bo1), two)), 2);
+		_mm_storeu_si128((__m128i*)other, _mm_or_si128(oa, _mm_slli_epi16(_mm_avg_epu16(te2, be2), 8)));
+		_mm_storeu_si128((__m128i*)g, _mm_or_si128(ga, _mm_slli_epi16(me2, 8)));
+		_mm_storeu_si128((__m128i*)row, _mm_or_si128(mo1, _mm_slli_epi16(_mm_avg_epu16(mo1, mo3), 8)));
+		row += 16; g += 16; other += 16;
+		top += 16; mid += 16; bot += 16;
+	}
+	if (n < width)
+		conv_c_ops.bayer_to_rgbp(row, g, other, top, mid, bot, width - n);
+}
+
+/* floor((p - n) / 256) of unsigned 16bit words. The difference is halved first
+   so it does not overflow: floor((p - n) / 2) = (p >> 1) - (n >> 1) - (~p & n & 1) */
+static inline __m128i diff_shr8(__m128i p, __m128i n)
+{
+	__m128i h = _mm_sub_epi16(_mm_sub_epi16(_mm_srli_epi16(p, 1), _mm_srli_epi16(n, 1)),
+							  _mm_and_si128(_mm_andnot_si128(p, n), _mm_set1_epi16(1)));
+	return _mm_srai_epi16(h, 7);
+}
+
+static void rgbp_to_yuyv_sse2(uint8_t* dst, const uint8_t* r, const uint8_t* g, const uint8_t* b, int width)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	const __m128i c128 = _mm_set1_epi16(128);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		__m128i r8 = _mm_loadu_si128((const __m128i*)r);
+		__m128i g8 = _mm_loadu_si128((const __m128i*)g);
+		__m128i b8 = _mm_loadu_si128((const __m128i*)b);
+		
+		// Even and odd pixels as 16 bit words
+		__m128i r0 = _mm_and_si128(r8, lo), r1 = _mm_srli_epi16(r8, 8);
+		__m128i g0 = _mm_and_si128(g8, lo), g1 = _mm_srli_epi16(g8, 8);
+		__m128i b0 = _mm_and_si128(b8, lo), b1 = _mm_srli_epi16(b8, 8);
+		
+		__m128i y0 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r0, _mm_set1_epi16(77)), 
+								_mm_mullo_epi16(g0, _mm_set1_epi16(150))), _mm_mullo_epi16(b0, _mm_set1_epi16(29))), 8);
+		__m128i y1 = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(r1, _mm_set1_epi16(77)), 
+								_mm_mullo_epi16(g1, _mm_set1_epi16(150))), _mm_mullo_epi16(b1, _mm_set1_epi16(29))), 8);
+		
+		__m128i rs = _mm_add_epi16(r0, r1), gs = _mm_add_epi16(g0, g1), bs = _mm_add_epi16(b0, b1);
+		__m128i u = _mm_add_epi16(diff_shr8(_mm_mullo_epi16(bs, _mm_set1_epi16(56)), 
+						_mm_add_epi16(_mm_mullo_epi16(rs, _mm_set1_epi16(19)), _mm_mullo_epi16(gs, _mm_set1_epi16(37)))), c128);
+		__m128i v = _mm_add_epi16(diff_shr8(_mm_mullo_epi16(rs, _mm_set1_epi16(79)), 
+						_mm_add_epi16(_mm_mullo_epi16(gs, _mm_set1_epi16(66)), _mm_mullo_epi16(bs, _mm_set1_epi16(13)))), c128);
+		
+		// Y0 U0 Y0' U1 ... and Y1 V0 Y1' V1 ..., interleaved by words
+		__m128i yy = _mm_packus_epi16(y0, y1);
+		__m128i uv = _mm_packus_epi16(u, v);
+		__m128i yu = _mm_unpacklo_epi8(yy, uv);
+		__m128i yv = _mm_unpackhi_epi8(yy, uv);
+		_mm_storeu_si128((__m128i*)(dst     ), _mm_unpacklo_epi16(yu, yv));
+		_mm_storeu_si128((__m128i*)(dst + 16), _mm_unpackhi_epi16(yu, yv));
+		dst += 32; r += 16; g += 16; b += 16;
+	}
+	if (n < width)
+		conv_c_ops.rgbp_to_yuyv(dst, r, g, b, width - n);
+}
+
+static void yuyv_lerp_sse2(uint8_t* dst, const uint8_t* a, const uint8_t* b, int frac, int width)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i fa = _mm_set1_epi16(128 - frac);
+	const __m128i fb = _mm_set1_epi16(frac);
+	const __m128i c64 = _mm_set1_epi16(64);
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w, i;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		for (i = 0; i < 32; i += 16) {
+			__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+			__m128i y = _mm_loadu_si128((const __m128i*)(b + i));
+			__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(x, zero), fa), 
+									   _mm_mullo_epi16(_mm_unpacklo_epi8(y, zero), fb)), c64);
+			__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(x, zero), fa), 
+									   _mm_mullo_epi16(_mm_unpackhi_epi8(y, zero), fb)), c64);
+			_mm_storeu_si128((__m128i*)(dst + i), _mm_packus_epi16(_mm_srli_epi16(lo, 7), _mm_srli_epi16(hi, 7)));
+		}
+		dst += 32; a += 32; b += 32;
+	}
+	if (n < width)
+		conv_c_ops.yuyv_lerp(dst, a, b, frac, width - n);
+}
+
+/* 4 source pixel pairs to 2 halved ones, in the low 32 bits of each 64 bit word */
+static inline __m128i yuyv_halve4(__m128i x)
+{
+	const __m128i lo = _mm_set1_epi16(0x00FF);
+	__m128i y = _mm_and_si128(x, lo);			// Y0 Y1 of each source pair, as 16 bit words
+	__m128i c = _mm_srli_epi16(x, 8);			// U V of each source pair
+	y = _mm_and_si128(_mm_avg_epu16(y, _mm_srli_epi32(y, 16)), _mm_set1_epi32(0xFFFF));
+	c = _mm_avg_epu16(c, _mm_srli_epi64(c, 32));
+	return _mm_or_si128(_mm_and_si128(_mm_or_si128(y, _mm_srli_epi64(y, 16)), _mm_set1_epi32(0x00FF00FF)), 
+						_mm_and_si128(_mm_slli_epi32(c, 8), _mm_set1_epi32(0xFF00FF00)));
+}
+
+static void yuyv_halve_sse2(uint8_t* dst, const uint8_t* src, int width)
+{
+	int n = width & (-CONV_SIMD_BLOCK);
+	int w, i;
+	for (w = 0; w < n; w += CONV_SIMD_BLOCK) {
+		for (i = 0; i < 2; i++) {
+			__m128i a = _mm_shuffle_epi32(yuyv_halve4(_mm_loadu_si128((const __m128i*)(src     ))), _MM_SHUFFLE(3,1,2,0));
+			__m128i b = _mm_shuffle_epi32(yuyv_halve4(_mm_loadu_si128((const __m128i*)(src + 16))), _MM_SHUFFLE(3,1,2,0));
+			_mm_storeu_si128((__m128i*)dst, _mm_unpacklo_epi64(a, b));
+			dst += 16; src += 32;
+		}
+	}
+	if (n < width)
+		conv_c_ops.yuyv_halve(dst, src, width - n);
+}
+
+const conv_simd_ops conv_sse2_ops = {
+	"sse2",
+	yuyv2_to_nv21_sse2,
+	yuyv2_to_yuv420p_sse2,
+	yuyv_to_yuv422p_sse2,
+	yuyv_to_rgb565_sse2,
+	yuyv_to_rgb24_sse2,
+	yuyv_to_rgb32_sse2,
+	uyvy_to_yuyv_sse2,
+	yvyu_to_yuyv_sse2,
+	yyuv_to_yuyv_sse2,
+	bayer_to_rgbp_sse2,
+	rgbp_to_yuyv_sse2,
+	yuyv_lerp_sse2,
+	yuyv_halve_sse2
+};
@@ -0,0 +1,101 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+#ifndef FRAME_RING_H
+#define FRAME_RING_H
+
+extern "C" {
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <semaphore.h>
+};
+#include <cutils/atomic.h>
+
+namespace android {
+
+/* Single producer / single consumer ring, used to pass frames between the
+   stages of the preview pipeline. Pushing and popping never lock: only the
+   producer writes mHead and only the consumer writes mTail. A semaphore 
+   counting the queued entries lets the consumer sleep while it is empty.
+   N must be a power of 2 */
+template <typename T, int N>
+class FrameRing {
+public:
+	FrameRing() : mHead(0), mTail(0) { sem_init(&mCount, 0, 0); }
+	~FrameRing() { sem_destroy(&mCount); }
+
+	/* Empty the ring. Only when neither the producer nor the consumer run */
+	void reset() {
+		mHead = 0;
+		mTail = 0;
+		sem_destroy(&mCount);
+		sem_init(&mCount, 0, 0);
+	}
+
+	/* Producer side. Tells if the next push would fail. Only the consumer 
+	   frees entries, so a ring seen not full stays so until the next push */
+	bool full() const {
+		return mHead - android_atomic_acquire_load(&mTail) >= N;
+	}
+
+	/* Producer side. Returns false if the ring is full */
+	bool push(const T& item) {
+		if (full())
+			return false;
+		int32_t head = mHead;
+		mItems[head & (N - 1)] = item;
+		android_atomic_release_store(head + 1, &mHead);
+		sem_post(&mCount);
+		return true;
+	}
+
+	/* Consumer side. Waits up to timeoutMs for an entry. Returns false on timeout */
+	bool pop(T& item, int timeoutMs) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec  += timeoutMs / 1000;
+		ts.tv_nsec += (timeoutMs % 1000) * 1000000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		while (sem_timedwait(&mCount, &ts) < 0) {
+			if (errno != EINTR)
+				return false;
+		}
+		
+		int32_t tail = mTail;
+		item = mItems[tail & (N - 1)];
+		android_atomic_release_store(tail + 1, &mTail);
+		return true;
+	}
+
+private:
+	T				 mItems[N];
+	volatile int32_t mHead;			// Next entry to write. Written by the producer
+	volatile int32_t mTail;			// Next entry to read. Written by the consumer
+	sem_t			 mCount;		// Entries ready to be read
+};
+
+}; // namespace android
+
+#endif
@@ -43,7 +43,11 @@
 extern "C" {
 #include <malloc.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 };
+#include <cutils/atomic.h>
+#include <utils/threads.h>
 
 #define LOG_TAG "CameraHardware"
 #include <utils/Log.h>
@@ -52,198 +56,6 @@ extern "C" {
 #define CLIP(value) (uint8_t)(((value)>0xFF)?0xff:(((value)<0)?0:(value)))
 
 
-/*jpeg decoding  420 planar to 422
-* args: 
-*      out: pointer to data output of idct (macroblocks yyyy u v)
-*      pic: pointer to picture buffer (yuyv)
-*      stride: picture stride
-*/
-static void yuv420pto422(int * out,uint8_t *pic,int stride)
-{
-	int j, k;
-	uint8_t *pic0, *pic1;
-	int *outy, *outu, *outv;
-	int outy1 = 0;
-	int outy2 = 8;
-
-	//yyyyuv
-	pic0 = pic;
-	pic1 = pic + stride;
-	outy = out;
-	outu = out + 64 * 4;
-	outv = out + 64 * 5;    
-	for (j = 0; j < 8; j++) 
-	{
-		for (k = 0; k < 8; k++)
-		{
-			if( k == 4) 
-			{ 
-				outy1 += 56;
-				outy2 += 56;
-			}
-			*pic0++ = CLIP(outy[outy1]);   //y1 line 1
-			*pic0++ = CLIP(128 + *outu);   //u  line 1-2
-			*pic0++ = CLIP(outy[outy1+1]); //y2 line 1
-			*pic0++ = CLIP(128 + *outv);   //v  line 1-2
-			*pic1++ = CLIP(outy[outy2]);   //y1 line 2
-			*pic1++ = CLIP(128 + *outu);   //u  line 1-2
-			*pic1++ = CLIP(outy[outy2+1]); //y2 line 2
-			*pic1++ = CLIP(128 + *outv);   //v  line 1-2
-			outy1 +=2; outy2 += 2; outu++; outv++;
-		}
-		if(j==3)
-		{
-			outy = out + 128;
-		} 
-		else 
-		{
-			outy += 16;
-		}
-		outy1 = 0;
-		outy2 = 8;
-		pic0 += 2 * (stride -16);
-		pic1 += 2 * (stride -16);
-	}
-}
-
-/*jpeg decoding 422 planar to 422
-* args: 
-*      out: pointer to data output of idct (macroblocks yyyy u v)
-*      pic: pointer to picture buffer (yuyv)
-*      stride: picture stride
-*/
-static void yuv422pto422(int * out,uint8_t *pic,int stride)
-{
-	int j, k;
-	uint8_t *pic0, *pic1;
-	int *outy, *outu, *outv;
-	int outy1 = 0;
-	int outy2 = 8;
-	int outu1 = 0;
-	int outv1 = 0;
- 
-	//yyyyuv
-	pic0 = pic;
-	pic1 = pic + stride;
-	outy = out;
-	outu = out + 64 * 4;
-	outv = out + 64 * 5;    
-	for (j = 0; j < 4; j++) 
-	{
-		for (k = 0; k < 8; k++) 
-		{
-			if( k == 4)
-			{ 
-				outy1 += 56;
-				outy2 += 56;
-			}
-			*pic0++ = CLIP(outy[outy1]);        //y1 line 1
-			*pic0++ = CLIP(128 + outu[outu1]);  //u  line 1
-			*pic0++ = CLIP(outy[outy1+1]);      //y2 line 1
-			*pic0++ = CLIP(128 + outv[outv1]);  //v  line 1
-			*pic1++ = CLIP(outy[outy2]);        //y1 line 2
-			*pic1++ = CLIP(128 + outu[outu1+8]);//u  line 2
-			*pic1++ = CLIP(outy[outy2+1]);      //y2 line 2
-			*pic1++ = CLIP(128 + outv[outv1+8]);//v  line 2
-			outv1 += 1; outu1 += 1;
-			outy1 +=2; outy2 +=2;
-		}
-		outy += 16;outu +=8; outv +=8;
-		outv1 = 0; outu1=0;
-		outy1 = 0;
-		outy2 = 8;
-		pic0 += 2 * (stride -16);
-		pic1 += 2 * (stride -16);
-	}
-}
-
-/*use in utils.c for jpeg decoding 444 planar to 422
-* args: 
-*      out: pointer to data output of idct (macroblocks yyyy u v)
-*      pic: pointer to picture buffer (yuyv)
-*      stride: picture stride
-*/
-static void yuv444pto422(int * out,uint8_t *pic,int stride)
-{
-	int j, k;
-	uint8_t *pic0, *pic1;
-	int *outy, *outu, *outv;
-	int outy1 = 0;
-	int outy2 = 8;
-	int outu1 = 0;
-	int outv1 = 0;
-
-	//yyyyuv
-	pic0 = pic;
-	pic1 = pic + stride;
-	outy = out;
-	outu = out + 64 * 4; // Ooops where did i invert ??
-	outv = out + 64 * 5;    
-	for (j = 0; j < 4; j++) 
-	{
-		for (k = 0; k < 4; k++) 
-		{
-			*pic0++ =CLIP( outy[outy1]);        //y1 line 1
-			*pic0++ =CLIP( 128 + outu[outu1]);  //u  line 1
-			*pic0++ =CLIP( outy[outy1+1]);      //y2 line 1
-			*pic0++ =CLIP( 128 + outv[outv1]);  //v  line 1
-			*pic1++ =CLIP( outy[outy2]);        //y1 line 2
-			*pic1++ =CLIP( 128 + outu[outu1+8]);//u  line 2
-			*pic1++ =CLIP( outy[outy2+1]);      //y2 line 2
-			*pic1++ =CLIP( 128 + outv[outv1+8]);//v  line 2
-			outv1 += 2; outu1 += 2;
-			outy1 +=2; outy2 +=2;
-		}
-		outy += 16;outu +=16; outv +=16;
-		outv1 = 0; outu1=0;
-		outy1 = 0;
-		outy2 = 8;
-		pic0 += 2 * (stride -8);
-		pic1 += 2 * (stride -8);
-	}
-}
-
-/*use in utils.c for jpeg decoding 400 planar to 422
-* args: 
-*      out: pointer to data output of idct (macroblocks yyyy )
-*      pic: pointer to picture buffer (yuyv)
-*      stride: picture stride
-*/
-static void yuv400pto422(int * out,uint8_t *pic,int stride)
-{
-	int j, k;
-	uint8_t *pic0, *pic1;
-	int *outy ;
-	int outy1 = 0;
-	int outy2 = 8;
-	pic0 = pic;
-	pic1 = pic + stride;
-	outy = out;
-
-	//yyyy
-	for (j = 0; j < 4; j++) 
-	{
-		for (k = 0; k < 4; k++) 
-		{
-			*pic0++ = CLIP(outy[outy1]);  //y1 line 1
-			*pic0++ = 128 ;               //u
-			*pic0++ = CLIP(outy[outy1+1]);//y2 line 1
-			*pic0++ = 128 ;               //v
-			*pic1++ = CLIP(outy[outy2]);  //y1 line 2
-			*pic1++ = 128 ;               //u
-			*pic1++ = CLIP(outy[outy2+1]);//y2 line 2
-			*pic1++ = 128 ;               //v
-			outy1 +=2; outy2 +=2;  
-		}
-		outy += 16;
-		outy1 = 0;
-		outy2 = 8;
-		pic0 += 2 * (stride -8);
-		pic1 += 2 * (stride -8);
-	}
-}
-
-
 #define JPG_HUFFMAN_TABLE_LENGTH 0x01A0
 
 static const unsigned char JPEGHuffmanTable[JPG_HUFFMAN_TABLE_LENGTH] = 
@@ -309,95 +121,68 @@ static const unsigned char JPEGHuffmanTable[JPG_HUFFMAN_TABLE_LENGTH] =
 }; 
 
 /* Fixed point arithmetic */
-//#define FIXED	Sint32
-//#define FIXED_BITS 16
-//#define TO_FIXED(X) (((Sint32)(X))<<(FIXED_BITS))
-//#define FROM_FIXED(X) (((Sint32)(X))>>(FIXED_BITS))
-
 #define ISHIFT 11
 #define IFIX(a) ((int)((a) * (1 << ISHIFT) + .5))
 
-/* special markers */
-#define M_BADHUFF	-1
-#define M_EOF		0x80
-
-struct jpeg_decdata 
-{
-	int dcts[6 * 64 + 16];
-	int out[64 * 6];
-	int dquant[3][64];
-};
+/******** Markers *********/
+#define M_SOI   0xd8
+#define M_APP0  0xe0
+#define M_DQT   0xdb
+#define M_SOF0  0xc0
+#define M_DHT   0xc4
+#define M_DRI   0xdd
+#define M_SOS   0xda
+#define M_RST0  0xd0
+#define M_EOI   0xd9
+#define M_COM   0xfe
 
-struct in 
-{
-	uint8_t *p;
-	uint32_t bits;
-	int left;
-	int marker;
-	int (*func) (void *);
-	void *data;
-};
 
 /*********************************/
-#define DECBITS 10		/* seems to be the optimum */
 
-struct dec_hufftbl 
+#undef PREC
+#define PREC int
+
+/* Huffman codes are decoded by looking ahead HUFF_FASTBITS bits into a table,
+   so most of them take a single lookup. Longer codes are found by comparing 
+   the next 16 bits against the last code of each length */
+#define HUFF_FASTBITS 9
+
+struct huff_tbl 
 {
-	int maxcode[17];
-	int valptr[16];
+	uint16_t fast[1 << HUFF_FASTBITS];	/* code length << 8 | symbol, or 0 if longer */
+	int32_t fastac[1 << HUFF_FASTBITS];	/* AC tables: value << 16 | run << 8 | length of code + value, 
+										   or 0 if not both fit */
+	uint32_t maxcode[18];				/* last code + 1 of each length, aligned to 16 bits */
+	int delta[17];						/* code of each length to index into vals */
 	uint8_t vals[256];
-	uint32_t llvals[1 << DECBITS];
 };
 
-union hufftblp 
+/* Entropy coded data reader. Bits are taken from the MSB of bits. Once a 
+   marker is found, the reader stops in front of it and feeds zeros */
+struct bitrd 
 {
-	struct dec_hufftbl *dhuff;
+	uint8_t *p;
+	uint32_t bits;
+	int left;
+	int marker;
 };
 
 struct scan 
 {
 	int dc;			/* old dc value */
 
-	union hufftblp hudc;
-	union hufftblp huac;
-	int next;		/* when to switch to next scan */
+	struct huff_tbl *hudc;
+	struct huff_tbl *huac;
 
 	int cid;		/* component id */
 	int hv;			/* horiz/vert, copied from comp */
 	int tq;			/* quant tbl, copied from comp */
+	PREC dquant[64];/* quant tbl scaled for the idct, in zigzag order */
 };
 
-/******** Markers *********/
-#define M_SOI   0xd8
-#define M_APP0  0xe0
-#define M_DQT   0xdb
-#define M_SOF0  0xc0
-#define M_DHT   0xc4
-#define M_DRI   0xdd
-#define M_SOS   0xda
-#define M_RST0  0xd0
-#define M_EOI   0xd9
-#define M_COM   0xfe
-
-
-/*********************************/
-
-#undef PREC
-#define PREC int
-
-
+static void dec_makehuff (struct huff_tbl *, int *, uint8_t *, int);
 static int huffman_init(struct ctx* ctx);
-static void decode_mcus (struct in *, int *, int, struct scan *, int *);
-static int dec_readmarker (struct in *);
-static void dec_makehuff (struct dec_hufftbl *, int *, uint8_t *);
-static void setinput (struct in *, uint8_t *);
 static void idctqtab(uint8_t *, PREC *);
-inline static void idct(int *in, int *out, int *quant, long off, int max);
-static int fillbits (struct in *, int, unsigned int);
-static int dec_rec2 (struct in *, struct dec_hufftbl *, int *, int, int);
-
-
-typedef void (*ftopict) (int * out, uint8_t *pic, int width) ;
 
 /*********************************/
 
@@ -414,8 +199,6 @@ struct jpginfo
 	int nc;			/* number of components */
 	int ns;			/* number of scans */
 	int dri;		/* restart interval */
-	int nm;			/* mcus til next marker */
-	int rm;			/* next restart marker */
 };
 
 struct ctx {
@@ -424,8 +207,19 @@ struct ctx {
 	struct comp comps[MAXCOMP];
 	struct scan dscans[MAXCOMP];
 	uint8_t quant[4][64];
-	struct dec_hufftbl dhuff[4];
-	struct in in;
+	struct huff_tbl dhuff[4];
+};
+
+/* Where and how the MCUs are written into the picture */
+struct jpgframe {
+	uint8_t *pic;
+	int stride;
+	int mb;			/* blocks per mcu */
+	int mcusx;		/* mcus per line */
+	int mcus;		/* mcus in the picture */
+	int xpitch;		/* bytes between mcus */
+	int ypitch;		/* bytes between lines of mcus */
+	int seglen;		/* mcus between restart markers */
 };
 
 
@@ -499,8 +293,10 @@ static int readtables(struct ctx* ctx,int till, int *isDHT)
 					if (tc > 1 || th > 1)
 					return -1;
 					
-					for (i = 0; i < 16; i++)
-						hufflen[i] = getbyte(ctx);
+					for (i = 0, k = 0; i < 16; i++)
+						k += hufflen[i] = getbyte(ctx);
+					if (k > 256)
+						return -1;
 					l -= 1 + 16;
 					k = 0;
 					for (i = 0; i < 16; i++) 
@@ -509,7 +305,7 @@ static int readtables(struct ctx* ctx,int till, int *isDHT)
 							huffvals[k++] = getbyte(ctx);
 						l -= hufflen[i];
 					}
-					dec_makehuff(ctx->dhuff + tt, hufflen, huffvals);
+					dec_makehuff(ctx->dhuff + tt, hufflen, huffvals, tc);
 				}
 				/* has huffman tables defined (JPEG)*/
 				*isDHT= 1;
@@ -530,167 +326,774 @@ static int readtables(struct ctx* ctx,int till, int *isDHT)
 	return 0;
 }
 
-static void dec_initscans(struct ctx* ctx)
-{
-	int i;
+/****************************************************************/
+/**************      entropy coded data reader    ***************/
+/****************************************************************/
 
-	ctx->info.nm = ctx->info.dri + 1;
-	ctx->info.rm = M_RST0;
-	for (i = 0; i < ctx->info.ns; i++)
-		ctx->dscans[i].dc = 0;
+static void setinput(struct bitrd *in, uint8_t *p)
+{
+	in->p = p;
+	in->bits = 0;
+	in->left = 0;
+	in->marker = 0;
 }
 
-static int dec_checkmarker(struct ctx* ctx)
+/* Make sure there are at least 25 bits to consume, unstuffing 0xff 0x00
+   sequences. The byte after a 0xff is only checked when a 0xff is found */
+static inline void fillbits(struct bitrd *in)
 {
-	int i;
+	while (in->left <= 24) 
+	{
+		uint32_t b = 0;
+		if (!in->marker) 
+		{
+			b = in->p[0];
+			if (b != 0xff)
+				in->p++;
+			else if (in->p[1] == 0)
+				in->p += 2;
+			else 
+			{
+				/* A marker: Keep it, and feed zeros */
+				in->marker = in->p[1];
+				b = 0;
+			}
+		}
+		in->bits |= b << (24 - in->left);
+		in->left += 8;
+	}
+}
 
-	if (dec_readmarker(&ctx->in) != ctx->info.rm)
-		return -1;
-	ctx->info.nm = ctx->info.dri;
-	ctx->info.rm = (ctx->info.rm + 1) & ~0x08;
-	for (i = 0; i < ctx->info.ns; i++)
-		ctx->dscans[i].dc = 0;
-	return 0;
+/* Get n bits (1 to 16) */
+static inline int getbits(struct bitrd *in, int n)
+{
+	int v;
+	if (in->left < n)
+		fillbits(in);
+	v = in->bits >> (32 - n);
+	in->bits <<= n;
+	in->left -= n;
+	return v;
 }
 
-/*jpeg decode
-* args: 
-*      pic:  pointer to picture data ( decoded image - yuyv format)
-*      buf:  pointer to input data ( compressed jpeg )
-*      with: picture width 
-*      height: picture height
-*/
-int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int width, int height)
+/* Sign extend the n bits value of a coefficient */
+#define EXTEND(v, n) ((v) < (1 << ((n) - 1)) ? (v) - (1 << (n)) + 1 : (v))
+
+/* Read the marker that follows the entropy coded data, dropping the bits 
+   left. Returns 0 if no marker is there */
+static int dec_readmarker(struct bitrd *in)
 {
-	struct ctx ctx;
-	struct jpeg_decdata *decdata;
-	int i=0, j=0, m=0, tac=0, tdc=0;
-	int intwidth=0, intheight=0;
-	int mcusx=0, mcusy=0, mx=0, my=0;
-	int ypitch=0 ,xpitch=0,x=0,y=0;
-	int mb=0;
-	int max[6];
-	ftopict convert;
-	int err = 0;
-	int isInitHuffman = 0;
-	decdata = (struct jpeg_decdata*) calloc(1, sizeof(struct jpeg_decdata));
-	
-	for(i=0;i<6;i++) 
-		max[i]=0;
+	uint8_t *p = in->p;
+	int m = 0;
 	
-	if (!decdata) 
-	{
-		err = -1;
-		goto error;
-	}
-	if (buf == NULL) 
-	{
-		err = -1;
-		goto error;
-	}
-	ctx.datap = buf;
-	/*check SOI (0xFFD8)*/
-	if (getbyte(&ctx) != 0xff) 
+	/* Skip the fill bytes */
+	while (p[0] == 0xff && p[1] == 0xff)
+		p++;
+	if (p[0] == 0xff && p[1] != 0) 
 	{
-		err = ERR_NO_SOI;
-		goto error;
+		m = p[1];
+		p += 2;
 	}
-	if (getbyte(&ctx) != M_SOI) 
-	{
-		err = ERR_NO_SOI;
-		goto error;
-	}
-	/*read tables - if exist, up to start frame marker (0xFFC0)*/
-	if (readtables(&ctx,M_SOF0, &isInitHuffman)) 
+	setinput(in, p);
+	return m;
+}
+
+/****************************************************************/
+/**************       huffman decoder             ***************/
+/****************************************************************/
+
+/* Decode a huffman coded symbol. Returns -1 on invalid codes */
+static inline int dec_huff(struct bitrd *in, const struct huff_tbl *hu)
+{
+	int c, l;
+	uint32_t t;
+	
+	if (in->left < 16)
+		fillbits(in);
+	c = hu->fast[in->bits >> (32 - HUFF_FASTBITS)];
+	if (c) 
 	{
-		err = ERR_BAD_TABLES;
-		goto error;
-	}
-	getword(&ctx);     /*header lenght*/
-	i = getbyte(&ctx); /*precision (8 bit)*/
-	if (i != 8) 
+		l = c >> 8;
+		c &= 0xff;
+	} 
+	else 
 	{
-		err = ERR_NOT_8BIT;
-		goto error;
+		t = in->bits >> 16;
+		for (l = HUFF_FASTBITS + 1; t >= hu->maxcode[l]; l++);
+		if (l > 16)
+			return -1;
+		c = hu->vals[(t >> (16 - l)) + hu->delta[l]];
 	}
-	intheight = getword(&ctx); /*height*/
-	intwidth = getword(&ctx);  /*width */
+	in->bits <<= l;
+	in->left -= l;
+	return c;
+}
 
-	if ((intheight & 7) || (intwidth & 7)) /*must be even*/
-	{
-		err = ERR_BAD_WIDTH_OR_HEIGHT;
-		goto error;
-	}
-	ctx.info.nc = getbyte(&ctx); /*number of components*/
-	if (ctx.info.nc > MAXCOMP) 
+/* Where each coefficient (in zigzag order) goes in the block the idct takes */
+static const uint8_t dezig[64] = {
+	 0,  5, 40, 16, 45,  2,  7, 42,
+	21, 56,  8, 61, 18, 47,  1,  4,
+	41, 23, 58, 13, 32, 24, 37, 10,
+	63, 17, 44,  3,  6, 43, 20, 57,
+	15, 34, 29, 48, 53, 26, 39,  9,
+	60, 19, 46, 22, 59, 12, 33, 31,
+	50, 55, 25, 36, 11, 62, 14, 35,
+	28, 49, 52, 27, 38, 30, 51, 54
+};
+
+/* Decode a block, dequantizing its coefficients into blk, that must be 
+   cleared. off is added to the DC one.
+   Returns a mask of the idct columns with AC coefficients (0 if there are
+   none), or -1 on errors */
+static int decode_block(struct bitrd *in, struct scan *sc, PREC *blk, int off)
+{
+	const struct huff_tbl *hu = sc->huac;
+	const PREC *dq = sc->dquant;
+	int k, s, r, c, v, ac = 0;
+
+	/* DC coefficient: difference to the previous one */
+	s = dec_huff(in, sc->hudc);
+	if (s < 0 || s > 16)
+		return -1;
+	if (s) 
 	{
-		err = ERR_TOO_MANY_COMPPS;
-		goto error;
+		v = getbits(in, s);
+		sc->dc += EXTEND(v, s);
 	}
-	/*for each component*/
-	for (i = 0; i < ctx.info.nc; i++) 
+	blk[0] = sc->dc * dq[0] + off;
+
+	/* AC coefficients */
+	for (k = 1; k < 64; k++) 
 	{
-		int h, v;
-		ctx.comps[i].cid = getbyte(&ctx); /*component id*/
-		ctx.comps[i].hv = getbyte(&ctx);
-		v = ctx.comps[i].hv & 15; /*vertical sampling   */
-		h = ctx.comps[i].hv >> 4; /*horizontal sampling */
-		ctx.comps[i].tq = getbyte(&ctx); /*quantization table used*/
-		if (h > 3 || v > 3) 
+		if (in->left < 16)
+			fillbits(in);
+			
+		/* Short codes with short values are decoded at once */
+		c = hu->fastac[in->bits >> (32 - HUFF_FASTBITS)];
+		if (c) 
 		{
-			err = ERR_ILLEGAL_HV;
-			goto error;
-		}
-		if (ctx.comps[i].tq > 3) 
+			r = c & 0xff;
+			in->bits <<= r;
+			in->left -= r;
+			k += (c >> 8) & 15;
+			v = c >> 16;
+		} 
+		else 
 		{
-			err = ERR_QUANT_TABLE_SELECTOR;
-			goto error;
+			c = dec_huff(in, hu);
+			if (c < 0)
+				return -1;
+			s = c & 15;
+			r = c >> 4;
+			if (s == 0) 
+			{
+				if (r != 15)	/* end of block */
+					break;
+				k += 15;		/* 16 zeros */
+				continue;
+			}
+			k += r;
+			v = getbits(in, s);
+			v = EXTEND(v, s);
 		}
+		if (k > 63)
+			return -1;
+		blk[dezig[k]] = v * dq[k];
+		ac |= 1 << (dezig[k] & 7);
 	}
-	/*read tables - if exist, up to start of scan marker (0xFFDA)*/ 
-	if (readtables(&ctx,M_SOS,&isInitHuffman)) 
+	return ac;
+}
+
+/****************************************************************/
+/**************             idct                  ***************/
+/****************************************************************/
+
+#define IMULT(a, b) (((a) * (b)) >> ISHIFT)
+#define ITOINT(a) ((a) >> ISHIFT)
+
+#define S22 ((PREC)IFIX(2 * 0.382683432))
+#define C22 ((PREC)IFIX(2 * 0.923879532))
+#define IC4 ((PREC)IFIX(1 / 0.707106781))
+
+/* How the samples of a block are placed into the yuyv picture */
+#define PUT_Y		0	/* luminance: even bytes */
+#define PUT_C		1	/* 422 chroma: every 4 bytes */
+#define PUT_C420	2	/* 420 chroma: every 4 bytes, each line written twice */
+#define PUT_C444	3	/* 444 chroma: even columns only, every 4 bytes */
+
+/* Write a line of 8 samples into the picture */
+static inline void put_line(uint8_t *pic, const uint8_t *v, int mode)
+{
+	switch (mode) 
 	{
-		err = ERR_BAD_TABLES;
-		goto error;
+		case PUT_Y:
+			pic[0] = v[0]; pic[2] = v[1]; pic[4] = v[2]; pic[6] = v[3];
+			pic[8] = v[4]; pic[10] = v[5]; pic[12] = v[6]; pic[14] = v[7];
+			break;
+		case PUT_C:
+		case PUT_C420:
+			pic[0] = v[0]; pic[4] = v[1]; pic[8] = v[2]; pic[12] = v[3];
+			pic[16] = v[4]; pic[20] = v[5]; pic[24] = v[6]; pic[28] = v[7];
+			break;
+		case PUT_C444:
+			pic[0] = v[0]; pic[4] = v[2]; pic[8] = v[4]; pic[12] = v[6];
+			break;
 	}
-	getword(&ctx); /* header lenght */
-	ctx.info.ns = getbyte(&ctx); /* number of scans */
-	if (!ctx.info.ns)
+}
+
+/*inverse dct for jpeg decoding, writing the samples straight into the yuyv picture
+* args: 
+*      blk: dequantized coefficients, as placed by decode_block. Cleared on return
+*      ac: mask of the columns with AC coefficients, as returned by decode_block
+*      pic: pointer to the first sample to write
+*      stride: picture stride
+*      mode: how samples are placed (PUT_xxx)
+*/
+static void idct_put(PREC *blk, int ac, uint8_t *pic, int stride, int mode)
+{
+	PREC t0, t1, t2, t3, t4, t5, t6, t7;
+	PREC tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6;
+	PREC tmp[64], te;
+	uint8_t out[8];
+	int i, j;
+	
+	if (!ac) //single color block
 	{
-	ALOGE("info ns %d/n",ctx.info.ns);
-		err = ERR_NOT_YCBCR_221111;
-		goto error;
+		t0 = ITOINT(blk[0]);
+		blk[0] = 0;
+		memset(out, CLIP(t0), sizeof(out));
+		for (j = 0; j < 8; j++, pic += stride)
+		{
+			put_line(pic, out, mode);
+			if (mode == PUT_C420) 
+			{
+				pic += stride;
+				put_line(pic, out, mode);
+			}
+		}
+		return;
 	}
-	/*for each scan*/
-	for (i = 0; i < ctx.info.ns; i++) 
+	
+	for (i = 0; i < 8; i++) //columns
 	{
-		ctx.dscans[i].cid = getbyte(&ctx); /*component id*/
-		tdc = getbyte(&ctx);
-		tac = tdc & 15; /*ac table*/
-		tdc >>= 4;      /*dc table*/
-		if (tdc > 1 || tac > 1) 
+		PREC *in = blk + i;
+		
+		if (i && !(ac & (1 << i))) //nothing in this column
 		{
-			err = ERR_QUANT_TABLE_SELECTOR;
-			goto error;
+			tmp[0 * 8 + i] = tmp[1 * 8 + i] = tmp[2 * 8 + i] = tmp[3 * 8 + i] = 0;
+			tmp[4 * 8 + i] = tmp[5 * 8 + i] = tmp[6 * 8 + i] = tmp[7 * 8 + i] = 0;
+			continue;
 		}
-		for (j = 0; j < ctx.info.nc; j++)
-			if (ctx.comps[j].cid == ctx.dscans[i].cid)
-				break;
-		if (j == ctx.info.nc) 
+		
+		t0 = in[0 * 8];
+		t1 = in[1 * 8];
+		t2 = in[2 * 8];
+		t3 = in[3 * 8];
+		t4 = in[4 * 8];
+		t5 = in[5 * 8];
+		t6 = in[6 * 8];
+		t7 = in[7 * 8];
+		in[0 * 8] = in[1 * 8] = in[2 * 8] = in[3 * 8] = 0;
+		in[4 * 8] = in[5 * 8] = in[6 * 8] = in[7 * 8] = 0;
+
+		if ((t1 | t2 | t3 | t4 | t5 | t6 | t7) == 0) 
 		{
-			err = ERR_UNKNOWN_CID_IN_SCAN;
-			goto error;
+			tmp[0 * 8 + i] = t0; //DC
+			tmp[1 * 8 + i] = t0;
+			tmp[2 * 8 + i] = t0;
+			tmp[3 * 8 + i] = t0;
+			tmp[4 * 8 + i] = t0;
+			tmp[5 * 8 + i] = t0;
+			tmp[6 * 8 + i] = t0;
+			tmp[7 * 8 + i] = t0;
+			continue;
 		}
-		ctx.dscans[i].hv = ctx.comps[j].hv;
-		ctx.dscans[i].tq = ctx.comps[j].tq;
-		ctx.dscans[i].hudc.dhuff = dec_huffdc + tdc;
-		ctx.dscans[i].huac.dhuff = dec_huffac + tac;
-	}
-
-	i = getbyte(&ctx); /*0 */
-	j = getbyte(&ctx); /*63*/
-	m = getbyte(&ctx); /*0 */
-
+		//IDCT;
+		tmp0 = t0 + t1;
+		t1 = t0 - t1;
+		tmp2 = t2 - t3;
+		t3 = t2 + t3;
+		tmp2 = IMULT(tmp2, IC4) - t3;
+		tmp3 = tmp0 + t3;
+		t3 = tmp0 - t3;
+		tmp1 = t1 + tmp2;
+		tmp2 = t1 - tmp2;
+		tmp4 = t4 - t7;
+		t7 = t4 + t7;
+		tmp5 = t5 + t6;
+		t6 = t5 - t6;
+		tmp6 = tmp5 - t7;
+		t7 = tmp5 + t7;
+		tmp5 = IMULT(tmp6, IC4);
+		tmp6 = IMULT((tmp4 + t6), S22);
+		tmp4 = IMULT(tmp4, (C22 - S22)) + tmp6;
+		t6 = IMULT(t6, (C22 + S22)) - tmp6;
+		t6 = t6 - t7;
+		t5 = tmp5 - t6;
+		t4 = tmp4 - t5;
+
+		tmp[0 * 8 + i] = tmp3 + t7;        //t0;
+		tmp[1 * 8 + i] = tmp1 + t6;        //t1;
+		tmp[2 * 8 + i] = tmp2 + t5;        //t2;
+		tmp[3 * 8 + i] = t3 + t4;          //t3;
+		tmp[4 * 8 + i] = t3 - t4;          //t4;
+		tmp[5 * 8 + i] = tmp2 - t5;        //t5;
+		tmp[6 * 8 + i] = tmp1 - t6;        //t6;
+		tmp[7 * 8 + i] = tmp3 - t7;        //t7;
+	}
+	for (j = 0; j < 64; j += 8) //lines
+	{
+		t0 = tmp[j + 0];
+		t1 = tmp[j + 1];
+		t2 = tmp[j + 2];
+		t3 = tmp[j + 3];
+		t4 = tmp[j + 4];
+		t5 = tmp[j + 5];
+		t6 = tmp[j + 6];
+		t7 = tmp[j + 7];
+		if ((t1 | t2 | t3 | t4 | t5 | t6 | t7) == 0) 
+		{
+			memset(out, CLIP(ITOINT(t0)), sizeof(out));
+		}
+		else
+		{
+			//IDCT;
+			tmp0 = t0 + t1;
+			t1 = t0 - t1;
+			tmp2 = t2 - t3;
+			t3 = t2 + t3;
+			tmp2 = IMULT(tmp2, IC4) - t3;
+			tmp3 = tmp0 + t3;
+			t3 = tmp0 - t3;
+			tmp1 = t1 + tmp2;
+			tmp2 = t1 - tmp2;
+			tmp4 = t4 - t7;
+			t7 = t4 + t7;
+			tmp5 = t5 + t6;
+			t6 = t5 - t6;
+			tmp6 = tmp5 - t7;
+			t7 = tmp5 + t7;
+			tmp5 = IMULT(tmp6, IC4);
+			tmp6 = IMULT((tmp4 + t6), S22);
+			tmp4 = IMULT(tmp4, (C22 - S22)) + tmp6;
+			t6 = IMULT(t6, (C22 + S22)) - tmp6;
+			t6 = t6 - t7;
+			t5 = tmp5 - t6;
+			t4 = tmp4 - t5;
+
+			te = ITOINT(tmp3 + t7);
+			out[0] = CLIP(te);
+			te = ITOINT(tmp1 + t6);
+			out[1] = CLIP(te);
+			te = ITOINT(tmp2 + t5);
+			out[2] = CLIP(te);
+			te = ITOINT(t3 + t4);
+			out[3] = CLIP(te);
+			te = ITOINT(t3 - t4);
+			out[4] = CLIP(te);
+			te = ITOINT(tmp2 - t5);
+			out[5] = CLIP(te);
+			te = ITOINT(tmp1 - t6);
+			out[6] = CLIP(te);
+			te = ITOINT(tmp3 - t7);
+			out[7] = CLIP(te);
+		}
+		
+		put_line(pic, out, mode);
+		pic += stride;
+		if (mode == PUT_C420) 
+		{
+			put_line(pic, out, mode);
+			pic += stride;
+		}
+	}
+}
+
+/* Decode count mcus, starting from the first one, and write them into
+   the picture. The blocks of each mcu are written as soon as they are 
+   decoded: Luminance on even bytes, U and V on the odd ones */
+static int decode_mcus(struct scan *sc, struct bitrd *in, const struct jpgframe *frm, int first, int count)
+{
+	PREC blk[64];
+	int i, j, m;
+	int stride = frm->stride;
+	int mx = first % frm->mcusx;
+	uint8_t *line = frm->pic + (first / frm->mcusx) * frm->ypitch;
+	uint8_t *mcu = line + mx * frm->xpitch;
+	
+	memset(blk, 0, sizeof(blk));
+	while (count-- > 0) 
+	{
+#define DECODE_PUT(sc, dst, mode) 											\
+		if ((m = decode_block(in, sc, blk, IFIX(128.5))) < 0) 			\
+			goto bad_data;													\
+		idct_put(blk, m, dst, stride, mode)
+				
+		switch (frm->mb)
+		{
+			case 6: 
+				DECODE_PUT(sc, mcu, PUT_Y);
+				DECODE_PUT(sc, mcu + 16, PUT_Y);
+				DECODE_PUT(sc, mcu + 8 * stride, PUT_Y);
+				DECODE_PUT(sc, mcu + 8 * stride + 16, PUT_Y);
+				DECODE_PUT(sc + 1, mcu + 1, PUT_C420);
+				DECODE_PUT(sc + 2, mcu + 3, PUT_C420);
+				break;
+				
+			case 4:
+				DECODE_PUT(sc, mcu, PUT_Y);
+				DECODE_PUT(sc, mcu + 16, PUT_Y);
+				DECODE_PUT(sc + 1, mcu + 1, PUT_C);
+				DECODE_PUT(sc + 2, mcu + 3, PUT_C);
+				break;
+				
+			case 3:
+				DECODE_PUT(sc, mcu, PUT_Y);
+				DECODE_PUT(sc + 1, mcu + 1, PUT_C444);
+				DECODE_PUT(sc + 2, mcu + 3, PUT_C444);
+				break;
+				
+			case 1:
+				DECODE_PUT(sc, mcu, PUT_Y);
+				for (j = 0; j < 8; j++)
+					for (i = 1; i < 16; i += 2)
+						mcu[j * stride + i] = 128;
+				break;
+		}
+#undef DECODE_PUT
+
+		/* Next mcu */
+		if (++mx < frm->mcusx) 
+		{
+			mcu += frm->xpitch;
+		} 
+		else 
+		{
+			mx = 0;
+			line += frm->ypitch;
+			mcu = line;
+		}
+	}
+	return 0;
+	
+bad_data:
+	ALOGE("jpeg_decode: bad huffman code");
+	return ERR_NO_EOI;
+}
+
+/* Decode count segments (the mcus between restart markers), starting from
+   the first one, whose data starts at p. The data must end with the marker
+   of the next segment, or the end of image one */
+static int decode_chunk(struct ctx *ctx, const struct jpgframe *frm, uint8_t *p, int first, int count)
+{
+	struct scan sc[MAXCOMP];
+	struct bitrd in;
+	int i, seg, mcu = 0, err;
+	int nseg = (frm->mcus + frm->seglen - 1) / frm->seglen;
+	
+	memcpy(sc, ctx->dscans, sizeof(sc));
+	setinput(&in, p);
+	for (seg = first; seg < first + count; seg++) 
+	{
+		if (seg > first && dec_readmarker(&in) != M_RST0 + ((seg - 1) & 7))
+			return ERR_WRONG_MARKER;
+		for (i = 0; i < ctx->info.ns; i++)
+			sc[i].dc = 0;
+			
+		mcu = seg * frm->seglen;
+		err = decode_mcus(sc, &in, frm, mcu, 
+					(frm->mcus - mcu < frm->seglen) ? frm->mcus - mcu : frm->seglen);
+		if (err)
+			return err;
+	}
+	
+	if (seg < nseg)
+		return (dec_readmarker(&in) != M_RST0 + ((seg - 1) & 7)) ? ERR_WRONG_MARKER : 0;
+	return (dec_readmarker(&in) != M_EOI) ? ERR_NO_EOI : 0;
+}
+
+/****************************************************************/
+/**************  restart interval parallel decoding  ************/
+/****************************************************************/
+
+/* The segments of a frame are grouped in up to JPEG_CHUNKS chunks, that 
+   are taken by the decoding threads as they become idle, so none of them
+   waits for the others. As each mcu is written to its own area of the 
+   picture, the threads never write to the same place. Up to JPEG_MAX_JOBS
+   frames, one per camera streaming, are decoded at the same time */
+#define JPEG_MAX_WORKERS 3
+#define JPEG_MAX_JOBS 2
+#define JPEG_CHUNKS 16
+
+struct jpeg_job {
+	struct ctx *ctx;
+	const struct jpgframe *frm;
+	int nchunks;
+	uint8_t *chunk[JPEG_CHUNKS];	/* data of the first segment of each chunk */
+	int first[JPEG_CHUNKS + 1];		/* first segment of each chunk */
+	volatile int32_t next;			/* next chunk to decode */
+	volatile int32_t err;			/* first error found */
+	int busy;						/* workers on it, under pool_lock */
+};
+
+/* Worker pool, started the first time a frame can be split. The thread 
+   that decodes the frame also takes chunks */
+static pthread_once_t pool_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_start = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t pool_done = PTHREAD_COND_INITIALIZER;
+static struct jpeg_job *pool_jobs[JPEG_MAX_JOBS];	/* jobs being decoded */
+static int pool_workers;
+
+static void run_job(struct jpeg_job *job)
+{
+	int c, err;
+	while ((c = android_atomic_inc(&job->next)) < job->nchunks) 
+	{
+		err = decode_chunk(job->ctx, job->frm, job->chunk[c], job->first[c], 
+					job->first[c + 1] - job->first[c]);
+		if (err)
+			android_atomic_cmpxchg(0, err, &job->err);
+	}
+}
+
+/* The job with chunks left and the fewest workers. Called with pool_lock 
+   held */
+static struct jpeg_job *pool_pick(void)
+{
+	struct jpeg_job *job = NULL;
+	int i;
+	for (i = 0; i < JPEG_MAX_JOBS; i++) 
+	{
+		struct jpeg_job *j = pool_jobs[i];
+		if (j && j->next < j->nchunks && (!job || j->busy < job->busy))
+			job = j;
+	}
+	return job;
+}
+
+static void *pool_thread(void *)
+{
+	struct jpeg_job *job;
+	
+	/* The frame being decoded is waited for by the preview */
+	androidSetThreadPriority(0, ANDROID_PRIORITY_URGENT_DISPLAY);
+	
+	pthread_mutex_lock(&pool_lock);
+	for (;;) 
+	{
+		while ((job = pool_pick()) == NULL)
+			pthread_cond_wait(&pool_start, &pool_lock);
+		job->busy++;
+		pthread_mutex_unlock(&pool_lock);
+		
+		run_job(job);
+		
+		pthread_mutex_lock(&pool_lock);
+		if (--job->busy == 0)
+			pthread_cond_broadcast(&pool_done);
+	}
+	return NULL;
+}
+
+static void pool_init(void)
+{
+	pthread_t thread;
+	int i, n;
+	
+	/* A worker per additional cpu */
+	n = sysconf(_SC_NPROCESSORS_CONF) - 1;
+	if (n > JPEG_MAX_WORKERS)
+		n = JPEG_MAX_WORKERS;
+	for (i = 0; i < n; i++) 
+	{
+		if (pthread_create(&thread, NULL, pool_thread, NULL) != 0)
+			break;
+		pthread_detach(thread);
+	}
+	pool_workers = i;
+	ALOGD("jpeg_decode: %d worker threads", pool_workers);
+}
+
+/* Find where the segments of each chunk start, and decode them in parallel.
+   Returns -1 if the frame can't be split, or the result of the decoding */
+static int decode_parallel(struct ctx *ctx, const struct jpgframe *frm, uint8_t *p, uint8_t *end)
+{
+	struct jpeg_job job;
+	int nseg = (frm->mcus + frm->seglen - 1) / frm->seglen;
+	int seg, c, slot;
+	
+	pthread_once(&pool_once, pool_init);
+	if (pool_workers == 0)
+		return -1;
+	
+	job.ctx = ctx;
+	job.frm = frm;
+	job.nchunks = (nseg < JPEG_CHUNKS) ? nseg : JPEG_CHUNKS;
+	for (c = 0; c <= job.nchunks; c++)
+		job.first[c] = c * nseg / job.nchunks;
+	job.next = 0;
+	job.err = 0;
+	job.busy = 0;
+	
+	/* Look for the restart markers. The data of the last chunk is not 
+	   scanned: it is checked while being decoded */
+	job.chunk[0] = p;
+	for (seg = 1, c = 1; c < job.nchunks; p++) 
+	{
+		if (p + 1 >= end)
+			return -1;
+		if (p[0] != 0xff || p[1] == 0 || p[1] == 0xff)
+			continue;
+		if (p[1] != M_RST0 + ((seg - 1) & 7))
+			return -1;
+		p++;
+		if (seg++ == job.first[c])
+			job.chunk[c++] = p + 1;
+	}
+	
+	pthread_mutex_lock(&pool_lock);
+	for (slot = 0; slot < JPEG_MAX_JOBS && pool_jobs[slot]; slot++)
+		;
+	if (slot == JPEG_MAX_JOBS) 
+	{
+		/* More frames than expected at once: decode this one alone */
+		pthread_mutex_unlock(&pool_lock);
+		return -1;
+	}
+	pool_jobs[slot] = &job;
+	pthread_cond_broadcast(&pool_start);
+	pthread_mutex_unlock(&pool_lock);
+	
+	run_job(&job);
+	
+	/* All the chunks are taken. Wait for the workers still decoding them */
+	pthread_mutex_lock(&pool_lock);
+	while (job.busy)
+		pthread_cond_wait(&pool_done, &pool_lock);
+	pool_jobs[slot] = NULL;
+	pthread_mutex_unlock(&pool_lock);
+	
+	return job.err;
+}
+
+/*jpeg decode
+* args: 
+*      pic:  pointer to picture data ( decoded image - yuyv format)
+*      stride: picture stride
+*      buf:  pointer to input data ( compressed jpeg )
+*      size: size of input data
+*      with: picture width 
+*      height: picture height
+*/
+int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int size, int width, int height)
+{
+	struct ctx ctx;
+	struct jpgframe frm;
+	int i=0, j=0, m=0, tac=0, tdc=0;
+	int intwidth=0, intheight=0;
+	int mcusx=0, mcusy=0;
+	int ypitch=0 ,xpitch=0;
+	int mb=0, nseg=0;
+	int err = 0;
+	int isInitHuffman = 0;
+	
+	if (buf == NULL) 
+	{
+		return -1;
+	}
+	ctx.datap = buf;
+	ctx.info.dri = 0;
+	/*check SOI (0xFFD8)*/
+	if (getbyte(&ctx) != 0xff) 
+	{
+		return ERR_NO_SOI;
+	}
+	if (getbyte(&ctx) != M_SOI) 
+	{
+		return ERR_NO_SOI;
+	}
+	/*read tables - if exist, up to start frame marker (0xFFC0)*/
+	if (readtables(&ctx,M_SOF0, &isInitHuffman)) 
+	{
+		return ERR_BAD_TABLES;
+	}
+	getword(&ctx);     /*header lenght*/
+	i = getbyte(&ctx); /*precision (8 bit)*/
+	if (i != 8) 
+	{
+		return ERR_NOT_8BIT;
+	}
+	intheight = getword(&ctx); /*height*/
+	intwidth = getword(&ctx);  /*width */
+
+	if ((intheight & 7) || (intwidth & 7)) /*must be even*/
+	{
+		return ERR_BAD_WIDTH_OR_HEIGHT;
+	}
+	ctx.info.nc = getbyte(&ctx); /*number of components*/
+	if (ctx.info.nc > MAXCOMP) 
+	{
+		return ERR_TOO_MANY_COMPPS;
+	}
+	/*for each component*/
+	for (i = 0; i < ctx.info.nc; i++) 
+	{
+		int h, v;
+		ctx.comps[i].cid = getbyte(&ctx); /*component id*/
+		ctx.comps[i].hv = getbyte(&ctx);
+		v = ctx.comps[i].hv & 15; /*vertical sampling   */
+		h = ctx.comps[i].hv >> 4; /*horizontal sampling */
+		ctx.comps[i].tq = getbyte(&ctx); /*quantization table used*/
+		if (h > 3 || v > 3) 
+		{
+			return ERR_ILLEGAL_HV;
+		}
+		if (ctx.comps[i].tq > 3) 
+		{
+			return ERR_QUANT_TABLE_SELECTOR;
+		}
+	}
+	/*read tables - if exist, up to start of scan marker (0xFFDA)*/ 
+	if (readtables(&ctx,M_SOS,&isInitHuffman)) 
+	{
+		return ERR_BAD_TABLES;
+	}
+	getword(&ctx); /* header lenght */
+	ctx.info.ns = getbyte(&ctx); /* number of scans */
+	if (!ctx.info.ns || ctx.info.ns > MAXCOMP)
+	{
+		ALOGE("info ns %d/n",ctx.info.ns);
+		return ERR_NOT_YCBCR_221111;
+	}
+	/*for each scan*/
+	for (i = 0; i < ctx.info.ns; i++) 
+	{
+		ctx.dscans[i].cid = getbyte(&ctx); /*component id*/
+		tdc = getbyte(&ctx);
+		tac = tdc & 15; /*ac table*/
+		tdc >>= 4;      /*dc table*/
+		if (tdc > 1 || tac > 1) 
+		{
+			return ERR_QUANT_TABLE_SELECTOR;
+		}
+		for (j = 0; j < ctx.info.nc; j++)
+			if (ctx.comps[j].cid == ctx.dscans[i].cid)
+				break;
+		if (j == ctx.info.nc) 
+		{
+			return ERR_UNKNOWN_CID_IN_SCAN;
+		}
+		ctx.dscans[i].hv = ctx.comps[j].hv;
+		ctx.dscans[i].tq = ctx.comps[j].tq;
+		ctx.dscans[i].hudc = dec_huffdc + tdc;
+		ctx.dscans[i].huac = dec_huffac + tac;
+	}
+
+	i = getbyte(&ctx); /*0 */
+	j = getbyte(&ctx); /*63*/
+	m = getbyte(&ctx); /*0 */
+
 	if (i != 0 || j != 63 || m != 0) 
 	{
 		ALOGE("hmm FW error,not seq DCT ??\n");
@@ -702,164 +1105,114 @@ int jpeg_decode(uint8_t *pic, int stride, uint8_t *buf, int width, int height)
 		if(huffman_init(&ctx) < 0)
 			return -ERR_BAD_TABLES;
 	}
-	/*
-	if (ctx->dscans[0].cid != 1 || ctx->dscans[1].cid != 2 || ctx->dscans[2].cid != 3) 
-	{
-		err = ERR_NOT_YCBCR_221111;
-		goto error;
-	}
-
-	if (ctx->dscans[1].hv != 0x11 || ctx->dscans[2].hv != 0x11) 
-	{
-		err = ERR_NOT_YCBCR_221111;
-		goto error;
-	}
-	*/
+	
 	/* if internal width and external are not the same or heigth too 
 	and pic not allocated realloc the good size and mark the change 
 	need 1 macroblock line more ?? */
 	if (intwidth > width || intheight > height) 
 	{
 		return -ERR_BAD_WIDTH_OR_HEIGHT;
-#if 0		
-		width = intwidth;
-		height = intheight;
-		// BytesperPixel 2 yuyv , 3 rgb24 
-		*pic = (uint8_t*) realloc( *pic, intwidth * (intheight + 8) * 2);
-#endif
 	}
 
 	switch (ctx.dscans[0].hv) 
 	{
 		case 0x22: // 411
 			mb=6;
-			mcusx = width >> 4;
-			mcusy = height >> 4;
-
+			mcusx = intwidth >> 4;
+			mcusy = intheight >> 4;
 			xpitch = 16 * 2;
-
 			ypitch = 16 * stride;
-			convert = yuv420pto422; //choose the right conversion function
 			break;
 		case 0x21: //422
 			mb=4;
-			mcusx = width >> 4;
-			mcusy = height >> 3;
-
+			mcusx = intwidth >> 4;
+			mcusy = intheight >> 3;
 			xpitch = 16 * 2;
-
 			ypitch = 8 * stride;
-			convert = yuv422pto422; //choose the right conversion function
 			break;
 		case 0x11: //444
-			mcusx = width >> 3;
-			mcusy = height >> 3;
-
+			mcusx = intwidth >> 3;
+			mcusy = intheight >> 3;
 			xpitch = 8 * 2;
-
 			ypitch = 8 * stride;
-			if (ctx.info.ns==1) 
-			{
-				mb = 1;
-				convert = yuv400pto422; //choose the right conversion function
-			}
-			else 
-			{
-				mb=3;
-				convert = yuv444pto422; //choose the right conversion function
-			}
+			mb = (ctx.info.ns==1) ? 1 : 3;
 			break;
 		default:
-			err = ERR_NOT_YCBCR_221111;
-			goto error;
-			break;
+			return ERR_NOT_YCBCR_221111;
+	}
+	if (mb > 1 && ctx.info.ns < 3)
+	{
+		return ERR_NOT_YCBCR_221111;
 	}
 
-	idctqtab(ctx.quant[ctx.dscans[0].tq], decdata->dquant[0]);
-	idctqtab(ctx.quant[ctx.dscans[1].tq], decdata->dquant[1]);
-	idctqtab(ctx.quant[ctx.dscans[2].tq], decdata->dquant[2]);
-	setinput(&ctx.in, ctx.datap);
-	dec_initscans(&ctx);
-
-	ctx.dscans[0].next = 2;
-	ctx.dscans[1].next = 1;
-	ctx.dscans[2].next = 0;	/* 4xx encoding */
-	for (my = 0,y=0; my < mcusy; my++,y+=ypitch) 
+	for (i = 0; i < ctx.info.ns; i++)
+		idctqtab(ctx.quant[ctx.dscans[i].tq], ctx.dscans[i].dquant);
+
+	frm.pic = pic;
+	frm.stride = stride;
+	frm.mb = mb;
+	frm.mcusx = mcusx;
+	frm.mcus = mcusx * mcusy;
+	frm.xpitch = xpitch;
+	frm.ypitch = ypitch;
+	frm.seglen = (ctx.info.dri && ctx.info.dri < frm.mcus) ? ctx.info.dri : frm.mcus;
+	nseg = (frm.mcus + frm.seglen - 1) / frm.seglen;
+	
+	/* With restart markers, the segments between them are decoded in parallel */
+	if (nseg > 1)
 	{
-		for (mx = 0,x=0; mx < mcusx; mx++,x+=xpitch) 
+		err = decode_parallel(&ctx, &frm, ctx.datap, buf + size);
+		if (err >= 0)
+			return err;
+			
+		/* Segments not where expected: decode sequentially, to find out
+		   what is wrong */
+	}
+
+	return decode_chunk(&ctx, &frm, ctx.datap, 0, nseg);
+}
+
+/* Build the lookup tables to decode a huffman table */
+static void dec_makehuff(struct huff_tbl *hu, int *hufflen, uint8_t *huffvals, int isAC)
+{
+	int code, k, l, j, d, n, s, v;
+	
+	memset(hu->fast, 0, sizeof(hu->fast));
+	memset(hu->fastac, 0, sizeof(hu->fastac));
+
+	code = 0;
+	k = 0;
+	for (l = 1; l <= 16; l++, code <<= 1)
+	{	/* sizes */
+		hu->delta[l] = k - code;
+		for (j = 0; j < hufflen[l - 1]; j++, k++, code++) 
 		{
-			if (ctx.info.dri && !--ctx.info.nm)
-				if (dec_checkmarker(&ctx)) 
+			hu->vals[k] = huffvals[k];
+			if (l > HUFF_FASTBITS)
+				continue;
+				
+			/* All the lookahead values starting with this code */
+			n = 1 << (HUFF_FASTBITS - l);
+			for (d = 0; d < n; d++) 
+			{
+				hu->fast[(code << (HUFF_FASTBITS - l)) | d] = l << 8 | hu->vals[k];
+				
+				/* If its value also fits, decode both at once */
+				s = hu->vals[k] & 15;
+				if (isAC && s && l + s <= HUFF_FASTBITS) 
 				{
-					err = ERR_WRONG_MARKER;
-					goto error;
+					v = d >> (HUFF_FASTBITS - l - s);
+					v = EXTEND(v, s);
+					hu->fastac[(code << (HUFF_FASTBITS - l)) | d] = 
+						v * 65536 + (hu->vals[k] & 0xf0) * 16 + l + s;
 				}
-			switch (mb)
-			{
-				case 6: 
-					decode_mcus(&ctx.in, decdata->dcts, mb, ctx.dscans, max);
-					idct(decdata->dcts, decdata->out, decdata->dquant[0],
-						IFIX(128.5), max[0]);
-					idct(decdata->dcts + 64, decdata->out + 64,
-						decdata->dquant[0], IFIX(128.5), max[1]);
-					idct(decdata->dcts + 128, decdata->out + 128,
-						decdata->dquant[0], IFIX(128.5), max[2]);
-					idct(decdata->dcts + 192, decdata->out + 192,
-						decdata->dquant[0], IFIX(128.5), max[3]);
-					idct(decdata->dcts + 256, decdata->out + 256,
-						decdata->dquant[1], IFIX(0.5), max[4]);
-					idct(decdata->dcts + 320, decdata->out + 320,
-						decdata->dquant[2], IFIX(0.5), max[5]);
-					break;
-					
-				case 4:
-					decode_mcus(&ctx.in, decdata->dcts, mb, ctx.dscans, max);
-					idct(decdata->dcts, decdata->out, decdata->dquant[0],
-						IFIX(128.5), max[0]);
-					idct(decdata->dcts + 64, decdata->out + 64,
-						decdata->dquant[0], IFIX(128.5), max[1]);
-					idct(decdata->dcts + 128, decdata->out + 256,
-							decdata->dquant[1], IFIX(0.5), max[4]);
-					idct(decdata->dcts + 192, decdata->out + 320,
-						decdata->dquant[2], IFIX(0.5), max[5]);
-					break;
-					
-				case 3:
-					decode_mcus(&ctx.in, decdata->dcts, mb, ctx.dscans, max);
-					idct(decdata->dcts, decdata->out, decdata->dquant[0],
-						IFIX(128.5), max[0]);    
-					idct(decdata->dcts + 64, decdata->out + 256,
-						decdata->dquant[1], IFIX(0.5), max[4]);
-					idct(decdata->dcts + 128, decdata->out + 320,
-						decdata->dquant[2], IFIX(0.5), max[5]);
-					break;
-					
-				case 1:
-					decode_mcus(&ctx.in, decdata->dcts, mb, ctx.dscans, max);
-					idct(decdata->dcts, decdata->out, decdata->dquant[0],
-						IFIX(128.5), max[0]);
-					break;
-			} // switch enc411
-			convert(decdata->out,pic+y+x,stride); //convert to 422
+			}
 		}
+		hu->maxcode[l] = code << (16 - l);
 	}
-
-	m = dec_readmarker(&ctx.in);
-	if (m != M_EOI) 
-	{
-		err = ERR_NO_EOI;
-		goto error;
-	}
-	free(decdata);
-	return 0;
-error:
-	free(decdata);
-	return err;
+	hu->maxcode[17] = 0xffffffff;	/* always terminate decode */
 }
 
-/****************************************************************/
-/**************       huffman decoder             ***************/
-/****************************************************************/
 static int huffman_init(struct ctx* ctx)
 {
 	int tc, th, tt;
@@ -887,399 +1240,11 @@ static int huffman_init(struct ctx* ctx)
 				huffvals[k++] = *ptr++;
 			l -= hufflen[i];
 		}
-		dec_makehuff(ctx->dhuff + tt, hufflen, huffvals);
+		dec_makehuff(ctx->dhuff + tt, hufflen, huffvals, tc);
 	}
 	return 0;
 }
 
-
-static void setinput(struct in *in, uint8_t *p)
-{
-	in->p = p;
-	in->left = 0;
-	in->bits = 0;
-	in->marker = 0;
-}
-
-static int fillbits(struct in *in, int le, unsigned int bi)
-{
-	int b, m;
-
-	if (in->marker) 
-	{
-		if (le <= 16)
-			in->bits = bi << 16, le += 16;
-		return le;
-	}
-	while (le <= 24) 
-	{
-		b = *in->p++;
-		if (b == 0xff && (m = *in->p++) != 0) 
-		{
-			if (m == M_EOF) 
-			{
-				if (in->func && (m = in->func(in->data)) == 0)
-					continue;
-			}
-			in->marker = m;
-			if (le <= 16)
-				bi = bi << 16, le += 16;
-			break;
-		}
-		bi = bi << 8 | b;
-		le += 8;
-	}
-	in->bits = bi;		/* tmp... 2 return values needed */
-	return le;
-}
-
-static int dec_readmarker(struct in *in)
-{
-	int m;
-
-	in->left = fillbits(in, in->left, in->bits);
-	if ((m = in->marker) == 0)
-		return 0;
-	in->left = 0;
-	in->marker = 0;
-	return m;
-}
-
-#define LEBI_DCL	int le, bi
-#define LEBI_GET(in)	(le = in->left, bi = in->bits)
-#define LEBI_PUT(in)	(in->left = le, in->bits = bi)
-
-#define GETBITS(in, n) (					\
-  (le < (n) ? le = fillbits(in, le, bi), bi = in->bits : 0),	\
-  (le -= (n)),							\
-  bi >> le & ((1 << (n)) - 1)					\
-)
-
-#define UNGETBITS(in, n) (	\
-  le += (n)			\
-)
-
-
-static int dec_rec2(struct in *in, struct dec_hufftbl *hu, int *runp, int c, int i)
-{
-	LEBI_DCL;
-
-	LEBI_GET(in);
-	if (i) 
-	{
-		UNGETBITS(in, i & 127);
-		*runp = i >> 8 & 15;
-		i >>= 16;
-	}
-	else
-	{
-		for (i = DECBITS;
-		(c = ((c << 1) | GETBITS(in, 1))) >= (hu->maxcode[i]); i++);
-		if (i >= 16) 
-		{
-			in->marker = M_BADHUFF;
-			return 0;
-		}
-		i = hu->vals[hu->valptr[i] + c - hu->maxcode[i - 1] * 2];
-		*runp = i >> 4;
-		i &= 15;
-	}
-	if (i == 0)
-	{	/* sigh, 0xf0 is 11 bit */
-		LEBI_PUT(in);
-		return 0;
-	}
-	/* receive part */
-	c = GETBITS(in, i);
-	if (c < (1 << (i - 1)))
-		c += (-1 << i) + 1;
-	LEBI_PUT(in);
-	return c;
-}
-
-#define DEC_REC(in, hu, r, i)	 (	\
-  r = GETBITS(in, DECBITS),		\
-  i = hu->llvals[r],			\
-  i & 128 ?				\
-    (					\
-      UNGETBITS(in, i & 127),		\
-      r = i >> 8 & 15,			\
-      i >> 16				\
-    )					\
-  :					\
-    (					\
-      LEBI_PUT(in),			\
-      i = dec_rec2(in, hu, &r, r, i),	\
-      LEBI_GET(in),			\
-      i					\
-    )					\
-)
-
-static void decode_mcus(struct in *in, int *dct, int n, struct scan *sc ,int *maxp)
-{
-	struct dec_hufftbl *hu;
-	int i = 0, r = 0, t = 0;
-	LEBI_DCL;
-
-	memset(dct, 0, n * 64 * sizeof(*dct));
-	LEBI_GET(in);
-	while (n-- > 0) 
-	{
-		hu = sc->hudc.dhuff;
-		*dct++ = (sc->dc += DEC_REC(in, hu, r, t));
-
-		hu = sc->huac.dhuff;
-		i = 63;
-		while (i > 0) 
-		{
-			t = DEC_REC(in, hu, r, t);
-			if (t == 0 && r == 0) 
-			{
-				dct += i;
-				break;
-			}
-			dct += r;
-			*dct++ = t;
-			i -= r + 1;
-		}
-		*maxp++ = 64 - i;
-		if (n == sc->next)
-		sc++;
-	}
-	LEBI_PUT(in);
-}
-
-static void dec_makehuff(struct dec_hufftbl *hu, int *hufflen, uint8_t *huffvals)
-{
-	int code, k, i, j, d, x, c, v;
-	for (i = 0; i < (1 << DECBITS); i++)
-		hu->llvals[i] = 0;
-
-	/*
-	* llvals layout:
-	*
-	* value v already known, run r, backup u bits:
-	*  vvvvvvvvvvvvvvvv 0000 rrrr 1 uuuuuuu
-	* value unknown, size b bits, run r, backup u bits:
-	*  000000000000bbbb 0000 rrrr 0 uuuuuuu
-	* value and size unknown:
-	*  0000000000000000 0000 0000 0 0000000
-	*/
-	code = 0;
-	k = 0;
-	for (i = 0; i < 16; i++, code <<= 1)
-	{	/* sizes */
-		hu->valptr[i] = k;
-		for (j = 0; j < hufflen[i]; j++) 
-		{
-			hu->vals[k] = *huffvals++;
-			if (i < DECBITS) 
-			{
-				c = code << (DECBITS - 1 - i);
-				v = hu->vals[k] & 0x0f;	/* size */
-				for (d = 1 << (DECBITS - 1 - i); --d >= 0;)
-				{
-					if (v + i < DECBITS) 
-					{	/* both fit in table */
-						x = d >> (DECBITS - 1 - v - i);
-						if (v && x < (1 << (v - 1)))
-							x += (-1 << v) + 1;
-						x = x << 16 | (hu->vals[k] & 0xf0) << 4 |
-							(DECBITS - (i + 1 + v)) | 128;
-					} 
-					else 
-						x = v << 16 | (hu->vals[k] & 0xf0) << 4 |
-							(DECBITS - (i + 1));
-					hu->llvals[c | d] = x;
-				}
-			}
-			code++;
-			k++;
-		}
-		hu->maxcode[i] = code;
-	}
-	hu->maxcode[16] = 0x20000;	/* always terminate decode */
-}
-
-/****************************************************************/
-/**************             idct                  ***************/
-/****************************************************************/
-
-#define IMULT(a, b) (((a) * (b)) >> ISHIFT)
-#define ITOINT(a) ((a) >> ISHIFT)
-
-#define S22 ((PREC)IFIX(2 * 0.382683432))
-#define C22 ((PREC)IFIX(2 * 0.923879532))
-#define IC4 ((PREC)IFIX(1 / 0.707106781))
-
-//zigzag order used by idct
-static uint8_t zig2[64] = {
-    0, 2, 3, 9, 10, 20, 21, 35,
-    14, 16, 25, 31, 39, 46, 50, 57,
-    5, 7, 12, 18, 23, 33, 37, 48,
-    27, 29, 41, 44, 52, 55, 59, 62,
-    15, 26, 30, 40, 45, 51, 56, 58,
-    1, 4, 8, 11, 19, 22, 34, 36,
-    28, 42, 43, 53, 54, 60, 61, 63,
-    6, 13, 17, 24, 32, 38, 47, 49
-};
-
-/*inverse dct for jpeg decoding
-* args: 
-*      in:  pointer to input data ( mcu - after huffman decoding)
-*      out: pointer to data with output of idct (to be filled)
-*      quant: pointer to quantization data tables
-*      off: offset value (128.5 or 0.5)
-*      max: maximum input mcu index?
-*/
-inline static void idct(int *in, int *out, int *quant, long off, int max)
-{
-	long t0, t1, t2, t3, t4, t5, t6, t7;	// t ;
-	long tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6;
-	long tmp[64], *tmpp;
-	int i, j, te;
-	uint8_t *zig2p;
-
-	t0 = off;
-	if (max == 1) //single color mcu
-	{
-		t0 += in[0] * quant[0];     //only DC available
-		for (i = 0; i < 64; i++)    // fill mcu with DC value
-			out[i] = ITOINT(t0);
-		return;
-	}
-	zig2p = zig2;
-	tmpp = tmp;
-	for (i = 0; i < 8; i++) //apply quantization table in zigzag order
-	{
-		j = *zig2p++;
-		t0 += in[j] * (long) quant[j];
-		j = *zig2p++;
-		t5 = in[j] * (long) quant[j];
-		j = *zig2p++;
-		t2 = in[j] * (long) quant[j];
-		j = *zig2p++;
-		t7 = in[j] * (long) quant[j];
-		j = *zig2p++;
-		t1 = in[j] * (long) quant[j];
-		j = *zig2p++;
-		t4 = in[j] * (long) quant[j];
-		j = *zig2p++;
-		t3 = in[j] * (long) quant[j];
-		j = *zig2p++;
-		t6 = in[j] * (long) quant[j];
-
-
-		if ((t1 | t2 | t3 | t4 | t5 | t6 | t7) == 0) 
-		{
-			tmpp[0 * 8] = t0; //DC
-			tmpp[1 * 8] = t0;
-			tmpp[2 * 8] = t0;
-			tmpp[3 * 8] = t0;
-			tmpp[4 * 8] = t0;
-			tmpp[5 * 8] = t0;
-			tmpp[6 * 8] = t0;
-			tmpp[7 * 8] = t0;
-
-			tmpp++;
-			t0 = 0;
-			continue;
-		}
-		//IDCT;
-		tmp0 = t0 + t1;
-		t1 = t0 - t1;
-		tmp2 = t2 - t3;
-		t3 = t2 + t3;
-		tmp2 = IMULT(tmp2, IC4) - t3;
-		tmp3 = tmp0 + t3;
-		t3 = tmp0 - t3;
-		tmp1 = t1 + tmp2;
-		tmp2 = t1 - tmp2;
-		tmp4 = t4 - t7;
-		t7 = t4 + t7;
-		tmp5 = t5 + t6;
-		t6 = t5 - t6;
-		tmp6 = tmp5 - t7;
-		t7 = tmp5 + t7;
-		tmp5 = IMULT(tmp6, IC4);
-		tmp6 = IMULT((tmp4 + t6), S22);
-		tmp4 = IMULT(tmp4, (C22 - S22)) + tmp6;
-		t6 = IMULT(t6, (C22 + S22)) - tmp6;
-		t6 = t6 - t7;
-		t5 = tmp5 - t6;
-		t4 = tmp4 - t5;
-
-		tmpp[0 * 8] = tmp3 + t7;        //t0;
-		tmpp[1 * 8] = tmp1 + t6;        //t1;
-		tmpp[2 * 8] = tmp2 + t5;        //t2;
-		tmpp[3 * 8] = t3 + t4;          //t3;
-		tmpp[4 * 8] = t3 - t4;          //t4;
-		tmpp[5 * 8] = tmp2 - t5;        //t5;
-		tmpp[6 * 8] = tmp1 - t6;        //t6;
-		tmpp[7 * 8] = tmp3 - t7;        //t7;
-		tmpp++;
-		t0 = 0;
-	}
-	for (i = 0, j = 0; i < 8; i++) 
-	{
-		t0 = tmp[j + 0];
-		t1 = tmp[j + 1];
-		t2 = tmp[j + 2];
-		t3 = tmp[j + 3];
-		t4 = tmp[j + 4];
-		t5 = tmp[j + 5];
-		t6 = tmp[j + 6];
-		t7 = tmp[j + 7];
-		if ((t1 | t2 | t3 | t4 | t5 | t6 | t7) == 0) 
-		{
-			te = ITOINT(t0);
-			out[j + 0] = te;
-			out[j + 1] = te;
-			out[j + 2] = te;
-			out[j + 3] = te;
-			out[j + 4] = te;
-			out[j + 5] = te;
-			out[j + 6] = te;
-			out[j + 7] = te;
-			j += 8;
-			continue;
-		}
-		//IDCT;
-		tmp0 = t0 + t1;
-		t1 = t0 - t1;
-		tmp2 = t2 - t3;
-		t3 = t2 + t3;
-		tmp2 = IMULT(tmp2, IC4) - t3;
-		tmp3 = tmp0 + t3;
-		t3 = tmp0 - t3;
-		tmp1 = t1 + tmp2;
-		tmp2 = t1 - tmp2;
-		tmp4 = t4 - t7;
-		t7 = t4 + t7;
-		tmp5 = t5 + t6;
-		t6 = t5 - t6;
-		tmp6 = tmp5 - t7;
-		t7 = tmp5 + t7;
-		tmp5 = IMULT(tmp6, IC4);
-		tmp6 = IMULT((tmp4 + t6), S22);
-		tmp4 = IMULT(tmp4, (C22 - S22)) + tmp6;
-		t6 = IMULT(t6, (C22 + S22)) - tmp6;
-		t6 = t6 - t7;
-		t5 = tmp5 - t6;
-		t4 = tmp4 - t5;
-
-		out[j + 0] = ITOINT(tmp3 + t7);
-		out[j + 1] = ITOINT(tmp1 + t6);
-		out[j + 2] = ITOINT(tmp2 + t5);
-		out[j + 3] = ITOINT(t3 + t4);
-		out[j + 4] = ITOINT(t3 - t4);
-		out[j + 5] = ITOINT(tmp2 - t5);
-		out[j + 6] = ITOINT(tmp1 - t6);
-		out[j + 7] = ITOINT(tmp3 - t7);
-		j += 8;
-	}
-}
-
 static uint8_t zig[64] = {
     0, 1, 5, 6, 14, 15, 27, 28,
     2, 4, 7, 13, 16, 26, 29, 42,
@@ -1308,4 +1273,3 @@ static void idctqtab(uint8_t *qin,PREC *qout)
 			qout[zig[i * 8 + j]] = qin[zig[i * 8 + j]] *
 				IMULT(aaidct[i], aaidct[j]);
 }
-
@@ -47,7 +47,7 @@ extern "C" {
 #include <stdint.h>
 };
 
-int jpeg_decode(uint8_t *pic,int stride, uint8_t *buf, int width, int height);
+int jpeg_decode(uint8_t *pic,int stride, uint8_t *buf, int size, int width, int height);
 
 /*******Error codes *******/
 #define ERR_NO_SOI 1
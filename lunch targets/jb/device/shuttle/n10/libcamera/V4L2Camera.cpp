@@ -12,13 +12,17 @@
 extern "C" {
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <errno.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/select.h>
+#include <poll.h>
+#include <pthread.h>
 #include "uvc_compat.h"
 #include "v4l2_formats.h"
 };
@@ -26,14 +30,21 @@ extern "C" {
 #include "V4L2Camera.h"
 #include "Utils.h"
 #include "Converter.h"
+#include "CameraStats.h"
 
 #define HEADERFRAME1 0xaf
 
+#ifndef V4L2_BUF_FLAG_TIMESTAMP_MASK
+#define V4L2_BUF_FLAG_TIMESTAMP_MASK		0xe000
+#define V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC	0x2000
+#endif
+
 namespace android {
 
 V4L2Camera::V4L2Camera ()
-        : fd(-1), nQueued(0), nDequeued(0)
+        : fd(-1), nQueued(0), nDequeued(0), m_PowerOn(false)
 {
+	m_CapsCache[0] = 0;
     videoIn = (struct vdIn *) calloc (1, sizeof (struct vdIn));
 }
 
@@ -44,26 +55,89 @@ V4L2Camera::~V4L2Camera()
 }
 
 // File to control camera power
+#ifndef CAMERA_POWER
 #define CAMERA_POWER "/sys/devices/platform/n10-pm-camera/power_on"
+#endif
+
+// Files where the enumerated video modes are cached. Each device node has 
+// its own, so several cameras can be used without invalidating each other
+#ifndef CAPS_CACHE_FMT
+#define CAPS_CACHE_FMT "/data/misc/camera/v4l2_caps_%s.bin"
+#endif
+
+// Users of the camera power rail
+static pthread_mutex_t powerLock = PTHREAD_MUTEX_INITIALIZER;
+static int powerUsers = 0;
+
+bool V4L2Camera::AcquirePower(bool* wasOn)
+{
+	bool on = true;
+	
+	pthread_mutex_lock(&powerLock);
+	if (powerUsers == 0) {
+		ALOGD("V4L2Camera::AcquirePower: Power ON camera.");
+	
+		// power on camera, unless it was left on
+		int handle = ::open(CAMERA_POWER,O_RDWR);
+		if (handle >= 0) {
+			char state = '0';
+			on = ::read(handle,&state,1) == 1 && state == '1';
+			if (!on) {
+				::lseek(handle,0,SEEK_SET);
+				::write(handle,"1\n",2);
+			}
+			::close(handle);
+		} else {
+			ALOGE("Could not open %s for writing.", CAMERA_POWER);
+			pthread_mutex_unlock(&powerLock);
+			return false;
+		} 
+
+		// Wait a bit to allow camera to start...
+		if (!on)
+			::usleep(500000);
+	}
+	powerUsers++;
+	if (wasOn)
+		*wasOn = on;
+	pthread_mutex_unlock(&powerLock);
+	return true;
+}
+
+void V4L2Camera::ReleasePower()
+{
+	pthread_mutex_lock(&powerLock);
+	if (powerUsers > 0 && --powerUsers == 0) {
+		ALOGD("V4L2Camera::ReleasePower: Power OFF camera.");
+	
+		// power off camera
+		int handle = ::open(CAMERA_POWER,O_RDWR);
+		if (handle >= 0) {
+			::write(handle,"0\n",2);
+			::close(handle);
+		} else {
+			ALOGE("Could not open %s for writing.", CAMERA_POWER);
+		} 
+	
+		// Wait a bit to allow camera to stop... Holding the lock, so it is 
+		//  not powered on again meanwhile
+		::usleep(500000);
+	}
+	pthread_mutex_unlock(&powerLock);
+}
 
 bool V4L2Camera::PowerOn(const char *device)
 {
 	ALOGD("V4L2Camera::PowerOn: Power ON camera.");
 	
-	// power on camera
-	int handle = ::open(CAMERA_POWER,O_RDWR);
-	if (handle >= 0) {
-		::write(handle,"1\n",2);
-		::close(handle);
-	} else {
-		ALOGE("Could not open %s for writing.", CAMERA_POWER);
-		return false;
-    } 
-
-	// Wait a bit to allow camera to start...
-	::usleep(500000);
+	if (!m_PowerOn) {
+		if (!AcquirePower())
+			return false;
+		m_PowerOn = true;
+	}
 
 	// Wait until the camera is recognized or timed out
+	int handle;
 	int timeOut = 500;
 	do {
 		// Try to open the video capture device
@@ -82,6 +156,7 @@ bool V4L2Camera::PowerOn(const char *device)
 		ALOGE("Unable to power camera");
 	}
 	
+	PowerOff();
 	return false;
 }
 
@@ -89,19 +164,11 @@ bool V4L2Camera::PowerOff()
 {
 	ALOGD("V4L2Camera::PowerOff: Power OFF camera.");
 	
-	// power on camera
-	int handle = ::open(CAMERA_POWER,O_RDWR);
-	if (handle >= 0) {
-		::write(handle,"0\n",2);
-		::close(handle);
-	} else {
-		ALOGE("Could not open %s for writing.", CAMERA_POWER);
-		return false;
-    } 
-	
-	// Wait a bit to allow camera to stop...
-	::usleep(500000);
-
+	// Other cameras could still be using it
+	if (m_PowerOn) {
+		m_PowerOn = false;
+		ReleasePower();
+	}
 	return true;
 }
 
@@ -142,6 +209,8 @@ int V4L2Camera::Open (const char *device)
     }
 	
 	/* Enumerate all available frame formats */
+	const char* node = strrchr(device, '/');
+	snprintf(m_CapsCache, sizeof(m_CapsCache), CAPS_CACHE_FMT, node ? node + 1 : device);
 	EnumFrameFormats();
 
     return ret;
@@ -149,10 +218,16 @@ int V4L2Camera::Open (const char *device)
 
 void V4L2Camera::Close ()
 {
-	/* Release the temporary buffer, if any */
+	/* Release the temporary buffers, if any */
 	if (videoIn->tmpBuffer)
 		free(videoIn->tmpBuffer);
 	videoIn->tmpBuffer = NULL;
+	if (videoIn->scaleBuffer)
+		free(videoIn->scaleBuffer);
+	videoIn->scaleBuffer = NULL;
+	if (videoIn->scaleLine)
+		free(videoIn->scaleLine);
+	videoIn->scaleLine = NULL;
 
 	/* Close the file descriptor */
 	if (fd > 0)
@@ -168,6 +243,33 @@ static int my_abs(int x)
 	return (x < 0) ? -x : x;
 }
 
+/* Smallest valid bytes per line of the first plane of a pixel format. For 
+   compressed formats, it just sizes the buffers */
+static unsigned int min_bytes_per_line(int pixelformat, unsigned int width)
+{
+	switch (pixelformat) {
+		case V4L2_PIX_FMT_SGBRG8:
+		case V4L2_PIX_FMT_SGRBG8:
+		case V4L2_PIX_FMT_SBGGR8:
+		case V4L2_PIX_FMT_SRGGB8:
+		case V4L2_PIX_FMT_GREY:
+		case V4L2_PIX_FMT_YUV420:
+		case V4L2_PIX_FMT_YVU420:
+		case V4L2_PIX_FMT_NV12:
+		case V4L2_PIX_FMT_NV21:
+		case V4L2_PIX_FMT_NV16:
+		case V4L2_PIX_FMT_NV61:
+			return width;
+			
+		case V4L2_PIX_FMT_RGB24:
+		case V4L2_PIX_FMT_BGR24:
+			return width * 3;
+			
+		default:
+			return width * 2;
+	}
+}
+
 int V4L2Camera::Init(int width, int height, int fps)
 {
 	ALOGD("V4L2Camera::Init");
@@ -251,26 +353,20 @@ int V4L2Camera::Init(int width, int height, int fps)
 
 	ALOGD("Selected format: (%d x %d), Fps: %d",closest.getWidth(),closest.getHeight(),closest.getFps());
 	
-	// Check if we will have to crop the captured image
-	bool crop = width != closest.getWidth() || height != closest.getHeight();
-	
-	// Iterate through pixel formats from best to worst
+	// Iterate through pixel formats from best to worst. Formats that can't 
+	// be cropped while converting are cropped when scaling
 	ret = -1;
 	for (i=0; i < (sizeof(pixFmtsOrder) / sizeof(pixFmtsOrder[0])); i++) {
 	
-		// If we will need to crop, make sure to only select formats we can crop...
-		if (!crop || pixFmtsOrder[i].allowscrop) {
-		
-			memset(&videoIn->format,0,sizeof(videoIn->format));
-			videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-			videoIn->format.fmt.pix.width = closest.getWidth();
-			videoIn->format.fmt.pix.height = closest.getHeight();
-			videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
-
-			ret = ioctl(fd, VIDIOC_TRY_FMT, &videoIn->format);
-			if (ret >= 0) {
-				break;
-			}
+		memset(&videoIn->format,0,sizeof(videoIn->format));
+		videoIn->format.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		videoIn->format.fmt.pix.width = closest.getWidth();
+		videoIn->format.fmt.pix.height = closest.getHeight();
+		videoIn->format.fmt.pix.pixelformat = pixFmtsOrder[i].fmt;
+
+		ret = ioctl(fd, VIDIOC_TRY_FMT, &videoIn->format);
+		if (ret >= 0) {
+			break;
 		}
 	}
     if (ret < 0) {
@@ -303,7 +399,7 @@ int V4L2Camera::Init(int width, int height, int fps)
 	/* Note VIDIOC_S_FMT may change width and height. */
 
 	/* Buggy driver paranoia. */
-	unsigned int min = videoIn->format.fmt.pix.width * 2;
+	unsigned int min = min_bytes_per_line(videoIn->format.fmt.pix.pixelformat, videoIn->format.fmt.pix.width);
 	if (videoIn->format.fmt.pix.bytesperline < min)
 		videoIn->format.fmt.pix.bytesperline = min;
 	min = videoIn->format.fmt.pix.bytesperline * videoIn->format.fmt.pix.height;
@@ -316,28 +412,64 @@ int V4L2Camera::Init(int width, int height, int fps)
 	videoIn->outFrameSize 		= width * height << 1; // Calculate the expected output framesize in YUYV
 	videoIn->capBytesPerPixel	= pixFmtsOrder[i].bpp;
 	
+	/* The captured area is the largest centered one with the aspect ratio of
+	   the requested size. It is scaled to the requested size, if they differ,
+	   so the whole field of view is kept */
+	int fmtWidth = videoIn->format.fmt.pix.width;
+	int fmtHeight = videoIn->format.fmt.pix.height;
+	int capWidth = fmtWidth;
+	int capHeight = fmtHeight;
+	if (capWidth * height > capHeight * width)
+		capWidth = (capHeight * width / height) & (-2);
+	else
+		capHeight = (capWidth * height / width) & (-2);
+	videoIn->capWidth = capWidth;
+	videoIn->capHeight = capHeight;
+	
 	/* Now calculate cropping margins, if needed, rounding to even */
-	int startX = ((closest.getWidth() - width) >> 1) & (-2);
-	int startY = ((closest.getHeight() - height) >> 1) & (-2);
+	int startX = ((fmtWidth - capWidth) >> 1) & (-2);
+	int startY = ((fmtHeight - capHeight) >> 1) & (-2);
 	
-	/* Avoid crashing if the mode found is smaller than the requested */
-	if (startX < 0) {
-		videoIn->outWidth += startX;
-		startX = 0;
-	}
-	if (startY < 0) {
-		videoIn->outHeight += startY;
-		startY = 0;
+	if (pixFmtsOrder[i].allowscrop) {
+		/* Crop while converting: Calculate the starting offset into each captured frame */
+		videoIn->capCropOffset = (startX * videoIn->capBytesPerPixel) +
+				(videoIn->format.fmt.pix.bytesperline * startY);	
+		videoIn->convWidth = capWidth;
+		videoIn->convHeight = capHeight;
+		videoIn->scaleOffset = 0;
+	} else {
+		/* Convert whole frames, and crop them when scaling */
+		videoIn->capCropOffset = 0;
+		videoIn->convWidth = fmtWidth;
+		videoIn->convHeight = fmtHeight;
+		videoIn->scaleOffset = (startX + startY * fmtWidth) << 1;
 	}
 	
-	/* Calculate the starting offset into each captured frame */
-	videoIn->capCropOffset = (startX * videoIn->capBytesPerPixel) +
-			(videoIn->format.fmt.pix.bytesperline * startY);	
-	
-	ALOGI("Cropping from origin: %dx%d - size: %dx%d  (offset:%d)", 
+	ALOGI("Cropping from origin: %dx%d - size: %dx%d  (offset:%d) - Output size: %dx%d", 
 		startX,startY,
-		videoIn->outWidth,videoIn->outHeight,
-		videoIn->capCropOffset);
+		capWidth,capHeight,
+		videoIn->capCropOffset,
+		videoIn->outWidth,videoIn->outHeight);
+		
+	/* Allocate the scaler buffers, if needed. YUYV frames are scaled straight
+	   from the capture buffers, the other formats are converted first */
+	if (videoIn->scaleBuffer)
+		free(videoIn->scaleBuffer);
+	videoIn->scaleBuffer = NULL;
+	if (videoIn->scaleLine)
+		free(videoIn->scaleLine);
+	videoIn->scaleLine = NULL;
+	
+	if (videoIn->convWidth != width || videoIn->convHeight != height) {
+		videoIn->scaleLine = malloc(capWidth << 1);
+		if (videoIn->format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV)
+			videoIn->scaleBuffer = malloc(videoIn->convWidth * videoIn->convHeight << 1);
+		if (!videoIn->scaleLine || 
+			(!videoIn->scaleBuffer && videoIn->format.fmt.pix.pixelformat != V4L2_PIX_FMT_YUYV)) {
+			ALOGE("couldn't allocate the scaler buffers");
+			return -ENOMEM;
+		}
+	}
 	
 	/* sets video device frame rate */
 	memset(&videoIn->params,0,sizeof(videoIn->params));
@@ -409,54 +541,10 @@ int V4L2Camera::Init(int width, int height, int fps)
 		}
 	}
 	
-    /* Check if camera can handle NB_BUFFER buffers */
-	memset(&videoIn->rb,0,sizeof(videoIn->rb));
-    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    videoIn->rb.memory = V4L2_MEMORY_MMAP;
-    videoIn->rb.count = MAX_NB_BUFFER;
-
-    ret = ioctl(fd, VIDIOC_REQBUFS, &videoIn->rb);
-    if (ret < 0) {
-        ALOGE("Init: VIDIOC_REQBUFS failed: %s", strerror(errno));
-        return ret;
-    }
-	
-	ALOGD("Init: Allocated %d buffers (requested: %d)", videoIn->rb.count, MAX_NB_BUFFER);
-	videoIn->nbBuffers = videoIn->rb.count;
-
-    for (int i = 0; i < videoIn->nbBuffers; i++) {
-
-        memset (&videoIn->buf, 0, sizeof (struct v4l2_buffer));
-        videoIn->buf.index = i;
-        videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        videoIn->buf.memory = V4L2_MEMORY_MMAP;
-
-        ret = ioctl (fd, VIDIOC_QUERYBUF, &videoIn->buf);
-        if (ret < 0) {
-            ALOGE("Init: Unable to query buffer %d (%s)", i, strerror(errno));
-            return ret;
-        }
-
-        videoIn->mem[i] = mmap (0,
-                                videoIn->buf.length,
-                                PROT_READ | PROT_WRITE,
-                                MAP_SHARED,
-                                fd,
-                                videoIn->buf.m.offset);
-
-        if (videoIn->mem[i] == MAP_FAILED) {
-            ALOGE("Init: Unable to map buffer (%s)", strerror(errno));
-            return -1;
-        }
-
-        ret = ioctl(fd, VIDIOC_QBUF, &videoIn->buf);
-        if (ret < 0) {
-            ALOGE("Init: VIDIOC_QBUF Failed");
-            return -1;
-        }
-
-        nQueued++;
-    }
+	/* Allocate and queue the capture buffers */
+	ret = InitMmapBuffers();
+	if (ret < 0) 
+		return ret;
 	
 	// Reserve temporary buffers, if they will be needed
 	size_t tmpbuf_size=0;
@@ -492,12 +580,11 @@ int V4L2Camera::Init(int width, int height, int fps)
 		case V4L2_PIX_FMT_SRGGB8: //3
 			// Raw 8 bit bayer 
 			// when grabbing use:
-			//    bayer_to_rgb24(bayer_data, RGB24_data, width, height, 0..3)
-			//    rgb2yuyv(RGB24_data, pFrameBuffer, width, height)
+			//    bayer_to_yuyv(pFrameBuffer, bayer_data, width, height, 0..3, lines)
 	
-			// alloc a temp buffer for converting to YUYV
-			// rgb buffer for decoding bayer data
-			tmpbuf_size = videoIn->format.fmt.pix.width * videoIn->format.fmt.pix.height * 3;
+			// alloc the line buffers used to demosaic the bayer data
+			// one line at a time
+			tmpbuf_size = videoIn->format.fmt.pix.width * 6;
 			if (videoIn->tmpBuffer)
 				free(videoIn->tmpBuffer);
 			videoIn->tmpBuffer = (uint8_t*)calloc(1, tmpbuf_size);
@@ -523,13 +610,83 @@ int V4L2Camera::Init(int width, int height, int fps)
     return 0;
 }
 
+/* Request, map and queue the MMAP capture buffers */
+int V4L2Camera::InitMmapBuffers()
+{
+	int ret;
+	
+    /* Check if camera can handle NB_BUFFER buffers */
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.memory = V4L2_MEMORY_MMAP;
+    videoIn->rb.count = MAX_NB_BUFFER;
+
+    ret = ioctl(fd, VIDIOC_REQBUFS, &videoIn->rb);
+    if (ret < 0) {
+        ALOGE("Init: VIDIOC_REQBUFS failed: %s", strerror(errno));
+        return ret;
+    }
+	
+	ALOGD("Init: Allocated %d buffers (requested: %d)", videoIn->rb.count, MAX_NB_BUFFER);
+	videoIn->nbBuffers = videoIn->rb.count;
+
+    for (int i = 0; i < videoIn->nbBuffers; i++) {
+
+        memset (&videoIn->buf, 0, sizeof (struct v4l2_buffer));
+        videoIn->buf.index = i;
+        videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        videoIn->buf.memory = V4L2_MEMORY_MMAP;
+
+        ret = ioctl (fd, VIDIOC_QUERYBUF, &videoIn->buf);
+        if (ret < 0) {
+            ALOGE("Init: Unable to query buffer %d (%s)", i, strerror(errno));
+            return ret;
+        }
+
+        videoIn->mem[i] = mmap (0,
+                                videoIn->buf.length,
+                                PROT_READ | PROT_WRITE,
+                                MAP_SHARED,
+                                fd,
+                                videoIn->buf.m.offset);
+
+        if (videoIn->mem[i] == MAP_FAILED) {
+            ALOGE("Init: Unable to map buffer (%s)", strerror(errno));
+            videoIn->mem[i] = NULL;
+            return -1;
+        }
+
+        ret = ioctl(fd, VIDIOC_QBUF, &videoIn->buf);
+        if (ret < 0) {
+            ALOGE("Init: VIDIOC_QBUF Failed");
+            return -1;
+        }
+
+        nQueued++;
+    }
+	
+	return 0;
+}
+
+/* Unmap the MMAP capture buffers */
+void V4L2Camera::UninitMmapBuffers()
+{
+    for (int i = 0; i < videoIn->nbBuffers; i++)
+		if (videoIn->mem[i] != NULL) {
+			if (munmap(videoIn->mem[i], videoIn->buf.length) < 0)
+				ALOGE("Uninit: Unmap failed");
+			videoIn->mem[i] = NULL;
+		}
+	videoIn->nbBuffers = 0;
+}
+
 void V4L2Camera::Uninit ()
 {
     int ret;
 
 	memset(&videoIn->buf,0,sizeof(videoIn->buf));
     videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    videoIn->buf.memory = V4L2_MEMORY_MMAP;
+    videoIn->buf.memory = videoIn->rb.memory;
 
     /* Dequeue everything */
     int DQcount = nQueued - nDequeued;
@@ -543,17 +700,17 @@ void V4L2Camera::Uninit ()
     nDequeued = 0;
 
     /* Unmap buffers */
-    for (int i = 0; i < videoIn->nbBuffers; i++)
-		if (videoIn->mem[i] != NULL) {
-			if (munmap(videoIn->mem[i], videoIn->buf.length) < 0)
-				ALOGE("Uninit: Unmap failed");
-			videoIn->mem[i] = NULL;
-		}
-	videoIn->nbBuffers = 0;
+	UninitMmapBuffers();
 		
 	if (videoIn->tmpBuffer)
 		free(videoIn->tmpBuffer);
 	videoIn->tmpBuffer = NULL;
+	if (videoIn->scaleBuffer)
+		free(videoIn->scaleBuffer);
+	videoIn->scaleBuffer = NULL;
+	if (videoIn->scaleLine)
+		free(videoIn->scaleLine);
+	videoIn->scaleLine = NULL;
 		
 }
 
@@ -591,7 +748,10 @@ int V4L2Camera::StopStreaming ()
             return ret;
         }
 
+		/* STREAMOFF returns all the buffers to us */
         videoIn->isStreaming = false;
+		nQueued = 0;
+		nDequeued = 0;
     }
 
     return 0;
@@ -610,10 +770,63 @@ int V4L2Camera::getFps() const
 	return videoIn->params.parm.capture.timeperframe.denominator;
 }
 
+/* Get the capture time of a buffer in the SYSTEM_TIME_MONOTONIC base. This 
+   kernel predates the timestamp flags, and drivers stamp buffers with either
+   clock without saying which (uvcvideo uses the monotonic one by default). 
+   Unless flagged, the clock is guessed as the one the stamp is closest to, 
+   as the frame was just captured */
+static nsecs_t frame_timestamp(const struct v4l2_buffer& buf)
+{
+	nsecs_t ts = seconds_to_nanoseconds(buf.timestamp.tv_sec) + 
+				 microseconds_to_nanoseconds(buf.timestamp.tv_usec);
+	nsecs_t mono = systemTime(SYSTEM_TIME_MONOTONIC);
+				 
+	// No timestamp at all: Use the dequeue time
+	if (ts == 0)
+		return mono;
+		
+	if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC)
+		return ts;
+		
+	nsecs_t real = systemTime(SYSTEM_TIME_REALTIME);
+	nsecs_t dmono = (ts > mono) ? ts - mono : mono - ts;
+	nsecs_t dreal = (ts > real) ? ts - real : real - ts;
+	if (dmono <= dreal)
+		return ts;
+		
+	return ts + mono - real;
+}
+
+/* Wait until a captured frame can be dequeued without blocking. Returns 1
+   if a frame is ready, 0 on timeout, or a negative error */
+int V4L2Camera::WaitFrame (int timeoutMs)
+{
+	struct pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	
+	int ret = poll(&pfd, 1, timeoutMs);
+	if (ret < 0) {
+		if (errno == EINTR)
+			return 0;
+		ALOGE("WaitFrame: poll failed: %s", strerror(errno));
+		return -errno;
+	}
+	if (ret == 0)
+		return 0;
+		
+	// The driver reports an error if there is no buffer queued to capture into
+	if (pfd.revents & (POLLERR | POLLHUP | POLLNVAL))
+		return -EIO;
+		
+	return 1;
+}
+
 /* Grab frame in YUYV mode */
 void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 {
-	ALOGD("V4L2Camera::GrabRawFrame: frameBuffer:%p, len:%d",frameBuffer,maxSize);
+	ALOGF("V4L2Camera::GrabRawFrame: frameBuffer:%p, len:%d",frameBuffer,maxSize);
     int ret;
 
 	/* DQ */
@@ -627,6 +840,7 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
     }
 
     nDequeued++;
+	videoIn->timestamp = frame_timestamp(videoIn->buf);
 	
 	// Calculate the stride of the output image (YUYV) in bytes
 	int strideOut = videoIn->outWidth << 1;
@@ -634,7 +848,15 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 	// And the pointer to the start of the image
 	uint8_t* src = (uint8_t*)videoIn->mem[videoIn->buf.index] + videoIn->capCropOffset;
 	
-	ALOGD("V4L2Camera::GrabRawFrame - Got Raw frame (%dx%d) (buf:%d@0x%p, len:%d)",videoIn->format.fmt.pix.width,videoIn->format.fmt.pix.height,videoIn->buf.index,src,videoIn->buf.bytesused);
+	// The converters write to the output buffer, or to the frame to scale
+	uint8_t* dst = (uint8_t*)frameBuffer;
+	int dstStride = strideOut;
+	if (videoIn->scaleBuffer) {
+		dst = (uint8_t*)videoIn->scaleBuffer;
+		dstStride = videoIn->convWidth << 1;
+	}
+	
+	ALOGF("V4L2Camera::GrabRawFrame - Got Raw frame (%dx%d) (buf:%d@0x%p, len:%d)",videoIn->format.fmt.pix.width,videoIn->format.fmt.pix.height,videoIn->buf.index,src,videoIn->buf.bytesused);
 	
 	/* Avoid crashing! - Make sure there is enough room in the output buffer! */
 	if (maxSize < videoIn->outFrameSize) {
@@ -654,7 +876,7 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 					break;
 				}
 
-				if (jpeg_decode((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight) < 0) 
+				if (jpeg_decode(dst, dstStride, src, videoIn->buf.bytesused, videoIn->convWidth, videoIn->convHeight) < 0) 
 				{
 					ALOGE("jpeg decode errors\n");
 					break;
@@ -662,116 +884,117 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 				break;
 			
 			case V4L2_PIX_FMT_UYVY:
-				uyvy_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							 src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				uyvy_to_yuyv(dst, dstStride,
+							 src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_YVYU:
-				yvyu_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							 src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				yvyu_to_yuyv(dst, dstStride,
+							 src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_YYUV:
-				yyuv_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							 src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				yyuv_to_yuyv(dst, dstStride,
+							 src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_YUV420:
-				yuv420_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				yuv420_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_YVU420:
-				yvu420_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				yvu420_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_NV12:
-				nv12_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				nv12_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_NV21:
-				nv21_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				nv21_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_NV16:
-				nv16_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				nv16_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_NV61:
-				nv61_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				nv61_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_Y41P: 
-				y41p_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				y41p_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_GREY:
-				grey_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				grey_to_yuyv(dst, dstStride,
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_Y16:
-				y16_to_yuyv((uint8_t*)frameBuffer, strideOut,
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				y16_to_yuyv(dst, dstStride,
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_SPCA501:
-				s501_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				s501_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_SPCA505:
-				s505_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				s505_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_SPCA508:
-				s508_to_yuyv((uint8_t*)frameBuffer, strideOut, src, videoIn->outWidth, videoIn->outHeight);
+				s508_to_yuyv(dst, dstStride, src, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			case V4L2_PIX_FMT_YUYV:
-				{
+				if (videoIn->scaleLine) {
+					// Scale straight from the captured frame
+					yuyv_scale((uint8_t*)frameBuffer, strideOut, videoIn->outWidth, videoIn->outHeight,
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->capWidth, videoIn->capHeight,
+							(uint8_t*)videoIn->scaleLine);
+				} else {
 					int h;
-					uint8_t* pdst = (uint8_t*)frameBuffer;
+					uint8_t* pdst = dst;
 					uint8_t* psrc = src;
-					int ss = videoIn->outWidth << 1;
-					for (h = 0; h < videoIn->outHeight; h++) {
+					int ss = videoIn->convWidth << 1;
+					for (h = 0; h < videoIn->convHeight; h++) {
 						memcpy(pdst,psrc,ss);
-						pdst += strideOut;
+						pdst += dstStride;
 						psrc += videoIn->format.fmt.pix.bytesperline;
 					}
 				}
 				break;
 				
 			case V4L2_PIX_FMT_SGBRG8: //0
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 0);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+				bayer_to_yuyv (dst, dstStride, src, videoIn->format.fmt.pix.bytesperline,
+							videoIn->convWidth, videoIn->convHeight, 0, (uint8_t*)videoIn->tmpBuffer);
 				break;
 				
 			case V4L2_PIX_FMT_SGRBG8: //1
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 1);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+				bayer_to_yuyv (dst, dstStride, src, videoIn->format.fmt.pix.bytesperline,
+							videoIn->convWidth, videoIn->convHeight, 1, (uint8_t*)videoIn->tmpBuffer);
 				break;
 				
 			case V4L2_PIX_FMT_SBGGR8: //2
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 2);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+				bayer_to_yuyv (dst, dstStride, src, videoIn->format.fmt.pix.bytesperline,
+							videoIn->convWidth, videoIn->convHeight, 2, (uint8_t*)videoIn->tmpBuffer);
 				break;
 				
 			case V4L2_PIX_FMT_SRGGB8: //3
-				bayer_to_rgb24 (src,(uint8_t*) videoIn->tmpBuffer, videoIn->outWidth, videoIn->outHeight, 3);
-				rgb_to_yuyv ((uint8_t*) frameBuffer, strideOut, 
-							(uint8_t*)videoIn->tmpBuffer, videoIn->outWidth*3, videoIn->outWidth, videoIn->outHeight);
+				bayer_to_yuyv (dst, dstStride, src, videoIn->format.fmt.pix.bytesperline,
+							videoIn->convWidth, videoIn->convHeight, 3, (uint8_t*)videoIn->tmpBuffer);
 				break;
 				
 			case V4L2_PIX_FMT_RGB24:
-				rgb_to_yuyv((uint8_t*) frameBuffer, strideOut, 
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				rgb_to_yuyv(dst, dstStride, 
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 				
 			case V4L2_PIX_FMT_BGR24:
-				bgr_to_yuyv((uint8_t*) frameBuffer, strideOut, 
-							src, videoIn->format.fmt.pix.bytesperline, videoIn->outWidth, videoIn->outHeight);
+				bgr_to_yuyv(dst, dstStride, 
+							src, videoIn->format.fmt.pix.bytesperline, videoIn->convWidth, videoIn->convHeight);
 				break;
 			
 			default:
@@ -779,7 +1002,14 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 				break;
 		}
 		
-		ALOGD("V4L2Camera::GrabRawFrame - Copied frame to destination 0x%p",frameBuffer);
+		// And scale the converted frame to the output size, if needed
+		if (videoIn->scaleBuffer) {
+			yuyv_scale((uint8_t*)frameBuffer, strideOut, videoIn->outWidth, videoIn->outHeight,
+					(uint8_t*)videoIn->scaleBuffer + videoIn->scaleOffset, videoIn->convWidth << 1,
+					videoIn->capWidth, videoIn->capHeight, (uint8_t*)videoIn->scaleLine);
+		}
+		
+		ALOGF("V4L2Camera::GrabRawFrame - Copied frame to destination 0x%p",frameBuffer);
 	}
 	
 	/* And Queue the buffer again */
@@ -791,8 +1021,119 @@ void V4L2Camera::GrabRawFrame (void *frameBuffer, int maxSize)
 
     nQueued++;
 	
-	ALOGD("V4L2Camera::GrabRawFrame - Queued buffer");
+	ALOGF("V4L2Camera::GrabRawFrame - Queued buffer");
+
+}
+
+/* Check if frames can be captured straight into a buffer with the given line
+   length, without any conversion or copy: That requires YUYV, no cropping and
+   the same line length as the one used by the driver */
+bool V4L2Camera::CanCaptureDirect(int bytesPerLine) const
+{
+	return videoIn->format.fmt.pix.pixelformat == V4L2_PIX_FMT_YUYV &&
+		videoIn->capCropOffset == 0 &&
+		videoIn->outWidth  == (int)videoIn->format.fmt.pix.width &&
+		videoIn->outHeight == (int)videoIn->format.fmt.pix.height &&
+		(int)videoIn->format.fmt.pix.bytesperline == bytesPerLine;
+}
+
+/* Replace the MMAP buffers allocated by Init by caller supplied ones. Must be
+   called before StartStreaming. Returns the number of buffers that can be
+   queued. If the driver does not support USERPTR, the MMAP buffers are
+   restored and an error is returned. Passing 0 buffers goes back to MMAP */
+int V4L2Camera::EnableUserPtr(int nbBuffers)
+{
+	ALOGD("V4L2Camera::EnableUserPtr: %d buffers", nbBuffers);
+    int ret;
+
+	if (videoIn->isStreaming) {
+		ALOGE("EnableUserPtr: Capture already started");
+		return -EBUSY;
+	}
+	
+	/* Release the current buffers */
+	int memory = videoIn->rb.memory;
+	UninitMmapBuffers();
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.memory = memory;
+    videoIn->rb.count = 0;
+	ioctl(fd, VIDIOC_REQBUFS, &videoIn->rb);
+    nQueued = 0;
+    nDequeued = 0;
+	
+	if (nbBuffers == 0)
+		return InitMmapBuffers();
+	
+	/* And ask for user pointer ones */
+	memset(&videoIn->rb,0,sizeof(videoIn->rb));
+    videoIn->rb.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->rb.memory = V4L2_MEMORY_USERPTR;
+    videoIn->rb.count = nbBuffers;
+
+    ret = ioctl(fd, VIDIOC_REQBUFS, &videoIn->rb);
+    if (ret < 0 || videoIn->rb.count == 0) {
+        ALOGE("EnableUserPtr: USERPTR not supported (%s) - Keeping MMAP", strerror(errno));
+		
+		/* Go back to MMAP buffers */
+		ret = InitMmapBuffers();
+		return (ret < 0) ? ret : -EINVAL;
+    }
+	
+	ALOGD("EnableUserPtr: Allowed %d buffers (requested: %d)", videoIn->rb.count, nbBuffers);
+	videoIn->nbBuffers = videoIn->rb.count;
+	return videoIn->nbBuffers;
+}
+
+/* Hand a caller supplied buffer to the driver to capture into. This can be
+   called while another thread is waiting for a frame in DequeueUserPtr, so
+   it does not touch videoIn->buf */
+int V4L2Camera::QueueUserPtr(int index, void* ptr, int len)
+{
+    int ret;
+	struct v4l2_buffer buf;
+
+	if (len < (int)videoIn->format.fmt.pix.sizeimage) {
+		ALOGE("QueueUserPtr: Buffer too small: Required: %d, Got %d",videoIn->format.fmt.pix.sizeimage,len);
+		return -EINVAL;
+	}
+	
+	memset(&buf,0,sizeof(buf));
+    buf.index = index;
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = V4L2_MEMORY_USERPTR;
+	buf.m.userptr = (unsigned long)ptr;
+	buf.length = len;
+
+    ret = ioctl(fd, VIDIOC_QBUF, &buf);
+    if (ret < 0) {
+        ALOGE("QueueUserPtr: VIDIOC_QBUF Failed: %s", strerror(errno));
+        return -errno;
+    }
 
+    nQueued++;
+	return 0;
+}
+
+/* Wait for a frame to be captured into one of the caller supplied buffers. 
+   Returns the amount of bytes captured, and the buffer index */
+int V4L2Camera::DequeueUserPtr(int& index)
+{
+    int ret;
+
+	memset(&videoIn->buf,0,sizeof(videoIn->buf));
+    videoIn->buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    videoIn->buf.memory = V4L2_MEMORY_USERPTR;
+	ret = ioctl(fd, VIDIOC_DQBUF, &videoIn->buf);
+    if (ret < 0) {
+        ALOGE("DequeueUserPtr: VIDIOC_DQBUF Failed: %s", strerror(errno));
+        return -errno;
+    }
+
+    nDequeued++;
+	videoIn->timestamp = frame_timestamp(videoIn->buf);
+	index = videoIn->buf.index;
+	return videoIn->buf.bytesused;
 }
 
 /* enumerate frame intervals (fps)
@@ -963,23 +1304,30 @@ bool V4L2Camera::EnumFrameFormats()
 	// Start with no modes
 	m_AllFmts.clear();
 	
-	memset(&fmt, 0, sizeof(fmt));
-	fmt.index = 0;
-	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	// Enumerating all the modes takes a lot of ioctls. Skip it if they 
+	// were already enumerated for this same device
+	if (!LoadCapsCache()) {
+	
+		memset(&fmt, 0, sizeof(fmt));
+		fmt.index = 0;
+		fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
 
-	while (ioctl(fd,VIDIOC_ENUM_FMT, &fmt) >= 0) 
-	{
-		fmt.index++;
-		ALOGD("{ pixelformat = '%c%c%c%c', description = '%s' }",
-				fmt.pixelformat & 0xFF, (fmt.pixelformat >> 8) & 0xFF,
-				(fmt.pixelformat >> 16) & 0xFF, (fmt.pixelformat >> 24) & 0xFF,
-				fmt.description);
-
-		//enumerate frame sizes for this pixel format
-		if (!EnumFrameSizes(fmt.pixelformat)) {
-			ALOGE("  Unable to enumerate frame sizes.");
-		}
-	};
+		while (ioctl(fd,VIDIOC_ENUM_FMT, &fmt) >= 0) 
+		{
+			fmt.index++;
+			ALOGD("{ pixelformat = '%c%c%c%c', description = '%s' }",
+					fmt.pixelformat & 0xFF, (fmt.pixelformat >> 8) & 0xFF,
+					(fmt.pixelformat >> 16) & 0xFF, (fmt.pixelformat >> 24) & 0xFF,
+					fmt.description);
+
+			//enumerate frame sizes for this pixel format
+			if (!EnumFrameSizes(fmt.pixelformat)) {
+				ALOGE("  Unable to enumerate frame sizes.");
+			}
+		};
+		
+		SaveCapsCache();
+	}
 	
 	// Now, select the best preview format and the best PictureFormat
 	m_BestPreviewFmt = SurfaceDesc();
@@ -1010,17 +1358,168 @@ bool V4L2Camera::EnumFrameFormats()
 	return true;
 } 
 
+/* Layout of the video modes cache file: The header, followed by the modes */
+#define CAPS_CACHE_MAGIC	0x43344c56	/* 'V4LC' */
+#define CAPS_CACHE_VERSION	1
+
+struct caps_cache_header {
+	uint32_t magic;
+	uint32_t version;
+	uint8_t driver[16];		/* Identity of the device the modes belong to */
+	uint8_t card[32];
+	uint8_t bus_info[32];
+	uint32_t drv_version;
+	uint32_t count;			/* Number of modes */
+};
+
+struct caps_cache_mode {
+	int32_t width;
+	int32_t height;
+	int32_t fps;
+};
+
+/* Fill the header of the cache file with the identity of the opened device */
+static void caps_cache_identity(struct caps_cache_header& hdr, const struct v4l2_capability& cap)
+{
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = CAPS_CACHE_MAGIC;
+	hdr.version = CAPS_CACHE_VERSION;
+	memcpy(hdr.driver, cap.driver, sizeof(hdr.driver));
+	memcpy(hdr.card, cap.card, sizeof(hdr.card));
+	memcpy(hdr.bus_info, cap.bus_info, sizeof(hdr.bus_info));
+	hdr.drv_version = cap.version;
+}
+
+/* Load the video modes from the cache file, if it was written for the same
+   device. Returns false if they must be enumerated */
+bool V4L2Camera::LoadCapsCache()
+{
+	struct caps_cache_header id;
+	struct stat st;
+	bool ret = false;
+	
+	int cfd = open(m_CapsCache, O_RDONLY);
+	if (cfd < 0)
+		return false;
+		
+	if (fstat(cfd, &st) < 0 || st.st_size < (off_t)sizeof(id)) {
+		close(cfd);
+		return false;
+	}
+	
+	void* map = mmap(0, st.st_size, PROT_READ, MAP_SHARED, cfd, 0);
+	close(cfd);
+	if (map == MAP_FAILED)
+		return false;
+		
+	const struct caps_cache_header* hdr = (const struct caps_cache_header*)map;
+	caps_cache_identity(id, videoIn->cap);
+	
+	// A different device or driver version invalidates the cache
+	if (memcmp(hdr, &id, offsetof(struct caps_cache_header, count)) == 0 &&
+		hdr->count > 0 &&
+		(st.st_size - sizeof(*hdr)) % sizeof(struct caps_cache_mode) == 0 &&
+		(st.st_size - sizeof(*hdr)) / sizeof(struct caps_cache_mode) == hdr->count) {
+		
+		const struct caps_cache_mode* mode = (const struct caps_cache_mode*)(hdr + 1);
+		unsigned int i;
+		for (i = 0; i < hdr->count; i++, mode++)
+			m_AllFmts.add( SurfaceDesc( mode->width, mode->height, mode->fps ) );
+		ret = true;
+		
+		ALOGD("V4L2Camera::LoadCapsCache: %d modes", hdr->count);
+	} else {
+		ALOGD("V4L2Camera::LoadCapsCache: Cache is stale");
+	}
+	
+	munmap(map, st.st_size);
+	return ret;
+}
+
+/* Store the enumerated video modes in the cache file. It is written to a 
+   temporary file that is then renamed, so readers never see it half written */
+void V4L2Camera::SaveCapsCache() const
+{
+	struct caps_cache_header hdr;
+	char tmp[sizeof(m_CapsCache) + 4];
+	
+	if (m_AllFmts.isEmpty())
+		return;
+	snprintf(tmp, sizeof(tmp), "%s.tmp", m_CapsCache);
+		
+	caps_cache_identity(hdr, videoIn->cap);
+	hdr.count = m_AllFmts.size();
+	
+	int cfd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	if (cfd < 0) {
+		ALOGD("V4L2Camera::SaveCapsCache: Unable to create cache: %s", strerror(errno));
+		return;
+	}
+	
+	bool ok = write(cfd, &hdr, sizeof(hdr)) == sizeof(hdr);
+	unsigned int i;
+	for (i = 0; ok && i < m_AllFmts.size(); i++) {
+		struct caps_cache_mode mode;
+		mode.width = m_AllFmts[i].getWidth();
+		mode.height = m_AllFmts[i].getHeight();
+		mode.fps = m_AllFmts[i].getFps();
+		ok = write(cfd, &mode, sizeof(mode)) == sizeof(mode);
+	}
+	close(cfd);
+	
+	if (!ok || rename(tmp, m_CapsCache) < 0) {
+		ALOGE("V4L2Camera::SaveCapsCache: Unable to write cache");
+		unlink(tmp);
+	}
+}
+
 SortedVector<SurfaceSize> V4L2Camera::getAvailableSizes() const
 {
 	ALOGD("V4L2Camera::getAvailableSizes");
 	SortedVector<SurfaceSize> ret;
 	
 	// Iterate through the list. All duplicated entries will be removed
-	unsigned int i;
+	unsigned int i, j;
 	for (i = 0; i< m_AllFmts.size() ; i++) 
 	{
 		ret.add(m_AllFmts[i].getSize());
 	}
+	
+	// Add the standard sizes that can be scaled down from a captured frame,
+	// as android apps could be expecting to find them. Some specific apps
+	// also expect to find some sizes:
+	//  GTalk expects 320x200
+	//  Fring expects 240x160
+	static const struct {
+		int w,h;
+	} stdSizes[] = {
+		{1920,1080},	// 1080p
+		{1280,720},		// 720p
+		{1024,768},		// XGA
+		{800,600},		// SVGA
+		{800,480},		// WVGA
+		{720,480},		// NTSC
+		{640,480},		// VGA
+		{640,360},
+		{480,320},		// HVGA
+		{432,320},		// 1.35-to-1, for photos. (Rounded up from 1.3333 to 1)
+		{352,288},		// CIF
+		{320,240},		// QVGA
+		{320,200},
+		{240,160},		// SQVGA
+		{176,144}		// QCIF
+	};
+	for (j = 0; j < (sizeof(stdSizes) / sizeof(stdSizes[0])); j++) 
+	{
+		for (i = 0; i< m_AllFmts.size() ; i++) 
+		{
+			if (m_AllFmts[i].getWidth() >= stdSizes[j].w &&
+				m_AllFmts[i].getHeight() >= stdSizes[j].h) {
+				ret.add(SurfaceSize(stdSizes[j].w,stdSizes[j].h));
+				break;
+			}
+		}
+	}
 	return ret;
 }
 
@@ -1074,7 +1573,6 @@ int V4L2Camera::v4l2_g_ctrl( int fd, int id, int *value)
 
     memset(&control, 0, sizeof(control));
     control.id = id;
-    control.value = (int32_t)value;
     rc = ioctl (fd, VIDIOC_G_CTRL, &control);
     if(rc) {
         ALOGD("%s: fd=%d, G_CTRL, id=0x%x, rc = %d\n", __func__, fd, id, rc);
@@ -1167,7 +1665,7 @@ int V4L2Camera::v4l2_get_whitebalance (int fd, WhiteBalance& mode)
 		
     switch(value) {
     default:
-		mode = wbOff:
+		mode = wbOff;
 		return rc;
     case 6500:
 		mode = wbDaylight;
@@ -1220,8 +1718,13 @@ bool V4L2Camera::GetCtl(VideoCtl ctl,int& val)
         return v4l2_g_ctrl(fd, V4L2_CID_SATURATION, &val) == 0;
     case ctlBrightness:
         return v4l2_g_ctrl(fd, V4L2_CID_BRIGHTNESS, &val) == 0;
-    case ctlWhiteBalance:
-        return v4l2_get_whitebalance(fd, (WhiteBalance&) (&val)) == 0;
+    case ctlWhiteBalance: {
+		WhiteBalance mode;
+		if (v4l2_get_whitebalance(fd, mode) != 0)
+			return false;
+		val = mode;
+		return true;
+	}
     case ctlZoom:
         return v4l2_g_ctrl(fd, V4L2_CID_ZOOM_ABSOLUTE, &val) == 0;
     case ctlAntibanding:
@@ -1245,7 +1748,7 @@ bool V4L2Camera::SetCtl(VideoCtl ctl,int val)
     case ctlBrightness:
         return v4l2_s_ctrl(fd, V4L2_CID_BRIGHTNESS, val) == 0;
     case ctlWhiteBalance:
-        return v4l2_set_whitebalance (fd, val) == 0;
+        return v4l2_set_whitebalance (fd, (WhiteBalance)val) == 0;
     case ctlZoom:
         return v4l2_s_ctrl(fd, V4L2_CID_ZOOM_ABSOLUTE, val) == 0;
     case ctlAntibanding:
@@ -14,6 +14,7 @@
 #include <binder/MemoryBase.h>
 #include <binder/MemoryHeapBase.h>
 #include <utils/SortedVector.h>
+#include <utils/Timers.h>
 extern "C" {
 #include "uvc_compat.h"
 };
@@ -40,6 +41,15 @@ struct vdIn {
 	int outFrameSize;						// The expected output framesize (in YUYV)
 	int capBytesPerPixel;					// Capture bytes per pixel
 	int capCropOffset;						// The offset in bytes to add to the captured buffer to get to the first pixel
+	int capWidth;							// Size of the captured area that is scaled to the output size
+	int capHeight;
+	int convWidth;							// Size of the area the pixel format converters work on
+	int convHeight;
+	int scaleOffset;						// The offset in bytes of the captured area into scaleBuffer
+	void* scaleBuffer;						// Converted frame, if it must be scaled after the conversion
+	void* scaleLine;						// Line buffer used by the scaler, if scaling
+	
+	nsecs_t timestamp;						// Capture time of the last dequeued frame (SYSTEM_TIME_MONOTONIC)
 	
 };
 
@@ -48,7 +58,7 @@ class V4L2Camera {
 public:
 	
 	// Video controls
-	enum {	
+	typedef enum {	
 		ctlSharpness,
 		ctlContrast,
 		ctlSaturation,
@@ -56,17 +66,17 @@ public:
 		ctlWhiteBalance,
 		ctlZoom,
 		ctlAntibanding
-	} VideoCtrl;
+	} VideoCtl;
 	
 	// White balance settings
-	enum {
+	typedef enum {
 		wbAuto,
 		wbOff,
 		wbDaylight,
 		wbIncandescent,
 		wbFluorescent,
 		wbCloudy
-	} WhiteBalance:
+	} WhiteBalance;
 
 	typedef struct {
 		int min;
@@ -87,7 +97,17 @@ public:
 	int StartStreaming ();
 	int StopStreaming ();
 
+	int  WaitFrame (int timeoutMs);
 	void GrabRawFrame (void *frameBuffer,int maxSize);
+	nsecs_t getFrameTimestamp() const { return videoIn->timestamp; }
+	uint32_t getPixelFormat() const { return videoIn->format.fmt.pix.pixelformat; }
+
+	// Zero copy capture into caller supplied buffers (V4L2_MEMORY_USERPTR)
+	bool CanCaptureDirect(int bytesPerLine) const;
+	int  EnableUserPtr(int nbBuffers);
+	bool IsUserPtr() const { return videoIn->rb.memory == V4L2_MEMORY_USERPTR; }
+	int  QueueUserPtr(int index, void* ptr, int len);
+	int  DequeueUserPtr(int& index);
 
 	void getSize(int& width, int& height) const;
 	int getFps() const;  	
@@ -101,12 +121,22 @@ public:
 	bool GetCtl(VideoCtl ctl,int& val);
 	bool SetCtl(VideoCtl ctl,int val);
 	
+	// The camera power rail is shared by all the cameras of the process. It 
+	// is switched on for the first user, and off once the last one is done.
+	// wasOn tells if it was already up, so the devices are there already
+	static bool AcquirePower(bool* wasOn = NULL);
+	static void ReleasePower();
+	
 private:
 	bool PowerOn(const char *device);
 	bool PowerOff();
 	bool EnumFrameIntervals(int pixfmt, int width, int height);
 	bool EnumFrameSizes(int pixfmt);
 	bool EnumFrameFormats(); 
+	bool LoadCapsCache();
+	void SaveCapsCache() const;
+	int  InitMmapBuffers();
+	void UninitMmapBuffers();
 	int saveYUYVtoJPEG(uint8_t* src, uint8_t* dst, int maxsize, int width, int height, int quality);
 	
 	static int v4l2_s_ctrl( int fd,  int id, int value);
@@ -121,10 +151,12 @@ private:
 
     int nQueued;
     int nDequeued;
+	bool m_PowerOn;								// If holding the power rail
 	
 	SortedVector<SurfaceDesc> m_AllFmts;		// Available video modes
 	SurfaceDesc m_BestPreviewFmt;				// Best preview mode. maximum fps with biggest frame
 	SurfaceDesc m_BestPictureFmt;				// Best picture format. maximum size
+	char m_CapsCache[64];						// File the video modes of this device are cached in
  	
 };
 
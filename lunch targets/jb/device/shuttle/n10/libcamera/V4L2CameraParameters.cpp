@@ -59,6 +59,11 @@ const char V4L2CameraParameters::KEY_MAX_CONTRAST[] = "max-contrast";
 const char V4L2CameraParameters::KEY_SATURATION[] = "saturation";
 const char V4L2CameraParameters::KEY_MAX_SATURATION[] = "max-saturation";
 
+const char V4L2CameraParameters::KEY_ZSL[] = "zsl";
+const char V4L2CameraParameters::KEY_SUPPORTED_ZSL_MODES[] = "zsl-values";
+const char V4L2CameraParameters::ZSL_OFF[] = "off";
+const char V4L2CameraParameters::ZSL_ON[] = "on";
+
 
 V4L2CameraParameters::~V4L2CameraParameters()
 {
@@ -65,6 +65,12 @@ public:
     static const char KEY_SATURATION[];
     static const char KEY_MAX_SATURATION[];
 
+    // Zero shutter lag
+    static const char KEY_ZSL[];
+    static const char KEY_SUPPORTED_ZSL_MODES[];
+    static const char ZSL_OFF[];
+    static const char ZSL_ON[];
+
 
 };
 
@@ -0,0 +1,453 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/* Host golden check and benchmark of the preview converters.
+
+   Each frame goes through the same two steps as in the camera: the source
+   format is converted to YUYV as GrabRawFrame does, then yuyv_to_multi
+   converts it to the outputs fillPreviewWindow asks for.
+
+   The check runs converter_check_impl on every implementation, then
+   converts every source format to every output with each implementation
+   available on this cpu, and compares the frames with the ones of the
+   reference "c" one. They must be exactly the same.
+
+   The benchmark times every source format to every output, at the
+   resolutions the camera uses, and reports the megapixels per second and
+   the bytes each frame reads and writes: the source, the YUYV frame written
+   and read back, and the output.
+
+   Usage: camera_bench [-b] [-i impl] [-r WxH] [-t ms per case]
+   -b benchmarks instead of checking
+   -i benchmarks the given implementation instead of the autodetected one */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include "Converter.h"
+#include "Utils.h"
+
+/* Every source format GrabRawFrame converts */
+enum {
+	SRC_MJPEG, SRC_YUYV, SRC_UYVY, SRC_YVYU, SRC_YYUV, SRC_YUV420, SRC_YVU420,
+	SRC_NV12, SRC_NV21, SRC_NV16, SRC_NV61, SRC_Y41P, SRC_GREY, SRC_Y16,
+	SRC_S501, SRC_S505, SRC_S508, SRC_SGBRG8, SRC_SGRBG8, SRC_SBGGR8,
+	SRC_SRGGB8, SRC_RGB24, SRC_BGR24, SRC_COUNT
+};
+
+static const char* const srcName[SRC_COUNT] = {
+	"mjpeg", "yuyv", "uyvy", "yvyu", "yyuv", "yuv420", "yvu420",
+	"nv12", "nv21", "nv16", "nv61", "y41p", "grey", "y16",
+	"s501", "s505", "s508", "sgbrg8", "sgrbg8", "sbggr8",
+	"srggb8", "rgb24", "bgr24"
+};
+
+/* Every output fillPreviewWindow asks yuyv_to_multi for, plus all of them
+   at once and none of them */
+#define OUT_COUNT	(CONV_BGR32 + 1)
+#define OUT_ALL		OUT_COUNT
+#define OUT_NONE	(OUT_COUNT + 1)
+
+static const char* const outName[OUT_COUNT + 2] = {
+	"yvu420sp", "yvu420p", "yuv420p", "yvu422p", "yuyv",
+	"rgb565", "rgb24", "rgb32", "bgr32", "all", "none"
+};
+
+static const char* const implName[] = { "c", "swar", "sse2", "neon" };
+#define IMPL_COUNT	(int)(sizeof(implName) / sizeof(implName[0]))
+
+struct frame {
+	int width, height;
+	uint8_t* src[SRC_COUNT];	// Source frames
+	int srcSize[SRC_COUNT];
+	uint8_t* yuyv;				// Converted frame, as GrabRawFrame leaves it
+	uint8_t* out[OUT_COUNT];	// Outputs
+	int outSize[OUT_COUNT];
+	uint8_t* work;				// Bayer line buffer
+};
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+static uint64_t hash(const uint8_t* p, int size)
+{
+	uint64_t h = 14695981039346656037ULL;
+	for (int i = 0; i < size; i++)
+		h = (h ^ p[i]) * 1099511628211ULL;
+	return h;
+}
+
+/* Bytes of a source frame, with the line strides GrabRawFrame is given */
+static int srcBytes(int fmt, int w, int h)
+{
+	switch (fmt) {
+		case SRC_YUYV: case SRC_UYVY: case SRC_YVYU: case SRC_YYUV:
+		case SRC_NV16: case SRC_NV61: case SRC_Y16:
+			return w * h * 2;
+		case SRC_YUV420: case SRC_YVU420: case SRC_NV12: case SRC_NV21:
+		case SRC_Y41P: case SRC_S501: case SRC_S505: case SRC_S508:
+			return w * h * 3 / 2;
+		case SRC_RGB24: case SRC_BGR24:
+			return w * h * 3;
+		default:
+			return w * h;
+	}
+}
+
+static int srcStride(int fmt, int w)
+{
+	return srcBytes(fmt, w, 1);
+}
+
+static void setDest(conv_dest& d, int fmt, struct frame* f)
+{
+	d.fmt = fmt;
+	d.dst = f->out[fmt];
+	d.dstHeight = f->height;
+	d.srcX = 0;
+	d.srcY = 0;
+	d.width = f->width;
+	d.height = f->height;
+	switch (fmt) {
+		case CONV_YUYV: case CONV_RGB565:
+			d.dstStride = f->width * 2;
+			break;
+		case CONV_RGB24:
+			d.dstStride = f->width * 3;
+			break;
+		case CONV_RGB32: case CONV_BGR32:
+			d.dstStride = f->width * 4;
+			break;
+		default:
+			d.dstStride = f->width;
+			break;
+	}
+}
+
+/* Bytes of an output frame. The chroma planes of the planar formats have
+   their stride rounded up to 16 bytes, as Android wants */
+static int outBytes(int fmt, int w, int h)
+{
+	int cStride = ((w >> 1) + 15) & (-16);
+	switch (fmt) {
+		case CONV_YVU420SP:
+			return w * h * 3 / 2;
+		case CONV_YVU420P: case CONV_YUV420P:
+			return w * h + cStride * h;
+		case CONV_YVU422P:
+			return w * h + cStride * h * 2;
+		case CONV_YUYV: case CONV_RGB565:
+			return w * h * 2;
+		case CONV_RGB24:
+			return w * h * 3;
+		default:
+			return w * h * 4;
+	}
+}
+
+/* Convert a source frame to YUYV, as GrabRawFrame does */
+static int grab(struct frame* f, int fmt)
+{
+	int w = f->width, h = f->height, ds = w * 2, ss = srcStride(fmt, w);
+	uint8_t* s = f->src[fmt];
+	uint8_t* d = f->yuyv;
+
+	switch (fmt) {
+		case SRC_MJPEG:
+			if (s == NULL)
+				return -1;
+			return jpeg_decode(d, ds, s, f->srcSize[fmt], w, h) < 0 ? -1 : 0;
+		case SRC_YUYV:
+			for (int y = 0; y < h; y++)
+				memcpy(d + y * ds, s + y * ss, w * 2);
+			break;
+		case SRC_UYVY:   uyvy_to_yuyv(d, ds, s, ss, w, h); break;
+		case SRC_YVYU:   yvyu_to_yuyv(d, ds, s, ss, w, h); break;
+		case SRC_YYUV:   yyuv_to_yuyv(d, ds, s, ss, w, h); break;
+		case SRC_YUV420: yuv420_to_yuyv(d, ds, s, w, h); break;
+		case SRC_YVU420: yvu420_to_yuyv(d, ds, s, w, h); break;
+		case SRC_NV12:   nv12_to_yuyv(d, ds, s, w, h); break;
+		case SRC_NV21:   nv21_to_yuyv(d, ds, s, w, h); break;
+		case SRC_NV16:   nv16_to_yuyv(d, ds, s, w, h); break;
+		case SRC_NV61:   nv61_to_yuyv(d, ds, s, w, h); break;
+		case SRC_Y41P:   y41p_to_yuyv(d, ds, s, w, h); break;
+		case SRC_GREY:   grey_to_yuyv(d, ds, s, ss, w, h); break;
+		case SRC_Y16:    y16_to_yuyv(d, ds, s, ss, w, h); break;
+		case SRC_S501:   s501_to_yuyv(d, ds, s, w, h); break;
+		case SRC_S505:   s505_to_yuyv(d, ds, s, w, h); break;
+		case SRC_S508:   s508_to_yuyv(d, ds, s, w, h); break;
+		case SRC_SGBRG8: bayer_to_yuyv(d, ds, s, ss, w, h, 0, f->work); break;
+		case SRC_SGRBG8: bayer_to_yuyv(d, ds, s, ss, w, h, 1, f->work); break;
+		case SRC_SBGGR8: bayer_to_yuyv(d, ds, s, ss, w, h, 2, f->work); break;
+		case SRC_SRGGB8: bayer_to_yuyv(d, ds, s, ss, w, h, 3, f->work); break;
+		case SRC_RGB24:  rgb_to_yuyv(d, ds, s, ss, w, h); break;
+		case SRC_BGR24:  bgr_to_yuyv(d, ds, s, ss, w, h); break;
+	}
+	return 0;
+}
+
+/* Convert the YUYV frame to one output, all of them, or none, as
+   fillPreviewWindow does */
+static void fill(struct frame* f, int out)
+{
+	conv_dest dests[OUT_COUNT];
+	int n = 0;
+
+	if (out == OUT_NONE)
+		return;
+	for (int i = 0; i < OUT_COUNT; i++) {
+		if (out == OUT_ALL || out == i)
+			setDest(dests[n++], i, f);
+	}
+	yuyv_to_multi(dests, n, f->yuyv, f->width * 2);
+}
+
+static void frameInit(struct frame* f, int w, int h)
+{
+	memset(f, 0, sizeof(*f));
+	f->width = w;
+	f->height = h;
+	f->yuyv = (uint8_t*)malloc(w * h * 2);
+	f->work = (uint8_t*)malloc(w * 6);
+	for (int i = 0; i < OUT_COUNT; i++) {
+		f->outSize[i] = outBytes(i, w, h);
+		f->out[i] = (uint8_t*)malloc(f->outSize[i]);
+	}
+
+	// Random sources, the same ones every time
+	unsigned int seed = w * 65536 + h;
+	for (int i = 1; i < SRC_COUNT; i++) {
+		f->srcSize[i] = srcBytes(i, w, h);
+		f->src[i] = (uint8_t*)malloc(f->srcSize[i]);
+		for (int j = 0; j < f->srcSize[i]; j++)
+			f->src[i][j] = rand_r(&seed);
+	}
+
+	// The MJPEG source is a smooth picture compressed by the reference
+	//  implementation, so it is the same whichever one is tested. The
+	//  encoder only takes sizes multiple of 16
+	if ((w | h) & 15)
+		return;
+	uint8_t* pic = f->yuyv;
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x += 2) {
+			uint8_t* p = pic + y * w * 2 + x * 2;
+			p[0] = (x * 255 / w + y) & 0xFF;
+			p[1] = (x * 128 / w + 64) & 0xFF;
+			p[2] = ((x + 1) * 255 / w + y) & 0xFF;
+			p[3] = (y * 128 / h + 64) & 0xFF;
+		}
+	}
+	const char* impl = converter_impl_name();
+	converter_set_impl("c");
+	f->src[SRC_MJPEG] = (uint8_t*)malloc(w * h * 2);
+	f->srcSize[SRC_MJPEG] = yuyv_to_jpeg(pic, f->src[SRC_MJPEG], w * h * 2, w, h, w * 2, 80);
+	converter_set_impl(impl);
+	if (f->srcSize[SRC_MJPEG] < 0) {
+		free(f->src[SRC_MJPEG]);
+		f->src[SRC_MJPEG] = NULL;
+	}
+}
+
+static void frameEnd(struct frame* f)
+{
+	for (int i = 0; i < SRC_COUNT; i++)
+		free(f->src[i]);
+	for (int i = 0; i < OUT_COUNT; i++)
+		free(f->out[i]);
+	free(f->yuyv);
+	free(f->work);
+}
+
+/* Convert every source format to all the outputs, one at a time and all at
+   once, and compare them with the ones of the reference implementation */
+static void checkFrames(int w, int h)
+{
+	struct frame f;
+	uint64_t ref[SRC_COUNT][OUT_COUNT + 1];
+	char what[128];
+
+	frameInit(&f, w, h);
+	for (int impl = 0; impl < IMPL_COUNT; impl++) {
+		if (!converter_set_impl(implName[impl]))
+			continue;
+
+		int mismatches = 0, cases = 0;
+		for (int s = 0; s < SRC_COUNT; s++) {
+			if (grab(&f, s) < 0)
+				continue;
+			uint64_t hy = hash(f.yuyv, w * h * 2);
+			if (impl == 0)
+				ref[s][OUT_COUNT] = hy;
+			else if (hy != ref[s][OUT_COUNT]) {
+				if (mismatches++ < 5)
+					printf("  %s: %s to yuyv differs\n", implName[impl], srcName[s]);
+			}
+			cases++;
+
+			// One at a time, then all at once. Both must give the same. The
+			//  outputs are cleared first, as the padding byte of RGB32 and
+			//  BGR32 is left as it was
+			for (int o = 0; o <= OUT_COUNT; o++) {
+				for (int i = 0; i < OUT_COUNT; i++)
+					memset(f.out[i], 0, f.outSize[i]);
+				fill(&f, o < OUT_COUNT ? o : OUT_ALL);
+				for (int i = 0; i < OUT_COUNT; i++) {
+					if (o < OUT_COUNT && i != o)
+						continue;
+					uint64_t ho = hash(f.out[i], f.outSize[i]);
+					cases++;
+					if (impl == 0 && o < OUT_COUNT)
+						ref[s][i] = ho;
+					else if (ho != ref[s][i]) {
+						if (mismatches++ < 5)
+							printf("  %s: %s to %s%s differs\n", implName[impl],
+								srcName[s], outName[i], o == OUT_COUNT ? ", with the others," : "");
+					}
+				}
+			}
+		}
+		snprintf(what, sizeof(what), "%dx%d, '%s': %d frames the same as the 'c' ones",
+			w, h, implName[impl], cases);
+		check(mismatches == 0, what);
+	}
+	converter_set_impl(implName[0]);
+	frameEnd(&f);
+}
+
+static void checkImpls(void)
+{
+	char what[128];
+	for (int impl = 0; impl < IMPL_COUNT; impl++) {
+		const char* bad = converter_check_impl(implName[impl]);
+		if (bad != NULL && !strcmp(bad, "unavailable")) {
+			printf("SKIP: '%s' kernels: not available on this cpu\n", implName[impl]);
+			continue;
+		}
+		snprintf(what, sizeof(what), "'%s' kernels match the reference ones%s%s",
+			implName[impl], bad ? ": not " : "", bad ? bad : "");
+		check(bad == NULL, what);
+	}
+}
+
+static void benchFrames(int w, int h, double budget)
+{
+	struct frame f;
+	int yuyvBytes = w * h * 2;
+
+	frameInit(&f, w, h);
+	for (int s = 0; s < SRC_COUNT; s++) {
+		if (f.src[s] == NULL)
+			continue;
+		for (int o = 0; o < OUT_COUNT + 2; o++) {
+			// Bytes read and written per frame
+			double bytes = f.srcSize[s] + yuyvBytes;
+			if (o != OUT_NONE)
+				bytes += yuyvBytes;
+			for (int i = 0; i < OUT_COUNT; i++) {
+				if (o == OUT_ALL || o == i)
+					bytes += f.outSize[i];
+			}
+
+			// Once to warm the caches up, then as many as fit in the budget
+			grab(&f, s);
+			fill(&f, o);
+			int frames = 0;
+			double t0 = now_ms(), t;
+			do {
+				grab(&f, s);
+				fill(&f, o);
+				frames++;
+				t = now_ms() - t0;
+			} while (t < budget || frames < 3);
+
+			printf("%4dx%-4d %-6s -> %-8s %7.2f ms %8.1f MPix/s %6.2f MB/frame %7.0f MB/s\n",
+				w, h, srcName[s], outName[o], t / frames, w * h * frames / t / 1e3,
+				bytes / 1e6, bytes * frames / t / 1e3);
+		}
+	}
+	frameEnd(&f);
+}
+
+int main(int argc, char** argv)
+{
+	static const int sizes[][2] = {
+		{ 320, 240 }, { 640, 480 }, { 1280, 720 }, { 1600, 1200 }
+	};
+	int bench = 0, w = 0, h = 0, opt;
+	double budget = 30;
+	const char* impl = NULL;
+
+	while ((opt = getopt(argc, argv, "bi:r:t:")) != -1) {
+		switch (opt) {
+			case 'b': bench = 1; break;
+			case 'i': impl = optarg; break;
+			case 'r': sscanf(optarg, "%dx%d", &w, &h); break;
+			case 't': budget = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-b] [-i impl] [-r WxH] [-t ms per case]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if (impl != NULL && !converter_set_impl(impl)) {
+		fprintf(stderr, "'%s' converters are not available on this cpu\n", impl);
+		return 2;
+	}
+	printf("Using '%s' converters\n", converter_impl_name());
+
+	if (bench) {
+		if (w != 0)
+			benchFrames(w, h, budget);
+		else {
+			for (unsigned int i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+				benchFrames(sizes[i][0], sizes[i][1], budget);
+		}
+		return 0;
+	}
+
+	checkImpls();
+
+	// The sizes of the camera, one whose width is not a multiple of 16,
+	//  so the kernels have a tail to do, and the one asked for
+	checkFrames(640, 480);
+	checkFrames(1600, 1200);
+	checkFrames(168, 120);
+	if (w != 0)
+		checkFrames(w, h);
+	return failed;
+}
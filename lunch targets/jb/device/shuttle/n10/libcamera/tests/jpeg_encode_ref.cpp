@@ -0,0 +1,235 @@
+/* 
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+ 
+    (C) 2011 Eduardo Jos Tagle <ejtagle@tutopia.com>
+	(C) 2011 RedScorpion
+	
+	Based on several packages:
+		- luvcview: Sdl video Usb Video Class grabber
+			(C) 2005,2006,2007 Laurent Pinchart && Michel Xhaard
+
+		- spcaview 
+			(C) 2003,2004,2005,2006 Michel Xhaard
+		
+		- JPEG decoder from http://www.bootsplash.org/
+			(C) August 2001 by Michael Schroeder, <mls@suse.de> 
+
+		- libcamera V4L for Android 2.2
+			(C) 2009 0xlab.org - http://0xlab.org/
+			(C) 2010 SpectraCore Technologies
+				Author: Venkat Raju <codredruids@spectracoretech.com>
+				Based on a code from http://code.google.com/p/android-m912/downloads/detail?name=v4l2_camera_v2.patch
+ 
+		- guvcview:  http://guvcview.berlios.de
+			Paulo Assis <pj.assis@gmail.com>
+			Nobuhiro Iwamatsu <iwamatsu@nigauri.org>
+	 
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+	
+ */
+
+/* The still picture encoder as it was before the picture path was reworked,
+   kept as the reference jpeg_shot_bench checks and times yuyv_to_jpeg
+   against. Only its entry point is renamed */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <jpeglib.h>
+
+/*	This a custom destination manager for jpeglib that
+	enables the use of memory to memory compression.
+	See IJG documentation for details.
+*/
+typedef struct {
+	struct jpeg_destination_mgr pub; 	/* base class */
+	JOCTET* buffer; 					/* buffer start address */
+	size_t bufsize;
+	size_t datasize; 					/* final size of compressed data */
+	int	   overflowed;
+} memory_destination_mgr;
+typedef memory_destination_mgr* mem_dest_ptr;
+
+
+/* This function is called by the library before any data gets written */
+METHODDEF(void) init_destination (j_compress_ptr cinfo)
+{
+	mem_dest_ptr dest = (mem_dest_ptr)cinfo->dest;
+	
+	dest->pub.next_output_byte 	= dest->buffer; 	/* set destination buffer */
+	dest->pub.free_in_buffer 	= dest->bufsize; 	/* input buffer size */
+	dest->datasize = 0; 							/* reset output size */
+}
+
+/* This function is called by the library if the buffer fills up */
+METHODDEF(boolean) empty_output_buffer (j_compress_ptr cinfo)
+{
+	mem_dest_ptr dest = (mem_dest_ptr)cinfo->dest;
+	
+	// Reinit to the start. Better than crashing
+	dest->pub.next_output_byte = (JOCTET*)dest->buffer;
+	dest->pub.free_in_buffer   = dest->bufsize;
+	dest->overflowed		   = 1;
+
+	return TRUE;
+}
+
+/* Usually the library wants to flush output here.
+   I will calculate output buffer size here. */
+
+METHODDEF(void) term_destination (j_compress_ptr cinfo)
+{
+	mem_dest_ptr dest = (mem_dest_ptr)cinfo->dest;
+	dest->datasize = dest->bufsize - dest->pub.free_in_buffer;
+}
+
+/* Override the default destination manager initialization
+   provided by jpeglib. Since we want to use memory-to-memory
+   compression, we need to use our own destination manager.
+*/
+static GLOBAL(void) jpeg_memory_dest (j_compress_ptr cinfo,void* buf,int sz)
+{
+	mem_dest_ptr dest;
+
+	/* first call for this instance - need to setup */
+	if (cinfo->dest == 0) {
+		cinfo->dest = (struct jpeg_destination_mgr *)
+		(*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_PERMANENT,
+			sizeof (memory_destination_mgr));
+	}
+
+	dest = (mem_dest_ptr) cinfo->dest;
+	dest->bufsize = sz;
+	dest->buffer = (JOCTET*)buf;
+	dest->datasize = 0;
+	
+	/* set method callbacks */
+	dest->pub.init_destination 		= init_destination;
+	dest->pub.empty_output_buffer 	= empty_output_buffer;
+	dest->pub.term_destination 		= term_destination;
+}
+
+
+/* yuyv_to_jpeg
+ *  converts an input image in the YUYV format into a jpeg image and puts
+ * it in a memory buffer.
+ */
+int yuyv_to_jpeg_ref(uint8_t* src, uint8_t* dst, int maxsize, int width, int height,int stride,int quality)
+{
+	// Round height to a multiple of 16:
+	height &= (-16);
+	
+	// Round width to a multiple of 16
+	width &= (-16);
+	
+	// Calculate deltaStride
+	int dstride = stride - (width << 1);
+
+	int i, j;
+
+	JSAMPROW y[16],cb[8],cr[8];
+	JSAMPARRAY data[3]; 
+
+	struct jpeg_compress_struct cinfo;
+	struct jpeg_error_mgr jerr;
+
+	// Allocate memory for line buffers 
+	y[0] = (JSAMPROW) malloc(sizeof(JSAMPLE) * width * 16);
+	cb[0] = (JSAMPROW) malloc(sizeof(JSAMPLE) * (width >> 1) * 8);
+	cr[0] = (JSAMPROW) malloc(sizeof(JSAMPLE) * (width >> 1) * 8);
+	
+	for (i = 1; i< 16; i++) {
+		y[i]  =  y[0] + (i*(sizeof(JSAMPLE) * width));
+	}
+	for (i = 1; i< 8; i++) {
+		cb[i] = cb[0] + (i*(sizeof(JSAMPLE) * (width >> 1)));
+		cr[i] = cr[0] + (i*(sizeof(JSAMPLE) * (width >> 1)));
+	}
+	
+	data[0] = y;
+	data[1] = cb;
+	data[2] = cr;
+
+	cinfo.err = jpeg_std_error(&jerr);  // errors get written to stderr 
+	
+	jpeg_create_compress(&cinfo);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	jpeg_set_defaults (&cinfo);
+
+	jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+
+	cinfo.raw_data_in = TRUE; 			// supply downsampled data
+	cinfo.comp_info[0].h_samp_factor = 2;
+	cinfo.comp_info[0].v_samp_factor = 2;
+	cinfo.comp_info[1].h_samp_factor = 1;
+	cinfo.comp_info[1].v_samp_factor = 1;
+	cinfo.comp_info[2].h_samp_factor = 1;
+	cinfo.comp_info[2].v_samp_factor = 1;
+
+	jpeg_set_quality(&cinfo, quality, TRUE);
+	cinfo.dct_method = JDCT_FASTEST;
+
+	jpeg_memory_dest(&cinfo,dst,maxsize);	// data written to mem
+	
+	jpeg_start_compress (&cinfo, TRUE);
+
+	uint8_t* yuyv = src;
+	
+	for (j=0; j<height; j+=16) {
+	
+		JSAMPROW pcb = cb[0];
+		JSAMPROW pcr = cr[0];
+		JSAMPROW py  = y[0];
+		for (i=0; i<8; i++) {
+			
+			int x;
+			for (x = 0; x < (width>>1); x++) {
+				*py++ = *yuyv++;		// Y0
+				*pcb++ = (yuyv[0] + yuyv[stride]) >> 1; // U
+				yuyv++;
+				*py++ = *yuyv++;		// Y1
+				*pcr++ = (yuyv[0] + yuyv[stride]) >> 1;	// V
+				yuyv++;
+			}
+			yuyv += dstride;
+			for (x = 0; x < (width>>1); x++) {	
+				*py++ = *yuyv++;		// Y2
+				yuyv++;
+				*py++ = *yuyv++;		// Y3
+				yuyv++;
+			}
+			yuyv += dstride;
+		}
+		jpeg_write_raw_data(&cinfo, data, 8*2);
+	}
+
+	jpeg_finish_compress(&cinfo);
+
+	// Release memory for line buffers 
+	free(y[0]);
+	free(cb[0]);
+	free(cr[0]);
+
+	// Create a buffer with the compressed data
+    int fileSize = ((mem_dest_ptr)cinfo.dest)->datasize;
+	
+	// Destroy compressor context
+	jpeg_destroy_compress(&cinfo);
+	
+	return fileSize;
+} 
@@ -0,0 +1,230 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/* Host check and benchmark of the still picture path: from a captured
+   YUYV picture to a JPEG the client can be handed.
+
+   The old path is the one pictureThread had: a buffer of the maximum JPEG
+   size malloc'ed for every shot, the encoder of the time (kept in
+   jpeg_encode_ref.cpp), a new shared memory heap of the compressed size,
+   and a copy into it. The new one is compressPictureLocked: yuyv_to_jpeg
+   straight into the Jpeg pool, and a view of the pool of the compressed
+   size. A memfd stands in for ashmem, and mmap for request_memory.
+
+   The check makes sure both encoders give the same bytes, and that
+   yuyv_to_jpeg tells when the picture does not fit. The benchmark reports
+   the shot to JPEG time of both paths, at 1600x1200 unless told otherwise.
+
+   Usage: jpeg_shot_bench [-b] [-n shots] [-r WxH] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <vector>
+#include "Converter.h"
+
+int yuyv_to_jpeg_ref(uint8_t* src, uint8_t* dst, int maxsize, int width, int height, int stride, int quality);
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+/* A picture with smooth gradients, edges and some sensor noise, in a
+   stride that may be larger than its width */
+static void makePicture(uint8_t* yuyv, int w, int h, int stride)
+{
+	unsigned int seed = w + h;
+	for (int y = 0; y < h; y++) {
+		uint8_t* p = yuyv + y * stride;
+		for (int x = 0; x < w; x += 2) {
+			int edge = ((x >> 6) ^ (y >> 6)) & 1 ? 60 : 0;
+			p[0] = (x * 160 / w + y * 40 / h + edge + rand_r(&seed) % 9) & 0xFF;
+			p[1] = 96 + x * 64 / w;
+			p[2] = ((x + 1) * 160 / w + y * 40 / h + edge + rand_r(&seed) % 9) & 0xFF;
+			p[3] = 160 - y * 64 / h;
+			p += 4;
+		}
+	}
+}
+
+/* What request_memory does: a shared memory region of the given size, or a
+   view of the given one */
+struct heap {
+	int fd;
+	void* data;
+	size_t size;
+};
+
+static bool requestMemory(struct heap* m, int fd, size_t size)
+{
+	m->fd = fd < 0 ? memfd_create("camera-heap", 0) : dup(fd);
+	m->size = size;
+	m->data = MAP_FAILED;
+	if (m->fd < 0)
+		return false;
+	if (fd < 0 && ftruncate(m->fd, size) < 0)
+		return false;
+	m->data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, m->fd, 0);
+	return m->data != MAP_FAILED;
+}
+
+static void releaseMemory(struct heap* m)
+{
+	if (m->data != MAP_FAILED)
+		munmap(m->data, m->size);
+	if (m->fd >= 0)
+		close(m->fd);
+	m->fd = -1;
+	m->data = MAP_FAILED;
+}
+
+/* The picture path of the old pictureThread */
+static int oldShot(uint8_t* yuyv, int w, int h, int quality, struct heap* pic)
+{
+	int maxSize = w * h * 2;
+	uint8_t* jpegBuff = (uint8_t*)malloc(maxSize);
+	if (jpegBuff == NULL)
+		return -1;
+	int fileSize = yuyv_to_jpeg_ref(yuyv, jpegBuff, maxSize, w, h, w << 1, quality);
+	releaseMemory(pic);
+	if (requestMemory(pic, -1, fileSize))
+		memcpy(pic->data, jpegBuff, fileSize);
+	free(jpegBuff);
+	return fileSize;
+}
+
+/* The picture path of compressPictureLocked */
+static int newShot(uint8_t* yuyv, int w, int h, int quality, struct heap* pool, struct heap* pic)
+{
+	releaseMemory(pic);
+	int fileSize = yuyv_to_jpeg(yuyv, (uint8_t*)pool->data, pool->size, w, h, w << 1, quality);
+	if (fileSize > 0)
+		requestMemory(pic, pool->fd, fileSize);
+	return fileSize;
+}
+
+static void checkEncoders(int w, int h, int stride)
+{
+	std::vector<uint8_t> yuyv(stride * h), a(w * h * 2), b(a.size());
+	static const int qualities[] = { 50, 75, 90, 100 };
+	char what[128];
+
+	makePicture(&yuyv[0], w, h, stride);
+	for (unsigned int i = 0; i < sizeof(qualities) / sizeof(qualities[0]); i++) {
+		int q = qualities[i];
+		int na = yuyv_to_jpeg(&yuyv[0], &a[0], a.size(), w, h, stride, q);
+		int nb = yuyv_to_jpeg_ref(&yuyv[0], &b[0], b.size(), w, h, stride, q);
+		snprintf(what, sizeof(what), "%dx%d, stride %d, q%d: %d bytes, the same as the old encoder",
+			w, h, stride, q, na);
+		check(na > 0 && na == nb && !memcmp(&a[0], &b[0], na), what);
+	}
+
+	// The old encoder wrapped around and returned a corrupt picture
+	int n = yuyv_to_jpeg(&yuyv[0], &a[0], 4096, w, h, stride, 90);
+	snprintf(what, sizeof(what), "%dx%d: -1 when the picture does not fit", w, h);
+	check(n == -1, what);
+}
+
+static void benchShots(int w, int h, int shots)
+{
+	static const int qualities[] = { 75, 90, 95 };
+	std::vector<uint8_t> yuyv(w * h * 2);
+	struct heap pool, pic = { -1, MAP_FAILED, 0 };
+	std::vector<double> to(shots), tn(shots);
+
+	makePicture(&yuyv[0], w, h, w * 2);
+	if (!requestMemory(&pool, -1, w * h * 2)) {
+		fprintf(stderr, "No memory for the Jpeg pool\n");
+		failed = 1;
+		return;
+	}
+
+	for (unsigned int i = 0; i < sizeof(qualities) / sizeof(qualities[0]); i++) {
+		int q = qualities[i], size = 0;
+
+		// Interleaved, so both see the same cpu and cache conditions
+		for (int s = 0; s < shots; s++) {
+			double t0 = now_ms();
+			oldShot(&yuyv[0], w, h, q, &pic);
+			double t1 = now_ms();
+			size = newShot(&yuyv[0], w, h, q, &pool, &pic);
+			double t2 = now_ms();
+			to[s] = t1 - t0;
+			tn[s] = t2 - t1;
+		}
+		std::sort(to.begin(), to.end());
+		std::sort(tn.begin(), tn.end());
+		printf("%dx%d q%d, %d bytes: shot to jpeg %.2f ms median (%.2f to %.2f), "
+			"old path %.2f ms (%.2f to %.2f), x%.2f\n",
+			w, h, q, size, tn[shots / 2], tn[0], tn[shots - 1],
+			to[shots / 2], to[0], to[shots - 1], to[shots / 2] / tn[shots / 2]);
+	}
+	releaseMemory(&pic);
+	releaseMemory(&pool);
+}
+
+int main(int argc, char** argv)
+{
+	int bench = 0, shots = 30, w = 1600, h = 1200, opt;
+
+	while ((opt = getopt(argc, argv, "bn:r:")) != -1) {
+		switch (opt) {
+			case 'b': bench = 1; break;
+			case 'n': shots = atoi(optarg); break;
+			case 'r': sscanf(optarg, "%dx%d", &w, &h); break;
+			default:
+				fprintf(stderr, "usage: %s [-b] [-n shots] [-r WxH]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (shots < 1)
+		shots = 1;
+
+	if (bench) {
+		printf("Using '%s' converters\n", converter_impl_name());
+		benchShots(w, h, shots);
+		return failed;
+	}
+
+	checkEncoders(1600, 1200, 3200);
+	checkEncoders(640, 480, 1280);
+	checkEncoders(640, 480, 1408);
+	if (w != 1600 || h != 1200)
+		checkEncoders(w, h, w * 2);
+	return failed;
+}
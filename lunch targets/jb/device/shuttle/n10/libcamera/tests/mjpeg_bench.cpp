@@ -0,0 +1,439 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/* Host check and benchmark of the MJPEG decoder over a corpus of frames.
+
+   Each frame is decoded by jpeg_decode, by the decoder it replaced (kept in
+   jpeg_decode_ref.cpp), and by libjpeg. jpeg_decode must give exactly the
+   same picture as the old decoder, and be close to the libjpeg one.
+
+   The old decoder took the chroma of 4:2:2 frames from the wrong rows: the
+   8 lines of a MCU used chroma rows 0, 1, 1, 2, 2, 3, 3, 4 instead of 0 to
+   7. jpeg_decode does not, so only the luma of those frames has to be the
+   same, and their chroma is checked against libjpeg alone.
+
+   The corpus is a directory of frames, one per file, as a UVC camera sends
+   them: "v4l2-ctl --stream-mmap --stream-to=..." splits into them easily.
+   Without one, a corpus is made with libjpeg: 4:2:2 and 4:2:0 frames at
+   several qualities and sizes, with and without restart markers, and
+   without their Huffman tables, as most cameras send them.
+
+   Usage: mjpeg_bench [-b] [-d corpus dir] [-g dir] [-t ms per frame]
+   -b also times the three decoders
+   -g writes the made up corpus to dir, and exits */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <setjmp.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <jpeglib.h>
+#include "Utils.h"
+
+int jpeg_decode_ref(uint8_t *pic, int stride, uint8_t *buf, int width, int height);
+
+/* Least PSNR of luma and chroma against libjpeg, in dB. The decoders have
+   their own IDCT, so they are not exactly the same. The chroma rows the
+   old decoder got wrong are around 44 dB */
+#define MIN_PSNR	50.0
+
+struct frame {
+	std::string name;
+	std::vector<uint8_t> data;
+	int width, height;
+	int hsamp, vsamp;			// Luma sampling factors
+};
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+static double now_ms(void)
+{
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1e3 + t.tv_nsec * 1e-6;
+}
+
+/* Find the size of a frame in its SOF0 marker. Returns false if it is not
+   a baseline JPEG */
+static bool frameSize(struct frame& f)
+{
+	const std::vector<uint8_t>& d = f.data;
+	size_t i = 2;
+	if (d.size() < 4 || d[0] != 0xFF || d[1] != 0xD8)
+		return false;
+	while (i + 9 < d.size() && d[i] == 0xFF) {
+		int m = d[i + 1];
+		int len = (d[i + 2] << 8) | d[i + 3];
+		if (m == 0xC0 && i + 11 < d.size()) {
+			f.height = (d[i + 5] << 8) | d[i + 6];
+			f.width = (d[i + 7] << 8) | d[i + 8];
+			f.hsamp = d[i + 11] >> 4;
+			f.vsamp = d[i + 11] & 15;
+			return true;
+		}
+		if (m == 0xDA || (m >= 0xC1 && m <= 0xCF && m != 0xC4 && m != 0xC8 && m != 0xCC))
+			return false;
+		i += 2 + len;
+	}
+	return false;
+}
+
+/* A picture with smooth gradients, edges and some sensor noise */
+static uint8_t pixel(int x, int y, int c, unsigned int* seed)
+{
+	double v = 128 + 60 * sin(x / (37.0 + c * 11)) * cos(y / 23.0) + 40 * sin((x + y) / 91.0);
+	if (((x >> 6) ^ (y >> 6)) & 1)
+		v = 255 - v;
+	v += (int)(rand_r(seed) % 9) - 4;
+	return v < 0 ? 0 : v > 255 ? 255 : (uint8_t)v;
+}
+
+static std::vector<uint8_t> encode(int w, int h, int hsamp, int vsamp, int quality, int restart)
+{
+	struct jpeg_compress_struct c;
+	struct jpeg_error_mgr err;
+	unsigned char* out = NULL;
+	unsigned long size = 0;
+	unsigned int seed = w + h + quality;
+
+	c.err = jpeg_std_error(&err);
+	jpeg_create_compress(&c);
+	jpeg_mem_dest(&c, &out, &size);
+	c.image_width = w;
+	c.image_height = h;
+	c.input_components = 3;
+	c.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&c);
+	jpeg_set_quality(&c, quality, TRUE);
+	c.comp_info[0].h_samp_factor = hsamp;
+	c.comp_info[0].v_samp_factor = vsamp;
+	c.restart_interval = restart;
+	jpeg_start_compress(&c, TRUE);
+
+	std::vector<uint8_t> row(w * 3);
+	for (int y = 0; y < h; y++) {
+		for (int x = 0; x < w; x++)
+			for (int k = 0; k < 3; k++)
+				row[x * 3 + k] = pixel(x, y, k, &seed);
+		JSAMPROW r = &row[0];
+		jpeg_write_scanlines(&c, &r, 1);
+	}
+	jpeg_finish_compress(&c);
+
+	std::vector<uint8_t> v(out, out + size);
+	free(out);
+	jpeg_destroy_compress(&c);
+	return v;
+}
+
+/* Remove the Huffman tables, as most UVC cameras do: the decoders must use
+   the standard ones */
+static std::vector<uint8_t> stripDHT(const std::vector<uint8_t>& j)
+{
+	std::vector<uint8_t> o(j.begin(), j.begin() + 2);
+	size_t i = 2;
+	while (i + 4 <= j.size()) {
+		int m = j[i + 1];
+		int len = (j[i + 2] << 8) | j[i + 3];
+		if (m == 0xDA) {
+			o.insert(o.end(), j.begin() + i, j.end());
+			break;
+		}
+		if (m != 0xC4)
+			o.insert(o.end(), j.begin() + i, j.begin() + i + 2 + len);
+		i += 2 + len;
+	}
+	return o;
+}
+
+static void makeCorpus(std::vector<frame>& corpus)
+{
+	static const int sizes[][2] = { { 640, 480 }, { 1280, 720 } };
+	static const int qualities[] = { 50, 75, 90 };
+	char name[64];
+
+	for (unsigned int s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		for (int vsamp = 1; vsamp <= 2; vsamp++) {
+			for (unsigned int q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++) {
+				for (int r = 0; r < 2; r++) {
+					int w = sizes[s][0], h = sizes[s][1];
+					// One restart interval per row of MCUs, as cameras do
+					int restart = r ? w / 16 : 0;
+					frame f;
+					snprintf(name, sizeof(name), "%dx%d_%s_q%d%s.jpg", w, h,
+						vsamp == 2 ? "420" : "422", qualities[q], r ? "_rst" : "");
+					f.name = name;
+					f.data = stripDHT(encode(w, h, 2, vsamp, qualities[q], restart));
+					frameSize(f);
+					corpus.push_back(f);
+				}
+			}
+		}
+	}
+}
+
+static bool loadCorpus(const char* dir, std::vector<frame>& corpus)
+{
+	DIR* d = opendir(dir);
+	struct dirent* e;
+	std::vector<std::string> names;
+
+	if (d == NULL) {
+		perror(dir);
+		return false;
+	}
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] != '.')
+			names.push_back(e->d_name);
+	}
+	closedir(d);
+	std::sort(names.begin(), names.end());
+
+	for (unsigned int i = 0; i < names.size(); i++) {
+		std::string path = std::string(dir) + "/" + names[i];
+		FILE* fp = fopen(path.c_str(), "rb");
+		frame f;
+		int c;
+		if (fp == NULL)
+			continue;
+		while ((c = getc(fp)) != EOF)
+			f.data.push_back(c);
+		fclose(fp);
+		f.name = names[i];
+		if (!frameSize(f)) {
+			printf("SKIP: %s: not a baseline JPEG\n", names[i].c_str());
+			continue;
+		}
+		corpus.push_back(f);
+	}
+	return true;
+}
+
+static bool saveCorpus(const char* dir, const std::vector<frame>& corpus)
+{
+	for (unsigned int i = 0; i < corpus.size(); i++) {
+		std::string path = std::string(dir) + "/" + corpus[i].name;
+		FILE* fp = fopen(path.c_str(), "wb");
+		if (fp == NULL) {
+			perror(path.c_str());
+			return false;
+		}
+		fwrite(&corpus[i].data[0], 1, corpus[i].data.size(), fp);
+		fclose(fp);
+	}
+	printf("%u frames written to %s\n", (unsigned int)corpus.size(), dir);
+	return true;
+}
+
+struct jpeg_err {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+};
+
+static void jpegError(j_common_ptr c)
+{
+	longjmp(((struct jpeg_err*)c->err)->jump, 1);
+}
+
+/* Decode with libjpeg into YUYV. The chroma of each pair of pixels is taken
+   from the first one */
+static int libjpegDecode(uint8_t* pic, int stride, const frame& f)
+{
+	struct jpeg_decompress_struct c;
+	struct jpeg_err err;
+	std::vector<uint8_t> row(f.width * 3);
+
+	c.err = jpeg_std_error(&err.pub);
+	err.pub.error_exit = jpegError;
+	if (setjmp(err.jump)) {
+		jpeg_destroy_decompress(&c);
+		return -1;
+	}
+	jpeg_create_decompress(&c);
+	jpeg_mem_src(&c, (unsigned char*)&f.data[0], f.data.size());
+	jpeg_read_header(&c, TRUE);
+	c.out_color_space = JCS_YCbCr;
+	c.dct_method = JDCT_ISLOW;
+	c.do_fancy_upsampling = FALSE;
+	jpeg_start_decompress(&c);
+	while (c.output_scanline < c.output_height) {
+		JSAMPROW r = &row[0];
+		uint8_t* p = pic + c.output_scanline * stride;
+		jpeg_read_scanlines(&c, &r, 1);
+		for (int x = 0; x < f.width; x += 2) {
+			p[0] = row[x * 3];
+			p[1] = row[x * 3 + 1];
+			p[2] = row[x * 3 + 3];
+			p[3] = row[x * 3 + 2];
+			p += 4;
+		}
+	}
+	jpeg_finish_decompress(&c);
+	jpeg_destroy_decompress(&c);
+	return 0;
+}
+
+/* PSNR of the luma (first = 0) or chroma (first = 1) of two YUYV frames */
+static double psnr(const uint8_t* a, const uint8_t* b, int size, int first)
+{
+	double e = 0;
+	for (int i = first; i < size; i += 2)
+		e += (a[i] - b[i]) * (a[i] - b[i]);
+	if (e == 0)
+		return 99;
+	return 10 * log10(255.0 * 255.0 * (size / 2) / e);
+}
+
+/* Compare the luma, or the chroma, of two YUYV frames */
+static bool same(const uint8_t* a, const uint8_t* b, int size, int first)
+{
+	for (int i = first; i < size; i += 2) {
+		if (a[i] != b[i])
+			return false;
+	}
+	return true;
+}
+
+enum { DEC_CUR, DEC_REF, DEC_LIBJPEG };
+
+static int decode(int dec, uint8_t* pic, int stride, frame& f)
+{
+	switch (dec) {
+		case DEC_CUR:
+			return jpeg_decode(pic, stride, &f.data[0], f.data.size(), f.width, f.height);
+		case DEC_REF:
+			return jpeg_decode_ref(pic, stride, &f.data[0], f.width, f.height);
+		default:
+			return libjpegDecode(pic, stride, f);
+	}
+}
+
+/* Time a decoder on a frame for about budget ms */
+static double timeDecode(int dec, uint8_t* pic, int stride, frame& f, double budget)
+{
+	int n = 0;
+	double t0, t;
+	decode(dec, pic, stride, f);
+	t0 = now_ms();
+	do {
+		decode(dec, pic, stride, f);
+		n++;
+		t = now_ms() - t0;
+	} while (t < budget || n < 3);
+	return t / n;
+}
+
+int main(int argc, char** argv)
+{
+	std::vector<frame> corpus;
+	const char* dir = NULL;
+	const char* gen = NULL;
+	double budget = 200, total[3] = { 0, 0, 0 }, pixels = 0;
+	int bench = 0, opt;
+	char what[256];
+
+	while ((opt = getopt(argc, argv, "bd:g:t:")) != -1) {
+		switch (opt) {
+			case 'b': bench = 1; break;
+			case 'd': dir = optarg; break;
+			case 'g': gen = optarg; break;
+			case 't': budget = atof(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-b] [-d corpus dir] [-g dir] [-t ms per frame]\n", argv[0]);
+				return 2;
+		}
+	}
+
+	if (dir != NULL) {
+		if (!loadCorpus(dir, corpus))
+			return 2;
+	} else
+		makeCorpus(corpus);
+	if (gen != NULL)
+		return saveCorpus(gen, corpus) ? 0 : 2;
+	if (corpus.empty()) {
+		fprintf(stderr, "No frames to decode\n");
+		return 2;
+	}
+
+	for (unsigned int i = 0; i < corpus.size(); i++) {
+		frame& f = corpus[i];
+		int stride = f.width * 2, size = stride * f.height;
+
+		// Room for whole MCUs below the picture, as the old decoder writes them
+		std::vector<uint8_t> cur(stride * (f.height + 16)), ref(cur.size()), lib(cur.size());
+		int rc = decode(DEC_CUR, &cur[0], stride, f);
+		int rr = decode(DEC_REF, &ref[0], stride, f);
+		int rl = decode(DEC_LIBJPEG, &lib[0], stride, f);
+
+		if (rc < 0 || rr < 0) {
+			snprintf(what, sizeof(what), "%s: decoded (%d, the old decoder %d)", f.name.c_str(), rc, rr);
+			check(rc >= 0 && rc == rr, what);
+			continue;
+		}
+		bool is422 = (f.hsamp == 2 && f.vsamp == 1);
+		snprintf(what, sizeof(what), "%s: %s the same as the old decoder", f.name.c_str(),
+			is422 ? "luma" : "luma and chroma");
+		check(same(&cur[0], &ref[0], size, 0) && (is422 || same(&cur[0], &ref[0], size, 1)), what);
+		if (rl < 0)
+			printf("SKIP: %s: libjpeg can not decode it\n", f.name.c_str());
+		else {
+			double py = psnr(&cur[0], &lib[0], size, 0), pc = psnr(&cur[0], &lib[0], size, 1);
+			snprintf(what, sizeof(what), "%s: luma %.1f dB, chroma %.1f dB against libjpeg "
+				"(old decoder %.1f dB), above %.0f dB", f.name.c_str(), py, pc,
+				psnr(&ref[0], &lib[0], size, 1), MIN_PSNR);
+			check(py >= MIN_PSNR && pc >= MIN_PSNR, what);
+		}
+
+		if (!bench)
+			continue;
+		double tc = timeDecode(DEC_CUR, &cur[0], stride, f, budget);
+		double tr = timeDecode(DEC_REF, &ref[0], stride, f, budget);
+		double tl = rl < 0 ? 0 : timeDecode(DEC_LIBJPEG, &lib[0], stride, f, budget);
+		printf("   %6.2f ms, %6.1f MPix/s; old decoder %6.2f ms, x%.2f; libjpeg %6.2f ms\n",
+			tc, f.width * f.height / tc / 1e3, tr, tr / tc, tl);
+		total[0] += tc;
+		total[1] += tr;
+		total[2] += tl;
+		pixels += f.width * f.height;
+	}
+
+	if (bench) {
+		printf("%u frames: %.1f MPix/s, old decoder %.1f MPix/s, libjpeg %.1f MPix/s\n",
+			(unsigned int)corpus.size(), pixels / total[0] / 1e3, pixels / total[1] / 1e3,
+			total[2] ? pixels / total[2] / 1e3 : 0);
+	}
+	return failed;
+}
@@ -0,0 +1,6 @@
+/* Host stand-in: nothing of binder is used by the code under test, but the
+   real header brings in the fixed size integer types */
+#ifndef _STUB_BINDER_MEMORYBASE_H
+#define _STUB_BINDER_MEMORYBASE_H
+#include <stdint.h>
+#endif
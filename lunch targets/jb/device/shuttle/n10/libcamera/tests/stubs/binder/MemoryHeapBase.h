@@ -0,0 +1,4 @@
+/* Host stand-in: nothing of binder is used by the code under test */
+#ifndef _STUB_BINDER_MEMORYHEAPBASE_H
+#define _STUB_BINDER_MEMORYHEAPBASE_H
+#endif
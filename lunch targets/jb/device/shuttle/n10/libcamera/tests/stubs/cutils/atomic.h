@@ -0,0 +1,49 @@
+/* Host stand-in for the cutils atomics, with the same barrier semantics */
+#ifndef _STUB_CUTILS_ATOMIC_H
+#define _STUB_CUTILS_ATOMIC_H
+
+#include <stdint.h>
+
+/* Return the previous value */
+static inline int32_t android_atomic_inc(volatile int32_t* addr)
+{
+	return __atomic_fetch_add(addr, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t android_atomic_dec(volatile int32_t* addr)
+{
+	return __atomic_fetch_sub(addr, 1, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t android_atomic_add(int32_t value, volatile int32_t* addr)
+{
+	return __atomic_fetch_add(addr, value, __ATOMIC_SEQ_CST);
+}
+
+static inline int32_t android_atomic_acquire_load(volatile const int32_t* addr)
+{
+	return __atomic_load_n(addr, __ATOMIC_ACQUIRE);
+}
+
+static inline void android_atomic_release_store(int32_t value, volatile int32_t* addr)
+{
+	__atomic_store_n(addr, value, __ATOMIC_RELEASE);
+}
+
+/* Return 0 if the value was swapped */
+static inline int android_atomic_cmpxchg(int32_t oldvalue, int32_t newvalue, volatile int32_t* addr)
+{
+	return !__atomic_compare_exchange_n(addr, &oldvalue, newvalue, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+static inline int android_atomic_acquire_cas(int32_t oldvalue, int32_t newvalue, volatile int32_t* addr)
+{
+	return android_atomic_cmpxchg(oldvalue, newvalue, addr);
+}
+
+static inline int android_atomic_release_cas(int32_t oldvalue, int32_t newvalue, volatile int32_t* addr)
+{
+	return android_atomic_cmpxchg(oldvalue, newvalue, addr);
+}
+
+#endif
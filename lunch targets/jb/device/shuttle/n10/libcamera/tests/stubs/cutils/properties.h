@@ -0,0 +1,29 @@
+/* Host stand-in for the Android properties. A property is read from the
+   environment, with its dots as underscores: debug_camera_convbench=1 sets
+   debug.camera.convbench */
+#ifndef _STUB_CUTILS_PROPERTIES_H
+#define _STUB_CUTILS_PROPERTIES_H
+
+#include <stdlib.h>
+#include <string.h>
+
+#define PROPERTY_KEY_MAX	32
+#define PROPERTY_VALUE_MAX	92
+
+static inline int property_get(const char* key, char* value, const char* default_value)
+{
+	char name[PROPERTY_KEY_MAX * 2];
+	const char* v;
+	size_t i;
+	for (i = 0; key[i] && i < sizeof(name) - 1; i++)
+		name[i] = (key[i] == '.') ? '_' : key[i];
+	name[i] = 0;
+	v = getenv(name);
+	if (!v)
+		v = default_value ? default_value : "";
+	strncpy(value, v, PROPERTY_VALUE_MAX - 1);
+	value[PROPERTY_VALUE_MAX - 1] = 0;
+	return strlen(value);
+}
+
+#endif
@@ -0,0 +1,29 @@
+/* Host stand-in for the Android log. Warnings and errors always go to 
+   stderr, the rest only if LOG_VERBOSE is set */
+#ifndef _STUB_UTILS_LOG_H
+#define _STUB_UTILS_LOG_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifndef LOG_TAG
+#define LOG_TAG "camera"
+#endif
+
+#define STUB_LOG(lvl, ...) \
+	((void)(((lvl) == 'E' || (lvl) == 'W' || getenv("LOG_VERBOSE")) && \
+		(fprintf(stderr, "%c/%s: ", (lvl), LOG_TAG), fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))))
+
+#define ALOGV(...) STUB_LOG('V', __VA_ARGS__)
+#define ALOGD(...) STUB_LOG('D', __VA_ARGS__)
+#define ALOGI(...) STUB_LOG('I', __VA_ARGS__)
+#define ALOGW(...) STUB_LOG('W', __VA_ARGS__)
+#define ALOGE(...) STUB_LOG('E', __VA_ARGS__)
+#define LOGV ALOGV
+#define LOGD ALOGD
+#define LOGI ALOGI
+#define LOGW ALOGW
+#define LOGE ALOGE
+
+#endif
@@ -0,0 +1,46 @@
+/* Host stand-in for the Android SortedVector: items kept sorted and unique */
+#ifndef _STUB_UTILS_SORTEDVECTOR_H
+#define _STUB_UTILS_SORTEDVECTOR_H
+
+#include <sys/types.h>
+#include <vector>
+#include <algorithm>
+
+namespace android {
+
+template <class T>
+class SortedVector {
+public:
+	size_t size() const { return items.size(); }
+	bool isEmpty() const { return items.empty(); }
+	void clear() { items.clear(); }
+	const T& itemAt(size_t index) const { return items[index]; }
+	const T& operator[](size_t index) const { return items[index]; }
+	const T& top() const { return items.back(); }
+
+	ssize_t indexOf(const T& item) const {
+		typename std::vector<T>::const_iterator i = std::lower_bound(items.begin(), items.end(), item);
+		return (i != items.end() && !(item < *i)) ? i - items.begin() : -1;
+	}
+
+	ssize_t add(const T& item) {
+		typename std::vector<T>::iterator i = std::lower_bound(items.begin(), items.end(), item);
+		if (i != items.end() && !(item < *i)) {
+			*i = item;
+			return i - items.begin();
+		}
+		return items.insert(i, item) - items.begin();
+	}
+
+	ssize_t removeAt(size_t index) {
+		items.erase(items.begin() + index);
+		return index;
+	}
+
+private:
+	std::vector<T> items;
+};
+
+}; // namespace android
+
+#endif
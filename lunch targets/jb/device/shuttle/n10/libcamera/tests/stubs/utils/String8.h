@@ -0,0 +1,32 @@
+/* Host stand-in for the Android String8, with what the camera uses */
+#ifndef _STUB_UTILS_STRING8_H
+#define _STUB_UTILS_STRING8_H
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string>
+
+namespace android {
+
+class String8 {
+public:
+	String8() {}
+	String8(const char* s) : str(s) {}
+	const char* string() const { return str.c_str(); }
+	size_t length() const { return str.length(); }
+	void append(const char* s) { str += s; }
+	void appendFormat(const char* fmt, ...) {
+		char buf[1024];
+		va_list ap;
+		va_start(ap, fmt);
+		vsnprintf(buf, sizeof(buf), fmt, ap);
+		va_end(ap);
+		str += buf;
+	}
+private:
+	std::string str;
+};
+
+}; // namespace android
+
+#endif
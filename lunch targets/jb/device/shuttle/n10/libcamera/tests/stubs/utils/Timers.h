@@ -0,0 +1,27 @@
+/* Host stand-in for the Android timers */
+#ifndef _STUB_UTILS_TIMERS_H
+#define _STUB_UTILS_TIMERS_H
+
+#include <stdint.h>
+#include <time.h>
+
+typedef int64_t nsecs_t;
+
+enum {
+	SYSTEM_TIME_REALTIME = 0,
+	SYSTEM_TIME_MONOTONIC = 1
+};
+
+static inline nsecs_t systemTime(int clock)
+{
+	struct timespec t;
+	clock_gettime(clock == SYSTEM_TIME_MONOTONIC ? CLOCK_MONOTONIC : CLOCK_REALTIME, &t);
+	return (nsecs_t)t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+static inline nsecs_t seconds_to_nanoseconds(nsecs_t secs) { return secs * 1000000000LL; }
+static inline nsecs_t milliseconds_to_nanoseconds(nsecs_t ms) { return ms * 1000000LL; }
+static inline nsecs_t microseconds_to_nanoseconds(nsecs_t us) { return us * 1000LL; }
+static inline nsecs_t nanoseconds_to_milliseconds(nsecs_t ns) { return ns / 1000000LL; }
+
+#endif
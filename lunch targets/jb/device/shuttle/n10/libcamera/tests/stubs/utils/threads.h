@@ -0,0 +1,12 @@
+/* Host stand-in for the Android thread priorities */
+#ifndef _STUB_UTILS_THREADS_H
+#define _STUB_UTILS_THREADS_H
+
+enum {
+	ANDROID_PRIORITY_DISPLAY = -4,
+	ANDROID_PRIORITY_URGENT_DISPLAY = -8
+};
+
+static inline int androidSetThreadPriority(int tid, int prio) { return 0; }
+
+#endif
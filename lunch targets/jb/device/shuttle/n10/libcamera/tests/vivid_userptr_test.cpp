@@ -0,0 +1,348 @@
+/*
+	libcamera: An implementation of the library required by Android OS 3.2 so
+	it can access V4L2 devices as cameras.
+
+    (C) 2011-2013 Eduardo Jos Tagle <ejtagle@tutopia.com>
+
+    This program is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+ */
+
+/* Host test of the zero copy preview path of V4L2Camera, against the vivid
+   virtual driver or a v4l2loopback device fed by some producer.
+
+   Preview buffers of the size of a frame are handed to the driver with
+   USERPTR, as CameraHardware does with the preview window buffers. The test
+   checks the driver writes each frame into one of them, without going past
+   its end, that the index returned is one that was queued, that timestamps
+   grow, and that the buffers go on being captured into once queued again.
+   Then it goes back to MMAP buffers, as when USERPTR is not supported, and
+   grabs frames through the copy path.
+
+   V4L2Camera switches the camera power rail on before opening the device,
+   and caches the enumerated modes under /data. The test build points both
+   to files in out/ instead.
+
+   Without a vivid or v4l2loopback capture node it reports SKIP. Load vivid
+   with "modprobe vivid", or feed a loopback device with, for example,
+   "gst-launch-1.0 videotestsrc ! video/x-raw,format=YUY2,width=640,height=480
+   ! v4l2sink device=/dev/videoN".
+
+   Usage: vivid_userptr_test [-d device] [-n frames] */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+#include "V4L2Camera.h"
+
+using namespace android;
+
+#define WIDTH		640
+#define HEIGHT		480
+#define FPS		30
+#define NBUFFERS	4
+
+/* Bytes after each buffer that the driver must not write */
+#define GUARD		4096
+#define CANARY		0xA5
+
+static int failed = 0;
+
+static void check(int ok, const char* what)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	if (!ok)
+		failed = 1;
+}
+
+/* The driver name of a capture node, or false if it is not one */
+static bool captureDriver(const char* dev, char* driver, int len)
+{
+	struct v4l2_capability cap;
+	int fd = open(dev, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return false;
+	memset(&cap, 0, sizeof(cap));
+	int ret = ioctl(fd, VIDIOC_QUERYCAP, &cap);
+	close(fd);
+	if (ret < 0)
+		return false;
+
+	unsigned int caps = (cap.capabilities & V4L2_CAP_DEVICE_CAPS) ? cap.device_caps : cap.capabilities;
+	if (!(caps & V4L2_CAP_VIDEO_CAPTURE) || !(caps & V4L2_CAP_STREAMING))
+		return false;
+	snprintf(driver, len, "%s", (const char*)cap.driver);
+	return true;
+}
+
+/* The pixel format the device was left set to. It is the same for every
+   open file of the device */
+static unsigned int currentFormat(const char* dev)
+{
+	struct v4l2_format fmt;
+	int fd = open(dev, O_RDWR | O_NONBLOCK);
+	if (fd < 0)
+		return 0;
+	memset(&fmt, 0, sizeof(fmt));
+	fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+	int ret = ioctl(fd, VIDIOC_G_FMT, &fmt);
+	close(fd);
+	return ret < 0 ? 0 : fmt.fmt.pix.pixelformat;
+}
+
+static bool findDevice(char* dev, int len, char* driver, int dlen)
+{
+	for (int i = 0; i < 64; i++) {
+		snprintf(dev, len, "/dev/video%d", i);
+		if (captureDriver(dev, driver, dlen) &&
+			(!strcmp(driver, "vivid") || !strcmp(driver, "v4l2 loopback")))
+			return true;
+	}
+	return false;
+}
+
+static bool untouched(const uint8_t* p, int len)
+{
+	for (int i = 0; i < len; i++)
+		if (p[i] != CANARY)
+			return false;
+	return true;
+}
+
+/* Capture frames into the caller supplied buffers, queueing each one back
+   once it is checked, as previewThread does */
+static void captureUserPtr(V4L2Camera& camera, int frames, bool loopback)
+{
+	char what[128];
+	int w, h;
+
+	camera.getSize(w, h);
+	int frameSize = w * h * 2;
+	int bufSize = (frameSize + 4095) & ~4095;
+
+	int n = camera.EnableUserPtr(NBUFFERS);
+	if (n == -EINVAL && loopback) {
+		printf("SKIP: the loopback device does not support USERPTR\n");
+		return;
+	}
+	snprintf(what, sizeof(what), "EnableUserPtr(%d): %d buffers", NBUFFERS, n);
+	check(n > 0 && n <= NBUFFERS && camera.IsUserPtr(), what);
+	if (n <= 0)
+		return;
+
+	uint8_t* bufs[NBUFFERS];
+	int seen[NBUFFERS];
+	for (int i = 0; i < n; i++) {
+		void* p = NULL;
+		if (posix_memalign(&p, 4096, bufSize + GUARD) != 0) {
+			check(0, "posix_memalign");
+			return;
+		}
+		bufs[i] = (uint8_t*)p;
+		memset(bufs[i], CANARY, bufSize + GUARD);
+		seen[i] = 0;
+	}
+
+	check(camera.QueueUserPtr(0, bufs[0], frameSize - 1) == -EINVAL,
+		"QueueUserPtr refuses a buffer smaller than a frame");
+
+	bool queued = true;
+	for (int i = 0; i < n; i++)
+		queued = queued && camera.QueueUserPtr(i, bufs[i], bufSize) == 0;
+	check(queued, "QueueUserPtr of every buffer");
+	check(camera.StartStreaming() == 0, "StartStreaming with USERPTR buffers");
+
+	int got = 0, badIndex = 0, badSize = 0, notWritten = 0, overrun = 0, requeue = 0, backwards = 0;
+	nsecs_t last = 0;
+	while (got < frames) {
+		int ret = camera.WaitFrame(2000);
+		if (ret <= 0) {
+			if (got == 0 && loopback) {
+				printf("SKIP: no frames from the loopback device, is a producer writing to it?\n");
+				camera.StopStreaming();
+				goto out;
+			}
+			snprintf(what, sizeof(what), "WaitFrame: %s after %d frames", ret == 0 ? "timeout" : "error", got);
+			check(0, what);
+			break;
+		}
+
+		int idx = -1;
+		int bytes = camera.DequeueUserPtr(idx);
+		if (bytes < 0) {
+			check(0, "DequeueUserPtr");
+			break;
+		}
+		got++;
+		if (idx < 0 || idx >= n) {
+			badIndex++;
+			continue;
+		}
+		seen[idx]++;
+		if (bytes != frameSize)
+			badSize++;
+
+		// vivid draws its pattern over the whole frame: Neither the first
+		//  nor the last line can be left as they were
+		if (untouched(bufs[idx], w * 2) || untouched(bufs[idx] + frameSize - w * 2, w * 2))
+			notWritten++;
+		if (!untouched(bufs[idx] + bufSize, GUARD))
+			overrun++;
+
+		nsecs_t ts = camera.getFrameTimestamp();
+		if (ts <= last)
+			backwards++;
+		last = ts;
+
+		memset(bufs[idx], CANARY, bufSize + GUARD);
+		if (camera.QueueUserPtr(idx, bufs[idx], bufSize) != 0)
+			requeue++;
+	}
+
+	snprintf(what, sizeof(what), "%d of %d frames captured", got, frames);
+	check(got == frames, what);
+	check(badIndex == 0, "every index returned was queued");
+	snprintf(what, sizeof(what), "every frame is %d bytes", frameSize);
+	check(badSize == 0, what);
+	check(notWritten == 0, "every frame was written into its buffer");
+	check(overrun == 0, "no write past the end of a buffer");
+	check(backwards == 0, "timestamps grow");
+	check(requeue == 0, "buffers can be queued again");
+	if (got >= 2 * n) {
+		bool all = true;
+		for (int i = 0; i < n; i++)
+			all = all && seen[i] > 1;
+		check(all, "every buffer was captured into more than once");
+	}
+
+	check(camera.StopStreaming() == 0, "StopStreaming");
+
+out:
+	// Back to MMAP before the buffers are freed, so the driver drops them
+	check(camera.EnableUserPtr(0) >= 0 && !camera.IsUserPtr(), "EnableUserPtr(0) goes back to MMAP");
+	for (int i = 0; i < n; i++)
+		free(bufs[i]);
+}
+
+/* The copy path, with the driver's MMAP buffers */
+static void captureMmap(V4L2Camera& camera, int frames, bool loopback)
+{
+	char what[128];
+	int w, h;
+
+	camera.getSize(w, h);
+	int frameSize = w * h * 2;
+	uint8_t* frame = (uint8_t*)malloc(frameSize + GUARD);
+
+	check(camera.StartStreaming() == 0, "StartStreaming with MMAP buffers");
+
+	int got = 0, notWritten = 0, overrun = 0;
+	while (got < frames) {
+		int ret = camera.WaitFrame(2000);
+		if (ret <= 0) {
+			if (got == 0 && loopback) {
+				printf("SKIP: no frames from the loopback device, is a producer writing to it?\n");
+				break;
+			}
+			snprintf(what, sizeof(what), "WaitFrame: %s after %d frames", ret == 0 ? "timeout" : "error", got);
+			check(0, what);
+			break;
+		}
+		memset(frame, CANARY, frameSize + GUARD);
+		camera.GrabRawFrame(frame, frameSize);
+		got++;
+		if (untouched(frame, w * 2) || untouched(frame + frameSize - w * 2, w * 2))
+			notWritten++;
+		if (!untouched(frame + frameSize, GUARD))
+			overrun++;
+	}
+	if (got > 0 || !loopback) {
+		snprintf(what, sizeof(what), "%d of %d frames grabbed through the copy path", got, frames);
+		check(got == frames, what);
+		check(notWritten == 0, "every grabbed frame was written");
+		check(overrun == 0, "GrabRawFrame does not write past the frame");
+	}
+
+	camera.StopStreaming();
+	free(frame);
+}
+
+int main(int argc, char** argv)
+{
+	char dev[64] = "", driver[32] = "";
+	int frames = 60, opt;
+
+	while ((opt = getopt(argc, argv, "d:n:")) != -1) {
+		switch (opt) {
+			case 'd': snprintf(dev, sizeof(dev), "%s", optarg); break;
+			case 'n': frames = atoi(optarg); break;
+			default:
+				fprintf(stderr, "usage: %s [-d device] [-n frames]\n", argv[0]);
+				return 2;
+		}
+	}
+	if (frames < 1)
+		frames = 1;
+
+	if (dev[0]) {
+		if (!captureDriver(dev, driver, sizeof(driver))) {
+			fprintf(stderr, "%s is not a video capture device\n", dev);
+			return 2;
+		}
+	} else if (!findDevice(dev, sizeof(dev), driver, sizeof(driver))) {
+		printf("SKIP: no vivid or v4l2loopback capture device\n");
+		return 0;
+	}
+	bool loopback = strcmp(driver, "vivid") != 0;
+	printf("Using %s (%s)\n", dev, driver);
+
+	// Stands in for the power rail
+	int handle = open(CAMERA_POWER, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (handle >= 0)
+		close(handle);
+
+	V4L2Camera camera;
+	if (camera.Open(dev) < 0) {
+		check(0, "Open");
+		return failed;
+	}
+	if (camera.Init(WIDTH, HEIGHT, FPS) < 0) {
+		check(0, "Init at 640x480");
+		camera.Close();
+		return failed;
+	}
+
+	int w, h;
+	camera.getSize(w, h);
+	if (currentFormat(dev) != V4L2_PIX_FMT_YUYV || w != WIDTH || h != HEIGHT) {
+		printf("SKIP: the device does not capture 640x480 YUYV\n");
+		camera.Uninit();
+		camera.Close();
+		return failed;
+	}
+	check(camera.CanCaptureDirect(w * 2), "CanCaptureDirect with the stride of the frame");
+	check(!camera.CanCaptureDirect(w * 2 + 64), "not with a larger one");
+
+	captureUserPtr(camera, frames, loopback);
+	captureMmap(camera, frames, loopback);
+
+	camera.Uninit();
+	camera.Close();
+	return failed;
+}